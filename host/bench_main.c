@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include "bench.h"
+#include "sd_bench.h"
+#include "hal_linux.h"
+
+/* Host benchmark runner
+ *
+ *   breathalyzer_bench [--filter name] [--time ms] [--save file] [--baseline file] [--threshold pct]
+ *   breathalyzer_bench --sd dir [--sd-kb kb]
+ *
+ * Allocations are counted by wrapping malloc/calloc/realloc at link time. With
+ * --baseline, a kernel slower than the threshold makes the run exit with 1.
+ * --sd runs the SD card benchmark against a directory instead of the kernels.
+ */
+
+#define DEFAULT_TIME_MS 200
+#define DEFAULT_THRESHOLD_PCT 10.0
+#define DEFAULT_SD_KB 128 // CONFIG_SD_BENCH_PASS_KB
+
+static atomic_ullong alloc_count = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add(&alloc_count, 1);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    atomic_fetch_add(&alloc_count, 1);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add(&alloc_count, 1);
+    return __real_realloc(ptr, size);
+}
+
+static uint64_t count_allocs(void)
+{
+    return atomic_load(&alloc_count);
+}
+
+static int save_results(const char *file, const bench_result_t *results, int count)
+{
+    FILE *f = fopen(file, "w");
+    if (f == NULL) {
+        perror(file);
+        return -1;
+    }
+    fprintf(f, "# kernel ns/op allocs/op\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "%s %.3f %.3f\n", results[i].name, results[i].ns_per_op, results[i].allocs_per_op);
+    }
+    fclose(f);
+    return 0;
+}
+
+// Print the change against each baseline entry, returns the number of regressions
+static int compare_results(const char *file, const bench_result_t *results, int count, double threshold)
+{
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        perror(file);
+        return -1;
+    }
+    int regressions = 0;
+    char line[128];
+    printf("\n%-20s %12s %12s %9s %14s\n", "kernel", "base ns/op", "ns/op", "change", "allocs/op");
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char name[64];
+        double base_ns, base_allocs;
+        if (line[0] == '#' || sscanf(line, "%63s %lf %lf", name, &base_ns, &base_allocs) != 3) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            if (strcmp(results[i].name, name) != 0) {
+                continue;
+            }
+            double change = (results[i].ns_per_op - base_ns) / base_ns * 100;
+            bool slower = change > threshold;
+            bool more_allocs = results[i].allocs_per_op > base_allocs + 0.005;
+            printf("%-20s %12.1f %12.1f %+8.1f%% %6.2f -> %-5.2f%s\n", name, base_ns, results[i].ns_per_op,
+                   change, base_allocs, results[i].allocs_per_op,
+                   slower || more_allocs ? "  REGRESSION" : "");
+            regressions += slower || more_allocs;
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "filter", required_argument, NULL, 'f' },
+        { "time", required_argument, NULL, 't' },
+        { "save", required_argument, NULL, 's' },
+        { "baseline", required_argument, NULL, 'b' },
+        { "threshold", required_argument, NULL, 'r' },
+        { "sd", required_argument, NULL, 'd' },
+        { "sd-kb", required_argument, NULL, 'k' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *filter = NULL;
+    const char *save_file = NULL;
+    const char *baseline_file = NULL;
+    uint32_t time_ms = DEFAULT_TIME_MS;
+    double threshold = DEFAULT_THRESHOLD_PCT;
+    const char *sd_dir = NULL;
+    uint32_t sd_kb = DEFAULT_SD_KB;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:t:s:b:r:d:k:", options, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            filter = optarg;
+            break;
+        case 't':
+            time_ms = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            save_file = optarg;
+            break;
+        case 'b':
+            baseline_file = optarg;
+            break;
+        case 'r':
+            threshold = strtod(optarg, NULL);
+            break;
+        case 'd':
+            sd_dir = optarg;
+            break;
+        case 'k':
+            sd_kb = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [--filter name] [--time ms] [--save file] "
+                            "[--baseline file] [--threshold pct] [--sd dir [--sd-kb kb]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (sd_dir != NULL) {
+        static sd_bench_result_t sd_results[SD_BENCH_MAX_RESULTS];
+        hal_storage_info_t info = { 0 };
+        hal_linux_set_sd_root(sd_dir);
+        hal_storage_info(&info);
+        int count = sd_bench_run(sd_kb * 1024, sd_results, SD_BENCH_MAX_RESULTS);
+        if (count < 0) {
+            return 2;
+        }
+        sd_bench_print(stdout, &info, sd_results, count);
+        return 0;
+    }
+
+    bench_result_t results[BENCH_MAX_RESULTS];
+    int count = bench_run(filter, time_ms, count_allocs, results, BENCH_MAX_RESULTS);
+    bench_print(stdout, results, count);
+
+    if (save_file != NULL && save_results(save_file, results, count) != 0) {
+        return 2;
+    }
+    if (baseline_file != NULL) {
+        int regressions = compare_results(baseline_file, results, count, threshold);
+        if (regressions < 0) {
+            return 2;
+        }
+        return regressions > 0;
+    }
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+#include <sys/stat.h>
+#include "hal_linux.h"
+#include "sd_card.h"
+#include "storage_fault.h"
+
+#define ADC_MAX_RAW 4095
+#define ADC_FULL_SCALE_MV 2500 // Same linear conversion as hal_idf.c without calibration
+#define GPIO_COUNT 64
+
+static hal_adc_source_t adc_source = NULL;
+static void *adc_source_ctx = NULL;
+static atomic_int gpio_levels[GPIO_COUNT];
+static hal_gpio_hook_t gpio_hook = NULL;
+static void *gpio_hook_ctx = NULL;
+static atomic_bool virtual_time = false;
+static atomic_llong virtual_now_us = 0;
+static time_t virtual_epoch = 0; // Wall clock time at virtual time 0
+static char sd_root[PATH_MAX];
+
+static int64_t monotonic_us(void)
+{
+    static int64_t boot_us = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (boot_us == 0) {
+        boot_us = now;
+    }
+    return now - boot_us;
+}
+
+void hal_linux_set_adc_source(hal_adc_source_t source, void *ctx)
+{
+    adc_source = source;
+    adc_source_ctx = ctx;
+}
+
+void hal_linux_set_virtual_time(bool enable)
+{
+    if (enable) {
+        atomic_store(&virtual_now_us, monotonic_us());
+        virtual_epoch = time(NULL) - monotonic_us() / 1000000;
+    }
+    atomic_store(&virtual_time, enable);
+}
+
+void hal_linux_set_gpio(int gpio, int level)
+{
+    if (gpio >= 0 && gpio < GPIO_COUNT) {
+        atomic_store(&gpio_levels[gpio], level);
+    }
+}
+
+void hal_linux_set_gpio_hook(hal_gpio_hook_t hook, void *ctx)
+{
+    gpio_hook = hook;
+    gpio_hook_ctx = ctx;
+}
+
+void hal_linux_set_sd_root(const char *dir)
+{
+    snprintf(sd_root, sizeof(sd_root), "%s", dir);
+}
+
+const char *hal_linux_sd_root(void)
+{
+    if (sd_root[0] == '\0') {
+        const char *env = getenv("BREATHALYZER_SD_ROOT");
+        hal_linux_set_sd_root(env != NULL ? env : "sdcard");
+    }
+    return sd_root;
+}
+
+esp_err_t hal_adc_init(int channel)
+{
+    return ESP_OK;
+}
+
+esp_err_t hal_adc_read(int *raw, int *millivolts)
+{
+    *raw = adc_source != NULL ? adc_source(adc_source_ctx, hal_time_us()) : (ADC_MAX_RAW + 1) / 2;
+    if (*raw < 0) {
+        *raw = 0;
+    } else if (*raw > ADC_MAX_RAW) {
+        *raw = ADC_MAX_RAW;
+    }
+    *millivolts = *raw * ADC_FULL_SCALE_MV / ADC_MAX_RAW;
+    return ESP_OK;
+}
+
+void hal_gpio_output(int gpio)
+{
+}
+
+void hal_gpio_input(int gpio)
+{
+}
+
+void hal_gpio_set(int gpio, int level)
+{
+    hal_linux_set_gpio(gpio, level);
+    if (gpio_hook != NULL) {
+        gpio_hook(gpio_hook_ctx, gpio, level, hal_time_us());
+    }
+}
+
+int hal_gpio_get(int gpio)
+{
+    return gpio >= 0 && gpio < GPIO_COUNT ? atomic_load(&gpio_levels[gpio]) : 0;
+}
+
+int64_t hal_time_us(void)
+{
+    return atomic_load(&virtual_time) ? atomic_load(&virtual_now_us) : monotonic_us();
+}
+
+static void sleep_until_us(int64_t deadline)
+{
+    if (atomic_load(&virtual_time)) {
+        // Never move the clock backwards when several threads wait
+        int64_t now = atomic_load(&virtual_now_us);
+        while (now < deadline && !atomic_compare_exchange_weak(&virtual_now_us, &now, deadline)) {
+        }
+        return;
+    }
+    int64_t now = monotonic_us();
+    if (deadline > now) {
+        struct timespec ts = { (deadline - now) / 1000000, ((deadline - now) % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+void hal_delay_ms(uint32_t ms)
+{
+    sleep_until_us(hal_time_us() + (int64_t)ms * 1000);
+}
+
+void hal_period_start(hal_period_t *period)
+{
+    period->last_wake = hal_time_us();
+}
+
+void hal_period_wait(hal_period_t *period, uint32_t period_ms)
+{
+    period->last_wake += (int64_t)period_ms * 1000;
+    sleep_until_us(period->last_wake);
+}
+
+void hal_clock_sync(void)
+{
+    // The host clock is already synchronised
+}
+
+time_t hal_clock_now(void)
+{
+    if (atomic_load(&virtual_time)) {
+        return virtual_epoch + atomic_load(&virtual_now_us) / 1000000;
+    }
+    return time(NULL);
+}
+
+// Map MOUNT_POINT paths into the SD root directory, other paths are left alone
+static const char *host_path(const char *path, char *buf, size_t len)
+{
+    size_t prefix = strlen(MOUNT_POINT);
+    if (strncmp(path, MOUNT_POINT, prefix) != 0 || (path[prefix] != '/' && path[prefix] != '\0')) {
+        return path;
+    }
+    snprintf(buf, len, "%s%s", hal_linux_sd_root(), path + prefix);
+    return buf;
+}
+
+FILE *hal_fopen(const char *path, const char *mode)
+{
+    char buf[PATH_MAX];
+    return storage_fault_wrap(fopen(host_path(path, buf, sizeof(buf)), mode), path);
+}
+
+int hal_stat(const char *path, struct stat *st)
+{
+    char buf[PATH_MAX];
+    return stat(host_path(path, buf, sizeof(buf)), st);
+}
+
+int hal_remove(const char *path)
+{
+    char buf[PATH_MAX];
+    return remove(host_path(path, buf, sizeof(buf)));
+}
+
+int hal_rename(const char *from, const char *to)
+{
+    char from_buf[PATH_MAX], to_buf[PATH_MAX];
+    struct stat st;
+    host_path(to, to_buf, sizeof(to_buf));
+    if (stat(to_buf, &st) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return rename(host_path(from, from_buf, sizeof(from_buf)), to_buf);
+}
+
+int hal_mkdir(const char *path)
+{
+    char buf[PATH_MAX];
+    return mkdir(host_path(path, buf, sizeof(buf)), 0777) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+int hal_fsync(FILE *f)
+{
+    if (fflush(f) != 0) {
+        return -1;
+    }
+    int fd = fileno(f);
+    return fd < 0 ? storage_fault_sync(f) : fsync(fd); // Files behind a fault cookie have no fd
+}
+
+// No DMA here, and glibc's aligned_alloc fragments the heap when files are reopened after errors
+void *hal_dma_alloc(size_t size)
+{
+    return malloc(size);
+}
+
+// Bitwise, the records it covers are a line long
+uint32_t hal_crc32(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+// The block size of the filesystem holding the SD root stands in for the cluster size
+esp_err_t hal_storage_info(hal_storage_info_t *info)
+{
+    struct statvfs vfs;
+    if (statvfs(hal_linux_sd_root(), &vfs) != 0) {
+        return ESP_FAIL;
+    }
+    info->cluster_bytes = vfs.f_bsize;
+    info->total_bytes = (uint64_t)vfs.f_blocks * vfs.f_frsize;
+    info->free_bytes = (uint64_t)vfs.f_bavail * vfs.f_frsize;
+    return ESP_OK;
+}
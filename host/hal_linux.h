@@ -0,0 +1,31 @@
+#ifndef __HAL_LINUX_H__INCLUDED__
+#define __HAL_LINUX_H__INCLUDED__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+/* Host-only controls of the Linux HAL
+ *
+ * The ADC reads from a callback, GPIOs are plain variables and the SD card is a
+ * directory. With virtual time on, delays advance the clock instead of sleeping,
+ * so a whole test cycle runs as fast as the CPU allows.
+ */
+
+// Returns the raw 12-bit sample for the given time
+typedef int (*hal_adc_source_t)(void *ctx, int64_t time_us);
+// Called when the firmware sets an output
+typedef void (*hal_gpio_hook_t)(void *ctx, int gpio, int level, int64_t time_us);
+
+// Without a source the ADC reads mid-scale
+void hal_linux_set_adc_source(hal_adc_source_t source, void *ctx);
+// Delays and the wall clock follow a virtual clock from now on
+void hal_linux_set_virtual_time(bool enable);
+// Drive a GPIO configured as input, e.g. the start button
+void hal_linux_set_gpio(int gpio, int level);
+void hal_linux_set_gpio_hook(hal_gpio_hook_t hook, void *ctx);
+// Directory standing in for MOUNT_POINT, defaults to $BREATHALYZER_SD_ROOT or ./sdcard
+void hal_linux_set_sd_root(const char *dir);
+const char *hal_linux_sd_root(void);
+
+#endif
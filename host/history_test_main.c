@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hal_linux.h"
+#include "hal.h"
+#include "lzss.h"
+#include "history.h"
+#include "result.h"
+#include "sd_card.h"
+#include "esp_log.h"
+
+/* Round trips of the history storage
+ *
+ *   breathalyzer_history_test [--sd dir]
+ *
+ * Encodes and decodes LZSS streams, reads hand-written BHS1 and BHS2 segments next
+ * to a garbage and a torn one and the log, and carries a cursor through its string
+ * form and a seal of the log. Prints every check that fails and exits with 1 then.
+ */
+
+#define SEGMENT_MAGIC_V1 0x31534842 // "BHS1"
+#define SEGMENT_MAGIC 0x32534842    // "BHS2"
+#define BASE_TIME 1700000000
+
+// The segment header as history.c writes it
+typedef struct {
+    uint32_t magic;
+    uint32_t records;
+    int64_t first;
+    int64_t last;
+    uint32_t source_len;
+    uint32_t source_crc;
+    uint32_t data_len;
+    uint32_t data_crc;
+} segment_header_t;
+
+typedef struct {
+    int64_t timestamp;
+    int32_t ppm; // In 1/100
+    int32_t bac; // In 1/1000
+    const char *user;
+} test_record_t;
+
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Encode in, decode it back from a file and compare, returns the encoded length
+static size_t lzss_round_trip(const uint8_t *in, size_t len, const char *what)
+{
+    uint8_t *out = malloc(LZSS_MAX_ENCODED(len));
+    size_t encoded = lzss_encode(in, len, out, LZSS_MAX_ENCODED(len));
+    FILE *f = tmpfile();
+    bool ok = encoded > 0 && f != NULL && fwrite(out, 1, encoded, f) == encoded && fseek(f, 0, SEEK_SET) == 0;
+    if (ok) {
+        lzss_decoder_t d;
+        lzss_decoder_init(&d, f, encoded);
+        for (size_t i = 0; ok && i < len; i++) {
+            ok = lzss_decoder_getc(&d) == in[i];
+        }
+        ok = ok && lzss_decoder_getc(&d) == -1;
+    }
+    check(ok, what);
+    if (f != NULL) {
+        fclose(f);
+    }
+    free(out);
+    return encoded;
+}
+
+static void test_lzss(void)
+{
+    static uint8_t buf[4096];
+
+    // One literal, then matches at distance 1 running on into the bytes they produce
+    memset(buf, 'a', sizeof(buf));
+    check(lzss_round_trip(buf, 1 + LZSS_MAX_MATCH, "lzss run of one byte") == 4,
+          "lzss run of one byte is one literal and one match of LZSS_MAX_MATCH");
+    lzss_round_trip(buf, sizeof(buf), "lzss run longer than the longest match");
+
+    // Overlapping matches at a distance of a few bytes
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = "abc"[i % 3];
+    }
+    lzss_round_trip(buf, sizeof(buf), "lzss overlapping matches");
+
+    // Repeats further back than the window, and data with nothing to match
+    srand(1);
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = i >= 300 && rand() % 4 != 0 ? buf[i - 300 + rand() % 100] : "0123456789/:- \n"[rand() % 15];
+    }
+    lzss_round_trip(buf, sizeof(buf), "lzss text");
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (uint8_t)rand();
+    }
+    lzss_round_trip(buf, sizeof(buf), "lzss random bytes");
+    lzss_round_trip(buf, 1, "lzss single byte");
+
+    uint8_t small[8];
+    check(lzss_encode(buf, sizeof(buf), small, sizeof(small)) == 0, "lzss output too small");
+}
+
+static size_t put_varint(uint8_t *out, int64_t value)
+{
+    uint64_t u = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    size_t n = 0;
+    while (u >= 0x80) {
+        out[n++] = (uint8_t)(u | 0x80);
+        u >>= 7;
+    }
+    out[n++] = (uint8_t)u;
+    return n;
+}
+
+// Write records as a numbered segment, BHS1 leaves the names out. A torn segment loses the end of its data
+static void write_segment(int number, uint32_t magic, const test_record_t *records, int count, bool torn)
+{
+    uint8_t raw[512];
+    size_t len = 0;
+    int64_t last_ts = 0;
+    int32_t last_ppm = 0, last_bac = 0;
+    segment_header_t h = { .magic = magic, .records = count, .first = records[0].timestamp,
+                           .last = records[count - 1].timestamp };
+    for (int i = 0; i < count; i++) {
+        len += put_varint(raw + len, records[i].timestamp - last_ts);
+        len += put_varint(raw + len, records[i].ppm - last_ppm);
+        len += put_varint(raw + len, records[i].bac - last_bac);
+        if (magic == SEGMENT_MAGIC) {
+            raw[len++] = (uint8_t)strlen(records[i].user);
+            memcpy(raw + len, records[i].user, strlen(records[i].user));
+            len += strlen(records[i].user);
+        }
+        last_ts = records[i].timestamp;
+        last_ppm = records[i].ppm;
+        last_bac = records[i].bac;
+    }
+    uint8_t data[LZSS_MAX_ENCODED(sizeof(raw))];
+    h.data_len = lzss_encode(raw, len, data, sizeof(data));
+    h.data_crc = hal_crc32(0, data, h.data_len);
+
+    char path[32];
+    snprintf(path, sizeof(path), HISTORY_SEGMENT_FMT, number);
+    FILE *f = hal_fopen(path, "w");
+    check(f != NULL && fwrite(&h, sizeof(h), 1, f) == 1 &&
+          fwrite(data, 1, torn ? h.data_len / 2 : h.data_len, f) == (torn ? h.data_len / 2 : h.data_len),
+          "write segment");
+    if (f != NULL) {
+        fclose(f);
+    }
+}
+
+// Append records to the log as lines, then what a reset left of one more
+static void write_log(const test_record_t *records, int count, const char *torn)
+{
+    FILE *f = hal_fopen(LOG_FILE, "w");
+    for (int i = 0; f != NULL && i < count; i++) {
+        result_t result;
+        char line[96];
+        result_make(&result, records[i].timestamp, records[i].ppm / 100.0f, records[i].bac / 1000.0f,
+                    records[i].user);
+        result_format_line(&result, records[i].user, line, sizeof(line));
+        result_release(&result);
+        fputs(line, f);
+    }
+    check(f != NULL && fputs(torn, f) >= 0, "write log");
+    if (f != NULL) {
+        fclose(f);
+    }
+}
+
+static bool same_record(const history_record_t *record, const test_record_t *expected)
+{
+    return record->timestamp == expected->timestamp && lroundf(record->ppm * 100) == expected->ppm &&
+           lroundf(record->bac * 1000) == expected->bac && strcmp(record->user, expected->user) == 0;
+}
+
+// Read from the reader's position on and compare with what is expected, count records from first
+static void expect_records(history_reader_t *reader, const test_record_t *expected, int first, int count,
+                           const char *what)
+{
+    history_record_t record;
+    char msg[96];
+    for (int i = first; i < count; i++) {
+        bool ok = history_next(reader, &record);
+        snprintf(msg, sizeof(msg), "%s: record %d", what, i);
+        check(ok && same_record(&record, &expected[i]), msg);
+        if (!ok) {
+            return;
+        }
+    }
+    snprintf(msg, sizeof(msg), "%s: end after %d records", what, count);
+    check(!history_next(reader, &record), msg);
+}
+
+static void test_history(void)
+{
+    static const test_record_t records[] = {
+        // BHS1, read without names
+        { BASE_TIME, 1234, 12, "" },
+        { BASE_TIME + 60, 98765, 987, "" },
+        { BASE_TIME + 30, 0, 0, "" },
+        // BHS2
+        { BASE_TIME + 3600, 4321, 43, "ANNA" },
+        { BASE_TIME + 7200, 150, 1, "" },
+        // The log
+        { BASE_TIME + 10000, 2500, 25, "BOB-1" },
+        { BASE_TIME + 10060, 2600, 26, "" },
+        { BASE_TIME + 10120, 2700, 27, "X_LONG_NAME1" },
+    };
+    static const test_record_t lost[] = {
+        { BASE_TIME + 8000, 100, 1, "" },
+        { BASE_TIME + 8060, 200, 2, "" },
+    };
+    const int count = sizeof(records) / sizeof(records[0]);
+
+    write_segment(1, SEGMENT_MAGIC_V1, records, 3, false);
+    write_segment(2, SEGMENT_MAGIC, records + 3, 2, false);
+    FILE *f = hal_fopen("/sdcard/h0000003.seg", "w");
+    check(f != NULL && fputs("not a segment at all, just some bytes on the card", f) >= 0, "write garbage");
+    if (f != NULL) {
+        fclose(f);
+    }
+    write_segment(4, SEGMENT_MAGIC, lost, 2, true);
+    write_log(records + 5, 3, "21/11/2023 10:13:20 - PPM: 27.");
+
+    history_reader_t reader;
+    check(history_open(&reader, LOG_FILE) == ESP_OK, "history_open");
+    expect_records(&reader, records, 0, count, "segments and log");
+
+    // A cursor taken in the log, through its string form and a seal of the log
+    history_rewind(&reader);
+    history_record_t record;
+    for (int i = 0; i < 6; i++) {
+        history_next(&reader, &record);
+    }
+    history_cursor_t cursor, parsed;
+    char str[HISTORY_CURSOR_SIZE];
+    history_tell(&reader, &cursor);
+    history_close(&reader);
+    check(cursor.file == 5 && cursor.index == 1 && cursor.offset > 0, "cursor in the log");
+    check(history_cursor_format(&cursor, str, sizeof(str)) < (int)sizeof(str) &&
+          history_cursor_parse(str, &parsed) && parsed.file == cursor.file && parsed.index == cursor.index &&
+          parsed.offset == cursor.offset, "cursor format and parse");
+    check(!history_cursor_parse("5.1", &parsed) && !history_cursor_parse("5.1.2x", &parsed) &&
+          !history_cursor_parse("5.1.-2", &parsed), "cursor parse rejects malformed strings");
+    check(history_cursor_parse(str, &parsed), "cursor parse");
+
+    check(history_seal(LOG_FILE) == ESP_OK, "history_seal");
+    check(history_open(&reader, LOG_FILE) == ESP_OK && reader.segments == 5 && reader.end == 0,
+          "history_open after the seal");
+    check(history_seek(&reader, &parsed) == ESP_OK, "seek into the sealed log");
+    expect_records(&reader, records, 6, count, "after the seal");
+    check(history_seek(&reader, &(history_cursor_t){ .file = 7 }) == ESP_ERR_INVALID_ARG, "seek past the history");
+    history_rewind(&reader);
+    expect_records(&reader, records, 0, count, "rewound after the seal");
+    history_close(&reader);
+}
+
+int main(int argc, char **argv)
+{
+    char sd_dir[256] = "";
+    if (argc == 3 && strcmp(argv[1], "--sd") == 0) {
+        snprintf(sd_dir, sizeof(sd_dir), "%s", argv[2]);
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [--sd dir]\n", argv[0]);
+        return 2;
+    } else {
+        snprintf(sd_dir, sizeof(sd_dir), "/tmp/breathalyzer-history-XXXXXX");
+        if (mkdtemp(sd_dir) == NULL) {
+            perror("mkdtemp");
+            return 2;
+        }
+    }
+    printf("SD card in %s\n", sd_dir);
+    hal_linux_set_sd_root(sd_dir);
+    // Log lines are in local time, pin it so the timestamps read back the same anywhere
+    setenv("TZ", "UTC", 1);
+    tzset();
+    esp_log_level_set("*", ESP_LOG_ERROR);
+
+    test_lzss();
+    test_history();
+
+    printf("%s\n", failures == 0 ? "All history checks passed" : "History checks failed");
+    return failures == 0 ? 0 : 1;
+}
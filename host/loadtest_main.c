@@ -0,0 +1,845 @@
+#define _GNU_SOURCE // sched_setaffinity
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "hal_linux.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "web_server.h"
+#include "sd_card.h"
+#include "measurement.h"
+#include "MQ303A.h"
+#include "dlog.h"
+#include "mq303a_sim.h"
+
+/* HTTP load test
+ *
+ *   breathalyzer_loadtest [--target host:port] [--concurrency n] [--duration s] [--warmup s]
+ *                         [--mix path=weight,...] [--static-size bytes] [--seed n]
+ *                         [--downloads n] [--large-size bytes] [--max-p99 path=ms]
+ *                         [--scenario downloads] [--capture] [--max-jitter-ms ms]
+ *                         [--save file] [--baseline file] [--threshold pct]
+ *
+ * Without --target the firmware's web server is started in this process, serving a
+ * fixture SD card from a temp directory: index.html, a static /app.js of
+ * --static-size bytes and a full highscore table. Every client keeps one HTTP/1.1
+ * connection alive and picks its next path from the weighted mix with its own seeded
+ * generator, so runs with the same options send the same request sequence. With
+ * --baseline, a p99 latency or throughput worse than the threshold exits with 1.
+ *
+ * --downloads adds connections that fetch /large.bin (--large-size bytes) back to
+ * back for the whole run without being measured, and --max-p99 exits with 1 when a
+ * path's p99 goes past the limit. --scenario downloads is the concurrency gate: it
+ * measures /api/status while two large downloads run and fails past
+ * SCENARIO_STATUS_P99_MS.
+ *
+ * --capture checks that sampling keeps its cadence under load. The process is pinned
+ * to one CPU like the single-core C3, and a thread runs baseline and capture every
+ * CAPTURE_GAP_MS in real time against the simulated sensor for the whole run, between
+ * set_capture_active() calls like app_main. The deviation of every sample interval
+ * from CAPTURE_PERIOD_MS is kept, and a worst one past --max-jitter-ms (default
+ * DEFAULT_MAX_JITTER_MS) exits with 1. Requests turned away during the captures count
+ * as errors of their path.
+ */
+
+#define DEFAULT_MIX "/=1,/api/status=1,/api/v1/highscores=1,/app.js=1"
+#define DEFAULT_THRESHOLD_PCT 20.0
+#define DEFAULT_LARGE_SIZE (1024 * 1024)
+#define LARGE_PATH "/large.bin"
+#define SCENARIO_DOWNLOADS 2 // Keeps both async workers busy, and with 4 clients stays within the 7 sockets
+#define DEFAULT_MAX_JITTER_MS 10.0
+#define CAPTURE_GAP_MS 1000 // Between captures, when requests are served in full
+#define HEATER_GPIO 3
+#define LED_GPIO 7
+#define SCENARIO_STATUS_P99_MS 20.0 // About 3 ms on the host, --max-p99 after it sets a board limit
+#define MAX_PATHS 16
+#define CONN_BUF_SIZE 8192
+
+typedef struct {
+    char path[256];
+    unsigned weight;
+} mix_entry_t;
+
+typedef struct {
+    uint32_t latency_us;
+    uint16_t status; // 0 when the connection failed
+    uint8_t path;
+} sample_t;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    uint32_t rng;
+    sample_t *samples;
+    size_t count;
+    size_t capacity;
+    unsigned connects;
+    bool download; // Fetches LARGE_PATH unmeasured instead of following the mix
+    unsigned downloads;
+} client_t;
+
+typedef struct {
+    int fd;
+    size_t start;
+    size_t end;
+    char buf[CONN_BUF_SIZE];
+} conn_t;
+
+static struct addrinfo *target_addr = NULL;
+static char target_host[128] = "127.0.0.1";
+static mix_entry_t mix[MAX_PATHS];
+static int mix_count = 0;
+static unsigned mix_total = 0;
+static int64_t warmup_end_us;
+static int64_t stop_us;
+
+static int64_t real_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift32, one generator per client keeps the request sequence independent of scheduling
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int parse_mix(const char *spec)
+{
+    char copy[1024];
+    snprintf(copy, sizeof(copy), "%s", spec);
+    for (char *save, *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        if (mix_count == MAX_PATHS || item[0] != '/') {
+            return -1;
+        }
+        char *weight = strrchr(item, '=');
+        mix[mix_count].weight = 1;
+        if (weight != NULL) {
+            *weight = '\0';
+            mix[mix_count].weight = strtoul(weight + 1, NULL, 10);
+        }
+        snprintf(mix[mix_count].path, sizeof(mix[mix_count].path), "%s", item);
+        mix_total += mix[mix_count].weight;
+        mix_count++;
+    }
+    return mix_count > 0 && mix_total > 0 ? 0 : -1;
+}
+
+static int pick_path(client_t *client)
+{
+    unsigned r = next_random(&client->rng) % mix_total;
+    for (int i = 0; i < mix_count; i++) {
+        if (r < mix[i].weight) {
+            return i;
+        }
+        r -= mix[i].weight;
+    }
+    return mix_count - 1;
+}
+
+/* Client connections */
+
+static int conn_open(conn_t *conn)
+{
+    conn->fd = socket(target_addr->ai_family, SOCK_STREAM, 0);
+    if (conn->fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval timeout = { .tv_sec = 10 };
+    setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(conn->fd, target_addr->ai_addr, target_addr->ai_addrlen) != 0) {
+        close(conn->fd);
+        conn->fd = -1;
+        return -1;
+    }
+    conn->start = conn->end = 0;
+    return 0;
+}
+
+static void conn_close(conn_t *conn)
+{
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+// Refill the buffer, false on EOF or error
+static bool conn_fill(conn_t *conn)
+{
+    if (conn->start == conn->end) {
+        conn->start = conn->end = 0;
+    }
+    if (conn->end == sizeof(conn->buf)) {
+        memmove(conn->buf, conn->buf + conn->start, conn->end - conn->start);
+        conn->end -= conn->start;
+        conn->start = 0;
+    }
+    ssize_t n = recv(conn->fd, conn->buf + conn->end, sizeof(conn->buf) - conn->end, 0);
+    if (n <= 0) {
+        return false;
+    }
+    conn->end += n;
+    return true;
+}
+
+// Read one CRLF-terminated line without the terminator
+static bool conn_line(conn_t *conn, char *line, size_t len)
+{
+    while (1) {
+        char *eol = memchr(conn->buf + conn->start, '\n', conn->end - conn->start);
+        if (eol != NULL) {
+            size_t n = eol - (conn->buf + conn->start);
+            size_t copy = n < len - 1 ? n : len - 1;
+            memcpy(line, conn->buf + conn->start, copy);
+            if (copy > 0 && line[copy - 1] == '\r') {
+                copy--;
+            }
+            line[copy] = '\0';
+            conn->start += n + 1;
+            return true;
+        }
+        if (conn->end - conn->start == sizeof(conn->buf) || !conn_fill(conn)) {
+            return false;
+        }
+    }
+}
+
+static bool conn_skip(conn_t *conn, size_t len)
+{
+    while (len > 0) {
+        if (conn->start == conn->end && !conn_fill(conn)) {
+            return false;
+        }
+        size_t n = conn->end - conn->start < len ? conn->end - conn->start : len;
+        conn->start += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Read a whole response, returns its status code or 0 if the connection broke
+static int read_response(conn_t *conn, bool *keep_alive, bool *got_bytes)
+{
+    char line[512];
+    int status = 0;
+    *got_bytes = false;
+    if (!conn_line(conn, line, sizeof(line)) || sscanf(line, "HTTP/1.%*d %d", &status) != 1) {
+        return 0;
+    }
+    *got_bytes = true;
+
+    long content_length = 0;
+    bool chunked = false;
+    *keep_alive = true;
+    while (1) {
+        if (!conn_line(conn, line, sizeof(line))) {
+            return 0;
+        }
+        if (line[0] == '\0') {
+            break;
+        }
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            content_length = atol(line + 15);
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked") != NULL) {
+            chunked = true;
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line, "close") != NULL) {
+            *keep_alive = false;
+        }
+    }
+
+    if (!chunked) {
+        return conn_skip(conn, content_length) ? status : 0;
+    }
+    while (1) {
+        if (!conn_line(conn, line, sizeof(line))) {
+            return 0;
+        }
+        unsigned long size = strtoul(line, NULL, 16);
+        if (size == 0) {
+            // Trailers up to the empty line
+            while (conn_line(conn, line, sizeof(line)) && line[0] != '\0') {
+            }
+            return status;
+        }
+        if (!conn_skip(conn, size) || !conn_line(conn, line, sizeof(line))) {
+            return 0;
+        }
+    }
+}
+
+static bool send_request(conn_t *conn, const char *path)
+{
+    char request[512];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", path, target_host);
+    return send(conn->fd, request, len, MSG_NOSIGNAL) == len;
+}
+
+// One request, reconnecting once if the server dropped the kept-alive connection
+static int do_request(client_t *client, conn_t *conn, const char *path)
+{
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = conn->fd >= 0;
+        if (!reused) {
+            if (conn_open(conn) != 0) {
+                return 0;
+            }
+            client->connects++;
+        }
+        bool keep_alive = false;
+        bool got_bytes = false;
+        int status = send_request(conn, path) ? read_response(conn, &keep_alive, &got_bytes) : 0;
+        if (status == 0 || !keep_alive) {
+            conn_close(conn);
+        }
+        if (status != 0 || got_bytes || !reused) {
+            return status;
+        }
+    }
+    return 0;
+}
+
+static void record(client_t *client, int path, int status, int64_t latency_us)
+{
+    if (client->count == client->capacity) {
+        client->capacity = client->capacity > 0 ? client->capacity * 2 : 4096;
+        client->samples = realloc(client->samples, client->capacity * sizeof(sample_t));
+        if (client->samples == NULL) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    client->samples[client->count++] = (sample_t){
+        .latency_us = latency_us > UINT32_MAX ? UINT32_MAX : (uint32_t)latency_us,
+        .status = status,
+        .path = path,
+    };
+}
+
+static void *client_thread(void *arg)
+{
+    client_t *client = arg;
+    conn_t *conn = malloc(sizeof(conn_t));
+    conn->fd = -1;
+    while (1) {
+        int64_t start = real_time_us();
+        if (start >= stop_us) {
+            break;
+        }
+        if (client->download) {
+            client->downloads += do_request(client, conn, LARGE_PATH) == 200;
+            continue;
+        }
+        int path = pick_path(client);
+        int status = do_request(client, conn, mix[path].path);
+        int64_t end = real_time_us();
+        if (start >= warmup_end_us && end <= stop_us) {
+            record(client, path, status, end - start);
+        }
+        if (status == 0) {
+            // Do not spin on a server that refuses connections
+            usleep(1000);
+        }
+    }
+    conn_close(conn);
+    free(conn);
+    return NULL;
+}
+
+/* Capture under load */
+
+typedef struct {
+    int captures;
+    int intervals;
+    int64_t max_dev_us;
+    double sum_sq;
+} capture_stats_t;
+
+static void *capture_thread(void *arg)
+{
+    capture_stats_t *stats = arg;
+    int64_t now = real_time_us();
+    if (now < warmup_end_us) {
+        usleep(warmup_end_us - now);
+    }
+    while (real_time_us() < stop_us) {
+        // The samples are timed with hal_time_us(), whose origin differs from real_time_us()
+        measurement_t m = { .source = NULL };
+        int64_t start_us = real_time_us();
+        set_capture_active(true);
+        measurement_baseline(&m);
+        measurement_capture(&m, LED_GPIO);
+        set_capture_active(false);
+        hal_gpio_set(LED_GPIO, 0);
+        int64_t end_us = real_time_us();
+        usleep(CAPTURE_GAP_MS * 1000);
+        if (start_us < warmup_end_us || end_us > stop_us) {
+            continue;
+        }
+        stats->captures++;
+        for (int i = 1; i < m.count; i++) {
+            int64_t dev = llabs(m.sample_times[i] - m.sample_times[i - 1] - CAPTURE_PERIOD_MS * 1000);
+            stats->max_dev_us = dev > stats->max_dev_us ? dev : stats->max_dev_us;
+            stats->sum_sq += (double)dev * dev;
+            stats->intervals++;
+        }
+    }
+    return NULL;
+}
+
+// Exit status of the jitter limit
+static int check_jitter(const capture_stats_t *stats, double max_ms)
+{
+    if (stats->intervals == 0) {
+        fprintf(stderr, "No capture finished inside the measured window, raise --duration\n");
+        return 2;
+    }
+    bool over = stats->max_dev_us / 1000.0 > max_ms;
+    printf("\n%d captures, sample interval deviation max %.3f ms rms %.3f ms, limit %.3f ms%s\n",
+           stats->captures, stats->max_dev_us / 1000.0, sqrt(stats->sum_sq / stats->intervals) / 1000,
+           max_ms, over ? "  FAIL" : "");
+    return over;
+}
+
+/* Results */
+
+typedef struct {
+    char name[256];
+    size_t requests;
+    size_t errors;
+    double rps;
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double max_ms;
+} endpoint_result_t;
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted latencies
+static double percentile_ms(const uint32_t *sorted, size_t count, double p)
+{
+    if (count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)(p / 100 * count + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+// path < 0 summarizes every request
+static void summarize(client_t *clients, int concurrency, int path, double seconds, endpoint_result_t *result)
+{
+    size_t total = 0;
+    for (int c = 0; c < concurrency; c++) {
+        total += clients[c].count;
+    }
+    uint32_t *latencies = malloc((total > 0 ? total : 1) * sizeof(uint32_t));
+    size_t count = 0;
+    size_t errors = 0;
+    for (int c = 0; c < concurrency; c++) {
+        for (size_t i = 0; i < clients[c].count; i++) {
+            const sample_t *s = &clients[c].samples[i];
+            if (path >= 0 && s->path != path) {
+                continue;
+            }
+            latencies[count++] = s->latency_us;
+            errors += s->status == 0 || s->status >= 400;
+        }
+    }
+    qsort(latencies, count, sizeof(uint32_t), compare_u32);
+
+    snprintf(result->name, sizeof(result->name), "%s", path >= 0 ? mix[path].path : "total");
+    result->requests = count;
+    result->errors = errors;
+    result->rps = count / seconds;
+    result->p50_ms = percentile_ms(latencies, count, 50);
+    result->p95_ms = percentile_ms(latencies, count, 95);
+    result->p99_ms = percentile_ms(latencies, count, 99);
+    result->max_ms = count > 0 ? latencies[count - 1] / 1000.0 : 0;
+    free(latencies);
+}
+
+static void print_results(const endpoint_result_t *results, int count)
+{
+    printf("\n%-24s %9s %9s %7s %9s %9s %9s %9s\n", "endpoint", "requests", "req/s", "errors",
+           "p50 ms", "p95 ms", "p99 ms", "max ms");
+    for (int i = 0; i < count; i++) {
+        const endpoint_result_t *r = &results[i];
+        printf("%-24s %9zu %9.1f %7zu %9.3f %9.3f %9.3f %9.3f\n", r->name, r->requests, r->rps, r->errors,
+               r->p50_ms, r->p95_ms, r->p99_ms, r->max_ms);
+    }
+}
+
+static int save_results(const char *file, const endpoint_result_t *results, int count)
+{
+    FILE *f = fopen(file, "w");
+    if (f == NULL) {
+        perror(file);
+        return -1;
+    }
+    fprintf(f, "# endpoint req/s p50_ms p95_ms p99_ms errors\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "%s %.1f %.3f %.3f %.3f %zu\n", results[i].name, results[i].rps, results[i].p50_ms,
+                results[i].p95_ms, results[i].p99_ms, results[i].errors);
+    }
+    fclose(f);
+    return 0;
+}
+
+// Print the change against each baseline entry, returns the number of regressions
+static int compare_results(const char *file, const endpoint_result_t *results, int count, double threshold)
+{
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        perror(file);
+        return -1;
+    }
+    int regressions = 0;
+    char line[512];
+    printf("\n%-24s %10s %10s %8s %11s %11s %8s\n", "endpoint", "base req/s", "req/s", "change",
+           "base p99 ms", "p99 ms", "change");
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char name[256];
+        double base_rps, base_p50, base_p95, base_p99;
+        if (line[0] == '#' ||
+            sscanf(line, "%255s %lf %lf %lf %lf", name, &base_rps, &base_p50, &base_p95, &base_p99) != 5) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            if (strcmp(results[i].name, name) != 0) {
+                continue;
+            }
+            double rps_change = base_rps > 0 ? (results[i].rps - base_rps) / base_rps * 100 : 0;
+            double p99_change = base_p99 > 0 ? (results[i].p99_ms - base_p99) / base_p99 * 100 : 0;
+            bool regressed = rps_change < -threshold || p99_change > threshold;
+            printf("%-24s %10.1f %10.1f %+7.1f%% %11.3f %11.3f %+7.1f%%%s\n", name, base_rps, results[i].rps,
+                   rps_change, base_p99, results[i].p99_ms, p99_change, regressed ? "  REGRESSION" : "");
+            regressions += regressed;
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+// Exit status of a --max-p99 limit, path is "" when there is none
+static int check_p99(const endpoint_result_t *results, int count, const char *path, double max_ms)
+{
+    if (path[0] == '\0') {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (strcmp(results[i].name, path) == 0) {
+            bool over = results[i].requests == 0 || results[i].p99_ms > max_ms;
+            printf("\n%s p99 %.3f ms, limit %.3f ms%s\n", path, results[i].p99_ms, max_ms, over ? "  FAIL" : "");
+            return over;
+        }
+    }
+    fprintf(stderr, "--max-p99 path %s is not in the mix\n", path);
+    return 2;
+}
+
+/* In-process server */
+
+static int write_fixture(const char *root, const char *name, size_t size, char fill)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        fputc(i % 64 == 63 ? '\n' : fill, f);
+    }
+    fclose(f);
+    return 0;
+}
+
+static int start_local_server(const char *sd_dir, size_t static_size, size_t large_size)
+{
+    if (write_fixture(sd_dir, "index.html", 4096, 'i') != 0 ||
+        write_fixture(sd_dir, "app.js", static_size, 'a') != 0 ||
+        write_fixture(sd_dir, LARGE_PATH + 1, large_size, 'l') != 0) {
+        return -1;
+    }
+    hal_linux_set_sd_root(sd_dir);
+    load_highscores(SCORES_FILE, NULL);
+    for (int i = 0; i < MAX_HIGHSCORES; i++) {
+        struct tm date = { .tm_year = 125, .tm_mon = 0, .tm_mday = 1 + i, .tm_hour = 20, .tm_isdst = -1 };
+        result_t result;
+        result_make(&result, mktime(&date), 0, 0.01f * (i + 1), "");
+        add_highscore(&result);
+    }
+
+    httpd_linux_set_port(0);
+    httpd_handle_t server = start_webserver();
+    if (server == NULL) {
+        return -1;
+    }
+    return httpd_linux_get_port(server);
+}
+
+static int resolve_target(const char *host, const char *port)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    int err = getaddrinfo(host, port, &hints, &target_addr);
+    if (err != 0) {
+        fprintf(stderr, "%s:%s: %s\n", host, port, gai_strerror(err));
+        return -1;
+    }
+    snprintf(target_host, sizeof(target_host), "%s", host);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "target", required_argument, NULL, 'T' },
+        { "concurrency", required_argument, NULL, 'c' },
+        { "duration", required_argument, NULL, 'd' },
+        { "warmup", required_argument, NULL, 'w' },
+        { "mix", required_argument, NULL, 'm' },
+        { "static-size", required_argument, NULL, 'z' },
+        { "seed", required_argument, NULL, 'S' },
+        { "downloads", required_argument, NULL, 'D' },
+        { "large-size", required_argument, NULL, 'L' },
+        { "max-p99", required_argument, NULL, 'P' },
+        { "scenario", required_argument, NULL, 'C' },
+        { "capture", no_argument, NULL, 'A' },
+        { "max-jitter-ms", required_argument, NULL, 'J' },
+        { "save", required_argument, NULL, 's' },
+        { "baseline", required_argument, NULL, 'b' },
+        { "threshold", required_argument, NULL, 'r' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *target = NULL;
+    const char *mix_spec = DEFAULT_MIX;
+    const char *save_file = NULL;
+    const char *baseline_file = NULL;
+    int concurrency = 4;
+    double duration_s = 10;
+    double warmup_s = 1;
+    size_t static_size = 16384;
+    uint32_t seed = 1;
+    double threshold = DEFAULT_THRESHOLD_PCT;
+    int downloads = 0;
+    size_t large_size = DEFAULT_LARGE_SIZE;
+    char p99_path[256] = "";
+    double p99_max_ms = 0;
+    bool capture = false;
+    double max_jitter_ms = DEFAULT_MAX_JITTER_MS;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "T:c:d:w:m:z:S:D:L:P:C:AJ:s:b:r:", options, NULL)) != -1) {
+        switch (opt) {
+        case 'T':
+            target = optarg;
+            break;
+        case 'c':
+            concurrency = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'd':
+            duration_s = atof(optarg);
+            break;
+        case 'w':
+            warmup_s = atof(optarg);
+            break;
+        case 'm':
+            mix_spec = optarg;
+            break;
+        case 'z':
+            static_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'D':
+            downloads = atoi(optarg) > 0 ? atoi(optarg) : 0;
+            break;
+        case 'L':
+            large_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'P':
+            if (sscanf(optarg, "%255[^=]=%lf", p99_path, &p99_max_ms) != 2 || p99_path[0] != '/') {
+                fprintf(stderr, "Bad --max-p99, expected /path=ms\n");
+                return 2;
+            }
+            break;
+        case 'C':
+            if (strcmp(optarg, "downloads") != 0) {
+                fprintf(stderr, "Unknown --scenario %s\n", optarg);
+                return 2;
+            }
+            mix_spec = "/api/status";
+            downloads = SCENARIO_DOWNLOADS;
+            snprintf(p99_path, sizeof(p99_path), "/api/status");
+            p99_max_ms = SCENARIO_STATUS_P99_MS;
+            break;
+        case 'A':
+            capture = true;
+            break;
+        case 'J':
+            max_jitter_ms = strtod(optarg, NULL);
+            break;
+        case 's':
+            save_file = optarg;
+            break;
+        case 'b':
+            baseline_file = optarg;
+            break;
+        case 'r':
+            threshold = strtod(optarg, NULL);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [--target host:port] [--concurrency n] [--duration s] [--warmup s]\n"
+                            "       [--mix path=weight,...] [--static-size bytes] [--seed n]\n"
+                            "       [--downloads n] [--large-size bytes] [--max-p99 path=ms]\n"
+                            "       [--scenario downloads] [--capture] [--max-jitter-ms ms]\n"
+                            "       [--save file] [--baseline file] [--threshold pct]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (parse_mix(mix_spec) != 0) {
+        fprintf(stderr, "Bad --mix, expected /path[=weight],... with at most %d paths\n", MAX_PATHS);
+        return 2;
+    }
+
+    if (capture && target != NULL) {
+        fprintf(stderr, "--capture needs the in-process server\n");
+        return 2;
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);
+    mq303a_sim_t sim;
+    if (capture) {
+        // Set before any thread starts, they all inherit it
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(sched_getcpu(), &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            perror("sched_setaffinity");
+            return 2;
+        }
+        for (int i = 0; i < DLOG_MODULE_COUNT; i++) {
+            dlog_set_level(i, ESP_LOG_NONE);
+        }
+        mq303a_sim_init(&sim, HEATER_GPIO, seed);
+        mq303a_sim_attach(&sim);
+        mq303a_init(2);
+        mq303a_start_heatup(HEATER_GPIO);
+    }
+    if (target == NULL) {
+        char sd_dir[] = "/tmp/breathalyzer-load-XXXXXX";
+        if (mkdtemp(sd_dir) == NULL) {
+            perror("mkdtemp");
+            return 2;
+        }
+        int port = start_local_server(sd_dir, static_size, large_size);
+        if (port < 0) {
+            fprintf(stderr, "Failed to start the web server\n");
+            return 2;
+        }
+        char port_str[8];
+        snprintf(port_str, sizeof(port_str), "%d", port);
+        if (resolve_target("127.0.0.1", port_str) != 0) {
+            return 2;
+        }
+        printf("In-process server on port %d, SD card in %s\n", port, sd_dir);
+    } else {
+        char host[128];
+        char port[8] = "80";
+        if (sscanf(target, "%127[^:]:%7s", host, port) < 1 || resolve_target(host, port) != 0) {
+            return 2;
+        }
+        printf("Target %s:%s\n", host, port);
+    }
+    printf("%d clients, %.1f s after %.1f s warm-up, seed %u, mix %s\n",
+           concurrency, duration_s, warmup_s, (unsigned)seed, mix_spec);
+    if (downloads > 0) {
+        printf("%d connections downloading %s at the same time\n", downloads, LARGE_PATH);
+    }
+    fflush(stdout);
+
+    // The downloading clients come after the measured ones and record nothing
+    client_t *clients = calloc(concurrency + downloads, sizeof(client_t));
+    int64_t start_us = real_time_us();
+    warmup_end_us = start_us + (int64_t)(warmup_s * 1e6);
+    stop_us = warmup_end_us + (int64_t)(duration_s * 1e6);
+    for (int i = 0; i < concurrency + downloads; i++) {
+        clients[i].id = i;
+        clients[i].download = i >= concurrency;
+        clients[i].rng = seed * 2654435761u + i + 1;
+        if (clients[i].rng == 0) {
+            clients[i].rng = 1;
+        }
+        pthread_create(&clients[i].thread, NULL, client_thread, &clients[i]);
+    }
+    capture_stats_t capture_stats = { 0 };
+    pthread_t capturer;
+    if (capture) {
+        pthread_create(&capturer, NULL, capture_thread, &capture_stats);
+    }
+    unsigned connects = 0, downloaded = 0;
+    for (int i = 0; i < concurrency + downloads; i++) {
+        pthread_join(clients[i].thread, NULL);
+        connects += clients[i].connects;
+        downloaded += clients[i].downloads;
+    }
+
+    endpoint_result_t results[MAX_PATHS + 1];
+    int count = 0;
+    for (int i = 0; i < mix_count; i++) {
+        summarize(clients, concurrency, i, duration_s, &results[count++]);
+    }
+    summarize(clients, concurrency, -1, duration_s, &results[count++]);
+    print_results(results, count);
+    printf("%u connections opened\n", connects);
+    if (downloads > 0) {
+        printf("%u downloads of %s completed\n", downloaded, LARGE_PATH);
+    }
+
+    if (save_file != NULL && save_results(save_file, results, count) != 0) {
+        return 2;
+    }
+    int status = check_p99(results, count, p99_path, p99_max_ms);
+    if (capture) {
+        pthread_join(capturer, NULL);
+        int jitter = check_jitter(&capture_stats, max_jitter_ms);
+        status = status > jitter ? status : jitter;
+    }
+    if (baseline_file != NULL) {
+        int regressions = compare_results(baseline_file, results, count, threshold);
+        if (regressions < 0) {
+            return 2;
+        }
+        status = status > 0 ? status : regressions > 0;
+    }
+    return status;
+}
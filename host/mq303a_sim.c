@@ -0,0 +1,102 @@
+#include <math.h>
+#include "mq303a_sim.h"
+#include "MQ303A.h"
+#include "hal_linux.h"
+
+#define ADC_MAX_RAW 4095
+#define ADC_FULL_SCALE_MV 2500
+#define US_PER_DAY 86400e6
+
+void mq303a_sim_init(mq303a_sim_t *sim, int heater_gpio, uint32_t seed)
+{
+    *sim = (mq303a_sim_t){
+        .heater_gpio = heater_gpio,
+        .air_mv = 1200,
+        .cold_mv = 400,
+        .heat_tau_s = 2.0f,
+        .cool_tau_s = 8.0f,
+        .drift_per_day = 0.002f,
+        .noise_mv = 4.0f,
+        .breath_peak_s = 1.5f,
+        .breath_start_us = -1,
+        .rng = seed ? seed : 1,
+    };
+}
+
+void mq303a_sim_breath(mq303a_sim_t *sim, float bac, int64_t start_us)
+{
+    sim->breath_start_us = start_us;
+    sim->breath_ppm = bac * 2600; // Inverse of mq303a_bac_from_ppm
+}
+
+// xorshift64*, deterministic for a given seed
+static double uniform(mq303a_sim_t *sim)
+{
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return ((sim->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double gaussian(mq303a_sim_t *sim)
+{
+    double u = uniform(sim);
+    double v = uniform(sim);
+    return sqrt(-2 * log(u + 1e-300)) * cos(2 * M_PI * v);
+}
+
+// Heater state at time_us, relative to the last GPIO change
+static float heat_at(const mq303a_sim_t *sim, int64_t time_us)
+{
+    float elapsed_s = (time_us - sim->heater_change_us) / 1e6f;
+    return sim->heater_on ? 1 - (1 - sim->heat) * expf(-elapsed_s / sim->heat_tau_s)
+                          : sim->heat * expf(-elapsed_s / sim->cool_tau_s);
+}
+
+static void heater_hook(void *ctx, int gpio, int level, int64_t time_us)
+{
+    mq303a_sim_t *sim = ctx;
+    if (gpio != sim->heater_gpio || (level != 0) == sim->heater_on) {
+        return;
+    }
+    sim->heat = heat_at(sim, time_us);
+    sim->heater_on = level != 0;
+    sim->heater_change_us = time_us;
+}
+
+void mq303a_sim_attach(mq303a_sim_t *sim)
+{
+    hal_linux_set_adc_source(mq303a_sim_read, sim);
+    hal_linux_set_gpio_hook(heater_hook, sim);
+}
+
+// Ethanol concentration of the current breath
+static float ppm_at(const mq303a_sim_t *sim, int64_t time_us)
+{
+    if (sim->breath_start_us < 0 || time_us < sim->breath_start_us) {
+        return 0;
+    }
+    float x = (time_us - sim->breath_start_us) / 1e6f / sim->breath_peak_s;
+    return sim->breath_ppm * x * expf(1 - x);
+}
+
+int mq303a_sim_read(void *ctx, int64_t time_us)
+{
+    mq303a_sim_t *sim = ctx;
+
+    float air_mv = sim->air_mv * (1 + sim->drift_per_day * (time_us / US_PER_DAY));
+    float clean_mv = sim->cold_mv + (air_mv - sim->cold_mv) * heat_at(sim, time_us);
+
+    // Below the concentration that reads as ratio 1 the sensor sees clean air
+    float floor_ppm = mq303a_ppm_from_ratio(1.0f);
+    float ppm = fmaxf(ppm_at(sim, time_us), floor_ppm);
+    float ratio = powf(10, 0.328f - 0.55f * log10f(ppm)); // Inverse of mq303a_ppm_from_ratio
+
+    // RS = v / (5 - v) with v = 2 * mV / 1000, see mq303a_calculate_current
+    float rs_air = clean_mv / (ADC_FULL_SCALE_MV - clean_mv);
+    float rs = rs_air * ratio;
+    float mv = ADC_FULL_SCALE_MV * rs / (1 + rs) + sim->noise_mv * gaussian(sim);
+
+    int raw = lroundf(mv * ADC_MAX_RAW / ADC_FULL_SCALE_MV);
+    return raw < 0 ? 0 : raw > ADC_MAX_RAW ? ADC_MAX_RAW : raw;
+}
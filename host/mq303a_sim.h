@@ -0,0 +1,44 @@
+#ifndef __MQ303A_SIM_H__INCLUDED__
+#define __MQ303A_SIM_H__INCLUDED__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Simulated MQ303A behind the host ADC
+ *
+ * The clean-air reading follows the heater GPIO with first-order heating and
+ * cooling, and drifts slowly over days. A breath is a concentration pulse
+ * peaking breath_peak_s after it starts. The resulting voltage inverts the
+ * firmware's RS and PPM curves, so a breath of a given BAC reads back as that
+ * BAC before noise. mq303a_sim_attach() hooks it to the host ADC and GPIOs.
+ */
+
+typedef struct {
+    int heater_gpio;
+    float air_mv;        // Clean-air reading of a warm sensor
+    float cold_mv;       // Reading with the heater off
+    float heat_tau_s;    // Heating time constant
+    float cool_tau_s;    // Cooling time constant
+    float drift_per_day; // Relative drift of air_mv per simulated day
+    float noise_mv;      // Standard deviation of the Gaussian noise
+    float breath_peak_s; // Time from the start of a breath to its peak
+
+    // State
+    bool heater_on;
+    float heat;              // 0 cold, 1 at operating temperature, at heater_change_us
+    int64_t heater_change_us;
+    int64_t breath_start_us;
+    float breath_ppm;
+    uint64_t rng;
+} mq303a_sim_t;
+
+// Defaults close to the real sensor, the heater on the breathalyzer's GPIO
+void mq303a_sim_init(mq303a_sim_t *sim, int heater_gpio, uint32_t seed);
+// Start a breath of the given BAC at start_us, replacing the previous one
+void mq303a_sim_breath(mq303a_sim_t *sim, float bac, int64_t start_us);
+// Feed the host ADC from the simulator and follow the heater GPIO
+void mq303a_sim_attach(mq303a_sim_t *sim);
+// hal_adc_source_t, returns the raw 12-bit sample at time_us
+int mq303a_sim_read(void *ctx, int64_t time_us);
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "adc_trace.h"
+#include "measurement.h"
+#include "dlog.h"
+#include "hal.h"
+
+/* Replays recorded ADC traces through the measurement pipeline
+ *
+ *   breathalyzer_replay [--repeat n] trace.adc...
+ *
+ * Prints the replayed result of each trace against the one computed when it was
+ * recorded, and the replay throughput. Exits with 1 if any result differs.
+ */
+
+static bool same_bits(float a, float b)
+{
+    return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "repeat", required_argument, NULL, 'n' },
+        { NULL, 0, NULL, 0 },
+    };
+    int repeat = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:", options, NULL)) != -1) {
+        if (opt != 'n') {
+            fprintf(stderr, "usage: %s [--repeat n] trace.adc...\n", argv[0]);
+            return 2;
+        }
+        repeat = atoi(optarg) > 0 ? atoi(optarg) : 1;
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [--repeat n] trace.adc...\n", argv[0]);
+        return 2;
+    }
+
+    // Per-sample logging would be the bottleneck
+    esp_log_level_set("*", ESP_LOG_WARN);
+    for (int i = 0; i < DLOG_MODULE_COUNT; i++) {
+        dlog_set_level(i, ESP_LOG_NONE);
+    }
+
+    int mismatches = 0;
+    for (int i = optind; i < argc; i++) {
+        adc_trace_t trace;
+        if (adc_trace_load(argv[i], &trace) != ESP_OK) {
+            fprintf(stderr, "%s: cannot load trace\n", argv[i]);
+            mismatches++;
+            continue;
+        }
+
+        measurement_t m = { .source = NULL };
+        int64_t start = hal_time_us();
+        for (int r = 0; r < repeat; r++) {
+            if (measurement_replay(&trace, &m) != ESP_OK) {
+                break;
+            }
+        }
+        int64_t elapsed = hal_time_us() - start;
+
+        printf("%s: rs_air %.6f ppm %.6f bac %.6f", argv[i], m.rs_air, m.ppm, m.bac);
+        if (trace.has_result) {
+            bool identical = same_bits(m.rs_air, trace.rs_air) && same_bits(m.ppm, trace.ppm) &&
+                             same_bits(m.bac, trace.bac);
+            printf(" | recorded rs_air %.6f ppm %.6f bac %.6f | %s", trace.rs_air, trace.ppm, trace.bac,
+                   identical ? "identical" : "DIFFERENT");
+            mismatches += !identical;
+        }
+        // Wall time the baseline and capture took when the trace was recorded
+        adc_trace_seek(&trace, ADC_TRACE_BASELINE);
+        uint32_t recorded_us = trace.count > 0 && trace.pos > 0
+                                   ? trace.records[trace.count - 1].time_us - trace.records[trace.pos - 1].time_us
+                                   : 0;
+        double per_replay_us = (double)elapsed / repeat;
+        printf("\n    %d replays, %.1f us each, %.0f replays/s, %.0fx real time\n", repeat, per_replay_us,
+               1e6 / per_replay_us, recorded_us / per_replay_us);
+        adc_trace_free(&trace);
+    }
+    return mismatches > 0;
+}
@@ -0,0 +1,9 @@
+#ifndef __SHIM_ESP_CPU_H__INCLUDED__
+#define __SHIM_ESP_CPU_H__INCLUDED__
+
+#include <stdint.h>
+
+// Nanoseconds of the monotonic clock on the host, there is no portable cycle counter
+uint32_t esp_cpu_get_cycle_count(void);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef __SHIM_ESP_RANDOM_H__INCLUDED__
+#define __SHIM_ESP_RANDOM_H__INCLUDED__
+
+#include <stdint.h>
+
+// Reads the kernel's random pool instead of the RF noise source
+uint32_t esp_random(void);
+
+#endif
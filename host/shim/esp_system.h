@@ -0,0 +1,11 @@
+#ifndef __SHIM_ESP_SYSTEM_H__INCLUDED__
+#define __SHIM_ESP_SYSTEM_H__INCLUDED__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// There is no fixed heap on the host, both report 0
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif
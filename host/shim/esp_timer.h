@@ -0,0 +1,9 @@
+#ifndef __SHIM_ESP_TIMER_H__INCLUDED__
+#define __SHIM_ESP_TIMER_H__INCLUDED__
+
+#include <stdint.h>
+
+// Follows hal_time_us, so instrumentation sees the same (possibly virtual) clock as the core
+int64_t esp_timer_get_time(void);
+
+#endif
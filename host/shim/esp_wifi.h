@@ -0,0 +1,26 @@
+#ifndef __SHIM_ESP_WIFI_H__INCLUDED__
+#define __SHIM_ESP_WIFI_H__INCLUDED__
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_netif.h"
+
+// Host stand-in for esp_wifi.h, the station reports an SSID of "host"
+
+typedef enum {
+    WIFI_IF_STA,
+    WIFI_IF_AP,
+} wifi_interface_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+} wifi_sta_config_t;
+
+typedef union {
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *conf);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __SHIM_FREERTOS_H__INCLUDED__
+#define __SHIM_FREERTOS_H__INCLUDED__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "sdkconfig.h"
+
+// Host stand-in for the FreeRTOS types and critical sections the portable core uses
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+
+// Critical sections become a mutex, nothing in the core nests them
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(mux)
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef __SHIM_FREERTOS_QUEUE_H__INCLUDED__
+#define __SHIM_FREERTOS_QUEUE_H__INCLUDED__
+
+#include "FreeRTOS.h"
+
+// Queues are a mutex and condition variable around a ring of items, timeouts run on the real clock
+
+typedef struct host_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+// A queue of one empty item that starts full, like FreeRTOS builds its mutexes
+QueueHandle_t xQueueCreateMutex(void);
+
+#endif
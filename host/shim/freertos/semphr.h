@@ -0,0 +1,15 @@
+#ifndef __SHIM_FREERTOS_SEMPHR_H__INCLUDED__
+#define __SHIM_FREERTOS_SEMPHR_H__INCLUDED__
+
+#include "queue.h"
+
+// Semaphores are queues of empty items, as in FreeRTOS. Mutexes do not inherit priority
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#define xSemaphoreCreateMutex() xQueueCreateMutex()
+#define xSemaphoreCreateBinary() xQueueCreate(1, 0)
+#define xSemaphoreTake(sem, ticks_to_wait) xQueueReceive((sem), NULL, (ticks_to_wait))
+#define xSemaphoreGive(sem) xQueueSend((sem), NULL, 0)
+
+#endif
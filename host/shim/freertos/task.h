@@ -0,0 +1,29 @@
+#ifndef __SHIM_FREERTOS_TASK_H__INCLUDED__
+#define __SHIM_FREERTOS_TASK_H__INCLUDED__
+
+#include "FreeRTOS.h"
+
+// Tasks are detached pthreads, priorities are recorded but not enforced
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define tskIDLE_PRIORITY 0
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+char *pcTaskGetName(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+TickType_t xTaskGetTickCount(void);
+// Delays sleep on the real clock, hal_delay_ms follows the virtual clock instead
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskDelayUntil(TickType_t *previous_wake, TickType_t increment);
+// Looks the task up by the name it was created with
+TaskHandle_t xTaskGetHandle(const char *name);
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+#endif
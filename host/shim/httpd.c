@@ -0,0 +1,718 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* Host HTTP server
+ *
+ * A select() loop on one "httpd" task, in the shape of esp_http_server: a fixed
+ * number of sessions, least recently used purge when they are all taken, handlers
+ * matched in registration order, and sessions parked while an async handler owns
+ * them. Request bodies are not supported, the firmware only serves GET.
+ */
+
+static const char *TAG = "httpd";
+
+#define HTTPD_MAX_REQ_HDR_LEN 1024 // CONFIG_HTTPD_MAX_REQ_HDR_LEN in the IDF build
+#define RESP_HEAD_SIZE 1024
+
+typedef struct {
+    int fd;        // -1 when the slot is free
+    bool async;    // Owned by an async handler, not polled until it completes
+    bool closing;  // Close requested through httpd_sess_trigger_close
+    uint64_t lru;  // Last time the session was used, in server ticks
+    size_t len;    // Request bytes buffered so far
+    char buf[HTTPD_MAX_REQ_HDR_LEN];
+} httpd_sess_t;
+
+typedef struct {
+    httpd_config_t config;
+    int listen_fd;
+    uint16_t port;
+    int wake[2]; // Written by async completions to get the session polled again
+    httpd_uri_t *uris;
+    size_t uri_count;
+    httpd_sess_t *sessions;
+    pthread_mutex_t lock; // Guards the async flag and the lru counter
+    uint64_t lru_counter;
+    volatile bool stop;
+} httpd_server_t;
+
+// Lives in req->aux, copied along with the request by httpd_req_async_handler_begin
+typedef struct {
+    httpd_server_t *server;
+    httpd_sess_t *sess;
+    char head[HTTPD_MAX_REQ_HDR_LEN]; // Header lines of the request, NUL-terminated
+    const char *status;
+    const char *type;
+    const char *hdr_fields[16];
+    const char *hdr_values[16];
+    int hdr_count;
+    bool chunked; // The chunked response head went out already
+} httpd_req_aux_t;
+
+static int port_override = -1;
+
+void httpd_linux_set_port(int port)
+{
+    port_override = port;
+}
+
+uint16_t httpd_linux_get_port(httpd_handle_t handle)
+{
+    return ((httpd_server_t *)handle)->port;
+}
+
+/* URI matching */
+
+bool httpd_uri_match_wildcard(const char *uri_template, const char *uri_to_match, size_t match_upto)
+{
+    size_t exact = strlen(uri_template);
+    bool asterisk = exact > 0 && uri_template[exact - 1] == '*';
+    if (asterisk) {
+        exact--;
+    }
+    bool quest = exact > 0 && uri_template[exact - 1] == '?';
+    if (quest) {
+        exact--;
+    }
+
+    // "/path/?" also matches "/path"
+    if (quest && match_upto + 1 == exact) {
+        return strncmp(uri_template, uri_to_match, match_upto) == 0;
+    }
+    if (match_upto < exact || strncmp(uri_template, uri_to_match, exact) != 0) {
+        return false;
+    }
+    if (asterisk || match_upto == exact) {
+        return true;
+    }
+    return quest && match_upto == exact + 1 && uri_to_match[exact] == uri_template[exact];
+}
+
+static bool uri_match(const httpd_server_t *server, const char *uri_template, const char *uri, size_t len)
+{
+    if (server->config.uri_match_fn != NULL) {
+        return server->config.uri_match_fn(uri_template, uri, len);
+    }
+    return strlen(uri_template) == len && strncmp(uri_template, uri, len) == 0;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    httpd_server_t *server = handle;
+    for (size_t i = 0; i < server->uri_count; i++) {
+        if (server->uris[i].method == uri_handler->method && strcmp(server->uris[i].uri, uri_handler->uri) == 0) {
+            return ESP_ERR_HTTPD_HANDLER_EXISTS;
+        }
+    }
+    if (server->uri_count == server->config.max_uri_handlers) {
+        ESP_LOGW(TAG, "No slot left for registering handler %s", uri_handler->uri);
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+    // The URI string is copied, the real server does the same
+    httpd_uri_t *entry = &server->uris[server->uri_count];
+    *entry = *uri_handler;
+    entry->uri = strdup(uri_handler->uri);
+    if (entry->uri == NULL) {
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    server->uri_count++;
+    return ESP_OK;
+}
+
+/* Request accessors */
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    const httpd_req_aux_t *aux = r->aux;
+    size_t field_len = strlen(field);
+    for (const char *line = aux->head; *line != '\0'; ) {
+        const char *end = strstr(line, "\r\n");
+        if (end == NULL) {
+            end = line + strlen(line);
+        }
+        if ((size_t)(end - line) > field_len && line[field_len] == ':' && strncasecmp(line, field, field_len) == 0) {
+            const char *value = line + field_len + 1;
+            while (value < end && (*value == ' ' || *value == '\t')) {
+                value++;
+            }
+            size_t len = end - value;
+            if (val_size == 0) {
+                return ESP_ERR_HTTPD_RESULT_TRUNC;
+            }
+            size_t copy = len < val_size - 1 ? len : val_size - 1;
+            memcpy(val, value, copy);
+            val[copy] = '\0';
+            return copy < len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+        }
+        line = *end != '\0' ? end + 2 : end;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    const char *query = strchr(r->uri, '?');
+    if (query == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    query++;
+    size_t len = strcspn(query, "#");
+    if (buf_len == 0) {
+        return ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+    size_t copy = len < buf_len - 1 ? len : buf_len - 1;
+    memcpy(buf, query, copy);
+    buf[copy] = '\0';
+    return copy < len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    size_t key_len = strlen(key);
+    for (const char *pair = qry; *pair != '\0'; ) {
+        size_t pair_len = strcspn(pair, "&");
+        if (pair_len > key_len && pair[key_len] == '=' && strncmp(pair, key, key_len) == 0) {
+            const char *value = pair + key_len + 1;
+            size_t len = pair_len - key_len - 1;
+            if (val_size == 0) {
+                return ESP_ERR_HTTPD_RESULT_TRUNC;
+            }
+            size_t copy = len < val_size - 1 ? len : val_size - 1;
+            memcpy(val, value, copy);
+            val[copy] = '\0';
+            return copy < len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+        }
+        pair += pair_len;
+        if (*pair == '&') {
+            pair++;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+/* Responses */
+
+int httpd_send(httpd_req_t *r, const char *buf, size_t buf_len)
+{
+    const httpd_req_aux_t *aux = r->aux;
+    ssize_t sent = send(aux->sess->fd, buf, buf_len, MSG_NOSIGNAL);
+    return sent < 0 ? HTTPD_SOCK_ERR_FAIL : (int)sent;
+}
+
+static esp_err_t send_all(httpd_req_t *r, const char *buf, size_t len)
+{
+    while (len > 0) {
+        int sent = httpd_send(r, buf, len);
+        if (sent <= 0) {
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    ((httpd_req_aux_t *)r->aux)->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    ((httpd_req_aux_t *)r->aux)->type = type;
+    return ESP_OK;
+}
+
+// Like the real server only the pointers are kept, they have to stay valid until the response is sent
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    httpd_req_aux_t *aux = r->aux;
+    const httpd_server_t *server = aux->server;
+    if (aux->hdr_count == server->config.max_resp_headers ||
+        aux->hdr_count == (int)(sizeof(aux->hdr_fields) / sizeof(aux->hdr_fields[0]))) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    aux->hdr_fields[aux->hdr_count] = field;
+    aux->hdr_values[aux->hdr_count] = value;
+    aux->hdr_count++;
+    return ESP_OK;
+}
+
+// Status line, content type, the extra headers and the framing header
+static esp_err_t send_head(httpd_req_t *r, const char *framing)
+{
+    const httpd_req_aux_t *aux = r->aux;
+    char head[RESP_HEAD_SIZE];
+    size_t len = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: %s\r\n%s\r\n",
+                          aux->status, aux->type, framing);
+    for (int i = 0; i < aux->hdr_count && len < sizeof(head); i++) {
+        len += snprintf(head + len, sizeof(head) - len, "%s: %s\r\n", aux->hdr_fields[i], aux->hdr_values[i]);
+    }
+    if (len < sizeof(head)) {
+        len += snprintf(head + len, sizeof(head) - len, "\r\n");
+    }
+    if (len >= sizeof(head)) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    return send_all(r, head, len);
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = buf != NULL ? strlen(buf) : 0;
+    }
+    char framing[40];
+    snprintf(framing, sizeof(framing), "Content-Length: %zd", buf_len);
+    esp_err_t ret = send_head(r, framing);
+    if (ret == ESP_OK && buf_len > 0) {
+        ret = send_all(r, buf, buf_len);
+    }
+    return ret;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    httpd_req_aux_t *aux = r->aux;
+    if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = buf != NULL ? strlen(buf) : 0;
+    }
+    if (!aux->chunked) {
+        esp_err_t ret = send_head(r, "Transfer-Encoding: chunked");
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        aux->chunked = true;
+    }
+    char size[16];
+    int size_len = snprintf(size, sizeof(size), "%zx\r\n", buf != NULL ? buf_len : 0);
+    esp_err_t ret = send_all(r, size, size_len);
+    if (ret == ESP_OK && buf != NULL && buf_len > 0) {
+        ret = send_all(r, buf, buf_len);
+    }
+    if (ret == ESP_OK) {
+        ret = send_all(r, "\r\n", 2);
+    }
+    return ret;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *r, httpd_err_code_t error, const char *msg)
+{
+    static const struct {
+        const char *status;
+        const char *msg;
+    } errors[] = {
+        [HTTPD_400_BAD_REQUEST] = { "400 Bad Request", "Bad request syntax" },
+        [HTTPD_404_NOT_FOUND] = { "404 Not Found", "This URI does not exist" },
+        [HTTPD_405_METHOD_NOT_ALLOWED] = { "405 Method Not Allowed", "Request method for this URI is not handled by server" },
+        [HTTPD_408_REQ_TIMEOUT] = { "408 Request Timeout", "Server closed this connection" },
+        [HTTPD_414_URI_TOO_LONG] = { "414 URI Too Long", "URI is too long" },
+        [HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE] = { "431 Request Header Fields Too Large", "Header fields are too long" },
+        [HTTPD_500_INTERNAL_SERVER_ERROR] = { "500 Internal Server Error", "Server has encountered an unexpected error" },
+    };
+    httpd_resp_set_status(r, errors[error].status);
+    httpd_resp_set_type(r, "text/html");
+    return httpd_resp_send(r, msg != NULL ? msg : errors[error].msg, HTTPD_RESP_USE_STRLEN);
+}
+
+/* Async handlers */
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out)
+{
+    httpd_req_t *copy = malloc(sizeof(httpd_req_t));
+    httpd_req_aux_t *aux = malloc(sizeof(httpd_req_aux_t));
+    if (copy == NULL || aux == NULL) {
+        free(copy);
+        free(aux);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, r, sizeof(httpd_req_t));
+    memcpy(aux, r->aux, sizeof(httpd_req_aux_t));
+    copy->aux = aux;
+
+    httpd_server_t *server = aux->server;
+    pthread_mutex_lock(&server->lock);
+    aux->sess->async = true;
+    pthread_mutex_unlock(&server->lock);
+    *out = copy;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r)
+{
+    httpd_req_aux_t *aux = r->aux;
+    httpd_server_t *server = aux->server;
+    pthread_mutex_lock(&server->lock);
+    aux->sess->async = false;
+    aux->sess->lru = ++server->lru_counter;
+    pthread_mutex_unlock(&server->lock);
+    if (write(server->wake[1], "", 1) < 0) {
+        ESP_LOGW(TAG, "Failed to wake the server: %s", strerror(errno));
+    }
+    free(aux);
+    free(r);
+    return ESP_OK;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return ((httpd_req_aux_t *)r->aux)->sess->fd;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    httpd_server_t *server = handle;
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < server->config.max_open_sockets; i++) {
+        if (server->sessions[i].fd == sockfd) {
+            server->sessions[i].closing = true;
+            ret = ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    if (ret == ESP_OK && write(server->wake[1], "", 1) < 0) {
+        return ESP_FAIL;
+    }
+    return ret;
+}
+
+/* Sessions */
+
+static void sess_close(httpd_sess_t *sess)
+{
+    close(sess->fd);
+    sess->fd = -1;
+    sess->len = 0;
+    sess->closing = false;
+}
+
+// The session the next client gets, NULL if all are taken and none can be purged
+static httpd_sess_t *sess_slot(httpd_server_t *server, bool purge)
+{
+    httpd_sess_t *lru = NULL;
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < server->config.max_open_sockets; i++) {
+        httpd_sess_t *sess = &server->sessions[i];
+        if (sess->fd < 0) {
+            pthread_mutex_unlock(&server->lock);
+            return sess;
+        }
+        if (!sess->async && (lru == NULL || sess->lru < lru->lru)) {
+            lru = sess;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    if (!purge || lru == NULL) {
+        return NULL;
+    }
+    ESP_LOGD(TAG, "Closing least recently used session %d", lru->fd);
+    sess_close(lru);
+    return lru;
+}
+
+static void sess_accept(httpd_server_t *server)
+{
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    httpd_sess_t *sess = sess_slot(server, server->config.lru_purge_enable);
+    if (sess == NULL) {
+        close(fd);
+        return;
+    }
+    struct timeval timeout = { .tv_sec = server->config.send_wait_timeout };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    pthread_mutex_lock(&server->lock);
+    sess->fd = fd;
+    sess->len = 0;
+    sess->async = false;
+    sess->lru = ++server->lru_counter;
+    pthread_mutex_unlock(&server->lock);
+}
+
+static int parse_method(const char *method, size_t len)
+{
+    static const struct {
+        const char *name;
+        httpd_method_t method;
+    } methods[] = {
+        { "GET", HTTP_GET }, { "HEAD", HTTP_HEAD }, { "POST", HTTP_POST },
+        { "PUT", HTTP_PUT }, { "DELETE", HTTP_DELETE },
+    };
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (strlen(methods[i].name) == len && strncmp(methods[i].name, method, len) == 0) {
+            return methods[i].method;
+        }
+    }
+    return -1;
+}
+
+// Handle the request at the start of the session buffer, false if the session has to be closed
+static bool sess_handle(httpd_server_t *server, httpd_sess_t *sess, size_t head_len)
+{
+    httpd_req_aux_t aux = {
+        .server = server,
+        .sess = sess,
+        .status = "200 OK",
+        .type = "text/html",
+    };
+    httpd_req_t req = {
+        .handle = server,
+        .aux = &aux,
+    };
+
+    // Request line: METHOD SP target SP version CRLF
+    const char *line = sess->buf;
+    const char *line_end = strstr(line, "\r\n");
+    const char *sp1 = memchr(line, ' ', line_end - line);
+    const char *sp2 = sp1 != NULL ? memchr(sp1 + 1, ' ', line_end - sp1 - 1) : NULL;
+    size_t head_rest = head_len - (line_end + 2 - sess->buf);
+    memcpy(aux.head, line_end + 2, head_rest);
+    aux.head[head_rest] = '\0';
+    if (sp2 == NULL) {
+        httpd_resp_send_err(&req, HTTPD_400_BAD_REQUEST, NULL);
+        return false;
+    }
+    req.method = parse_method(line, sp1 - line);
+    size_t uri_len = sp2 - sp1 - 1;
+    if (uri_len > HTTPD_MAX_URI_LEN) {
+        httpd_resp_send_err(&req, HTTPD_414_URI_TOO_LONG, NULL);
+        return false;
+    }
+    memcpy((char *)req.uri, sp1 + 1, uri_len);
+    ((char *)req.uri)[uri_len] = '\0';
+
+    char content_length[16];
+    if (httpd_req_get_hdr_value_str(&req, "Content-Length", content_length, sizeof(content_length)) == ESP_OK &&
+        atol(content_length) > 0) {
+        httpd_resp_send_err(&req, HTTPD_400_BAD_REQUEST, "Request bodies are not supported");
+        return false;
+    }
+
+    // The buffer only holds the next request from here on
+    sess->len -= head_len;
+    memmove(sess->buf, sess->buf + head_len, sess->len);
+
+    size_t path_len = strcspn(req.uri, "?#");
+    const httpd_uri_t *handler = NULL;
+    bool uri_known = false;
+    for (size_t i = 0; i < server->uri_count && handler == NULL; i++) {
+        if (uri_match(server, server->uris[i].uri, req.uri, path_len)) {
+            uri_known = true;
+            if (server->uris[i].method == req.method) {
+                handler = &server->uris[i];
+            }
+        }
+    }
+    if (handler == NULL) {
+        httpd_resp_send_err(&req, uri_known ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND, NULL);
+        return false;
+    }
+
+    req.user_ctx = handler->user_ctx;
+    if (handler->handler(&req) != ESP_OK) {
+        // A session handed to an async handler stays open, the handler answered on it
+        pthread_mutex_lock(&server->lock);
+        bool async = sess->async;
+        pthread_mutex_unlock(&server->lock);
+        return async;
+    }
+    return true;
+}
+
+// Read what the client sent and handle the request once its head is complete
+static void sess_read(httpd_server_t *server, httpd_sess_t *sess)
+{
+    ssize_t n = recv(sess->fd, sess->buf + sess->len, sizeof(sess->buf) - 1 - sess->len, 0);
+    if (n <= 0) {
+        sess_close(sess);
+        return;
+    }
+    sess->len += n;
+    sess->buf[sess->len] = '\0';
+    pthread_mutex_lock(&server->lock);
+    sess->lru = ++server->lru_counter;
+    pthread_mutex_unlock(&server->lock);
+}
+
+static bool sess_is_async(httpd_server_t *server, const httpd_sess_t *sess)
+{
+    pthread_mutex_lock(&server->lock);
+    bool async = sess->async;
+    pthread_mutex_unlock(&server->lock);
+    return async;
+}
+
+// Handle the complete requests buffered for a session, pipelined ones included
+static void sess_process(httpd_server_t *server, httpd_sess_t *sess)
+{
+    while (sess->fd >= 0 && !sess_is_async(server, sess)) {
+        sess->buf[sess->len] = '\0';
+        const char *end = strstr(sess->buf, "\r\n\r\n");
+        if (end == NULL) {
+            if (sess->len == sizeof(sess->buf) - 1) {
+                httpd_req_aux_t aux = { .server = server, .sess = sess, .type = "text/html" };
+                httpd_req_t req = { .handle = server, .aux = &aux };
+                httpd_resp_send_err(&req, HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE, NULL);
+                sess_close(sess);
+            }
+            return;
+        }
+        if (!sess_handle(server, sess, end + 4 - sess->buf)) {
+            sess_close(sess);
+        }
+    }
+}
+
+static void httpd_task(void *arg)
+{
+    httpd_server_t *server = arg;
+    while (!server->stop) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(server->wake[0], &fds);
+        int max_fd = server->wake[0];
+        bool slot_free = false;
+
+        pthread_mutex_lock(&server->lock);
+        for (int i = 0; i < server->config.max_open_sockets; i++) {
+            httpd_sess_t *sess = &server->sessions[i];
+            if (sess->fd >= 0 && sess->closing && !sess->async) {
+                sess_close(sess);
+            }
+            if (sess->fd < 0) {
+                slot_free = true;
+            } else if (!sess->async) {
+                FD_SET(sess->fd, &fds);
+                max_fd = sess->fd > max_fd ? sess->fd : max_fd;
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        // Without a free session new clients wait in the backlog, unless one can be purged
+        if (slot_free || server->config.lru_purge_enable) {
+            FD_SET(server->listen_fd, &fds);
+            max_fd = server->listen_fd > max_fd ? server->listen_fd : max_fd;
+        }
+
+        if (select(max_fd + 1, &fds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ESP_LOGE(TAG, "select failed: %s", strerror(errno));
+            break;
+        }
+        if (FD_ISSET(server->wake[0], &fds)) {
+            char drain[64];
+            if (read(server->wake[0], drain, sizeof(drain)) < 0) {
+                ESP_LOGW(TAG, "Failed to drain the wake pipe: %s", strerror(errno));
+            }
+        }
+        for (int i = 0; i < server->config.max_open_sockets; i++) {
+            httpd_sess_t *sess = &server->sessions[i];
+            if (sess->fd >= 0 && FD_ISSET(sess->fd, &fds)) {
+                sess_read(server, sess);
+            }
+            // Sessions back from an async handler may have a request buffered already
+            if (sess->fd >= 0) {
+                sess_process(server, sess);
+            }
+        }
+        if (FD_ISSET(server->listen_fd, &fds)) {
+            sess_accept(server);
+        }
+    }
+
+    for (int i = 0; i < server->config.max_open_sockets; i++) {
+        if (server->sessions[i].fd >= 0 && !sess_is_async(server, &server->sessions[i])) {
+            sess_close(&server->sessions[i]);
+        }
+    }
+    close(server->listen_fd);
+    vTaskDelay(portMAX_DELAY);
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    httpd_server_t *server = calloc(1, sizeof(httpd_server_t));
+    if (server == NULL) {
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    server->config = *config;
+    server->uris = calloc(config->max_uri_handlers, sizeof(httpd_uri_t));
+    server->sessions = calloc(config->max_open_sockets, sizeof(httpd_sess_t));
+    if (server->uris == NULL || server->sessions == NULL || pipe(server->wake) != 0) {
+        free(server->uris);
+        free(server->sessions);
+        free(server);
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    for (int i = 0; i < config->max_open_sockets; i++) {
+        server->sessions[i].fd = -1;
+    }
+    pthread_mutex_init(&server->lock, NULL);
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port_override >= 0 ? port_override : config->server_port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    socklen_t addr_len = sizeof(addr);
+    if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, config->backlog_conn) != 0 ||
+        getsockname(server->listen_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        ESP_LOGE(TAG, "Failed to listen on port %d: %s", ntohs(addr.sin_port), strerror(errno));
+        if (server->listen_fd >= 0) {
+            close(server->listen_fd);
+        }
+        close(server->wake[0]);
+        close(server->wake[1]);
+        free(server->uris);
+        free(server->sessions);
+        free(server);
+        return ESP_FAIL;
+    }
+    server->port = ntohs(addr.sin_port);
+
+    if (xTaskCreate(httpd_task, "httpd", config->stack_size, server, config->task_priority, NULL) != pdPASS) {
+        close(server->listen_fd);
+        return ESP_ERR_HTTPD_TASK;
+    }
+    ESP_LOGI(TAG, "Started server on port %d", server->port);
+    *handle = server;
+    return ESP_OK;
+}
+
+// The server task closes the sockets and parks, the memory stays around for late async completions
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    httpd_server_t *server = handle;
+    server->stop = true;
+    if (write(server->wake[1], "", 1) < 0) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
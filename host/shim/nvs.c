@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "nvs.h"
+
+/* Host NVS
+ *
+ * A fixed table of entries keyed by namespace and key. It survives everything a soak
+ * simulates, reboots included, like the flash partition would.
+ */
+
+#define NVS_MAX_NAMESPACES 8
+#define NVS_MAX_ENTRIES 256
+#define NVS_KEY_SIZE 16     // NVS_KEY_NAME_MAX_SIZE
+#define NVS_VALUE_SIZE 4000 // Largest string NVS stores
+
+typedef struct {
+    uint8_t ns; // Index into namespaces + 1, 0 is a free entry
+    char key[NVS_KEY_SIZE];
+    bool is_str;
+    uint32_t u32;
+    char *str;
+} nvs_entry_t;
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static char namespaces[NVS_MAX_NAMESPACES][NVS_KEY_SIZE];
+static nvs_entry_t entries[NVS_MAX_ENTRIES];
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (strlen(namespace_name) >= NVS_KEY_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = ESP_ERR_NVS_NOT_FOUND;
+    pthread_mutex_lock(&nvs_lock);
+    for (int i = 0; i < NVS_MAX_NAMESPACES; i++) {
+        if (strcmp(namespaces[i], namespace_name) == 0 ||
+            (namespaces[i][0] == '\0' && open_mode == NVS_READWRITE)) {
+            strcpy(namespaces[i], namespace_name);
+            *out_handle = i + 1;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ret;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+// With nvs_lock held
+static nvs_entry_t *find(nvs_handle_t handle, const char *key, bool create)
+{
+    nvs_entry_t *free_entry = NULL;
+    for (int i = 0; i < NVS_MAX_ENTRIES; i++) {
+        if (entries[i].ns == handle && strcmp(entries[i].key, key) == 0) {
+            return &entries[i];
+        }
+        if (entries[i].ns == 0 && free_entry == NULL) {
+            free_entry = &entries[i];
+        }
+    }
+    if (!create || free_entry == NULL || strlen(key) >= NVS_KEY_SIZE) {
+        return NULL;
+    }
+    free_entry->ns = handle;
+    strcpy(free_entry->key, key);
+    return free_entry;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t *entry = find(handle, key, false);
+    bool found = entry != NULL && !entry->is_str;
+    if (found) {
+        *out_value = entry->u32;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return found ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t *entry = find(handle, key, true);
+    if (entry != NULL) {
+        free(entry->str);
+        entry->str = NULL;
+        entry->is_str = false;
+        entry->u32 = value;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return entry != NULL ? ESP_OK : ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    esp_err_t ret = ESP_ERR_NVS_NOT_FOUND;
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t *entry = find(handle, key, false);
+    if (entry != NULL && entry->is_str) {
+        size_t size = strlen(entry->str) + 1;
+        ret = ESP_OK;
+        if (out_value != NULL && *length < size) {
+            ret = ESP_ERR_NVS_INVALID_LENGTH;
+        } else if (out_value != NULL) {
+            memcpy(out_value, entry->str, size);
+        }
+        *length = size;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ret;
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    if (strlen(value) >= NVS_VALUE_SIZE) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    char *copy = strdup(value);
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t *entry = find(handle, key, true);
+    if (entry != NULL) {
+        free(entry->str);
+        entry->str = copy;
+        entry->is_str = true;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    if (entry == NULL) {
+        free(copy);
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t *entry = find(handle, key, false);
+    if (entry != NULL) {
+        free(entry->str);
+        memset(entry, 0, sizeof(*entry));
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return entry != NULL ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
@@ -0,0 +1,58 @@
+#ifndef __SHIM_SDKCONFIG_H__INCLUDED__
+#define __SHIM_SDKCONFIG_H__INCLUDED__
+
+// Kconfig defaults from main/Kconfig.projbuild for the host build, CMake may override them
+
+#ifndef CONFIG_FREERTOS_HZ
+#define CONFIG_FREERTOS_HZ 1000
+#endif
+#ifndef CONFIG_WEB_MAX_OPEN_SOCKETS
+#define CONFIG_WEB_MAX_OPEN_SOCKETS 7
+#endif
+#ifndef CONFIG_WEB_LRU_PURGE_ENABLE
+#define CONFIG_WEB_LRU_PURGE_ENABLE 1
+#endif
+#ifndef CONFIG_WEB_ASYNC_WORKERS
+#define CONFIG_WEB_ASYNC_WORKERS 2
+#endif
+#ifndef CONFIG_TRACE_BUFFER_EVENTS
+#define CONFIG_TRACE_BUFFER_EVENTS 512
+#endif
+#ifndef CONFIG_DLOG_BUFFER_RECORDS
+#define CONFIG_DLOG_BUFFER_RECORDS 256
+#endif
+#ifndef CONFIG_ADC_TRACE_MAX_SAMPLES
+#define CONFIG_ADC_TRACE_MAX_SAMPLES 256
+#endif
+
+#ifndef CONFIG_SD_BENCH_PASS_KB
+#define CONFIG_SD_BENCH_PASS_KB 128
+#endif
+
+#ifndef CONFIG_SD_LOG_PREALLOC_KB
+#define CONFIG_SD_LOG_PREALLOC_KB 64
+#endif
+
+#ifndef CONFIG_JOURNAL_CHECKPOINT_IDLE_S
+#define CONFIG_JOURNAL_CHECKPOINT_IDLE_S 30
+#endif
+
+#ifndef CONFIG_JOURNAL_SD_STALL_MS
+#define CONFIG_JOURNAL_SD_STALL_MS 250
+#endif
+#ifndef CONFIG_FLASH_RING_SLOTS
+#define CONFIG_FLASH_RING_SLOTS 64
+#endif
+
+#ifndef CONFIG_HISTORY_SEGMENT_KB
+#define CONFIG_HISTORY_SEGMENT_KB 16
+#endif
+
+#ifndef CONFIG_SESSION_RING_SIZE
+#define CONFIG_SESSION_RING_SIZE 8
+#endif
+#ifndef CONFIG_SESSION_FILE_KB
+#define CONFIG_SESSION_FILE_KB 64
+#endif
+
+#endif
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include "hal_linux.h"
+#include "mq303a_sim.h"
+#include "measurement.h"
+#include "sd_card.h"
+#include "journal.h"
+#include "history.h"
+#include "session.h"
+#include "dlog.h"
+#include "storage_fault.h"
+#include "flash_ring.h"
+
+/* Soak test of the full test cycle against the simulated sensor
+ *
+ *   breathalyzer_soak [--tests n] [--interval s] [--bac min:max] [--seed n] [--report n] [--sd dir]
+ *                     [--faults key=value,...] [--card-out first:count] [--max-bac-error x]
+ *
+ * Runs warm-up, baseline, capture and store back to back in virtual time, like
+ * app_main does on a button press, with one test every --interval simulated
+ * seconds. Every --report tests it prints the simulated time, throughput, heap,
+ * storage sizes, store latency and the BAC error against the simulated breath.
+ *
+ * --faults takes the keys of storage_fault_config_t, e.g.
+ * latency_ms=20,stall_pct=5,stall_ms=400,torn_pct=2. The report then adds the
+ * faults injected, the worst capture sample interval, and how many highscores a
+ * reboot after each test would have lost, found by reloading the table from the card.
+ *
+ * --card-out pulls the card for count tests from test first on, the results go to
+ * the flash ring meanwhile. The fault report then also shows the lines waiting in
+ * the ring, which should be back to 0 once the card has been tried again.
+ *
+ * Exits with 1 when a reboot would have lost a highscore, when the ring still holds
+ * lines at the end although the card came back before the last test and was tried
+ * once more without faults, or when the
+ * worst BAC error passes --max-bac-error (DEFAULT_MAX_BAC_ERROR), so CI can run it.
+ */
+
+#define HEATER_GPIO 3
+#define LED_GPIO 7
+#define WARMUP_MS 6322       // Length of the melody app_main plays before the baseline
+#define BREATH_DELAY_MS 500  // From the start of the capture to the start of the breath
+#define DEFAULT_MAX_BAC_ERROR 0.02
+
+static int64_t real_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    return hal_stat(path, &st) == 0 ? (long)st.st_size : 0;
+}
+
+typedef struct {
+    int tests;
+    double store_us_sum;
+    int64_t store_us_max;
+    int64_t store_sim_us_max; // Includes injected storage latency
+    int64_t capture_gap_us_max;
+    double bac_error_sum;
+    double bac_error_max;
+    int scores_lost;
+} soak_stats_t;
+
+// Rebuild the highscores from the card like a reboot would and count the entries that did not survive
+static int reboot_check(void)
+{
+    highscore_t before[MAX_HIGHSCORES];
+    highscore_t after[MAX_HIGHSCORES];
+    copy_highscores(before);
+    storage_fault_suspend(true);
+    journal_replay(SCORES_FILE);
+    storage_fault_suspend(false);
+    copy_highscores(after);
+
+    // The files keep the log's three decimals and the day
+    int lost = 0;
+    for (int i = 0; i < MAX_HIGHSCORES; i++) {
+        struct tm day_before, day_after;
+        result_date(&before[i].result, &day_before);
+        result_date(&after[i].result, &day_after);
+        if (before[i].result.bac > 0 &&
+            (before[i].result.bac != after[i].result.bac || day_before.tm_mday != day_after.tm_mday ||
+             day_before.tm_mon != day_after.tm_mon || day_before.tm_year != day_after.tm_year)) {
+            lost++;
+        }
+    }
+    return lost;
+}
+
+static void report_faults(const soak_stats_t *stats)
+{
+    storage_fault_config_t config;
+    storage_fault_stats_t faults;
+    storage_fault_get(&config, &faults);
+    printf("         faults: %u writes, %u stalls, %u ENOSPC, %u EIO, %u torn | store sim max %lld ms | "
+           "capture gap max %lld ms | flash ring %u | scores lost on reboot %d\n",
+           (unsigned)faults.writes, (unsigned)faults.stalls, (unsigned)faults.enospc, (unsigned)faults.eio,
+           (unsigned)faults.torn, (long long)stats->store_sim_us_max / 1000,
+           (long long)stats->capture_gap_us_max / 1000, (unsigned)flash_ring_count(), stats->scores_lost);
+}
+
+static void report(const soak_stats_t *stats, int64_t sim_start_us, int64_t real_start_us, size_t heap_start)
+{
+    double sim_days = (hal_time_us() - sim_start_us) / 86400e6;
+    double real_s = (real_time_us() - real_start_us) / 1e6;
+    struct mallinfo2 mi = mallinfo2();
+    long segment_bytes;
+    int segments = history_segment_usage(&segment_bytes);
+    printf("%8d tests %7.2f days | %8.0f tests/h | heap %+7ld B | log %8ld B scores %4ld B "
+           "segments %3d %7ld B | store avg %6.0f us max %6lld us | bac err avg %.5f max %.5f\n",
+           stats->tests, sim_days, stats->tests / real_s * 3600, (long)mi.uordblks - (long)heap_start,
+           file_size(LOG_FILE), file_size(SCORES_FILE), segments, segment_bytes, stats->store_us_sum / stats->tests,
+           (long long)stats->store_us_max, stats->bac_error_sum / stats->tests, stats->bac_error_max);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "tests", required_argument, NULL, 'n' },
+        { "interval", required_argument, NULL, 'i' },
+        { "bac", required_argument, NULL, 'b' },
+        { "seed", required_argument, NULL, 's' },
+        { "report", required_argument, NULL, 'r' },
+        { "sd", required_argument, NULL, 'd' },
+        { "faults", required_argument, NULL, 'f' },
+        { "card-out", required_argument, NULL, 'c' },
+        { "max-bac-error", required_argument, NULL, 'e' },
+        { NULL, 0, NULL, 0 },
+    };
+    int tests = 1000;
+    double interval_s = 600;
+    float bac_min = 0, bac_max = 0.1f;
+    uint32_t seed = 1;
+    int report_every = 100;
+    char sd_dir[256] = "";
+    const char *faults = NULL;
+    int card_out_first = -1, card_out_count = 0;
+    double max_bac_error = DEFAULT_MAX_BAC_ERROR;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:i:b:s:r:d:f:c:e:", options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            tests = atoi(optarg);
+            break;
+        case 'i':
+            interval_s = atof(optarg);
+            break;
+        case 'b':
+            if (sscanf(optarg, "%f:%f", &bac_min, &bac_max) == 1) {
+                bac_max = bac_min;
+            }
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            report_every = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'd':
+            snprintf(sd_dir, sizeof(sd_dir), "%s", optarg);
+            break;
+        case 'f':
+            faults = optarg;
+            break;
+        case 'c':
+            if (sscanf(optarg, "%d:%d", &card_out_first, &card_out_count) != 2) {
+                fprintf(stderr, "Bad --card-out, expected first:count\n");
+                return 2;
+            }
+            break;
+        case 'e':
+            max_bac_error = strtod(optarg, NULL);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [--tests n] [--interval s] [--bac min:max] [--seed n] "
+                            "[--report n] [--sd dir] [--faults key=value,...] [--card-out first:count] "
+                            "[--max-bac-error x]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (sd_dir[0] == '\0') {
+        snprintf(sd_dir, sizeof(sd_dir), "/tmp/breathalyzer-soak-XXXXXX");
+        if (mkdtemp(sd_dir) == NULL) {
+            perror("mkdtemp");
+            return 2;
+        }
+    }
+    printf("SD card in %s\n", sd_dir);
+
+    hal_linux_set_sd_root(sd_dir);
+    hal_linux_set_virtual_time(true);
+    mq303a_sim_t sim;
+    mq303a_sim_init(&sim, HEATER_GPIO, seed);
+    mq303a_sim_attach(&sim);
+    srand(seed);
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    for (int i = 0; i < DLOG_MODULE_COUNT; i++) {
+        dlog_set_level(i, ESP_LOG_NONE);
+    }
+
+    mq303a_init(2);
+    // Configured before the journal opens its file, so a pulled card reaches it too
+    bool card_out = card_out_count > 0;
+    bool inject = faults != NULL || card_out;
+    if (inject) {
+        storage_fault_config_t config = { .seed = seed };
+        if (faults != NULL && storage_fault_parse(faults, &config) != ESP_OK) {
+            fprintf(stderr, "Bad --faults, expected latency_ms, stall_pct, stall_ms, enospc_after, "
+                            "eio_pct, torn_pct or seed\n");
+            return 2;
+        }
+        storage_fault_configure(&config);
+    }
+    storage_fault_suspend(true);
+    journal_init(SCORES_FILE);
+    storage_fault_suspend(false);
+
+    soak_stats_t stats = { 0 };
+    int64_t sim_start_us = hal_time_us();
+    int64_t real_start_us = real_time_us();
+    size_t heap_start = mallinfo2().uordblks;
+
+    for (int i = 0; i < tests; i++) {
+        if (card_out && (i == card_out_first || i == card_out_first + card_out_count)) {
+            storage_fault_eject(i == card_out_first);
+        }
+        int64_t test_start_us = hal_time_us();
+        float bac = bac_min + (bac_max - bac_min) * rand() / (float)RAND_MAX;
+
+        mq303a_start_heatup(HEATER_GPIO);
+        hal_delay_ms(WARMUP_MS);
+
+        measurement_t m = { .source = NULL };
+        measurement_baseline(&m);
+        mq303a_sim_breath(&sim, bac, hal_time_us() + BREATH_DELAY_MS * 1000);
+        measurement_capture(&m, LED_GPIO);
+        mq303a_stop_heatup(HEATER_GPIO);
+        hal_gpio_set(LED_GPIO, 0);
+
+        for (int j = 1; j < m.count; j++) {
+            int64_t gap = m.sample_times[j] - m.sample_times[j - 1];
+            stats.capture_gap_us_max = gap > stats.capture_gap_us_max ? gap : stats.capture_gap_us_max;
+        }
+
+        int64_t store_start = real_time_us();
+        int64_t store_sim_start = hal_time_us();
+        measurement_store(&m);
+        int64_t store_us = real_time_us() - store_start;
+        int64_t store_sim_us = hal_time_us() - store_sim_start;
+        stats.store_sim_us_max = store_sim_us > stats.store_sim_us_max ? store_sim_us : stats.store_sim_us_max;
+
+        stats.tests++;
+        stats.store_us_sum += store_us;
+        stats.store_us_max = store_us > stats.store_us_max ? store_us : stats.store_us_max;
+        double error = fabs(m.bac - bac);
+        stats.bac_error_sum += error;
+        stats.bac_error_max = error > stats.bac_error_max ? error : stats.bac_error_max;
+        if (inject) {
+            stats.scores_lost += reboot_check();
+        }
+        if (stats.tests % report_every == 0 || i == tests - 1) {
+            report(&stats, sim_start_us, real_start_us, heap_start);
+            if (inject) {
+                report_faults(&stats);
+            }
+        }
+
+        // Idle until the next test, the sensor cools down in the meantime
+        int64_t next_us = test_start_us + (int64_t)(interval_s * 1e6);
+        if (next_us > hal_time_us()) {
+            hal_delay_ms((next_us - hal_time_us()) / 1000);
+        }
+        journal_poll();
+        session_poll();
+    }
+
+    int failures = 0;
+    if (stats.scores_lost > 0) {
+        fprintf(stderr, "FAIL: a reboot would have lost %d highscores\n", stats.scores_lost);
+        failures++;
+    }
+    // A card that failed again just before the end gets one more try without faults
+    if (inject && flash_ring_count() != 0) {
+        storage_fault_suspend(true);
+        hal_delay_ms(JOURNAL_RETRY_S * 1000);
+        journal_poll();
+        storage_fault_suspend(false);
+    }
+    if (card_out && card_out_first + card_out_count < tests && flash_ring_count() != 0) {
+        fprintf(stderr, "FAIL: %u lines left in the flash ring after the card came back\n",
+                (unsigned)flash_ring_count());
+        failures++;
+    }
+    if (stats.bac_error_max > max_bac_error) {
+        fprintf(stderr, "FAIL: BAC error %.5f over %.5f\n", stats.bac_error_max, max_bac_error);
+        failures++;
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -7,6 +7,18 @@
 #include "includes/MQ303A.h"
 #include "includes/buzzer.h"
 #include "includes/sd_card.h"
+#include "includes/web_server.h"
+#include "includes/metrics.h"
+#include "includes/trace.h"
+#include "includes/dlog.h"
+#include "includes/measurement.h"
+#include "includes/hal.h"
+#include "includes/bench.h"
+#include "includes/adc_trace.h"
+#include "includes/sd_bench.h"
+#include "includes/sd_mount.h"
+#include "includes/journal.h"
+#include "includes/session.h"
 
 // Web server includes
 #include "freertos/FreeRTOS.h"
@@ -17,12 +29,14 @@
 #include "esp_system.h"
 #include "nvs_flash.h"
 #include "esp_netif.h"
-#include "esp_http_server.h"
-#include "cJSON.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "sdmmc_cmd.h"
+#include "driver/gpio.h"
+#include "esp_adc/adc_oneshot.h"
 
 #define HEATER_SEL_PIN 3
 
-#define SAMPLE_COUNT 100
 #define VREF_DEFAULT 2500 // Default reference voltage in mV
 
 #define BUZZER_GPIO 0 // Define the output GPIO
@@ -166,199 +180,16 @@ void init_wifi(void)
     ESP_LOGI(TAG, "wifi_init_sta finished.");
 }
 
-// HTTP handlers
-static esp_err_t index_handler(httpd_req_t *req)
-{
-    ESP_LOGI(TAG, "Index handler called for URI: %s", req->uri);
-    
-    FILE *file = fopen("/sdcard/index.html", "r");
-    if (file == NULL) {
-        ESP_LOGE(TAG, "Failed to open /sdcard/index.html - serving fallback content");
-        ESP_LOGE(TAG, "Error opening file: %s", strerror(errno));
-        
-        // Serve fallback HTML content
-        const char* fallback_html = 
-            "<!DOCTYPE html>"
-            "<html><head><title>ESP32 Breathalyzer</title></head>"
-            "<body style='font-family: Arial, sans-serif; text-align: center; padding: 50px;'>"
-            "<h1>ESP32 Breathalyzer Server</h1>"
-            "<p>SD card file not found. Please check:</p>"
-            "<ul style='text-align: left; max-width: 400px; margin: 0 auto;'>"
-            "<li>SD card is properly inserted</li>"
-            "<li>index.html file exists in the root directory</li>"
-            "<li>SD card is formatted as FAT32</li>"
-            "</ul>"
-            "<p><a href='/api/status'>Check API Status</a></p>"
-            "</body></html>";
-        
-        httpd_resp_set_type(req, "text/html");
-        httpd_resp_send(req, fallback_html, strlen(fallback_html));
-        return ESP_OK;
-    }
-
-    ESP_LOGI(TAG, "Successfully opened index.html");
-    httpd_resp_set_type(req, "text/html");
-
-    char chunk[1024];
-    size_t chunksize;
-    do {
-        chunksize = fread(chunk, 1, sizeof(chunk), file);
-        if (chunksize > 0) {
-            if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK) {
-                fclose(file);
-                return ESP_FAIL;
-            }
-        }
-    } while (chunksize != 0);
-
-    fclose(file);
-    httpd_resp_send_chunk(req, NULL, 0);
-    ESP_LOGI(TAG, "Index page served successfully");
-    return ESP_OK;
-}
-
-static esp_err_t status_handler(httpd_req_t *req)
-{
-    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
-    esp_netif_ip_info_t ip_info;
-    esp_netif_get_ip_info(netif, &ip_info);
-    
-    char response[256];
-    snprintf(response, sizeof(response), 
-        "{"
-        "\"ip\":\"%d.%d.%d.%d\","
-        "\"status\":\"connected\","
-        "\"ssid\":\"%s\""
-        "}", 
-        IP2STR(&ip_info.ip), WIFI_SSID);
-    
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, response, strlen(response));
-    return ESP_OK;
-}
-
-/* Handler for getting alcohol highscores */
-static esp_err_t highscores_handler(httpd_req_t *req)
-{
-    httpd_resp_set_type(req, "application/json");
-    
-    // Load highscores from the file
-    load_highscores(SCORES_FILE);
-    ESP_LOGI(TAG, "Loaded highscores from %s", SCORES_FILE);
-    cJSON *highscores_array = cJSON_CreateArray();
-    for (int i = 0; i < MAX_HIGHSCORES; i++) {
-        ESP_LOGI(TAG, "Checking highscore %d: %f", i , highscores[i].score);
-        if (highscores[i].score >= 0.0) {
-            cJSON *highscore_item = cJSON_CreateObject();
-            
-            // Format date as string
-            char date_str[32];
-            strftime(date_str, sizeof(date_str), "%d-%m-%Y", &highscores[i].date);
-            ESP_LOGI(TAG, "Adding highscore: %s 0.%f", date_str, highscores[i].score);
-            
-            cJSON_AddStringToObject(highscore_item, "date", date_str);
-            cJSON_AddNumberToObject(highscore_item, "score", highscores[i].score); // Send as float
-            cJSON_AddItemToArray(highscores_array, highscore_item);
-        }
-    }
-
-    const char *json_response = cJSON_Print(highscores_array);
-    httpd_resp_send(req, json_response, strlen(json_response));
-    free((void *)json_response);
-    cJSON_Delete(highscores_array);
-    return ESP_OK;
-}
-
-static esp_err_t static_handler(httpd_req_t *req)
-{
-    char filepath[520];
-    snprintf(filepath, sizeof(filepath), "/sdcard%s", req->uri);
-    
-    FILE *file = fopen(filepath, "r");
-    if (file == NULL) {
-        httpd_resp_send_404(req);
-        return ESP_FAIL;
-    }
-
-    // Set content type based on file extension
-    const char *ext = strrchr(req->uri, '.');
-    if (ext) {
-        if (strcmp(ext, ".js") == 0) {
-            httpd_resp_set_type(req, "application/javascript");
-        } else if (strcmp(ext, ".css") == 0) {
-            httpd_resp_set_type(req, "text/css");
-        } else if (strcmp(ext, ".html") == 0) {
-            httpd_resp_set_type(req, "text/html");
-        }
-    }
-
-    char chunk[1024];
-    size_t chunksize;
-    do {
-        chunksize = fread(chunk, 1, sizeof(chunk), file);
-        if (chunksize > 0) {
-            if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK) {
-                fclose(file);
-                return ESP_FAIL;
-            }
-        }
-    } while (chunksize != 0);
-
-    fclose(file);
-    httpd_resp_send_chunk(req, NULL, 0);
-    return ESP_OK;
-}
-
-static httpd_handle_t start_webserver(void)
-{
-    httpd_handle_t server = NULL;
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-
-    if (httpd_start(&server, &config) == ESP_OK) {
-        // Register specific handlers first
-        httpd_uri_t status_uri = {
-            .uri       = "/api/status",
-            .method    = HTTP_GET,
-            .handler   = status_handler,
-            .user_ctx  = NULL
-        };
-        httpd_register_uri_handler(server, &status_uri);
-
-        httpd_uri_t highscores_uri = {
-            .uri       = "/api/v1/highscores",
-            .method    = HTTP_GET,
-            .handler   = highscores_handler,
-            .user_ctx  = NULL
-        };
-        httpd_register_uri_handler(server, &highscores_uri);
-
-        httpd_uri_t index_uri = {
-            .uri       = "/",
-            .method    = HTTP_GET,
-            .handler   = index_handler,
-            .user_ctx  = NULL
-        };
-        httpd_register_uri_handler(server, &index_uri);
-
-        // Register wildcard handler last
-        httpd_uri_t static_uri = {
-            .uri       = "/*",
-            .method    = HTTP_GET,
-            .handler   = static_handler,
-            .user_ctx  = NULL
-        };
-        httpd_register_uri_handler(server, &static_uri);
-
-        return server;
-    }
-
-    ESP_LOGI(TAG, "Error starting server!");
-    return NULL;
-}
-
 void app_main(void)
 {
     ESP_LOGI(TAG, "Starting Breathalyzer Application");
+    dlog_init(); // Per-sample logs are formatted by a low-priority task
+
+#ifdef CONFIG_BENCH_ON_BOOT
+    static bench_result_t bench_results[BENCH_MAX_RESULTS];
+    int bench_count = bench_run(NULL, 100, NULL, bench_results, BENCH_MAX_RESULTS);
+    bench_print(stdout, bench_results, bench_count);
+#endif
     
     // Initialize NVS
     ESP_ERROR_CHECK(nvs_flash_init());
@@ -369,74 +200,41 @@ void app_main(void)
     ESP_LOGI(TAG, "WiFi initialization complete");
     
     // Create breathalyzer task
-    adc_oneshot_unit_handle_t adc_handle = NULL;
-    adc_cali_handle_t adc_cali_handle = NULL;
     esp_timer_handle_t counting_timer = NULL;
     esp_timer_handle_t heatup_timer = NULL;
 
     buzzer_init(BUZZER_GPIO, BUZZER_FREQ);                            // Initialize the buzzer
     configure_button();                                               // Configure the button
     configure_led();                                                  // Configure the LED
-    mq303a_init(ADC_CHANNEL, &adc_handle, &adc_cali_handle);          // Initialize the MQ303A sensor
+    mq303a_init(ADC_CHANNEL);                                         // Initialize the MQ303A sensor
     // component_init(adc_handle, adc_cali_handle, counting_timer, heatup_timer); // Initialize components
     
     // Initialize the SD card
 
-    esp_err_t ret;
-
-    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-        .format_if_mount_failed = true,
-        .max_files = 5,
-        .allocation_unit_size = 16 * 1024
-    };
-    sdmmc_card_t *card;
-    const char mount_point[] = MOUNT_POINT;
+    static sdmmc_card_t *card;
     ESP_LOGI(TAG, "Initializing SD card");
-
-    ESP_LOGI(TAG, "Using SPI peripheral");
-
-    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
-
-    spi_bus_config_t bus_cfg = {
-        .mosi_io_num = PIN_NUM_MOSI,
-        .miso_io_num = PIN_NUM_MISO,
-        .sclk_io_num = PIN_NUM_CLK,
-        .quadwp_io_num = -1,
-        .quadhd_io_num = -1,
-        .max_transfer_sz = 4000,
-    };
-
-    ret = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize bus.");
-        return;
+    bool card_mounted = sd_mount(&card, true) == ESP_OK;
+    if (!card_mounted) {
+        // Tests go on, the journal keeps their results in internal flash until a card is mounted
+        ESP_LOGW(TAG, "No SD card, retrying in the background");
+        sd_mount_background(&card, true);
     }
-
-    // This initializes the slot without card detect (CD) and write protect (WP) signals.
-    // Modify slot_config.gpio_cd and slot_config.gpio_wp if your board has these signals.
-    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
-    slot_config.gpio_cs = PIN_NUM_CS;
-    slot_config.host_id = host.slot;
-
-    ESP_LOGI(TAG, "Mounting filesystem");
-    ret = esp_vfs_fat_sdspi_mount(mount_point, &host, &slot_config, &mount_config, &card);
-
-    if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE(TAG, "Failed to mount filesystem. ");
-        } else {
-            ESP_LOGE(TAG, "Failed to initialize the card (%s). "
-                     "Make sure SD card lines have pull-up resistors in place.", esp_err_to_name(ret));
-        }
-        return;
+    hal_clock_sync(); // Synchronize the system clock with NTP server
+
+    if (card_mounted) {
+        // Card has been initialized, print its properties
+        ESP_LOGI(TAG, "Filesystem mounted");
+        sdmmc_card_print_info(stdout, card);
+#ifdef CONFIG_SD_BENCH_ON_BOOT
+        static sd_bench_result_t sd_bench_results[SD_BENCH_MAX_RESULTS];
+        hal_storage_info_t storage_info = { 0 };
+        hal_storage_info(&storage_info);
+        int sd_bench_count = sd_bench_run(CONFIG_SD_BENCH_PASS_KB * 1024, sd_bench_results, SD_BENCH_MAX_RESULTS);
+        sd_bench_print(stdout, &storage_info, sd_bench_results, sd_bench_count < 0 ? 0 : sd_bench_count);
+#endif
     }
-    ESP_LOGI(TAG, "Filesystem mounted");
-    sync_clock(); // Synchronize the system clock with NTP server
-
-    // Card has been initialized, print its properties
-    sdmmc_card_print_info(stdout, card);
     const char *file_scores = MOUNT_POINT"/scores.txt";
-    load_highscores(file_scores); // Load highscores from the file
+    journal_init(file_scores); // Load highscores and replay the results a reset cut off
 
     // Check if index.html exists on SD card, if not create a basic one
     struct stat st;
@@ -452,6 +250,8 @@ void app_main(void)
         ESP_LOGE(TAG, "Failed to start web server");
     }
 
+    metrics_register_task(xTaskGetCurrentTaskHandle());
+
     // End of SD card initialization
     while (1)
     {
@@ -459,15 +259,21 @@ void app_main(void)
         timer_init("Counting Timer", &counting_timer, timer_callback);    // Initialize the counting timer
         while (gpio_get_level(GPIO_BUTTON) == 0)
         {
+            journal_poll(); // Checkpoint the journal while nobody is testing
+            session_poll(); // Save the samples of the last test
             vTaskDelay(pdMS_TO_TICKS(10));
         }
 
+        int64_t phase_start = esp_timer_get_time();
+        TRACE_BEGIN("warmup");
+        adc_trace_begin(); // Does nothing unless ADC_TRACE_RECORD is set
         ESP_ERROR_CHECK(esp_timer_start_once(heatup_timer, 10000000)); // Start timer for 10 seconds
         mq303a_start_heatup(HEATER_SEL_PIN);                           // Start the heater
         // Main loop
         ESP_LOGI(TAG, "Waiting for heater to be ready...");
         int size = sizeof(durations) / sizeof(int);
 
+        TRACE_BEGIN("melody");
         for (int note = 0; note < size; note++)
         {
             // to calculate the note duration, take one second divided by the note type.
@@ -499,38 +305,21 @@ void app_main(void)
         //     vTaskDelay(pdMS_TO_TICKS(100)); // Delay for 1 second
         // }
 
-        float RS_air = mq303a_get_rs_air(ADC_CHANNEL, &adc_handle, &adc_cali_handle, SAMPLE_COUNT); // Get RS_air value
-        ESP_LOGI(TAG, "RS_air: %.3f", RS_air);
+        TRACE_END("melody");
+        TRACE_END("warmup");
+        metrics_observe(METRIC_PHASE_WARMUP, esp_timer_get_time() - phase_start);
+
+        measurement_t measurement = { .source = NULL };
+        set_capture_active(true); // Keep the web server out of the way while sampling
+        measurement_baseline(&measurement);
 
         ESP_ERROR_CHECK(esp_timer_start_once(counting_timer, 5000000));
+        measurement_capture(&measurement, GPIO_LED);
+        set_capture_active(false);
 
-        float ppm = 0;
-        float bac = 0;
-        int count = 0;
-        while (count < 50)
-        {
-            // buzzer_on(BUZZER_FREQ);
-            gpio_set_level(GPIO_LED, 1);                                                  // Turn on the LED
-            float RS_gas = mq303a_get_rs_gas(ADC_CHANNEL, &adc_handle, &adc_cali_handle); // Get RS_gas value
-
-            float ratio = RS_gas / RS_air;                  // Calculate the ratio of RS values
-            ESP_LOGI(TAG, "RS_gas: %.3f, Ratio: %.3f", RS_gas, ratio);
-            ESP_LOGI(TAG, "PPM: %.2f", pow(10, (log10(ratio) - 0.328) / -0.55));
-            ESP_LOGI(TAG, "BAC: %.2f", pow(10, (log10(ratio) - 0.328) / -0.55) / 2600);
-            if (pow(10, (log10(ratio) - 0.328) / -0.55) > ppm) // Check if the current PPM is greater than the previous one
-            {
-                ppm = pow(10, (log10(ratio) - 0.328) / -0.55); // Update PPM value
-            }
-            vTaskDelay(pdMS_TO_TICKS(100)); // Delay for 0.1 second
-            count++;
-        }
-        count = 0; // Reset the stop counting flag
-        bac = ppm / 2600; // Convert PPM to BAC
-        add_log(ppm, bac); // Add a log entry
-        save_log(LOG_FILE, *logs); // Save the log to the file
-        add_highscore(file_scores, get_date(), bac); // Add a highscore
-        save_highscores(file_scores); // Save highscores to the file
-        display_highscores(); // Display the highscore table
+        measurement_store(&measurement);
+        notify_highscore_waiters(); // Push the new table to long-polling clients
+        metrics_inc(METRIC_TESTS_COMPLETED);
         // ésp_timer_stop(counting_timer); // Stop the counting timer
         esp_timer_delete(counting_timer); // Delete the counting timer
         // esp_timer_stop(heatup_timer); // Stop the heatup timer
@@ -15,11 +15,26 @@ const AlcoholSensorApp = () => {
   const [playerName, setPlayerName] = useState('');
   const [pendingScore, setPendingScore] = useState(null);
 
+  // Name the player of the next test on the board, before its button is pressed
+  const namePlayer = async () => {
+    try {
+      const name = encodeURIComponent(playerName.toUpperCase());
+      const response = await fetch(`/api/v1/player?name=${name}`, { method: 'POST' });
+      return response.ok;
+    } catch (error) {
+      console.error('Error naming the player:', error);
+      return false;
+    }
+  };
+
   // Simulate button press and sensor reading
-  const simulateButtonPress = () => {
+  const simulateButtonPress = async () => {
     if (isReading) return; // Prevent multiple simultaneous readings
     
     setIsReading(true);
+    if (playerName.length > 0) {
+      await namePlayer(); // The result is tagged with whoever is named when the test starts
+    }
     setCurrentReading(null);
     
     // Simulate sensor reading delay
@@ -103,6 +118,23 @@ const AlcoholSensorApp = () => {
                   Press the button on the board to get started
                 </div>
                 <div className="text-6xl mb-4">🎯</div>
+                <div className="flex justify-center gap-2 mb-4">
+                  <input
+                    type="text"
+                    value={playerName}
+                    onChange={(e) => setPlayerName(e.target.value.slice(0, 3))}
+                    className="px-4 py-2 rounded-lg text-center text-xl font-bold uppercase"
+                    maxLength="3"
+                    placeholder="AAA"
+                  />
+                  <button
+                    onClick={namePlayer}
+                    disabled={playerName.length === 0}
+                    className="px-4 py-2 bg-green-500 text-white rounded-lg font-semibold hover:bg-green-600 transition-colors"
+                  >
+                    I'm next
+                  </button>
+                </div>
                 <button
                   onClick={simulateButtonPress}
                   className="px-6 py-3 bg-blue-500 text-white rounded-lg font-semibold hover:bg-blue-600 transition-colors shadow-lg border border-blue-400"
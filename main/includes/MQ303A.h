@@ -1,27 +1,29 @@
 #ifndef __MQ303A_H__INCLUDED__
 #define __MQ303A_H__INCLUDED__
 
-#include "esp_adc/adc_cali_scheme.h"
-#include "esp_adc/adc_oneshot.h"
-#include "esp_adc/adc_cali.h"
-
-#include "esp_timer.h"
+#include <stdbool.h>
 #include "esp_log.h"
-#include "driver/gpio.h"
+#include "hal.h"
 
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+// Where samples come from, the live ADC or a recorded trace
+typedef struct {
+    esp_err_t (*read)(void *ctx, int *raw, int *millivolts);
+    void *ctx;
+} mq303a_source_t;
 
-#define ADC_WIDTH ADC_BITWIDTH_12
-#define ADC_ATTEN ADC_ATTEN_DB_12
+// Reads the ADC through the HAL, and records the samples when an ADC trace is running
+extern const mq303a_source_t mq303a_adc_source;
 
-void mq303a_init(adc_channel_t channel, adc_oneshot_unit_handle_t* adc_handle,
-                  adc_cali_handle_t* adc_cali_handle);
+void mq303a_init(int channel);
 bool mq303a_start_heatup(int heater_gpio);
 bool mq303a_stop_heatup(int heater_gpio);
-float mq303a_get_rs_air(adc_channel_t channel, adc_oneshot_unit_handle_t* adc_handle,
-                  adc_cali_handle_t* adc_cali_handle, int samples);
-float mq303a_get_rs_gas(adc_channel_t channel, adc_oneshot_unit_handle_t* adc_handle,
-                  adc_cali_handle_t* adc_cali_handle);
+float mq303a_get_rs_air(const mq303a_source_t *source, int samples);
+float mq303a_get_rs_gas(const mq303a_source_t *source);
+
+// Sensor resistance ratio from the averaged ADC voltage in mV
+float mq303a_calculate_current(float voltage);
+// Ethanol concentration from RS_gas / RS_air, fitted to the datasheet curve
+float mq303a_ppm_from_ratio(float ratio);
+float mq303a_bac_from_ppm(float ppm);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,66 @@
+#ifndef __ADC_TRACE_H__INCLUDED__
+#define __ADC_TRACE_H__INCLUDED__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "MQ303A.h"
+
+/* Raw ADC traces
+ *
+ * With CONFIG_ADC_TRACE_RECORD every raw sample of a test is kept in RAM with its
+ * time and written to MOUNT_POINT once the test is stored, together with the result
+ * the firmware computed. A trace can be fed back through the same pipeline with
+ * the replay source, see measurement_replay.
+ *
+ * File layout, all little-endian:
+ *   header: u32 magic "ADCT", u16 version, u16 record size, u32 start (unix time), u32 record count
+ *   record: u32 time in us since the start, u16 raw sample or marker, u16 millivolts
+ *   result: u32 magic "ARES", f32 rs_air, f32 ppm, f32 bac
+ * A marker has ADC_TRACE_MARKER set in the raw field, and the phase in the low bits.
+ */
+
+#define ADC_TRACE_MARKER 0x8000
+
+typedef enum {
+    ADC_TRACE_WARMUP,
+    ADC_TRACE_BASELINE,
+    ADC_TRACE_CAPTURE,
+    ADC_TRACE_PHASE_COUNT
+} adc_trace_phase_t;
+
+typedef struct {
+    uint32_t time_us;
+    uint16_t raw;
+    uint16_t millivolts;
+} adc_trace_record_t;
+
+// A trace loaded for replay
+typedef struct {
+    adc_trace_record_t *records;
+    uint32_t count;
+    uint32_t pos;      // Next record to read
+    uint32_t start;    // Unix time the recording started
+    bool has_result;   // The result below was stored with the trace
+    float rs_air;
+    float ppm;
+    float bac;
+} adc_trace_t;
+
+// Recording, all of these do nothing without CONFIG_ADC_TRACE_RECORD
+void adc_trace_begin(void);
+void adc_trace_mark(adc_trace_phase_t phase);
+void adc_trace_record(int raw, int millivolts);
+// Write the recorded session and its result to MOUNT_POINT/trace_<start>.adc
+esp_err_t adc_trace_save(float rs_air, float ppm, float bac);
+
+// Replay
+esp_err_t adc_trace_load(const char *path, adc_trace_t *trace);
+void adc_trace_free(adc_trace_t *trace);
+// Position the replay at the first sample of a phase, returns the number of samples in it
+int adc_trace_seek(adc_trace_t *trace, adc_trace_phase_t phase);
+// Sample source reading the trace in order, skipping markers
+mq303a_source_t adc_trace_source(adc_trace_t *trace);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __BENCH_H__INCLUDED__
+#define __BENCH_H__INCLUDED__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Microbenchmarks of the measurement kernels
+ *
+ * The same kernels run on the host (host/bench_main.c) and on the target at boot
+ * with CONFIG_BENCH_ON_BOOT. Each one is repeated until it ran for min_time_ms.
+ */
+
+#define BENCH_MAX_RESULTS 16
+
+typedef struct {
+    const char *name;
+    uint32_t iterations;
+    double ns_per_op;
+    double cycles_per_op; // Negative without a cycle counter, the host shim only has nanoseconds
+    double allocs_per_op; // Negative when allocations are not counted
+} bench_result_t;
+
+// Returns the number of allocations made so far, NULL when it cannot be counted
+typedef uint64_t (*bench_alloc_counter_t)(void);
+
+// Run every kernel whose name contains filter (all with NULL), returns the number of results
+int bench_run(const char *filter, uint32_t min_time_ms, bench_alloc_counter_t alloc_counter,
+              bench_result_t *results, int max_results);
+void bench_print(FILE *out, const bench_result_t *results, int count);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __CBOR_H__INCLUDED__
+#define __CBOR_H__INCLUDED__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* CBOR encoder (RFC 8949)
+ *
+ * Writes into a caller buffer. Like snprintf, output past the end of the buffer is
+ * counted but not written, so pos is the length the item needed and the item fits
+ * when pos <= len. Arrays and maps are counted up front.
+ */
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t pos;
+} cbor_writer_t;
+
+void cbor_init(cbor_writer_t *w, uint8_t *buf, size_t len);
+void cbor_uint(cbor_writer_t *w, uint64_t value);
+void cbor_int(cbor_writer_t *w, int64_t value);
+void cbor_text(cbor_writer_t *w, const char *text);
+void cbor_float(cbor_writer_t *w, float value);
+void cbor_null(cbor_writer_t *w);
+void cbor_array(cbor_writer_t *w, size_t count);
+void cbor_map(cbor_writer_t *w, size_t pairs);
+
+#endif
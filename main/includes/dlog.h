@@ -0,0 +1,89 @@
+#ifndef __DLOG_H__INCLUDED__
+#define __DLOG_H__INCLUDED__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+/* Deferred logging
+ *
+ * DLOGx records the format string pointer and the raw arguments into a ring buffer and
+ * returns. A low-priority task formats the records later, so hot loops do not pay for
+ * float formatting and UART output. Format strings must be literals and %s arguments
+ * must point to strings that outlive the record, such as other literals.
+ */
+#define DLOG_MAX_ARGS 4
+
+typedef enum {
+    DLOG_MAIN,
+    DLOG_MQ303A,
+    DLOG_SD_CARD,
+    DLOG_MODULE_COUNT
+} dlog_module_t;
+
+typedef enum {
+    DLOG_ARG_INT,
+    DLOG_ARG_DOUBLE,
+    DLOG_ARG_STR,
+} dlog_arg_type_t;
+
+typedef struct {
+    dlog_arg_type_t type;
+    union {
+        long long i;
+        double d;
+        const char *s;
+    };
+} dlog_arg_t;
+
+static inline dlog_arg_t dlog_arg_int(long long value) { return (dlog_arg_t){ .type = DLOG_ARG_INT, .i = value }; }
+static inline dlog_arg_t dlog_arg_double(double value) { return (dlog_arg_t){ .type = DLOG_ARG_DOUBLE, .d = value }; }
+static inline dlog_arg_t dlog_arg_str(const char *value) { return (dlog_arg_t){ .type = DLOG_ARG_STR, .s = value }; }
+
+#define DLOG_ARG(x) _Generic((x), \
+    float: dlog_arg_double, double: dlog_arg_double, \
+    char *: dlog_arg_str, const char *: dlog_arg_str, \
+    default: dlog_arg_int)(x)
+
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, N, ...) N
+#define DLOG_NARGS(...) DLOG_NARGS_(_0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define DLOG_CAT_(a, b) a##b
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_MAP_0()
+#define DLOG_MAP_1(a) DLOG_ARG(a)
+#define DLOG_MAP_2(a, b) DLOG_ARG(a), DLOG_ARG(b)
+#define DLOG_MAP_3(a, b, c) DLOG_ARG(a), DLOG_ARG(b), DLOG_ARG(c)
+#define DLOG_MAP_4(a, b, c, d) DLOG_ARG(a), DLOG_ARG(b), DLOG_ARG(c), DLOG_ARG(d)
+#define DLOG_MAP(...) DLOG_CAT(DLOG_MAP_, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+extern esp_log_level_t dlog_levels[DLOG_MODULE_COUNT];
+
+// The level check happens before any argument is converted
+#define DLOG(module, level, fmt, ...) do {                                              \
+        if ((level) <= dlog_levels[module]) {                                           \
+            const dlog_arg_t dlog_args_[] = { { 0 }, DLOG_MAP(__VA_ARGS__) };           \
+            dlog_write((module), (level), (fmt), dlog_args_ + 1,                         \
+                       sizeof(dlog_args_) / sizeof(dlog_args_[0]) - 1);                  \
+        }                                                                                \
+    } while (0)
+
+#define DLOGE(module, fmt, ...) DLOG(module, ESP_LOG_ERROR, fmt, ##__VA_ARGS__)
+#define DLOGW(module, fmt, ...) DLOG(module, ESP_LOG_WARN, fmt, ##__VA_ARGS__)
+#define DLOGI(module, fmt, ...) DLOG(module, ESP_LOG_INFO, fmt, ##__VA_ARGS__)
+#define DLOGD(module, fmt, ...) DLOG(module, ESP_LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+// Called with each piece of a binary dump, a non-ESP_OK return stops the output
+typedef esp_err_t (*dlog_emit_t)(void *ctx, const char *data, size_t len);
+
+// Start the task that formats the records
+void dlog_init(void);
+void dlog_write(dlog_module_t module, esp_log_level_t level, const char *fmt, const dlog_arg_t *args, size_t nargs);
+// Look a module up by its tag, case-insensitive. Returns DLOG_MODULE_COUNT if unknown
+dlog_module_t dlog_find_module(const char *tag);
+const char *dlog_module_tag(dlog_module_t module);
+void dlog_set_level(dlog_module_t module, esp_log_level_t level);
+// Write the records still in the ring as a binary dump for tools/dlog_decode.py
+esp_err_t dlog_dump(dlog_emit_t emit, void *ctx);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __FLASH_RING_H__INCLUDED__
+#define __FLASH_RING_H__INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/* Result ring in internal flash
+ *
+ * Log lines the card could not take, kept in NVS as CONFIG_FLASH_RING_SLOTS string
+ * entries plus head and tail counters. NVS spreads the writes over its pages, so the
+ * ring wears the flash evenly. When it is full the oldest line is dropped. NVS must
+ * be initialised first.
+ */
+
+#define FLASH_RING_SLOTS CONFIG_FLASH_RING_SLOTS
+#define FLASH_RING_LINE_SIZE 96 // Longest line plus its NUL
+
+esp_err_t flash_ring_push(const char *line);
+// Copy the oldest line into line, ESP_ERR_NOT_FOUND when the ring is empty. index numbers the lines in the
+// order they were pushed, it is not reused
+esp_err_t flash_ring_peek(char *line, size_t size, uint32_t *index);
+esp_err_t flash_ring_pop(void);
+// Lines waiting, 0 when NVS cannot be read
+uint32_t flash_ring_count(void);
+// Read the lines oldest first without removing them, stops when fn returns false
+void flash_ring_foreach(bool (*fn)(const char *line, void *ctx), void *ctx);
+
+#endif
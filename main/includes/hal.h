@@ -0,0 +1,70 @@
+#ifndef __HAL_H__INCLUDED__
+#define __HAL_H__INCLUDED__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "esp_err.h"
+
+/* Hardware abstraction layer
+ *
+ * The sensor, storage and measurement code only talks to the hardware through
+ * these functions. utils/hal_idf.c implements them on the ESP-IDF drivers, and
+ * host/hal_linux.c on plain POSIX so the same code builds as a Linux library.
+ */
+
+// ADC, one channel of ADC unit 1 as used by the MQ303A
+esp_err_t hal_adc_init(int channel);
+// Read one sample, millivolts falls back to a linear conversion when the ADC is not calibrated
+esp_err_t hal_adc_read(int *raw, int *millivolts);
+
+// GPIO
+void hal_gpio_output(int gpio);
+void hal_gpio_input(int gpio);
+void hal_gpio_set(int gpio, int level);
+int hal_gpio_get(int gpio);
+
+// Timer, microseconds since boot
+int64_t hal_time_us(void);
+void hal_delay_ms(uint32_t ms);
+
+// Fixed-rate wait without drift, like xTaskDelayUntil
+typedef struct {
+    int64_t last_wake;
+} hal_period_t;
+
+void hal_period_start(hal_period_t *period);
+void hal_period_wait(hal_period_t *period, uint32_t period_ms);
+
+// Wall clock, synchronised from NTP on the target
+void hal_clock_sync(void);
+// Seconds since the epoch, -1 while the clock was never synchronised
+time_t hal_clock_now(void);
+
+// File I/O, paths are under MOUNT_POINT
+FILE *hal_fopen(const char *path, const char *mode);
+int hal_stat(const char *path, struct stat *st);
+int hal_remove(const char *path);
+// Fails when to exists, as on FAT
+int hal_rename(const char *from, const char *to);
+// Create a directory, 0 when it exists already
+int hal_mkdir(const char *path);
+// Flush stdio and the filesystem so the data is on the card
+int hal_fsync(FILE *f);
+// Buffer the SD driver can DMA from without a bounce copy, aligned to a sector, free() it
+void *hal_dma_alloc(size_t size);
+// CRC-32 (IEEE, as zlib), chain calls by passing the previous result, start with 0
+uint32_t hal_crc32(uint32_t crc, const void *data, size_t len);
+
+// Size of the filesystem under MOUNT_POINT and its allocation unit (cluster)
+typedef struct {
+    uint64_t total_bytes;
+    uint64_t free_bytes;
+    uint32_t cluster_bytes;
+} hal_storage_info_t;
+
+esp_err_t hal_storage_info(hal_storage_info_t *info);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef __HISTORY_H__INCLUDED__
+#define __HISTORY_H__INCLUDED__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "lzss.h"
+#include "user.h"
+
+/* Measurement history
+ *
+ * The newest records are lines in the log file. Once its data reaches
+ * HISTORY_SEGMENT_BYTES a checkpoint seals it into a numbered segment and clears it.
+ * A segment is a header and an LZSS stream of varints, per record the zigzag deltas
+ * of the timestamp, PPM in 1/100 and BAC in 1/1000 against the record before, then
+ * the length and characters of the player name. That is everything a log line holds,
+ * so sealing loses nothing, and a record takes a few bytes instead of a 45 byte line.
+ * Readers go through the segments oldest first and the log last, decompressing as they
+ * go. Segments sealed before player names existed ("BHS1") are read as unnamed.
+ */
+
+#define HISTORY_SEGMENT_FMT "/sdcard/h%07d.seg" // Numbered from 1, 8.3 names
+#define HISTORY_SEGMENT_TMP "/sdcard/hnew.seg"  // Written in full, then renamed to the next number
+#define HISTORY_SEGMENT_BYTES (CONFIG_HISTORY_SEGMENT_KB * 1024)
+
+// One measurement as stored in the log file
+typedef struct {
+    time_t timestamp;
+    float ppm;
+    float bac;
+    char user[USER_NAME_SIZE]; // Empty when nobody was named for the test
+} history_record_t;
+
+// Sequential reader over the segments and the log file
+typedef struct history_reader {
+    FILE *f;       // Segment or log being read, one file at a time
+    const char *path;
+    long offset;   // Offset of the next line in the log
+    long end;      // End of the log data when the reader was opened, later appends are not read
+    int segment;   // Segment being read, segments + 1 for the log
+    uint32_t index; // Records read from it so far
+    int segments;  // Sealed segments when the reader was opened
+    time_t from;   // Segments entirely outside [from, to] are skipped, to 0 means no bound
+    time_t to;
+    uint32_t left; // Records left in the segment
+    int64_t last_ts;
+    int32_t last_ppm;
+    int32_t last_bac;
+    bool named;    // The segment stores player names
+    lzss_decoder_t lz;
+} history_reader_t;
+
+// Parse a line as result_format_line writes it
+bool history_parse_line(const char *line, history_record_t *record);
+/* Cursors
+ *
+ * A position in the history is the file, the records read from it and, in the log,
+ * the byte offset. Seeking to the log opens it at the offset. Seeking into a segment
+ * decodes it from its start, which takes at most one segment however deep the position
+ * is. A cursor taken in the log stays valid once the log is sealed: the records before
+ * it are the first ones of the segment it became.
+ */
+typedef struct history_cursor {
+    int file;       // 0 for the start, segment number, or one past the last segment for the log
+    uint32_t index;
+    long offset;
+} history_cursor_t;
+
+#define HISTORY_CURSOR_SIZE 32
+
+// Open the history of a log file for reading, the log end and segment count are fixed at open time
+esp_err_t history_open(history_reader_t *reader, const char *file);
+// Skip segments with no record in [from, to], records are still returned unfiltered
+void history_set_range(history_reader_t *reader, time_t from, time_t to);
+// Read the next record, skipping malformed lines. Returns false at the end of the history
+bool history_next(history_reader_t *reader, history_record_t *record);
+// Position of the next record history_next() returns
+void history_tell(const history_reader_t *reader, history_cursor_t *cursor);
+// Go to a position taken with history_tell(), ESP_ERR_INVALID_ARG when it is past the history
+esp_err_t history_seek(history_reader_t *reader, const history_cursor_t *cursor);
+// Position the next record appended to the log will have, to index it before it is written. The log is only
+// read past where the previous call stopped, call it from the task that writes the log
+esp_err_t history_log_cursor(const char *file, history_cursor_t *cursor);
+// Cursors travel as opaque strings
+int history_cursor_format(const history_cursor_t *cursor, char *buf, size_t len);
+bool history_cursor_parse(const char *str, history_cursor_t *cursor);
+// Go back to the first record, keeping what was fixed at open time
+void history_rewind(history_reader_t *reader);
+void history_close(history_reader_t *reader);
+
+// Whether the log has grown enough to be sealed
+bool history_seal_due(const char *file);
+// Seal the log into the next segment and clear it. Every journal record must already be in the log
+esp_err_t history_seal(const char *file);
+// Sealed segments and the bytes they take on the card
+int history_segment_usage(long *bytes);
+
+#endif
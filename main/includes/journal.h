@@ -0,0 +1,51 @@
+#ifndef __JOURNAL_H__INCLUDED__
+#define __JOURNAL_H__INCLUDED__
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/* Result journal
+ *
+ * A test appends its log line to JOURNAL_FILE as one record, "crc seq line", and that
+ * single sequential write is all it costs the card. The log, the player files and the
+ * highscore file are brought up to date from the journal at a checkpoint, once nothing
+ * has been appended for CONFIG_JOURNAL_CHECKPOINT_IDLE_S or JOURNAL_MAX_PENDING
+ * records wait.
+ * A checkpoint appends to the log first, saves the sequence number of the newest
+ * record in it and the log end in NVS, and rewrites the highscore file after that,
+ * stamped with the sequence number of the last record it holds. Boot can tell which
+ * records each file is missing and replay them. A reset at any point loses at most
+ * the record being appended.
+ *
+ * A player index that is stale (see user.h) is rebuilt once the device is idle and
+ * every record is in the log.
+ *
+ * Everything that reads the log, the export and the player files, lags the in-RAM
+ * highscores by the records waiting for a checkpoint.
+ *
+ * A card that is missing, fails an append or stalls one past CONFIG_JOURNAL_SD_STALL_MS
+ * is left alone for JOURNAL_RETRY_S and the records go to the flash ring meanwhile, so
+ * a test never waits on the card. Once the card takes records again the ring is moved
+ * over to the journal before anything new.
+ */
+
+#define JOURNAL_FILE "/sdcard/journal.txt"
+#define JOURNAL_RECORD_SIZE 96
+#define JOURNAL_MAX_PENDING 32          // Records waiting for the log before a checkpoint is forced
+#define JOURNAL_REWIND_BYTES (8 * 1024) // The journal starts over at the first checkpoint past this
+#define JOURNAL_RETRY_S 30              // Between attempts to get back to a card that failed
+#define JOURNAL_INDEX_RETRY_S 600       // Between attempts to rebuild a player index that failed
+
+// Load the highscores, replay the journal over them and checkpoint, ESP_FAIL when there is no card
+esp_err_t journal_init(const char *scores_file);
+// Rebuild the in-RAM highscores from the card like a boot does, without writing to it
+esp_err_t journal_replay(const char *scores_file);
+// Record a test: line is its log entry as result_format_line writes it, the highscores are updated from it
+esp_err_t journal_append(const char *line);
+// Checkpoint when records wait and the device has been idle long enough, or retry the card, call it between tests
+void journal_poll(void);
+// Bring the log and the highscore file up to date with the journal now
+esp_err_t journal_checkpoint(void);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __LZSS_H__INCLUDED__
+#define __LZSS_H__INCLUDED__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* LZSS with a 256-byte window
+ *
+ * A flag byte leads every eight items, bit 0 first: a set bit is a literal byte, a
+ * clear bit a match of two bytes, distance - 1 and length - LZSS_MIN_MATCH. The
+ * decoder needs nothing but the window, so it streams from a file in a few hundred
+ * bytes of RAM. Encoding searches the whole window and is meant for idle time.
+ */
+
+#define LZSS_WINDOW 256
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + 255)
+// Worst case output for len input bytes, when nothing matches
+#define LZSS_MAX_ENCODED(len) ((len) + (len) / 8 + 1)
+
+// Compress in into out, returns the encoded length or 0 when out is too small
+size_t lzss_encode(const uint8_t *in, size_t len, uint8_t *out, size_t out_size);
+
+typedef struct {
+    FILE *in;
+    uint32_t in_left;   // Encoded bytes not read yet
+    uint8_t window[LZSS_WINDOW];
+    uint8_t pos;        // Wraps with the window
+    uint8_t flags;
+    uint8_t flag_bits;  // Items left under the current flag byte
+    uint16_t match_dist;
+    uint16_t match_left;
+} lzss_decoder_t;
+
+// Decode len bytes of in from its current position
+void lzss_decoder_init(lzss_decoder_t *d, FILE *in, uint32_t len);
+// Next decoded byte, -1 at the end of the data or on a read error
+int lzss_decoder_getc(lzss_decoder_t *d);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __MEASUREMENT_H__INCLUDED__
+#define __MEASUREMENT_H__INCLUDED__
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "MQ303A.h"
+#include "adc_trace.h"
+
+#define BASELINE_SAMPLES 100
+#define CAPTURE_SAMPLES 50
+#define CAPTURE_PERIOD_MS 100
+
+// One breath test, from the clean-air baseline to the peak reading
+typedef struct {
+    const mq303a_source_t *source; // NULL reads the live ADC
+    float rs_air;  // Sensor resistance in clean air
+    float ppm;     // Peak concentration of the capture
+    float bac;
+    int count;     // Samples taken during the capture
+    int64_t sample_times[CAPTURE_SAMPLES]; // Acquisition timestamps in us
+    float ratios[CAPTURE_SAMPLES];         // RS_gas / RS_air of every sample
+} measurement_t;
+
+// Average the sensor over BASELINE_SAMPLES reads to get RS_air
+void measurement_baseline(measurement_t *m);
+// Sample the sensor every CAPTURE_PERIOD_MS and keep the peak, led_gpio is lit while sampling
+void measurement_capture(measurement_t *m, int led_gpio);
+// Run baseline and capture on a recorded trace, without waiting between samples
+esp_err_t measurement_replay(adc_trace_t *trace, measurement_t *m);
+// Append the result to the journal, the log and highscore table get it at the next checkpoint, and keep its samples
+void measurement_store(const measurement_t *m);
+
+#endif
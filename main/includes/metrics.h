@@ -0,0 +1,57 @@
+#ifndef __METRICS_H__INCLUDED__
+#define __METRICS_H__INCLUDED__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Latency histograms, all sharing the same bucket boundaries
+typedef enum {
+    METRIC_ADC_READ,
+    METRIC_PHASE_WARMUP,
+    METRIC_PHASE_BASELINE,
+    METRIC_PHASE_CAPTURE,
+    METRIC_PHASE_STORE,
+    METRIC_SD_SAVE_LOG,
+    METRIC_SD_SAVE_HIGHSCORES,
+    METRIC_SD_JOURNAL_APPEND,
+    METRIC_SD_CHECKPOINT,
+    METRIC_HTTP_INDEX,
+    METRIC_HTTP_STATUS,
+    METRIC_HTTP_HIGHSCORES,
+    METRIC_HTTP_EXPORT,
+    METRIC_HTTP_METRICS,
+    METRIC_HTTP_TRACE,
+    METRIC_HTTP_LOG,
+    METRIC_HTTP_REPLAY,
+    METRIC_HTTP_STATIC,
+    METRIC_HTTP_DIAG,
+    METRIC_HTTP_SESSIONS,
+    METRIC_HTTP_USERS,
+    METRIC_HISTOGRAM_COUNT
+} metric_histogram_t;
+
+typedef enum {
+    METRIC_TESTS_COMPLETED,
+    METRIC_SD_WRITE_ERRORS,
+    METRIC_SD_PREALLOCATIONS,
+    METRIC_SD_STALLS,
+    METRIC_FLASH_RING_WRITES,
+    METRIC_FLASH_RING_DROPPED,
+    METRIC_HTTP_REJECTED,
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+// Called with each piece of the text exposition, a non-ESP_OK return stops the output
+typedef esp_err_t (*metrics_emit_t)(void *ctx, const char *text, size_t len);
+
+void metrics_observe(metric_histogram_t histogram, int64_t duration_us);
+void metrics_inc(metric_counter_t counter);
+// Report the stack high-water mark of a task, up to METRICS_MAX_TASKS
+void metrics_register_task(TaskHandle_t task);
+// Write every metric in the Prometheus text exposition format
+esp_err_t metrics_render(metrics_emit_t emit, void *ctx);
+
+#endif
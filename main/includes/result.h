@@ -0,0 +1,50 @@
+#ifndef __RESULT_H__INCLUDED__
+#define __RESULT_H__INCLUDED__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "esp_err.h"
+#include "user.h"
+
+/* Test results in RAM
+ *
+ * A result is 12 bytes: the time in seconds since the epoch, PPM and BAC in fixed
+ * point at the precision the log line and the segments keep them, flags, and a
+ * reference to the player's name (see user_ref()). Dates and decimals are only
+ * formatted where a result leaves RAM: the log line, scores.txt and the API.
+ */
+
+#define RESULT_PPM_SCALE 100  // PPM in 1/100
+#define RESULT_BAC_SCALE 1000 // BAC in 1/1000, up to 65.535
+
+#define RESULT_CLOCK_UNSET 0x01 // The clock was never synchronised, time is 0 until the caller numbers it
+#define RESULT_CLIPPED     0x02 // PPM or BAC did not fit and was saturated
+
+typedef struct {
+    uint32_t time;  // Seconds since the epoch
+    uint32_t ppm;   // In 1/RESULT_PPM_SCALE
+    uint16_t bac;   // In 1/RESULT_BAC_SCALE
+    uint8_t flags;
+    uint8_t user;   // Reference to the player's name, USER_NONE when nobody was named
+} result_t;
+
+// Build a result, time -1 sets RESULT_CLOCK_UNSET. The name stays referenced until result_release().
+// ESP_ERR_NO_MEM when the name could not be referenced, the result is made without it then (see user_ref())
+esp_err_t result_make(result_t *result, time_t time, float ppm, float bac, const char *user);
+// Parse a log line into a result to release after use, ESP_ERR_INVALID_ARG when it is not one, or an error of
+// result_make()
+esp_err_t result_parse_line(const char *line, result_t *result);
+void result_release(result_t *result);
+
+static inline float result_ppm(const result_t *result) { return (float)result->ppm / RESULT_PPM_SCALE; }
+static inline float result_bac(const result_t *result) { return (float)result->bac / RESULT_BAC_SCALE; }
+
+// Local date and time of a result
+void result_date(const result_t *result, struct tm *date);
+// Write the log line of a result: "dd/mm/yyyy HH:MM:SS - PPM: x, BAC: y", then " - USER: name" for a named
+// player. The name is the one given, not looked up from the result. Returns the length like snprintf
+size_t result_format_line(const result_t *result, const char *user, char *line, size_t len);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef __SD_BENCH_H__INCLUDED__
+#define __SD_BENCH_H__INCLUDED__
+
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_err.h"
+#include "hal.h"
+
+/* SD card throughput benchmark
+ *
+ * Writes and reads a scratch file under MOUNT_POINT, sequentially and at random
+ * offsets, for every operation size and stdio buffering mode. Each pass moves at most
+ * pass_bytes and SD_BENCH_MAX_OPS operations. Throughput includes opening and closing
+ * the file, so writes count the final flush to the card.
+ *
+ * Runs at boot with CONFIG_SD_BENCH_ON_BOOT, from /api/v1/diag/sd, and on the host
+ * with breathalyzer_bench --sd.
+ */
+
+#define SD_BENCH_MAX_OPS 512
+#define SD_BENCH_MAX_RESULTS 48
+#define SD_BENCH_FULL_VBUF_SIZE 4096 // Buffer given to setvbuf in SD_BENCH_VBUF_FULL
+
+typedef enum {
+    SD_BENCH_SEQ_WRITE,
+    SD_BENCH_SEQ_READ,
+    SD_BENCH_RAND_WRITE,
+    SD_BENCH_RAND_READ,
+    SD_BENCH_PATTERN_COUNT
+} sd_bench_pattern_t;
+
+typedef enum {
+    SD_BENCH_VBUF_DEFAULT, // Whatever buffer stdio allocates
+    SD_BENCH_VBUF_NONE,    // _IONBF, every call goes to the filesystem
+    SD_BENCH_VBUF_FULL,    // _IOFBF with SD_BENCH_FULL_VBUF_SIZE bytes
+    SD_BENCH_VBUF_COUNT
+} sd_bench_vbuf_t;
+
+typedef struct {
+    sd_bench_pattern_t pattern;
+    sd_bench_vbuf_t vbuf;
+    uint32_t op_bytes;
+    uint32_t ops;
+    double mb_per_s;
+    // Per fread/fwrite call, random patterns include the fseek
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} sd_bench_result_t;
+
+// Run every combination, returns the number of results or -1 when the card failed
+int sd_bench_run(uint32_t pass_bytes, sd_bench_result_t *results, int max_results);
+
+const char *sd_bench_pattern_name(sd_bench_pattern_t pattern);
+const char *sd_bench_vbuf_name(sd_bench_vbuf_t vbuf);
+
+void sd_bench_print(FILE *out, const hal_storage_info_t *info, const sd_bench_result_t *results, int count);
+
+typedef esp_err_t (*sd_bench_emit_t)(void *ctx, const char *text, size_t len);
+
+// JSON object with the storage info and one entry per result
+esp_err_t sd_bench_render(const hal_storage_info_t *info, const sd_bench_result_t *results, int count,
+                          sd_bench_emit_t emit, void *ctx);
+
+#endif
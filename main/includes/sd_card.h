@@ -2,59 +2,74 @@
 #define __SDCARD_H__INCLUDED__
 
 #include <string.h>
+#include <stdint.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
-#include "esp_vfs_fat.h"
-#include "sdmmc_cmd.h"
-#include "sd_test_io.h"
 #include <time.h>
-#include "esp_netif.h"
-#include "esp_netif_sntp.h"
-#include "esp_sntp.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "user.h"
+#include "result.h"
 
 
 #define SCORES_FILE "/sdcard/scores.txt"
 #define LOG_FILE "/sdcard/log.txt"
-#define MAX_CHAR_SIZE    64
+#define MAX_CHAR_SIZE    80 // A log line with the longest player name
 #define MAX_HIGHSCORES 10
-#define MAX_LOG_SIZE    100
-
-extern char logs[MAX_LOG_SIZE][MAX_CHAR_SIZE]; // Buffer for storing logs
-extern int log_size; // Current size of the log buffer
 
 extern const char *TAGSD;
 
+// A leaderboard entry as the API shows it, with the player's name looked up
 typedef struct {
-    struct tm date; // Date structure for storing date/time
-    float score;
+    result_t result; // Its score is result.bac, an entry with none is empty
+    char user[USER_NAME_SIZE]; // Empty when nobody was named for the test
 } highscore_t;
 
-extern highscore_t highscores[MAX_HIGHSCORES];
+// Best results first, each holding a reference to its player's name
+extern result_t highscores[MAX_HIGHSCORES];
 
 #define MOUNT_POINT "/sdcard"
 #define PIN_NUM_MISO  4
 #define PIN_NUM_MOSI  6
 #define PIN_NUM_CLK   5
 #define PIN_NUM_CS    1
+#define SD_SECTOR_SIZE 512
 
 
 esp_err_t s_write_file(const char *path, char *data);
 esp_err_t s_read_file(const char *path);
-// Function to load highscores from the file
-esp_err_t load_highscores(const char *file);
-// Function to save highscores to the file
-esp_err_t save_highscores(const char *file);
-// Function to add a new highscore
-void add_highscore(const char *file, struct tm date, float score);
+// Function to load highscores from the file, seq (may be NULL) gets the journal sequence number it was saved at.
+// Returns ESP_ERR_INVALID_CRC when a rewrite was torn, the table then holds whatever could be read
+esp_err_t load_highscores(const char *file, uint32_t *seq);
+// Function to save highscores to the file, seq is the last journal record in the table
+esp_err_t save_highscores(const char *file, uint32_t seq);
+// Empty the table before it is rebuilt from the log
+void clear_highscores(void);
+// Function to add a new highscore, the table takes its own reference to the player's name
+void add_highscore(const result_t *result);
 // Function to display the highscore table
 void display_highscores(void);
+// Version of the highscore table, bumped every time its contents change
+uint32_t get_highscores_version(void);
+// Copy the highscore table atomically with the players' names, returns the version of the copy
+uint32_t copy_highscores(highscore_t out[MAX_HIGHSCORES]);
+// Longest entry: ,{"date":"dd-mm-yyyy","score":65.535,"user":"<name>"}, the year stays 4 digits until 2106
+#define HIGHSCORES_JSON_ENTRY_MAX (47 + USER_NAME_MAX)
+#define HIGHSCORES_JSON_SIZE (MAX_HIGHSCORES * HIGHSCORES_JSON_ENTRY_MAX + 3) // Always enough for a full table
+// Write limit entries of a table from rank first as a JSON array of {"date","score"} and "user" when named,
+// for /api/v1/highscores. The score is written as the exact decimal it is kept in (0.120), where cJSON
+// printed the float (0.119999997317791). Returns the length like snprintf
+size_t highscores_to_json(const highscore_t table[MAX_HIGHSCORES], int first, int limit, char *buf, size_t len);
+// The same entries as a CBOR array of maps, the score in 1/1000. Never longer than the JSON
+size_t highscores_to_cbor(const highscore_t table[MAX_HIGHSCORES], int first, int limit, uint8_t *buf, size_t len);
 
-void add_log(float ppm, float bac);
+// Open the log for adding, what a reset or a failed append left of a line is padded over
+esp_err_t open_log(const char *file);
 esp_err_t save_log(const char *file, char *msg);
+// Offset just past the data of the log file, -1 when it cannot be opened
+long log_data_end(const char *file);
+// Empty the log file once history_seal has moved its lines into a segment
+esp_err_t clear_log(const char *file);
 
 
-void sync_clock();
-
-struct tm get_date(void);
-
 #endif
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef __SD_MOUNT_H__INCLUDED__
+#define __SD_MOUNT_H__INCLUDED__
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+
+/* SD card mount with SPI clock negotiation
+ *
+ * Mounts the card on MOUNT_POINT, starting at CONFIG_SD_SPI_MAX_FREQ_KHZ and stepping
+ * down until the card reads its first sectors identically twice at that clock. The
+ * check only reads raw sectors and runs before the filesystem is mounted. The clock
+ * is kept in NVS together with the card's serial number, so later boots with the
+ * same card mount there without the check. NVS must be initialised first.
+ *
+ * With format_if_mount_failed, a card without a filesystem is formatted, but only
+ * when the first clock tried worked: a card that needed a lower clock is never
+ * formatted, whatever the reason its mount failed.
+ */
+
+#define SD_ALLOCATION_UNIT (16 * 1024)
+// One DMA transfer covers a whole allocation unit, so cluster writes go out as one multi-block write
+#define SD_MAX_TRANSFER_SIZE SD_ALLOCATION_UNIT
+
+#define SD_MOUNT_RETRY_MS 30000 // Between mount attempts when no card answered at boot
+
+esp_err_t sd_mount(sdmmc_card_t **card, bool format_if_mount_failed);
+// Keep retrying sd_mount from a low-priority task until a card answers, *card is set then
+void sd_mount_background(sdmmc_card_t **card, bool format_if_mount_failed);
+
+#endif
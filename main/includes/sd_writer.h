@@ -0,0 +1,45 @@
+#ifndef __SD_WRITER_H__INCLUDED__
+#define __SD_WRITER_H__INCLUDED__
+
+#include <stdio.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/* Sector-aligned writers for the SD card
+ *
+ * Append-only files stay open and are extended with NUL bytes SD_WRITER_CHUNK_SIZE at
+ * a time, so an append writes data into sectors and clusters that already belong to
+ * the file: no cluster allocation, no size change in the directory entry. The data
+ * ends at the first NUL of the padding, sd_writer_data_end() finds it again after a
+ * reboot. Small files are rewritten in place, padded to whole sectors.
+ */
+
+#define SD_WRITER_BUF_SIZE 4096 // Sector-aligned, DMA-capable stdio buffer
+#define SD_WRITER_CHUNK_SIZE (CONFIG_SD_LOG_PREALLOC_KB * 1024)
+
+typedef struct {
+    FILE *f;
+    char *buf;
+    char path[32];
+    long end;  // Where the next append goes
+    long size; // File size, including the padding
+} sd_writer_t;
+
+// Open an append-only file, creating it if needed, and find the end of its data. A record at the end without its
+// newline, torn by a reset or a failed append, is padded over
+esp_err_t sd_writer_open(sd_writer_t *w, const char *path);
+// Append and push the data to the card, the writer is closed when this fails. What a failed append may have
+// written is padded over again, unless that fails as well
+esp_err_t sd_writer_append(sd_writer_t *w, const char *data, size_t len);
+// Clear the data and append from the start again, the file keeps its size and clusters
+esp_err_t sd_writer_rewind(sd_writer_t *w);
+void sd_writer_close(sd_writer_t *w);
+
+// Offset just past the data of a file written by sd_writer, the file position is left undefined
+long sd_writer_data_end(FILE *f);
+
+// Rewrite a small file in place, padding the data with NULs to a whole number of sectors
+esp_err_t sd_writer_replace(const char *path, const char *data, size_t len);
+
+#endif
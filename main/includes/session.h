@@ -0,0 +1,48 @@
+#ifndef __SESSION_H__INCLUDED__
+#define __SESSION_H__INCLUDED__
+
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "measurement.h"
+
+/* Sample series of recent tests
+ *
+ * A capture keeps the RS_gas / RS_air ratio of every sample. The last
+ * SESSION_RING_SIZE sessions stay in RAM, and every session goes to SESSION_FILE as
+ * one text line, written between tests. A session is identified by the timestamp of
+ * its history record, so an entry of /api/v1/export leads to
+ * /api/v1/sessions/{timestamp}/samples. A test taken with the clock unset is dated in
+ * the first seconds of 1970 instead, numbered by session_unset_id(), so those tests
+ * keep apart too. Once SESSION_FILE would pass
+ * CONFIG_SESSION_FILE_KB it becomes SESSION_FILE_OLD and a new one is started, so the
+ * card holds between one and two files of sessions.
+ */
+
+#define SESSION_FILE "/sdcard/samples.txt"
+#define SESSION_FILE_OLD "/sdcard/samples.old"
+#define SESSION_RING_SIZE CONFIG_SESSION_RING_SIZE
+#define SESSION_RATIO_SCALE 10000 // Ratios are kept in 1/10000, so 0 to 6.5535
+#define SESSION_LINE_SIZE (80 + CAPTURE_SAMPLES * 4)
+
+typedef struct {
+    time_t id;             // Timestamp of the history record
+    float rs_air;
+    float ppm;             // Peak of the capture
+    float bac;
+    uint16_t interval_ms;  // Between samples
+    uint16_t count;
+    uint16_t ratio[CAPTURE_SAMPLES]; // In 1/SESSION_RATIO_SCALE
+} session_t;
+
+// Keep the samples of a test, id is the time of its result
+void session_record(const measurement_t *m, time_t id);
+// Time to give a result taken with the clock unset: 1, 2, 3... counted on across reboots in NVS
+time_t session_unset_id(void);
+// Write the sessions not on the card yet, call it between tests
+void session_poll(void);
+// Look a session up in RAM, then on the card. ESP_ERR_NOT_FOUND when it is in neither
+esp_err_t session_find(time_t id, session_t *out);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __STORAGE_FAULT_H__INCLUDED__
+#define __STORAGE_FAULT_H__INCLUDED__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/* Storage fault injection
+ *
+ * hal_fopen hands every file it opens to storage_fault_wrap. With faults configured,
+ * the file comes back behind a stdio cookie that delays writes and fails reads and
+ * writes the way a worn SD card does. Writes reach the cookie when stdio flushes its
+ * buffer, so a fault hits a whole buffer at once, like a FAT sector write would.
+ * hal_fsync goes through storage_fault_sync, which fails with EIO at eio_pct too.
+ */
+
+typedef struct {
+    uint32_t latency_ms;   // Added to every write
+    uint32_t stall_pct;    // Chance in percent that a write stalls for stall_ms on top
+    uint32_t stall_ms;
+    uint32_t enospc_after; // Bytes written from now on before every write fails with ENOSPC, 0 never
+    uint32_t eio_pct;      // Chance in percent that an open, read, write or sync fails with EIO
+    uint32_t torn_pct;     // Chance in percent that a write stores only part of its data, then EIO
+    uint32_t seed;
+} storage_fault_config_t;
+
+typedef struct {
+    uint32_t writes;
+    uint32_t stalls;
+    uint32_t enospc;
+    uint32_t eio;
+    uint32_t torn;
+} storage_fault_stats_t;
+
+#ifdef CONFIG_STORAGE_FAULT_INJECT
+// Returns file itself when no fault is configured, NULL if opening "failed"
+FILE *storage_fault_wrap(FILE *file, const char *path);
+// Sync a file storage_fault_wrap returned through to the card, 0 for any other file
+int storage_fault_sync(FILE *file);
+// Replace the configuration, all zero turns injection off
+void storage_fault_configure(const storage_fault_config_t *config);
+void storage_fault_get(storage_fault_config_t *config, storage_fault_stats_t *stats);
+// Keep the configuration but inject nothing until resumed, e.g. to read back what was written
+void storage_fault_suspend(bool suspend);
+// Pull the card: opens fail with ENODEV and files already open fail every read and write with EIO.
+// Only files opened while a configuration was set are affected
+void storage_fault_eject(bool ejected);
+// Parse "key=value" pairs separated by ',' or '&' into config, keys as in storage_fault_config_t
+esp_err_t storage_fault_parse(const char *spec, storage_fault_config_t *config);
+#else
+#define storage_fault_wrap(file, path) (file)
+#define storage_fault_sync(file) ((void)(file), 0)
+#endif
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef __TRACE_H__INCLUDED__
+#define __TRACE_H__INCLUDED__
+
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+// Trace points take a string literal, only the pointer is stored
+#ifdef CONFIG_TRACE_ENABLE
+#define TRACE_BEGIN(name) trace_record((name), 'B')
+#define TRACE_END(name) trace_record((name), 'E')
+#define TRACE_INSTANT(name) trace_record((name), 'i')
+#else
+#define TRACE_BEGIN(name) do { } while (0)
+#define TRACE_END(name) do { } while (0)
+#define TRACE_INSTANT(name) do { } while (0)
+#endif
+
+// Called with each piece of the JSON output, a non-ESP_OK return stops the output
+typedef esp_err_t (*trace_emit_t)(void *ctx, const char *text, size_t len);
+
+#ifdef CONFIG_TRACE_ENABLE
+void trace_record(const char *name, char phase);
+// Write the buffered events as a Chrome trace_event JSON object
+esp_err_t trace_render(trace_emit_t emit, void *ctx);
+#endif
+
+#endif
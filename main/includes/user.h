@@ -0,0 +1,92 @@
+#ifndef __USER_H__INCLUDED__
+#define __USER_H__INCLUDED__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <inttypes.h>
+#include "esp_err.h"
+
+/* Players and their history
+ *
+ * The web UI names the player of the next test, the result is tagged with that name
+ * from the log line on. Each player has a file under USER_DIR named after a hash of
+ * the name, holding the name and the position of each of their tests in the history,
+ * one "file index offset" line per test (see history_cursor_t), appended when a
+ * checkpoint moves the record to the log. Reading a player's history or best follows
+ * those positions, so it only decodes the segments that hold their tests, however long
+ * the rest of the history gets. Two names with the same hash take the next file along,
+ * the name line tells them apart.
+ *
+ * A test that cannot be added leaves the index stale rather than holding up the log.
+ * user_index_rebuild() then writes every file again from the history, and it is the
+ * only writer of USER_INDEX_MARK, so an index from an older firmware or cut short by a
+ * reset is rebuilt too.
+ */
+
+#define USER_NAME_MAX 12 // Letters, digits, '-' and '_', stored upper-case
+#define USER_NAME_SIZE (USER_NAME_MAX + 1)
+#define USER_DIR "/sdcard/users"
+#define USER_FILE_FMT USER_DIR "/%08" PRIx32 ".usr"
+#define USER_INDEX_MARK USER_DIR "/index.ver" // Holds USER_INDEX_VERSION once the files cover the history
+#define USER_INDEX_VERSION 2
+#define USER_PROBES 8    // Files tried for a name before the index gives up on it
+#define USER_REFS 16     // Names referenced at once, slot 0 is USER_NONE
+#define USER_NONE 0
+
+struct history_reader;
+struct history_cursor;
+
+// A player's history, oldest test first
+typedef struct {
+    FILE *f;
+    long start; // Offset of the first test, after the name line
+    char name[USER_NAME_SIZE];
+    struct history_reader *history; // Where the positions lead
+} user_reader_t;
+
+// Check and upper-case a submitted name, false when it is empty, too long or has other characters
+bool user_normalize(const char *name, char out[USER_NAME_SIZE]);
+// Name the player of the next test, an empty name clears it
+void user_set_player(const char name[USER_NAME_SIZE]);
+void user_get_player(char out[USER_NAME_SIZE]);
+// Take the player for the test being stored, the test after it has none unless named again
+void user_take_player(char out[USER_NAME_SIZE]);
+
+/* Name references
+ *
+ * Results in RAM name their player with a one byte reference into a table of
+ * USER_REFS names instead of the name itself, so a player on the leaderboard ten times
+ * is stored once. A reference is counted until released, a slot nobody references any
+ * more is reused for the next new name.
+ */
+
+// Reference a name, USER_NONE for "". ESP_ERR_NO_MEM when every slot is referenced, ref is USER_NONE then.
+// Callable inside the highscores lock, so the caller logs the name it lost
+esp_err_t user_ref(const char *name, uint8_t *ref);
+// Reference a name already referenced once more
+void user_ref_hold(uint8_t ref);
+void user_unref(uint8_t ref);
+// Name of a reference, "" for USER_NONE
+void user_ref_name(uint8_t ref, char out[USER_NAME_SIZE]);
+
+// Add the position of a test to the player's file, one not past the last position in it is taken as already
+// there. ESP_ERR_NOT_FOUND when the name has no file left, the rebuild would not find one either
+esp_err_t user_index_add(const char *name, const struct history_cursor *at);
+// Leave the index to be rebuilt, after a test could not be added to it
+void user_index_invalidate(void);
+// Whether the index misses tests: invalidated, or not rebuilt since an older firmware wrote it
+bool user_index_stale(void);
+// Write every player's file again from the history, walking all of it. Only the task that writes the log
+esp_err_t user_index_rebuild(void);
+// Open a player's history, ESP_ERR_NOT_FOUND when no test of theirs reached the card
+esp_err_t user_open(user_reader_t *reader, const char *name);
+// Read the next test, skipping positions that lead to a test of someone else (the index is stale)
+bool user_next(user_reader_t *reader, time_t *timestamp, float *ppm, float *bac);
+// Offset of the next test in the file, a cursor for user_seek()
+long user_tell(user_reader_t *reader);
+// Go to an offset taken with user_tell(), ESP_ERR_INVALID_ARG when it is not the start of a line in the file
+esp_err_t user_seek(user_reader_t *reader, long offset);
+void user_close(user_reader_t *reader);
+
+#endif
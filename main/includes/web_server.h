@@ -0,0 +1,13 @@
+#ifndef __WEB_SERVER_H__INCLUDED__
+#define __WEB_SERVER_H__INCLUDED__
+
+#include "esp_http_server.h"
+
+// Start the HTTP server and register the API and static file handlers
+httpd_handle_t start_webserver(void);
+// Wake up the clients long-polling the highscores after the table changed
+void notify_highscore_waiters(void);
+// Lower the HTTP tasks below the measurement loop and turn away SD-backed requests while capturing
+void set_capture_active(bool active);
+
+#endif
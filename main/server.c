@@ -18,6 +18,7 @@
 #include "sdmmc_cmd.h"
 #include "esp_vfs_fat.h"
 #include "cJSON.h"
+#include "includes/sd_mount.h"
 
 static const char *TAG = "web_server";
 
@@ -108,57 +109,9 @@ void init_wifi(void)
 
 void init_sd_card(void)
 {
-    esp_err_t ret;
-    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-        .format_if_mount_failed = false,
-        .max_files = 5,
-        .allocation_unit_size = 16 * 1024
-    };
     sdmmc_card_t *card;
-    const char mount_point[] = MOUNT_POINT;
     ESP_LOGI(TAG, "Initializing SD card");
-
-    // Use SPI2 host (HSPI) for better compatibility
-    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
-    host.slot = SPI2_HOST;
-    
-    // Configure SPI bus with proper settings for ESP32-C3
-    spi_bus_config_t bus_cfg = {
-        .mosi_io_num = 6,
-        .miso_io_num = 4,
-        .sclk_io_num = 5,
-        .quadwp_io_num = -1,
-        .quadhd_io_num = -1,
-        .max_transfer_sz = 4000,
-    };
-    
-    ESP_LOGI(TAG, "Initializing SPI bus with pins: MOSI=%d, MISO=%d, SCLK=%d, CS=%d", 
-             bus_cfg.mosi_io_num, bus_cfg.miso_io_num, bus_cfg.sclk_io_num, 13);
-    
-    ret = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
-    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
-        ESP_LOGE(TAG, "Failed to initialize SPI bus: %s", esp_err_to_name(ret));
-        return;
-    }
-
-    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
-    slot_config.gpio_cs = 1;
-    slot_config.host_id = host.slot;
-
-    ESP_LOGI(TAG, "Mounting SD card...");
-    ret = esp_vfs_fat_sdspi_mount(mount_point, &host, &slot_config, &mount_config, &card);
-
-    if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE(TAG, "Failed to mount filesystem. Format SD card in FAT32 and try again.");
-        } else if (ret == ESP_ERR_TIMEOUT) {
-            ESP_LOGE(TAG, "SD card timeout. Check wiring and ensure SD card is properly inserted.");
-        } else {
-            ESP_LOGE(TAG, "Failed to initialize the card (%s). Check wiring and SD card.", esp_err_to_name(ret));
-        }
-        
-        // Try to deinitialize the SPI bus if mount failed
-        spi_bus_free(host.slot);
+    if (sd_mount(&card, false) != ESP_OK) { // Never format the card from here
         return;
     }
 
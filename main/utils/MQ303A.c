@@ -1,52 +1,53 @@
+#include <math.h>
 #include "../includes/MQ303A.h"
+#include "../includes/metrics.h"
+#include "../includes/trace.h"
+#include "../includes/dlog.h"
+#include "../includes/adc_trace.h"
 
 static const char *TAG = "MQ303A";
 
-static float calculate_current(float voltage) {
+float mq303a_calculate_current(float voltage) {
     float sensor_volt = voltage / 1000.0; // Convert to volts
     float real_volt = sensor_volt * (5.0 / 2.5); // Convert to the true sensor output
-    ESP_LOGI(TAG, "Sensor Voltage: %.3f V", real_volt);
+    DLOGI(DLOG_MQ303A, "Sensor Voltage: %.3f V", real_volt);
     return real_volt / (5.0 - real_volt); //
 }
 
-void mq303a_init(adc_channel_t channel, adc_oneshot_unit_handle_t *adc_handle,
-                 adc_cali_handle_t *adc_cali_handle)
+float mq303a_ppm_from_ratio(float ratio)
 {
-    // Initialize ADC
-    adc_oneshot_unit_init_cfg_t init_config = {
-        .unit_id = ADC_UNIT_1,
-    };
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config, adc_handle));
-
-    // ADC config
-    adc_oneshot_chan_cfg_t config = {
-        .atten = ADC_ATTEN,    // Set attenuation to 12dB
-        .bitwidth = ADC_WIDTH, // Set bitwidth to 12 bits
-    };
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(*adc_handle, channel, &config));
-
-    // Initialize ADC calibration
-    adc_cali_curve_fitting_config_t cali_config = {
-        .unit_id = ADC_UNIT_1,
-        .atten = ADC_ATTEN,
-        .bitwidth = ADC_WIDTH,
-    };
-    esp_err_t ret = adc_cali_create_scheme_curve_fitting(&cali_config, adc_cali_handle);
-    if (ret != ESP_OK)
-    {
-        ESP_LOGW(TAG, "ADC calibration scheme not supported, using raw values");
-        adc_cali_handle = NULL;
-    }
-    else
-    {
-        ESP_LOGI(TAG, "ADC calibration initialized successfully");
+    return pow(10, (log10(ratio) - 0.328) / -0.55);
+}
+
+float mq303a_bac_from_ppm(float ppm)
+{
+    return ppm / 2600;
+}
+
+static esp_err_t adc_read(void *ctx, int *raw, int *millivolts)
+{
+    int64_t start = hal_time_us();
+    TRACE_BEGIN("adc_read");
+    esp_err_t ret = hal_adc_read(raw, millivolts);
+    TRACE_END("adc_read");
+    metrics_observe(METRIC_ADC_READ, hal_time_us() - start);
+    if (ret == ESP_OK) {
+        adc_trace_record(*raw, *millivolts);
     }
+    return ret;
+}
+
+const mq303a_source_t mq303a_adc_source = { adc_read, NULL };
+
+void mq303a_init(int channel)
+{
+    ESP_ERROR_CHECK(hal_adc_init(channel));
 }
 
 bool mq303a_start_heatup(int heater_gpio)
 {
-    gpio_set_direction(heater_gpio, GPIO_MODE_OUTPUT);
-    gpio_set_level(heater_gpio, 1); // Set heater pin HIGH initially
+    hal_gpio_output(heater_gpio);
+    hal_gpio_set(heater_gpio, 1); // Set heater pin HIGH initially
     ESP_LOGI(TAG, "GPIO setup complete: HEATER_SEL_PIN set to output");
 
     return true;
@@ -55,55 +56,40 @@ bool mq303a_start_heatup(int heater_gpio)
 bool mq303a_stop_heatup(int heater_gpio)
 {
     // Turn off the heater
-    gpio_set_level(heater_gpio, 0); // Set heater pin LOW to turn off
+    hal_gpio_set(heater_gpio, 0); // Set heater pin LOW to turn off
     ESP_LOGI(TAG, "Heater turned off");
 
     return true;
 }
 
-float mq303a_get_rs_air(adc_channel_t channel, adc_oneshot_unit_handle_t *adc_handle,
-                        adc_cali_handle_t *adc_cali_handle, int samples)
+float mq303a_get_rs_air(const mq303a_source_t *source, int samples)
 {
     int adc_raw = 0;
     int voltage = 0;    
     int total_voltage = 0;
 
     for (int i = 0;  i < samples; i++) {
-        // Read ADC value
-        ESP_ERROR_CHECK(adc_oneshot_read(*adc_handle, channel, &adc_raw));
-        ESP_LOGI(TAG, "ADC Raw Value: %d", adc_raw);
-
-        // Convert raw value to voltage
-        if (adc_cali_handle) {
-            ESP_ERROR_CHECK(adc_cali_raw_to_voltage(*adc_cali_handle, adc_raw, &voltage));
-            ESP_LOGI(TAG, "Calibrated Voltage: %d mV", voltage);
-            total_voltage += voltage;
-        } 
+        // Read ADC value and convert it to voltage
+        ESP_ERROR_CHECK(source->read(source->ctx, &adc_raw, &voltage));
+        DLOGI(DLOG_MQ303A, "ADC Raw Value: %d", adc_raw);
+        DLOGI(DLOG_MQ303A, "Calibrated Voltage: %d mV", voltage);
+        total_voltage += voltage;
     }
 
     total_voltage /= samples; // Average the voltage over the samples
-    float RS_air = calculate_current(total_voltage); // Calculate RS_air
+    float RS_air = mq303a_calculate_current(total_voltage); // Calculate RS_air
 
     return RS_air;
 }
 
-float mq303a_get_rs_gas(adc_channel_t channel, adc_oneshot_unit_handle_t *adc_handle,
-                        adc_cali_handle_t *adc_cali_handle)
+float mq303a_get_rs_gas(const mq303a_source_t *source)
 {
     int adc_raw = 0;
     int voltage = 0;    
-    // Read ADC value
-    ESP_ERROR_CHECK(adc_oneshot_read(*adc_handle, channel, &adc_raw));
-
-    // Convert raw value to voltage
-    if (adc_cali_handle) {
-        ESP_ERROR_CHECK(adc_cali_raw_to_voltage(*adc_cali_handle, adc_raw, &voltage));
-    } 
+    // Read ADC value and convert it to voltage
+    ESP_ERROR_CHECK(source->read(source->ctx, &adc_raw, &voltage));
 
-    float RS_gas = calculate_current(voltage); // Calculate RS_gas
+    float RS_gas = mq303a_calculate_current(voltage); // Calculate RS_gas
 
     return RS_gas;
 }
-
-
-
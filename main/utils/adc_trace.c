@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../includes/adc_trace.h"
+#include "../includes/sd_card.h"
+#include "../includes/hal.h"
+#include "esp_log.h"
+
+#define ADC_TRACE_MAGIC 0x54434441  // "ADCT" in little-endian
+#define ADC_RESULT_MAGIC 0x53455241 // "ARES" in little-endian
+#define ADC_TRACE_VERSION 1
+#define ADC_TRACE_HEADER_SIZE 16
+#define ADC_TRACE_RECORD_SIZE 8
+#define ADC_TRACE_RESULT_SIZE 16
+
+static const char *TAG = "adc_trace";
+
+#ifdef CONFIG_ADC_TRACE_RECORD
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+static void put_f32(uint8_t *p, float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    put_u32(p, bits);
+}
+#endif
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static float get_f32(const uint8_t *p)
+{
+    uint32_t bits = get_u32(p);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+/* Recording
+ *
+ * Only the measurement task records, so the buffer needs no lock.
+ */
+
+#ifdef CONFIG_ADC_TRACE_RECORD
+static adc_trace_record_t recording[CONFIG_ADC_TRACE_MAX_SAMPLES];
+static uint32_t recording_count = 0;
+static uint32_t recording_start = 0;
+static int64_t recording_start_us = 0;
+static bool recording_active = false;
+static bool recording_overflow = false;
+
+static void append(uint16_t raw, uint16_t millivolts)
+{
+    if (recording_count >= CONFIG_ADC_TRACE_MAX_SAMPLES) {
+        recording_overflow = true;
+        return;
+    }
+    recording[recording_count].time_us = hal_time_us() - recording_start_us;
+    recording[recording_count].raw = raw;
+    recording[recording_count].millivolts = millivolts;
+    recording_count++;
+}
+
+void adc_trace_begin(void)
+{
+    recording_count = 0;
+    recording_overflow = false;
+    time_t now = hal_clock_now();
+    recording_start = now >= 0 ? (uint32_t)now : (uint32_t)(hal_time_us() / 1000000); // From boot while unset
+    recording_start_us = hal_time_us();
+    recording_active = true;
+    append(ADC_TRACE_MARKER | ADC_TRACE_WARMUP, 0);
+}
+
+void adc_trace_mark(adc_trace_phase_t phase)
+{
+    if (recording_active) {
+        append(ADC_TRACE_MARKER | phase, 0);
+    }
+}
+
+void adc_trace_record(int raw, int millivolts)
+{
+    if (recording_active) {
+        append(raw & ~ADC_TRACE_MARKER, millivolts);
+    }
+}
+
+esp_err_t adc_trace_save(float rs_air, float ppm, float bac)
+{
+    if (!recording_active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    recording_active = false;
+    if (recording_overflow) {
+        ESP_LOGW(TAG, "Trace truncated to %d samples, raise ADC_TRACE_MAX_SAMPLES", CONFIG_ADC_TRACE_MAX_SAMPLES);
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), MOUNT_POINT "/trace_%lu.adc", (unsigned long)recording_start);
+    FILE *f = hal_fopen(path, "wb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s for writing", path);
+        return ESP_FAIL;
+    }
+
+    uint8_t buf[ADC_TRACE_HEADER_SIZE];
+    put_u32(buf, ADC_TRACE_MAGIC);
+    put_u16(buf + 4, ADC_TRACE_VERSION);
+    put_u16(buf + 6, ADC_TRACE_RECORD_SIZE);
+    put_u32(buf + 8, recording_start);
+    put_u32(buf + 12, recording_count);
+    bool ok = fwrite(buf, ADC_TRACE_HEADER_SIZE, 1, f) == 1;
+
+    for (uint32_t i = 0; i < recording_count && ok; i++) {
+        put_u32(buf, recording[i].time_us);
+        put_u16(buf + 4, recording[i].raw);
+        put_u16(buf + 6, recording[i].millivolts);
+        ok = fwrite(buf, ADC_TRACE_RECORD_SIZE, 1, f) == 1;
+    }
+
+    put_u32(buf, ADC_RESULT_MAGIC);
+    put_f32(buf + 4, rs_air);
+    put_f32(buf + 8, ppm);
+    put_f32(buf + 12, bac);
+    ok = ok && fwrite(buf, ADC_TRACE_RESULT_SIZE, 1, f) == 1;
+
+    if (fclose(f) != 0 || !ok) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Saved %lu trace records to %s", (unsigned long)recording_count, path);
+    return ESP_OK;
+}
+#else
+void adc_trace_begin(void)
+{
+}
+
+void adc_trace_mark(adc_trace_phase_t phase)
+{
+}
+
+void adc_trace_record(int raw, int millivolts)
+{
+}
+
+esp_err_t adc_trace_save(float rs_air, float ppm, float bac)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#endif
+
+/* Replay */
+
+esp_err_t adc_trace_load(const char *path, adc_trace_t *trace)
+{
+    memset(trace, 0, sizeof(*trace));
+    FILE *f = hal_fopen(path, "rb");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint8_t buf[ADC_TRACE_HEADER_SIZE];
+    if (fread(buf, ADC_TRACE_HEADER_SIZE, 1, f) != 1 || get_u32(buf) != ADC_TRACE_MAGIC ||
+        get_u16(buf + 4) != ADC_TRACE_VERSION || get_u16(buf + 6) != ADC_TRACE_RECORD_SIZE) {
+        fclose(f);
+        ESP_LOGW(TAG, "%s is not an ADC trace", path);
+        return ESP_ERR_INVALID_ARG;
+    }
+    trace->start = get_u32(buf + 8);
+    uint32_t count = get_u32(buf + 12);
+
+    trace->records = malloc(count * sizeof(adc_trace_record_t));
+    if (count > 0 && trace->records == NULL) {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (fread(buf, ADC_TRACE_RECORD_SIZE, 1, f) != 1) {
+            fclose(f);
+            adc_trace_free(trace);
+            ESP_LOGW(TAG, "%s is truncated", path);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        trace->records[i].time_us = get_u32(buf);
+        trace->records[i].raw = get_u16(buf + 4);
+        trace->records[i].millivolts = get_u16(buf + 6);
+    }
+    trace->count = count;
+
+    if (fread(buf, ADC_TRACE_RESULT_SIZE, 1, f) == 1 && get_u32(buf) == ADC_RESULT_MAGIC) {
+        trace->has_result = true;
+        trace->rs_air = get_f32(buf + 4);
+        trace->ppm = get_f32(buf + 8);
+        trace->bac = get_f32(buf + 12);
+    }
+    fclose(f);
+    return ESP_OK;
+}
+
+void adc_trace_free(adc_trace_t *trace)
+{
+    free(trace->records);
+    trace->records = NULL;
+    trace->count = 0;
+}
+
+int adc_trace_seek(adc_trace_t *trace, adc_trace_phase_t phase)
+{
+    for (uint32_t i = 0; i < trace->count; i++) {
+        if (trace->records[i].raw == (ADC_TRACE_MARKER | phase)) {
+            trace->pos = i + 1;
+            int samples = 0;
+            while (i + 1 + samples < trace->count && !(trace->records[i + 1 + samples].raw & ADC_TRACE_MARKER)) {
+                samples++;
+            }
+            return samples;
+        }
+    }
+    trace->pos = trace->count;
+    return 0;
+}
+
+static esp_err_t trace_read(void *ctx, int *raw, int *millivolts)
+{
+    adc_trace_t *trace = ctx;
+    while (trace->pos < trace->count && (trace->records[trace->pos].raw & ADC_TRACE_MARKER)) {
+        trace->pos++;
+    }
+    if (trace->pos >= trace->count) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *raw = trace->records[trace->pos].raw;
+    *millivolts = trace->records[trace->pos].millivolts;
+    trace->pos++;
+    return ESP_OK;
+}
+
+mq303a_source_t adc_trace_source(adc_trace_t *trace)
+{
+    return (mq303a_source_t){ trace_read, trace };
+}
@@ -0,0 +1,267 @@
+#include <string.h>
+#include <math.h>
+#include "../includes/bench.h"
+#include "../includes/MQ303A.h"
+#include "../includes/sd_card.h"
+#include "../includes/dlog.h"
+#include "../includes/hal.h"
+#include "esp_log.h"
+#include "esp_cpu.h"
+#ifdef ESP_PLATFORM
+#include "cJSON.h"
+#endif
+
+// Results are folded into this so the compiler cannot drop the kernels
+static volatile float sink;
+
+// Ratios spanning clean air to a strong reading, indexed with i % RATIO_COUNT
+#define RATIO_COUNT 64
+static float ratios[RATIO_COUNT];
+
+static void setup_inputs(void)
+{
+    for (int i = 0; i < RATIO_COUNT; i++) {
+        ratios[i] = 0.05f + 0.95f * i / (RATIO_COUNT - 1);
+    }
+}
+
+// Unnamed entries, the names the saved table references are left alone
+static void fill_highscores(void)
+{
+    for (int i = 0; i < MAX_HIGHSCORES; i++) {
+        result_make(&highscores[i], hal_clock_now(), 0, 0.5f - i * 0.04f, "");
+    }
+}
+
+/* Kernels */
+
+static void bench_ppm_pow(uint32_t n)
+{
+    float acc = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        acc += mq303a_ppm_from_ratio(ratios[i % RATIO_COUNT]);
+    }
+    sink = acc;
+}
+
+// Same curve in single precision
+static void bench_ppm_powf(uint32_t n)
+{
+    float acc = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        acc += powf(10.0f, (log10f(ratios[i % RATIO_COUNT]) - 0.328f) / -0.55f);
+    }
+    sink = acc;
+}
+
+// 10^((log10(r) - a) / b) rewritten as r^(1/b) * 10^(-a/b), one powf per sample
+static void bench_ppm_powf_folded(uint32_t n)
+{
+    const float exponent = 1.0f / -0.55f;
+    const float scale = powf(10.0f, 0.328f / 0.55f);
+    float acc = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        acc += scale * powf(ratios[i % RATIO_COUNT], exponent);
+    }
+    sink = acc;
+}
+
+// The same as an exp/log pair, which newlib implements faster than powf
+static void bench_ppm_expf(uint32_t n)
+{
+    const float exponent = 1.0f / -0.55f;
+    const float scale = powf(10.0f, 0.328f / 0.55f);
+    float acc = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        acc += scale * expf(exponent * logf(ratios[i % RATIO_COUNT]));
+    }
+    sink = acc;
+}
+
+static void bench_calculate_current(uint32_t n)
+{
+    float acc = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        acc += mq303a_calculate_current(500 + i % 1500);
+    }
+    sink = acc;
+}
+
+// Worst case, every score goes to the top and shifts the whole table
+static void bench_highscore_insert(uint32_t n)
+{
+    result_t result;
+    result_make(&result, hal_clock_now(), 0, 0, "");
+    for (uint32_t i = 0; i < n; i++) {
+        if (highscores[0].bac == UINT16_MAX) {
+            fill_highscores();
+        }
+        result.bac = highscores[0].bac + 1;
+        add_highscore(&result);
+    }
+    sink = result_bac(&highscores[0]);
+}
+
+static void bench_log_format(uint32_t n)
+{
+    char line[MAX_CHAR_SIZE];
+    result_t result;
+    result_make(&result, hal_clock_now(), 0, 0.046f, "");
+    for (uint32_t i = 0; i < n; i++) {
+        result.ppm = 12050 + i % 100 * RESULT_PPM_SCALE;
+        result_format_line(&result, "", line, sizeof(line));
+    }
+    sink = line[0];
+}
+
+static void bench_highscores_json(uint32_t n)
+{
+    highscore_t table[MAX_HIGHSCORES];
+    char json[HIGHSCORES_JSON_SIZE];
+    size_t len = 0;
+    copy_highscores(table);
+    for (uint32_t i = 0; i < n; i++) {
+        len += highscores_to_json(table, 0, MAX_HIGHSCORES, json, sizeof(json));
+    }
+    sink = len;
+}
+
+static void bench_highscores_cbor(uint32_t n)
+{
+    highscore_t table[MAX_HIGHSCORES];
+    uint8_t cbor[HIGHSCORES_JSON_SIZE];
+    size_t len = 0;
+    copy_highscores(table);
+    for (uint32_t i = 0; i < n; i++) {
+        len += highscores_to_cbor(table, 0, MAX_HIGHSCORES, cbor, sizeof(cbor));
+    }
+    sink = len;
+}
+
+#ifdef ESP_PLATFORM
+// What the highscores endpoint used before highscores_to_json
+static void bench_highscores_cjson(uint32_t n)
+{
+    size_t len = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        cJSON *array = cJSON_CreateArray();
+        for (int j = 0; j < MAX_HIGHSCORES; j++) {
+            cJSON *item = cJSON_CreateObject();
+            char date_str[32];
+            struct tm date;
+            result_date(&highscores[j], &date);
+            strftime(date_str, sizeof(date_str), "%d-%m-%Y", &date);
+            cJSON_AddStringToObject(item, "date", date_str);
+            cJSON_AddNumberToObject(item, "score", result_bac(&highscores[j]));
+            cJSON_AddItemToArray(array, item);
+        }
+        char *json = cJSON_Print(array);
+        len += strlen(json);
+        cJSON_free(json);
+        cJSON_Delete(array);
+    }
+    sink = len;
+}
+#endif
+
+static const struct {
+    const char *name;
+    void (*fn)(uint32_t n);
+} kernels[] = {
+    { "ppm_pow", bench_ppm_pow },
+    { "ppm_powf", bench_ppm_powf },
+    { "ppm_powf_folded", bench_ppm_powf_folded },
+    { "ppm_expf", bench_ppm_expf },
+    { "calculate_current", bench_calculate_current },
+    { "highscore_insert", bench_highscore_insert },
+    { "log_format", bench_log_format },
+    { "highscores_json", bench_highscores_json },
+    { "highscores_cbor", bench_highscores_cbor },
+#ifdef ESP_PLATFORM
+    { "highscores_cjson", bench_highscores_cjson },
+#endif
+};
+
+/* Runner */
+
+static void run_kernel(void (*fn)(uint32_t n), uint32_t n, bench_alloc_counter_t alloc_counter,
+                       bench_result_t *result)
+{
+    uint64_t allocs = alloc_counter ? alloc_counter() : 0;
+    int64_t start = hal_time_us();
+    uint32_t start_cycles = esp_cpu_get_cycle_count();
+    fn(n);
+    uint32_t cycles = esp_cpu_get_cycle_count() - start_cycles;
+    int64_t elapsed = hal_time_us() - start;
+
+    result->iterations = n;
+    result->ns_per_op = elapsed * 1000.0 / n;
+#ifdef ESP_PLATFORM
+    result->cycles_per_op = (double)cycles / n;
+#else
+    (void)cycles;
+    result->cycles_per_op = -1;
+#endif
+    result->allocs_per_op = alloc_counter ? (double)(alloc_counter() - allocs) / n : -1;
+}
+
+int bench_run(const char *filter, uint32_t min_time_ms, bench_alloc_counter_t alloc_counter,
+              bench_result_t *results, int max_results)
+{
+    setup_inputs();
+
+    // Kernels call into code that logs, which would be measured instead of the kernel
+    esp_log_level_t dlog_saved[DLOG_MODULE_COUNT];
+    memcpy(dlog_saved, dlog_levels, sizeof(dlog_saved));
+    for (int i = 0; i < DLOG_MODULE_COUNT; i++) {
+        dlog_set_level(i, ESP_LOG_NONE);
+    }
+    esp_log_level_set("*", ESP_LOG_NONE);
+    result_t highscores_saved[MAX_HIGHSCORES];
+    memcpy(highscores_saved, highscores, sizeof(highscores));
+
+    int count = 0;
+    for (int k = 0; k < sizeof(kernels) / sizeof(kernels[0]) && count < max_results; k++) {
+        if (filter != NULL && strstr(kernels[k].name, filter) == NULL) {
+            continue;
+        }
+        fill_highscores();
+        // Double the iteration count until one run takes at least min_time_ms
+        uint32_t n = 1;
+        bench_result_t *result = &results[count++];
+        result->name = kernels[k].name;
+        while (1) {
+            run_kernel(kernels[k].fn, n, alloc_counter, result);
+            if (result->ns_per_op * n >= min_time_ms * 1e6 || n >= UINT32_MAX / 2) {
+                break;
+            }
+            n *= 2;
+        }
+    }
+
+    memcpy(highscores, highscores_saved, sizeof(highscores));
+    esp_log_level_set("*", ESP_LOG_INFO);
+    for (int i = 0; i < DLOG_MODULE_COUNT; i++) {
+        dlog_set_level(i, dlog_saved[i]);
+    }
+    return count;
+}
+
+void bench_print(FILE *out, const bench_result_t *results, int count)
+{
+    fprintf(out, "%-20s %12s %12s %14s %12s\n", "kernel", "iterations", "ns/op", "cycles/op", "allocs/op");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%-20s %12lu %12.1f ", results[i].name, (unsigned long)results[i].iterations,
+                results[i].ns_per_op);
+        if (results[i].cycles_per_op < 0) {
+            fprintf(out, "%14s ", "n/a");
+        } else {
+            fprintf(out, "%14.1f ", results[i].cycles_per_op);
+        }
+        if (results[i].allocs_per_op < 0) {
+            fprintf(out, "%12s\n", "-");
+        } else {
+            fprintf(out, "%12.2f\n", results[i].allocs_per_op);
+        }
+    }
+}
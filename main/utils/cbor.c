@@ -0,0 +1,81 @@
+#include <string.h>
+#include "../includes/cbor.h"
+
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_SIMPLE 7
+
+static void put(cbor_writer_t *w, const void *data, size_t n)
+{
+    if (w->pos + n <= w->len) {
+        memcpy(w->buf + w->pos, data, n);
+    }
+    w->pos += n;
+}
+
+// Major type and argument, the argument in as few bytes as it fits, big-endian
+static void put_head(cbor_writer_t *w, uint8_t major, uint64_t value)
+{
+    uint8_t head[9];
+    int bytes = value < 24 ? 0 : value <= UINT8_MAX ? 1 : value <= UINT16_MAX ? 2 : value <= UINT32_MAX ? 4 : 8;
+    head[0] = major << 5 | (bytes == 0 ? value : bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27);
+    for (int i = 0; i < bytes; i++) {
+        head[1 + i] = (uint8_t)(value >> (8 * (bytes - 1 - i)));
+    }
+    put(w, head, 1 + bytes);
+}
+
+void cbor_init(cbor_writer_t *w, uint8_t *buf, size_t len)
+{
+    w->buf = buf;
+    w->len = len;
+    w->pos = 0;
+}
+
+void cbor_uint(cbor_writer_t *w, uint64_t value)
+{
+    put_head(w, CBOR_UINT, value);
+}
+
+void cbor_int(cbor_writer_t *w, int64_t value)
+{
+    if (value < 0) {
+        put_head(w, CBOR_NEGINT, (uint64_t)(-1 - value));
+    } else {
+        put_head(w, CBOR_UINT, (uint64_t)value);
+    }
+}
+
+void cbor_text(cbor_writer_t *w, const char *text)
+{
+    size_t n = strlen(text);
+    put_head(w, CBOR_TEXT, n);
+    put(w, text, n);
+}
+
+void cbor_float(cbor_writer_t *w, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint8_t out[5] = { CBOR_SIMPLE << 5 | 26, bits >> 24, bits >> 16, bits >> 8, bits };
+    put(w, out, sizeof(out));
+}
+
+void cbor_null(cbor_writer_t *w)
+{
+    uint8_t out = CBOR_SIMPLE << 5 | 22;
+    put(w, &out, 1);
+}
+
+void cbor_array(cbor_writer_t *w, size_t count)
+{
+    put_head(w, CBOR_ARRAY, count);
+}
+
+void cbor_map(cbor_writer_t *w, size_t pairs)
+{
+    put_head(w, CBOR_MAP, pairs);
+}
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "../includes/dlog.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define DLOG_TASK_PRIORITY tskIDLE_PRIORITY
+#define DLOG_TASK_STACK_SIZE 3072
+#define DLOG_POLL_MS 50
+#define DLOG_MESSAGE_SIZE 160
+#define DLOG_DUMP_MAGIC 0x474f4c44 // "DLOG" in little-endian
+#define DLOG_DUMP_VERSION 1
+#define DLOG_DUMP_TAG_SIZE 16
+
+typedef struct {
+    atomic_uint seq; // Index + 1 once the record is fully written, 0 while it is being written
+    const char *fmt;
+    uint32_t timestamp_ms;
+    uint8_t level;
+    uint8_t module;
+    uint8_t nargs;
+    uint8_t types;                // 2 bits per argument, a dlog_arg_type_t each
+    uint64_t args[DLOG_MAX_ARGS]; // Raw bits of the arguments
+} dlog_record_t;
+
+static const char *module_tags[DLOG_MODULE_COUNT] = {
+    [DLOG_MAIN] = "BREATHALYZER",
+    [DLOG_MQ303A] = "MQ303A",
+    [DLOG_SD_CARD] = "sd_card",
+};
+
+esp_log_level_t dlog_levels[DLOG_MODULE_COUNT] = {
+    [0 ... DLOG_MODULE_COUNT - 1] = ESP_LOG_INFO,
+};
+
+static dlog_record_t records[CONFIG_DLOG_BUFFER_RECORDS];
+static atomic_uint next_index = 0;
+
+void dlog_write(dlog_module_t module, esp_log_level_t level, const char *fmt, const dlog_arg_t *args, size_t nargs)
+{
+    unsigned index = atomic_fetch_add_explicit(&next_index, 1, memory_order_relaxed);
+    dlog_record_t *record = &records[index % CONFIG_DLOG_BUFFER_RECORDS];
+
+    atomic_store_explicit(&record->seq, 0, memory_order_relaxed);
+    record->fmt = fmt;
+    record->timestamp_ms = esp_log_timestamp();
+    record->level = level;
+    record->module = module;
+    record->nargs = nargs < DLOG_MAX_ARGS ? nargs : DLOG_MAX_ARGS;
+    record->types = 0;
+    for (int i = 0; i < record->nargs; i++) {
+        record->types |= args[i].type << (2 * i);
+        switch (args[i].type) {
+        case DLOG_ARG_INT:
+            record->args[i] = (uint64_t)args[i].i;
+            break;
+        case DLOG_ARG_DOUBLE:
+            memcpy(&record->args[i], &args[i].d, sizeof(double));
+            break;
+        case DLOG_ARG_STR:
+            record->args[i] = (uintptr_t)args[i].s;
+            break;
+        }
+    }
+    atomic_store_explicit(&record->seq, index + 1, memory_order_release);
+}
+
+// Copy a record out of the ring, fails if it was overwritten or is still being written
+static bool read_record(unsigned index, dlog_record_t *out)
+{
+    dlog_record_t *record = &records[index % CONFIG_DLOG_BUFFER_RECORDS];
+    if (atomic_load_explicit(&record->seq, memory_order_acquire) != index + 1) {
+        return false;
+    }
+    out->fmt = record->fmt;
+    out->timestamp_ms = record->timestamp_ms;
+    out->level = record->level;
+    out->module = record->module;
+    out->nargs = record->nargs;
+    out->types = record->types;
+    memcpy(out->args, record->args, sizeof(out->args));
+    return atomic_load_explicit(&record->seq, memory_order_acquire) == index + 1;
+}
+
+// printf-style formatting from the recorded arguments, length modifiers are replaced by the recorded width
+static void format_record(const dlog_record_t *record, char *out, size_t len)
+{
+    const char *p = record->fmt;
+    size_t pos = 0;
+    int arg = 0;
+
+    while (*p != '\0' && pos < len - 1) {
+        if (*p != '%') {
+            out[pos++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[pos++] = '%';
+            p += 2;
+            continue;
+        }
+
+        char spec[16];
+        size_t n = 0;
+        spec[n++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL && n < sizeof(spec) - 4) {
+            spec[n++] = *p++;
+        }
+        while (*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+            p++;
+        }
+        char conv = *p;
+        if (conv == '\0') {
+            break;
+        }
+        p++;
+
+        if (arg >= record->nargs) {
+            pos += snprintf(out + pos, len - pos, "<?>");
+            continue;
+        }
+        dlog_arg_type_t type = (record->types >> (2 * arg)) & 0x3;
+        uint64_t raw = record->args[arg++];
+        double d;
+        memcpy(&d, &raw, sizeof(d));
+        long long i = type == DLOG_ARG_DOUBLE ? (long long)d : (long long)raw;
+
+        int written;
+        switch (conv) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conv;
+            spec[n] = '\0';
+            written = snprintf(out + pos, len - pos, spec, i);
+            break;
+        case 'c':
+            spec[n++] = conv;
+            spec[n] = '\0';
+            written = snprintf(out + pos, len - pos, spec, (int)i);
+            break;
+        case 's':
+            spec[n++] = conv;
+            spec[n] = '\0';
+            written = snprintf(out + pos, len - pos, spec,
+                               type == DLOG_ARG_STR ? (const char *)(uintptr_t)raw : "<?>");
+            break;
+        case 'p':
+            written = snprintf(out + pos, len - pos, "%p", (void *)(uintptr_t)raw);
+            break;
+        default:
+            // f, e, g, a and their upper case forms
+            spec[n++] = conv;
+            spec[n] = '\0';
+            written = snprintf(out + pos, len - pos, spec, type == DLOG_ARG_DOUBLE ? d : (double)i);
+            break;
+        }
+        if (written > 0) {
+            pos += written;
+        }
+    }
+
+    if (pos >= len) {
+        pos = len - 1;
+    }
+    out[pos] = '\0';
+}
+
+static char level_letter(esp_log_level_t level)
+{
+    switch (level) {
+    case ESP_LOG_ERROR:
+        return 'E';
+    case ESP_LOG_WARN:
+        return 'W';
+    case ESP_LOG_INFO:
+        return 'I';
+    case ESP_LOG_DEBUG:
+        return 'D';
+    default:
+        return 'V';
+    }
+}
+
+static void dlog_task(void *arg)
+{
+    unsigned read_index = 0;
+    char message[DLOG_MESSAGE_SIZE];
+
+    while (1) {
+        unsigned end = atomic_load_explicit(&next_index, memory_order_acquire);
+        if (end - read_index > CONFIG_DLOG_BUFFER_RECORDS) {
+            ESP_LOGW("dlog", "%u log records dropped", end - read_index - CONFIG_DLOG_BUFFER_RECORDS);
+            read_index = end - CONFIG_DLOG_BUFFER_RECORDS;
+        }
+
+        for (; read_index != end; read_index++) {
+            dlog_record_t record;
+            if (!read_record(read_index, &record)) {
+                continue;
+            }
+            const char *tag = module_tags[record.module];
+            format_record(&record, message, sizeof(message));
+            esp_log_write(record.level, tag, "%c (%lu) %s: %s\n", level_letter(record.level),
+                          (unsigned long)record.timestamp_ms, tag, message);
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(DLOG_POLL_MS));
+    }
+}
+
+void dlog_init(void)
+{
+    xTaskCreate(dlog_task, "dlog", DLOG_TASK_STACK_SIZE, NULL, DLOG_TASK_PRIORITY, NULL);
+}
+
+dlog_module_t dlog_find_module(const char *tag)
+{
+    for (int i = 0; i < DLOG_MODULE_COUNT; i++) {
+        if (strcasecmp(tag, module_tags[i]) == 0) {
+            return i;
+        }
+    }
+    return DLOG_MODULE_COUNT;
+}
+
+const char *dlog_module_tag(dlog_module_t module)
+{
+    return module < DLOG_MODULE_COUNT ? module_tags[module] : NULL;
+}
+
+void dlog_set_level(dlog_module_t module, esp_log_level_t level)
+{
+    if (module < DLOG_MODULE_COUNT) {
+        dlog_levels[module] = level;
+    }
+}
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+    put_u32(p, v);
+    put_u32(p + 4, v >> 32);
+}
+
+/* Binary dump layout, all little-endian:
+ *   header:  u32 magic "DLOG", u16 version, u16 record size, u32 record count, u32 module count
+ *   modules: module count tags, DLOG_DUMP_TAG_SIZE bytes each, NUL padded
+ *   records: u32 index, u32 fmt address, u32 timestamp ms, u8 level, u8 module, u8 nargs,
+ *            u8 types, DLOG_MAX_ARGS x u64 raw arguments
+ * Format strings and %s arguments are addresses, tools/dlog_decode.py resolves them from the ELF.
+ */
+#define DLOG_DUMP_RECORD_SIZE (16 + 8 * DLOG_MAX_ARGS)
+
+esp_err_t dlog_dump(dlog_emit_t emit, void *ctx)
+{
+    unsigned end = atomic_load_explicit(&next_index, memory_order_acquire);
+    unsigned start = end > CONFIG_DLOG_BUFFER_RECORDS ? end - CONFIG_DLOG_BUFFER_RECORDS : 0;
+
+    uint8_t buf[DLOG_DUMP_RECORD_SIZE];
+    put_u32(buf, DLOG_DUMP_MAGIC);
+    put_u16(buf + 4, DLOG_DUMP_VERSION);
+    put_u16(buf + 6, DLOG_DUMP_RECORD_SIZE);
+    put_u32(buf + 8, end - start);
+    put_u32(buf + 12, DLOG_MODULE_COUNT);
+    if (emit(ctx, (const char *)buf, 16) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    for (int i = 0; i < DLOG_MODULE_COUNT; i++) {
+        char tag[DLOG_DUMP_TAG_SIZE] = { 0 };
+        strncpy(tag, module_tags[i], sizeof(tag) - 1);
+        if (emit(ctx, tag, sizeof(tag)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+
+    for (unsigned index = start; index != end; index++) {
+        dlog_record_t record;
+        if (!read_record(index, &record)) {
+            // Keep the record count in the header right, an empty fmt marks a lost record
+            memset(&record, 0, sizeof(record));
+        }
+        put_u32(buf, index);
+        put_u32(buf + 4, (uintptr_t)record.fmt);
+        put_u32(buf + 8, record.timestamp_ms);
+        buf[12] = record.level;
+        buf[13] = record.module;
+        buf[14] = record.nargs;
+        buf[15] = record.types;
+        for (int i = 0; i < DLOG_MAX_ARGS; i++) {
+            put_u64(buf + 16 + 8 * i, record.args[i]);
+        }
+        if (emit(ctx, (const char *)buf, sizeof(buf)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
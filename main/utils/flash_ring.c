@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include "../includes/flash_ring.h"
+#include "../includes/metrics.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+static const char *TAG = "flash_ring";
+
+#define NVS_NAMESPACE "ring"
+#define NVS_KEY_HEAD "head" // Index the next line goes to, counts up forever
+#define NVS_KEY_TAIL "tail" // Index of the oldest line
+
+// Only the main task uses the ring, no locking
+static nvs_handle_t ring_nvs;
+static bool ring_open = false;
+static uint32_t head, tail;
+
+static esp_err_t open_ring(void)
+{
+    if (ring_open)
+    {
+        return ESP_OK;
+    }
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &ring_nvs);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open NVS (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+    if (nvs_get_u32(ring_nvs, NVS_KEY_HEAD, &head) != ESP_OK || nvs_get_u32(ring_nvs, NVS_KEY_TAIL, &tail) != ESP_OK ||
+        head - tail > FLASH_RING_SLOTS)
+    {
+        head = tail = 0;
+    }
+    ring_open = true;
+    return ESP_OK;
+}
+
+static void slot_key(uint32_t index, char key[8])
+{
+    snprintf(key, 8, "r%" PRIu32, index % FLASH_RING_SLOTS);
+}
+
+esp_err_t flash_ring_push(const char *line)
+{
+    esp_err_t ret = open_ring();
+    // The oldest line leaves before its slot is reused, a reset in between loses only that line
+    if (ret == ESP_OK && head - tail == FLASH_RING_SLOTS)
+    {
+        ESP_LOGW(TAG, "Ring full, dropping the oldest line");
+        metrics_inc(METRIC_FLASH_RING_DROPPED);
+        ret = nvs_set_u32(ring_nvs, NVS_KEY_TAIL, tail + 1);
+        tail += ret == ESP_OK;
+    }
+    char key[8];
+    slot_key(head, key);
+    ret = ret == ESP_OK ? nvs_set_str(ring_nvs, key, line) : ret;
+    ret = ret == ESP_OK ? nvs_set_u32(ring_nvs, NVS_KEY_HEAD, head + 1) : ret;
+    ret = ret == ESP_OK ? nvs_commit(ring_nvs) : ret;
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to store a line (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+    head++;
+    metrics_inc(METRIC_FLASH_RING_WRITES);
+    return ESP_OK;
+}
+
+esp_err_t flash_ring_peek(char *line, size_t size, uint32_t *index)
+{
+    esp_err_t ret = open_ring();
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    if (head == tail)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    char key[8];
+    slot_key(tail, key);
+    *index = tail;
+    return nvs_get_str(ring_nvs, key, line, &size);
+}
+
+esp_err_t flash_ring_pop(void)
+{
+    esp_err_t ret = open_ring();
+    if (ret != ESP_OK || head == tail)
+    {
+        return ret != ESP_OK ? ret : ESP_ERR_NOT_FOUND;
+    }
+    ret = nvs_set_u32(ring_nvs, NVS_KEY_TAIL, tail + 1);
+    ret = ret == ESP_OK ? nvs_commit(ring_nvs) : ret;
+    tail += ret == ESP_OK;
+    return ret;
+}
+
+uint32_t flash_ring_count(void)
+{
+    return open_ring() == ESP_OK ? head - tail : 0;
+}
+
+void flash_ring_foreach(bool (*fn)(const char *line, void *ctx), void *ctx)
+{
+    if (open_ring() != ESP_OK)
+    {
+        return;
+    }
+    for (uint32_t i = tail; i != head; i++)
+    {
+        char key[8];
+        char line[FLASH_RING_LINE_SIZE];
+        size_t size = sizeof(line);
+        slot_key(i, key);
+        if (nvs_get_str(ring_nvs, key, line, &size) == ESP_OK && !fn(line, ctx))
+        {
+            return;
+        }
+    }
+}
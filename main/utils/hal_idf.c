@@ -0,0 +1,211 @@
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+#include "../includes/hal.h"
+#include "../includes/storage_fault.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_netif_sntp.h"
+#include "esp_sntp.h"
+#include "ff.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+
+#define ADC_WIDTH ADC_BITWIDTH_12
+#define ADC_ATTEN ADC_ATTEN_DB_12
+#define ADC_MAX_RAW 4095
+#define ADC_FULL_SCALE_MV 2500 // Rough full scale at 12 dB attenuation, used without calibration
+
+static const char *TAG = "hal";
+
+static adc_oneshot_unit_handle_t adc_handle = NULL;
+static adc_cali_handle_t adc_cali_handle = NULL;
+static adc_channel_t adc_channel;
+
+esp_err_t hal_adc_init(int channel)
+{
+    // Initialize ADC
+    adc_oneshot_unit_init_cfg_t init_config = {
+        .unit_id = ADC_UNIT_1,
+    };
+    ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config, &adc_handle));
+
+    // ADC config
+    adc_channel = channel;
+    adc_oneshot_chan_cfg_t config = {
+        .atten = ADC_ATTEN,    // Set attenuation to 12dB
+        .bitwidth = ADC_WIDTH, // Set bitwidth to 12 bits
+    };
+    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc_handle, adc_channel, &config));
+
+    // Initialize ADC calibration
+    adc_cali_curve_fitting_config_t cali_config = {
+        .unit_id = ADC_UNIT_1,
+        .atten = ADC_ATTEN,
+        .bitwidth = ADC_WIDTH,
+    };
+    esp_err_t ret = adc_cali_create_scheme_curve_fitting(&cali_config, &adc_cali_handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "ADC calibration scheme not supported, using raw values");
+        adc_cali_handle = NULL;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "ADC calibration initialized successfully");
+    }
+    return ESP_OK;
+}
+
+esp_err_t hal_adc_read(int *raw, int *millivolts)
+{
+    esp_err_t ret = adc_oneshot_read(adc_handle, adc_channel, raw);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (adc_cali_handle) {
+        return adc_cali_raw_to_voltage(adc_cali_handle, *raw, millivolts);
+    }
+    *millivolts = *raw * ADC_FULL_SCALE_MV / ADC_MAX_RAW;
+    return ESP_OK;
+}
+
+void hal_gpio_output(int gpio)
+{
+    gpio_reset_pin(gpio);
+    gpio_set_direction(gpio, GPIO_MODE_OUTPUT);
+}
+
+void hal_gpio_input(int gpio)
+{
+    gpio_reset_pin(gpio);
+    gpio_set_direction(gpio, GPIO_MODE_INPUT);
+}
+
+void hal_gpio_set(int gpio, int level)
+{
+    gpio_set_level(gpio, level);
+}
+
+int hal_gpio_get(int gpio)
+{
+    return gpio_get_level(gpio);
+}
+
+int64_t hal_time_us(void)
+{
+    return esp_timer_get_time();
+}
+
+void hal_delay_ms(uint32_t ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void hal_period_start(hal_period_t *period)
+{
+    period->last_wake = xTaskGetTickCount();
+}
+
+void hal_period_wait(hal_period_t *period, uint32_t period_ms)
+{
+    TickType_t last_wake = period->last_wake;
+    xTaskDelayUntil(&last_wake, pdMS_TO_TICKS(period_ms));
+    period->last_wake = last_wake;
+}
+
+// Until SNTP sets the time, time() counts from boot
+static volatile bool clock_synced;
+
+static void clock_synced_cb(struct timeval *tv)
+{
+    clock_synced = true;
+}
+
+void hal_clock_sync(void)
+{
+    esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
+    config.sync_cb = clock_synced_cb; // SNTP keeps trying after the wait, a later sync still counts
+    esp_netif_sntp_init(&config);
+    if (esp_netif_sntp_sync_wait(pdMS_TO_TICKS(10000)) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to update system time within 10s, results are marked clock unset until it is");
+    }
+    ESP_LOGI(TAG, "Current timestamp: %lld", time(NULL));
+}
+
+time_t hal_clock_now(void)
+{
+    return clock_synced ? time(NULL) : -1;
+}
+
+FILE *hal_fopen(const char *path, const char *mode)
+{
+    return storage_fault_wrap(fopen(path, mode), path);
+}
+
+int hal_stat(const char *path, struct stat *st)
+{
+    return stat(path, st);
+}
+
+int hal_remove(const char *path)
+{
+    return remove(path);
+}
+
+int hal_rename(const char *from, const char *to)
+{
+    return rename(from, to);
+}
+
+int hal_mkdir(const char *path)
+{
+    return mkdir(path, 0777) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+// Files wrapped by the fault injector have no descriptor, fflush is all they get
+int hal_fsync(FILE *f)
+{
+    if (fflush(f) != 0) {
+        return -1;
+    }
+    int fd = fileno(f);
+    return fd < 0 ? storage_fault_sync(f) : fsync(fd); // Files behind a fault cookie have no fd
+}
+
+void *hal_dma_alloc(size_t size)
+{
+    return heap_caps_aligned_alloc(512, size, MALLOC_CAP_DMA);
+}
+
+uint32_t hal_crc32(uint32_t crc, const void *data, size_t len)
+{
+    return esp_rom_crc32_le(crc, data, len);
+}
+
+// The card is the only FAT volume, mounted as drive 0
+esp_err_t hal_storage_info(hal_storage_info_t *info)
+{
+    FATFS *fs;
+    DWORD free_clusters;
+    if (f_getfree("0:", &free_clusters, &fs) != FR_OK) {
+        return ESP_FAIL;
+    }
+#if FF_MAX_SS != FF_MIN_SS
+    uint32_t sector_bytes = fs->ssize;
+#else
+    uint32_t sector_bytes = FF_MIN_SS;
+#endif
+    info->cluster_bytes = fs->csize * sector_bytes;
+    info->total_bytes = (uint64_t)(fs->n_fatent - 2) * info->cluster_bytes;
+    info->free_bytes = (uint64_t)free_clusters * info->cluster_bytes;
+    return ESP_OK;
+}
@@ -0,0 +1,619 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "../includes/history.h"
+#include "esp_log.h"
+#include "../includes/trace.h"
+#include "../includes/hal.h"
+#include "../includes/sd_card.h"
+#include "../includes/sd_writer.h"
+
+static const char *TAG = "history";
+
+#define SEGMENT_MAGIC_V1 0x31534842 // "BHS1", records without a player name
+#define SEGMENT_MAGIC 0x32534842    // "BHS2"
+#define RECORD_MAX_BYTES (20 + 1 + USER_NAME_MAX) // Three varints, a 64-bit and two 32-bit deltas, and the name
+
+typedef struct {
+    uint32_t magic;
+    uint32_t records;
+    int64_t first;       // Oldest and newest timestamp in the segment
+    int64_t last;
+    uint32_t source_len; // Log data the segment was sealed from
+    uint32_t source_crc;
+    uint32_t data_len;   // LZSS stream after the header
+    uint32_t data_crc;
+} segment_header_t;
+
+// Segments found so far, only ever grows, so a reader on another task at worst sees an older count
+static int known_segments;
+
+static int count_segments(void)
+{
+    char path[32];
+    struct stat st;
+    int n = known_segments;
+    while (snprintf(path, sizeof(path), HISTORY_SEGMENT_FMT, n + 1), hal_stat(path, &st) == 0)
+    {
+        n++;
+    }
+    known_segments = n;
+    return n;
+}
+
+// Lines are written by result_format_line as "dd/mm/yyyy HH:MM:SS - PPM: x, BAC: y", then " - USER: name" for a named player
+bool history_parse_line(const char *line, history_record_t *record)
+{
+    struct tm tm_info = {0};
+    float ppm, bac;
+    int end = 0;
+    if (sscanf(line, "%d/%d/%d %d:%d:%d - PPM: %f, BAC: %f%n",
+               &tm_info.tm_mday, &tm_info.tm_mon, &tm_info.tm_year,
+               &tm_info.tm_hour, &tm_info.tm_min, &tm_info.tm_sec, &ppm, &bac, &end) != 8)
+    {
+        return false;
+    }
+    tm_info.tm_mon -= 1;     // tm_mon is 0-based
+    tm_info.tm_year -= 1900; // tm_year is years since 1900
+    tm_info.tm_isdst = -1;
+
+    record->timestamp = mktime(&tm_info);
+    record->ppm = ppm;
+    record->bac = bac;
+    record->user[0] = '\0';
+    if (strncmp(line + end, " - USER: ", 9) == 0)
+    {
+        sscanf(line + end + 9, "%12[-_A-Z0-9]", record->user);
+    }
+    return true;
+}
+
+static size_t put_varint(uint8_t *out, int64_t value)
+{
+    uint64_t u = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); // Zigzag, small negatives stay short
+    size_t n = 0;
+    while (u >= 0x80)
+    {
+        out[n++] = (uint8_t)(u | 0x80);
+        u >>= 7;
+    }
+    out[n++] = (uint8_t)u;
+    return n;
+}
+
+static bool get_varint(lzss_decoder_t *lz, int64_t *value)
+{
+    uint64_t u = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int c = lzss_decoder_getc(lz);
+        if (c < 0)
+        {
+            return false;
+        }
+        u |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+        {
+            *value = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool read_header(const char *path, FILE **f, segment_header_t *h)
+{
+    *f = hal_fopen(path, "r");
+    if (*f == NULL || fread(h, sizeof(*h), 1, *f) != 1 || (h->magic != SEGMENT_MAGIC && h->magic != SEGMENT_MAGIC_V1))
+    {
+        ESP_LOGW(TAG, "Skipping unreadable segment %s", path);
+        return false;
+    }
+    return true;
+}
+
+/* Opening a segment
+ *
+ * The stream is checked against its CRC before the first record is handed out, a
+ * damaged segment is skipped whole rather than decoded into made-up records.
+ */
+static bool open_segment(history_reader_t *reader)
+{
+    char path[32];
+    segment_header_t h;
+    snprintf(path, sizeof(path), HISTORY_SEGMENT_FMT, reader->segment);
+    if (!read_header(path, &reader->f, &h))
+    {
+        return false;
+    }
+    if (h.records == 0 || h.last < reader->from || (reader->to != 0 && h.first > reader->to))
+    {
+        return false;
+    }
+    uint8_t buf[128];
+    uint32_t crc = 0;
+    for (uint32_t left = h.data_len; left > 0; )
+    {
+        size_t n = left < sizeof(buf) ? left : sizeof(buf);
+        if (fread(buf, 1, n, reader->f) != n)
+        {
+            break;
+        }
+        crc = hal_crc32(crc, buf, n);
+        left -= n;
+    }
+    if (crc != h.data_crc || fseek(reader->f, sizeof(h), SEEK_SET) != 0)
+    {
+        ESP_LOGW(TAG, "Skipping damaged segment %s", path);
+        return false;
+    }
+    lzss_decoder_init(&reader->lz, reader->f, h.data_len);
+    reader->left = h.records;
+    reader->last_ts = 0;
+    reader->last_ppm = 0;
+    reader->last_bac = 0;
+    reader->named = h.magic == SEGMENT_MAGIC;
+    return true;
+}
+
+// Close the file being read and open the next one, the log comes after the last segment
+static void next_file(history_reader_t *reader)
+{
+    if (reader->f != NULL)
+    {
+        fclose(reader->f);
+        reader->f = NULL;
+    }
+    reader->segment++;
+    reader->index = 0;
+    if (reader->segment <= reader->segments)
+    {
+        if (!open_segment(reader) && reader->f != NULL)
+        {
+            fclose(reader->f);
+            reader->f = NULL;
+        }
+    }
+    else if (reader->segment == reader->segments + 1 && reader->end > 0)
+    {
+        TRACE_BEGIN("fopen");
+        reader->f = hal_fopen(reader->path, "r");
+        TRACE_END("fopen");
+        reader->offset = 0;
+    }
+}
+
+static bool next_segment_record(history_reader_t *reader, history_record_t *record)
+{
+    int64_t dt, dppm, dbac;
+    if (reader->left == 0 || !get_varint(&reader->lz, &dt) || !get_varint(&reader->lz, &dppm) ||
+        !get_varint(&reader->lz, &dbac))
+    {
+        return false;
+    }
+    reader->left--;
+    reader->index++;
+    reader->last_ts += dt;
+    reader->last_ppm += (int32_t)dppm;
+    reader->last_bac += (int32_t)dbac;
+    record->timestamp = (time_t)reader->last_ts;
+    record->ppm = reader->last_ppm / 100.0f;
+    record->bac = reader->last_bac / 1000.0f;
+    record->user[0] = '\0';
+    int len = reader->named ? lzss_decoder_getc(&reader->lz) : 0;
+    for (int i = 0; i < len && i < USER_NAME_MAX; i++)
+    {
+        int c = lzss_decoder_getc(&reader->lz);
+        if (c < 0)
+        {
+            return false;
+        }
+        record->user[i] = (char)c;
+        record->user[i + 1] = '\0';
+    }
+    return len >= 0 && len <= USER_NAME_MAX;
+}
+
+// A line a reset or a failed append cut short has no newline, its record is still in the journal
+static bool parse_log_line(const char *line, history_record_t *record)
+{
+    size_t len = strlen(line);
+    return len > 0 && line[len - 1] == '\n' && history_parse_line(line, record);
+}
+
+static bool next_log_record(history_reader_t *reader, history_record_t *record)
+{
+    char line[96];
+    while (reader->offset < reader->end && fgets(line, sizeof(line), reader->f) != NULL)
+    {
+        reader->offset = ftell(reader->f);
+        if (parse_log_line(line, record))
+        {
+            reader->index++;
+            return true;
+        }
+        ESP_LOGD(TAG, "Skipping malformed line at offset %ld", reader->offset);
+    }
+    return false;
+}
+
+/* A log sealed before
+ *
+ * A reset or a failed clear between seal and clear leaves the log the newest segment
+ * holds. A clear that got part way leaves NULs at its start, otherwise the log is
+ * compared with where the segment came from. ESP_OK when the segment holds the log,
+ * ESP_ERR_NOT_FOUND when not, ESP_FAIL when either could not be read.
+ */
+static esp_err_t log_sealed(FILE *f, long end, int segments)
+{
+    if (segments == 0 || end <= 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    char path[32];
+    segment_header_t last;
+    snprintf(path, sizeof(path), HISTORY_SEGMENT_FMT, segments);
+    FILE *seg = hal_fopen(path, "r");
+    bool read = seg != NULL && fread(&last, sizeof(last), 1, seg) == 1;
+    if (seg != NULL)
+    {
+        fclose(seg);
+    }
+    int c = read && fseek(f, 0, SEEK_SET) == 0 ? fgetc(f) : EOF;
+    if (c == EOF)
+    {
+        return ESP_FAIL;
+    }
+    if (last.magic != SEGMENT_MAGIC && last.magic != SEGMENT_MAGIC_V1)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (c == '\0')
+    {
+        return ESP_OK;
+    }
+    if (end != (long)last.source_len)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    char buf[64];
+    uint32_t crc = 0;
+    bool ok = fseek(f, 0, SEEK_SET) == 0;
+    for (long pos = 0; pos < end && ok; )
+    {
+        size_t len = end - pos < (long)sizeof(buf) ? end - pos : sizeof(buf);
+        ok = fread(buf, 1, len, f) == len;
+        crc = hal_crc32(crc, buf, len);
+        pos += len;
+    }
+    return !ok ? ESP_FAIL : crc == last.source_crc ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t history_open(history_reader_t *reader, const char *file)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->path = file;
+    reader->segments = count_segments();
+
+    // Only the end of the log is taken now, it is opened again once the segments are read
+    TRACE_BEGIN("fopen");
+    FILE *f = hal_fopen(file, "r");
+    TRACE_END("fopen");
+    if (f == NULL && reader->segments == 0)
+    {
+        ESP_LOGW(TAG, "Failed to open %s for reading", file);
+        return ESP_FAIL;
+    }
+    if (f != NULL)
+    {
+        // The log is padded past its data, see sd_writer.h
+        reader->end = sd_writer_data_end(f);
+        reader->end = reader->end < 0 || log_sealed(f, reader->end, reader->segments) == ESP_OK ? 0 : reader->end;
+        fclose(f);
+    }
+    return ESP_OK;
+}
+
+void history_set_range(history_reader_t *reader, time_t from, time_t to)
+{
+    reader->from = from;
+    reader->to = to;
+}
+
+bool history_next(history_reader_t *reader, history_record_t *record)
+{
+    while (reader->segment <= reader->segments + 1)
+    {
+        if (reader->f != NULL)
+        {
+            bool in_log = reader->segment > reader->segments;
+            if (in_log ? next_log_record(reader, record) : next_segment_record(reader, record))
+            {
+                return true;
+            }
+        }
+        next_file(reader);
+    }
+    return false;
+}
+
+void history_rewind(history_reader_t *reader)
+{
+    if (reader->f != NULL)
+    {
+        fclose(reader->f);
+        reader->f = NULL;
+    }
+    reader->segment = 0;
+    reader->index = 0;
+    reader->offset = 0;
+}
+
+/* Log position
+ *
+ * The records of the log are counted like history_next() reads them, once, then only
+ * the lines appended since. A different segment count or a shorter log means it was
+ * sealed, and the count starts over.
+ */
+static struct {
+    int segments;
+    long end;
+    uint32_t records;
+} log_count = { -1, 0, 0 };
+
+esp_err_t history_log_cursor(const char *file, history_cursor_t *cursor)
+{
+    int segments = count_segments();
+    long end = log_data_end(file); // Known to the log writer, no scan for the end of the data
+    end = end > 0 ? end : 0;
+    if (log_count.segments != segments || log_count.end > end)
+    {
+        log_count.segments = segments;
+        log_count.end = 0;
+        log_count.records = 0;
+    }
+    FILE *f = log_count.end < end ? hal_fopen(file, "r") : NULL;
+    if (f != NULL && fseek(f, log_count.end, SEEK_SET) == 0)
+    {
+        char line[96];
+        history_record_t record;
+        for (long offset = log_count.end; offset < end && fgets(line, sizeof(line), f) != NULL; offset = ftell(f))
+        {
+            log_count.records += parse_log_line(line, &record);
+        }
+        log_count.end = end;
+    }
+    if (f != NULL)
+    {
+        fclose(f);
+    }
+    cursor->file = segments + 1;
+    cursor->index = log_count.records;
+    cursor->offset = log_count.end;
+    return log_count.end == end ? ESP_OK : ESP_FAIL;
+}
+
+void history_tell(const history_reader_t *reader, history_cursor_t *cursor)
+{
+    cursor->file = reader->segment;
+    cursor->index = reader->index;
+    cursor->offset = reader->segment > reader->segments ? reader->offset : 0;
+}
+
+esp_err_t history_seek(history_reader_t *reader, const history_cursor_t *cursor)
+{
+    history_rewind(reader);
+    if (cursor->file == 0)
+    {
+        return ESP_OK;
+    }
+    bool in_log = cursor->file == reader->segments + 1;
+    if (cursor->file < 0 || cursor->file > reader->segments + 1 || (in_log && cursor->offset > reader->end))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    reader->segment = cursor->file - 1;
+    next_file(reader);
+    if (reader->f == NULL)
+    {
+        return ESP_OK; // A segment that is skipped anyway, history_next() carries on after it
+    }
+    if (in_log)
+    {
+        if (fseek(reader->f, cursor->offset, SEEK_SET) != 0)
+        {
+            return ESP_FAIL;
+        }
+        reader->offset = cursor->offset;
+        reader->index = cursor->index;
+        return ESP_OK;
+    }
+    history_record_t record;
+    while (reader->index < cursor->index && next_segment_record(reader, &record))
+    {
+        // A stream only decodes from its start, the records before the cursor are dropped
+    }
+    return ESP_OK;
+}
+
+int history_cursor_format(const history_cursor_t *cursor, char *buf, size_t len)
+{
+    return snprintf(buf, len, "%x.%" PRIx32 ".%lx", (unsigned)cursor->file, cursor->index, cursor->offset);
+}
+
+bool history_cursor_parse(const char *str, history_cursor_t *cursor)
+{
+    unsigned file;
+    int end = 0;
+    if (sscanf(str, "%x.%" SCNx32 ".%lx%n", &file, &cursor->index, &cursor->offset, &end) != 3 ||
+        str[end] != '\0' || file > INT_MAX || cursor->offset < 0)
+    {
+        return false;
+    }
+    cursor->file = (int)file;
+    return true;
+}
+
+void history_close(history_reader_t *reader)
+{
+    if (reader->f != NULL)
+    {
+        fclose(reader->f);
+        reader->f = NULL;
+    }
+}
+
+bool history_seal_due(const char *file)
+{
+    FILE *f = hal_fopen(file, "r");
+    if (f == NULL)
+    {
+        return false;
+    }
+    long end = sd_writer_data_end(f);
+    fclose(f);
+    return end >= HISTORY_SEGMENT_BYTES;
+}
+
+static esp_err_t write_segment(const char *path, const segment_header_t *h, const uint8_t *data)
+{
+    hal_remove(HISTORY_SEGMENT_TMP);
+    FILE *f = hal_fopen(HISTORY_SEGMENT_TMP, "w");
+    if (f == NULL)
+    {
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(h, sizeof(*h), 1, f) == 1 && fwrite(data, 1, h->data_len, f) == h->data_len;
+    ok = ok && hal_fsync(f) == 0;
+    ok = fclose(f) == 0 && ok;
+    // Readers only look for numbered segments, a torn write never becomes one
+    return ok && hal_rename(HISTORY_SEGMENT_TMP, path) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+/* Sealing
+ *
+ * The log is read once, encoded into a RAM buffer and compressed into a second one,
+ * a few KB each for the default segment size. The segment is complete on the card
+ * before the log is cleared, and records where its data came from, so a reset or a
+ * failed clear in between is found by the next seal and the log is only cleared then,
+ * see log_sealed(). Readers skip such a log, the journal adds no lines to it before.
+ */
+esp_err_t history_seal(const char *file)
+{
+    int64_t start = hal_time_us();
+    FILE *f = hal_fopen(file, "r");
+    long end = f != NULL ? sd_writer_data_end(f) : -1;
+    if (end <= 0 || fseek(f, 0, SEEK_SET) != 0)
+    {
+        if (f != NULL)
+        {
+            fclose(f);
+        }
+        return end == 0 ? ESP_OK : ESP_FAIL;
+    }
+
+    int segments = count_segments();
+    esp_err_t before = log_sealed(f, end, segments);
+    bool sealed = before == ESP_OK;
+
+    // A line is usually more than twice as long as its record, damaged ones that still parse can get
+    // further and the buffer grows for them
+    size_t raw_size = end / 2 + RECORD_MAX_BYTES;
+    uint8_t *raw = malloc(raw_size);
+    size_t raw_len = 0;
+    segment_header_t h = { .magic = SEGMENT_MAGIC };
+    int64_t last_ts = 0;
+    int32_t last_ppm = 0, last_bac = 0;
+    char line[96];
+    long offset = 0;
+    bool ok = before != ESP_FAIL && raw != NULL && fseek(f, 0, SEEK_SET) == 0;
+    while (ok && !sealed && offset < end)
+    {
+        if (fgets(line, sizeof(line), f) == NULL)
+        {
+            ok = false;
+            break;
+        }
+        long next = ftell(f);
+        h.source_crc = hal_crc32(h.source_crc, line, next - offset);
+        offset = next;
+
+        history_record_t record;
+        if (!parse_log_line(line, &record))
+        {
+            continue;
+        }
+        if (raw_len + RECORD_MAX_BYTES > raw_size)
+        {
+            uint8_t *grown = realloc(raw, raw_size * 2);
+            if (grown == NULL)
+            {
+                ok = false;
+                break;
+            }
+            raw = grown;
+            raw_size *= 2;
+        }
+        int32_t ppm = (int32_t)lroundf(record.ppm * 100);
+        int32_t bac = (int32_t)lroundf(record.bac * 1000);
+        raw_len += put_varint(raw + raw_len, (int64_t)record.timestamp - last_ts);
+        raw_len += put_varint(raw + raw_len, ppm - last_ppm);
+        raw_len += put_varint(raw + raw_len, bac - last_bac);
+        size_t user_len = strlen(record.user);
+        raw[raw_len++] = (uint8_t)user_len;
+        memcpy(raw + raw_len, record.user, user_len);
+        raw_len += user_len;
+        h.first = h.records == 0 || record.timestamp < h.first ? record.timestamp : h.first;
+        h.last = h.records == 0 || record.timestamp > h.last ? record.timestamp : h.last;
+        last_ts = record.timestamp;
+        last_ppm = ppm;
+        last_bac = bac;
+        h.records++;
+    }
+    fclose(f);
+    h.source_len = offset;
+
+    uint8_t *data = NULL;
+    if (ok && !sealed)
+    {
+        data = malloc(LZSS_MAX_ENCODED(raw_len));
+        h.data_len = data != NULL ? lzss_encode(raw, raw_len, data, LZSS_MAX_ENCODED(raw_len)) : 0;
+        h.data_crc = hal_crc32(0, data, h.data_len);
+        char path[32];
+        snprintf(path, sizeof(path), HISTORY_SEGMENT_FMT, segments + 1);
+        ok = (h.data_len > 0 || raw_len == 0) && write_segment(path, &h, data) == ESP_OK;
+        known_segments = ok ? segments + 1 : known_segments;
+    }
+    free(raw);
+    free(data);
+    ok = ok && clear_log(file) == ESP_OK;
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to seal %s", file);
+        return ESP_FAIL;
+    }
+    if (sealed)
+    {
+        ESP_LOGW(TAG, "%s was already sealed into segment %d, cleared it", file, segments);
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "Sealed %" PRIu32 " records, %ld bytes of log into %" PRIu32 " in %lld us", h.records,
+             offset, (uint32_t)(sizeof(h) + h.data_len), (long long)(hal_time_us() - start));
+    return ESP_OK;
+}
+
+int history_segment_usage(long *bytes)
+{
+    int segments = count_segments();
+    *bytes = 0;
+    for (int i = 1; i <= segments; i++)
+    {
+        char path[32];
+        struct stat st;
+        snprintf(path, sizeof(path), HISTORY_SEGMENT_FMT, i);
+        *bytes += hal_stat(path, &st) == 0 ? (long)st.st_size : 0;
+    }
+    return segments;
+}
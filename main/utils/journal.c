@@ -0,0 +1,665 @@
+#include <string.h>
+#include <inttypes.h>
+#include "../includes/journal.h"
+#include "../includes/sd_card.h"
+#include "../includes/sd_writer.h"
+#include "../includes/history.h"
+#include "../includes/flash_ring.h"
+#include "../includes/user.h"
+#include "../includes/result.h"
+#include "../includes/metrics.h"
+#include "../includes/hal.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+static const char *TAG = "journal";
+
+#define NVS_NAMESPACE "journal"
+#define NVS_KEY_LOG_SEQ "log_seq" // Newest record in the log at the last checkpoint
+#define NVS_KEY_LOG_END "log_end" // End of the log data then
+#define NVS_KEY_MIG_INDEX "mig_index" // Ring line last moved to the journal
+#define NVS_KEY_MIG_SEQ "mig_seq"     // Sequence number of its record
+
+// Only the main task records and checkpoints, no locking
+static sd_writer_t journal;
+static const char *scores_path;
+static uint32_t last_seq;     // Newest record appended
+static uint32_t scores_seq;   // Newest record in the highscore file
+static long log_offset;       // Journal offset of the first record the log does not hold
+static uint32_t log_seq;      // Newest record in the log
+static uint32_t mark_seq;     // log_seq and the log end as saved in NVS
+static long mark_end;
+static bool log_torn;         // A reset or a failed append may have left part of a line in the log
+static int pending;           // Records the log does not hold
+static bool scores_dirty;     // The in-RAM table has changes without a journal record behind them
+static int64_t last_append_us;
+static bool sd_ok;            // New records go to the card, otherwise to the flash ring
+static bool sd_loaded;        // The in-RAM table was replayed from the card this boot
+static int64_t sd_retry_us;   // When a card that failed is tried again
+static int64_t index_retry_us; // When a player index rebuild that failed is tried again
+
+static size_t format_record(char rec[JOURNAL_RECORD_SIZE], uint32_t seq, const char *line)
+{
+    char body[JOURNAL_RECORD_SIZE];
+    snprintf(body, sizeof(body), "%" PRIu32 " %s", seq, line);
+    return snprintf(rec, JOURNAL_RECORD_SIZE, "%08" PRIx32 " %s", hal_crc32(0, body, strlen(body)), body);
+}
+
+// The log line held by a record, NULL when the record is torn or damaged
+static char *parse_record(char *rec, uint32_t *seq)
+{
+    uint32_t crc;
+    int body = 0, line = 0;
+    if (sscanf(rec, "%8" SCNx32 " %n", &crc, &body) != 1 || body == 0 ||
+        hal_crc32(0, rec + body, strlen(rec + body)) != crc ||
+        sscanf(rec + body, "%" SCNu32 " %n", seq, &line) != 1 || line == 0)
+    {
+        return NULL;
+    }
+    return rec + body + line;
+}
+
+// Put a logged result on the leaderboard, whose score counts even when its name could not be referenced
+static void add_result(esp_err_t err, result_t *result)
+{
+    if (err == ESP_ERR_NO_MEM)
+    {
+        ESP_LOGE(TAG, "Every name reference is taken, the result of %" PRIu32 " counts without its player",
+                 result->time);
+    }
+    add_highscore(result);
+    result_release(result);
+}
+
+// Put a logged result on the in-RAM leaderboard, lines are written by result_format_line
+static void apply_line(const char *line)
+{
+    result_t result;
+    esp_err_t err = result_parse_line(line, &result);
+    if (err != ESP_ERR_INVALID_ARG)
+    {
+        add_result(err, &result);
+    }
+}
+
+typedef struct {
+    int skip;  // Leading lines already applied from the journal
+    int lines; // Lines applied
+} ring_apply_t;
+
+static bool apply_ring_line(const char *line, void *ctx)
+{
+    ring_apply_t *apply = ctx;
+    if (apply->skip > 0)
+    {
+        apply->skip--;
+        return true;
+    }
+    apply->lines++;
+    apply_line(line);
+    return true;
+}
+
+/* Log mark
+ *
+ * The sequence number of the newest record in the log and where the log data ended,
+ * saved in NVS by every checkpoint once its records are in the log. Boot compares the
+ * end with the log on the card: every complete line past it is a record the next
+ * checkpoint wrote before a reset cut it short, taken in journal order. A log found
+ * shorter than the mark was sealed since, all its lines are past the mark then.
+ */
+static bool load_pair(const char *key_a, uint32_t *a, const char *key_b, uint32_t *b)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return false;
+    }
+    bool ok = nvs_get_u32(nvs, key_a, a) == ESP_OK && nvs_get_u32(nvs, key_b, b) == ESP_OK;
+    nvs_close(nvs);
+    return ok;
+}
+
+static esp_err_t save_pair(const char *key_a, uint32_t a, const char *key_b, uint32_t b)
+{
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    ret = nvs_set_u32(nvs, key_a, a);
+    ret = ret == ESP_OK ? nvs_set_u32(nvs, key_b, b) : ret;
+    ret = ret == ESP_OK ? nvs_commit(nvs) : ret;
+    nvs_close(nvs);
+    return ret;
+}
+
+static bool load_mark(void)
+{
+    uint32_t end;
+    bool ok = load_pair(NVS_KEY_LOG_SEQ, &mark_seq, NVS_KEY_LOG_END, &end);
+    mark_end = ok ? (long)end : -1;
+    return ok;
+}
+
+static esp_err_t save_mark(uint32_t seq, long end)
+{
+    esp_err_t ret = save_pair(NVS_KEY_LOG_SEQ, seq, NVS_KEY_LOG_END, (uint32_t)end);
+    if (ret == ESP_OK)
+    {
+        mark_seq = seq;
+        mark_end = end;
+    }
+    return ret;
+}
+
+// Whether the ring line with this index already has its record in the journal, see migrate_ring()
+static bool ring_line_migrated(uint32_t index)
+{
+    uint32_t mig_index, mig_seq;
+    return load_pair(NVS_KEY_MIG_INDEX, &mig_index, NVS_KEY_MIG_SEQ, &mig_seq) && mig_index == index &&
+           last_seq >= mig_seq;
+}
+
+// Complete lines of the log past the mark, and whether its data ends inside a line
+static int count_log_past_mark(void)
+{
+    log_torn = false;
+    FILE *f = hal_fopen(LOG_FILE, "r");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    long end = sd_writer_data_end(f);
+    long from = mark_end <= end ? mark_end : 0;
+    int lines = 0;
+    int c = '\n';
+    if (from < end && fseek(f, from, SEEK_SET) == 0)
+    {
+        for (long at = from; at < end && (c = fgetc(f)) != EOF; at++)
+        {
+            lines += c == '\n' && at > from; // One right at the mark ends a torn line before it
+        }
+    }
+    else if (end > 0 && fseek(f, end - 1, SEEK_SET) == 0)
+    {
+        c = fgetc(f);
+    }
+    log_torn = end > 0 && c != '\n';
+    fclose(f);
+    return lines;
+}
+
+// The last line of a file with its data ending at end, newline included
+static bool read_last_line(FILE *f, long end, char *line, size_t size)
+{
+    long from = end - (long)(size - 1) > 0 ? end - (long)(size - 1) : 0;
+    size_t len = end > from ? end - from : 0;
+    bool ok = end >= 0 && fseek(f, from, SEEK_SET) == 0 && fread(line, 1, len, f) == len;
+    len = ok ? len : 0;
+    line[len] = '\0';
+    size_t start = len > 0 ? len - 1 : 0;
+    while (start > 0 && line[start - 1] != '\n')
+    {
+        start--;
+    }
+    memmove(line, line + start, len - start + 1);
+    return ok;
+}
+
+static esp_err_t open_journal(void)
+{
+    if (journal.f == NULL)
+    {
+        if (sd_writer_open(&journal, JOURNAL_FILE) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        // An append that failed can have got its record to the card all the same, it counts then
+        char rec[JOURNAL_RECORD_SIZE];
+        uint32_t seq;
+        if (sd_loaded && read_last_line(journal.f, journal.end, rec, sizeof(rec)) && parse_record(rec, &seq) != NULL &&
+            seq == last_seq + 1)
+        {
+            ESP_LOGW(TAG, "Record %" PRIu32 " made it to the journal before its append failed", seq);
+            last_seq = seq;
+            pending++;
+        }
+    }
+    // A rewind that failed half way can leave less data than the log was known to hold
+    log_offset = log_offset < journal.end ? log_offset : journal.end;
+    return ESP_OK;
+}
+
+/* Replay
+ *
+ * Walks the journal once. The records up to the log mark are in the log, and so are
+ * as many of the next ones as the log has lines past it. Those past the sequence
+ * number of the highscore file are not on the leaderboard yet. A torn highscore file
+ * is rebuilt from the whole log instead.
+ */
+esp_err_t journal_replay(const char *scores_file)
+{
+    scores_path = scores_file;
+    bool rebuild = load_highscores(scores_file, &scores_seq) == ESP_ERR_INVALID_CRC;
+    if (!load_mark())
+    {
+        // Saved before the log had a mark: checkpoints wrote the log before the highscore file. Without
+        // that either no checkpoint got through yet, whatever the log holds is past the mark
+        ESP_LOGW(TAG, "No log mark, taking the highscore file's");
+        mark_seq = scores_seq;
+        mark_end = scores_seq > 0 ? log_data_end(LOG_FILE) : 0;
+    }
+    int past_mark = count_log_past_mark();
+
+    log_seq = mark_seq;
+    last_seq = scores_seq > mark_seq ? scores_seq : mark_seq;
+    scores_dirty = false;
+    log_offset = 0;
+    pending = 0;
+    int replayed = 0;
+    FILE *f = hal_fopen(JOURNAL_FILE, "r");
+    long end = f != NULL ? sd_writer_data_end(f) : 0;
+    if (f != NULL && end > 0 && fseek(f, 0, SEEK_SET) == 0)
+    {
+        char rec[JOURNAL_RECORD_SIZE];
+        for (long offset = 0; offset < end && fgets(rec, sizeof(rec), f) != NULL; )
+        {
+            offset = ftell(f);
+            uint32_t seq;
+            char *line = parse_record(rec, &seq);
+            if (line == NULL)
+            {
+                continue;
+            }
+            last_seq = seq > last_seq ? seq : last_seq;
+            if (seq <= mark_seq || past_mark > 0)
+            {
+                past_mark -= seq > mark_seq;
+                log_seq = seq > log_seq ? seq : log_seq;
+                log_offset = offset;
+                pending = 0;
+            }
+            else
+            {
+                pending++;
+            }
+            if (!rebuild && seq > scores_seq)
+            {
+                apply_line(line);
+                replayed++;
+            }
+        }
+    }
+
+    if (rebuild)
+    {
+        ESP_LOGW(TAG, "Rebuilding the highscores from the log");
+        clear_highscores();
+        history_reader_t reader;
+        history_record_t record;
+        if (history_open(&reader, LOG_FILE) == ESP_OK)
+        {
+            while (history_next(&reader, &record))
+            {
+                result_t result;
+                add_result(result_make(&result, record.timestamp, record.ppm, record.bac, record.user), &result);
+            }
+            history_close(&reader);
+        }
+        // Then the records the log is still missing
+        char rec[JOURNAL_RECORD_SIZE];
+        uint32_t seq;
+        bool ok = f != NULL && fseek(f, log_offset, SEEK_SET) == 0;
+        while (ok && ftell(f) < end && fgets(rec, sizeof(rec), f) != NULL)
+        {
+            char *line = parse_record(rec, &seq);
+            if (line != NULL)
+            {
+                apply_line(line);
+                replayed++;
+            }
+        }
+        scores_dirty = true;
+    }
+    if (f != NULL)
+    {
+        fclose(f);
+    }
+    // Results kept in internal flash are newer than anything on the card, except the oldest when a reset
+    // kept it from leaving the ring after it was moved to the journal
+    char first[FLASH_RING_LINE_SIZE];
+    uint32_t index;
+    ring_apply_t apply = { 0 };
+    apply.skip = flash_ring_peek(first, sizeof(first), &index) == ESP_OK && ring_line_migrated(index);
+    flash_ring_foreach(apply_ring_line, &apply);
+    replayed += apply.lines;
+    ESP_LOGI(TAG, "Replayed %d records, %d not in the log, last %" PRIu32 ", log at %" PRIu32, replayed, pending,
+             last_seq, log_seq);
+    return ESP_OK;
+}
+
+// Stop writing to the card until it is tried again, new records go to internal flash
+static void go_offline(const char *why)
+{
+    if (sd_ok)
+    {
+        ESP_LOGW(TAG, "%s, results go to internal flash", why);
+    }
+    sd_ok = false;
+    sd_retry_us = hal_time_us() + JOURNAL_RETRY_S * 1000000LL;
+}
+
+/* Appending a record
+ *
+ * A failed append closes the journal and a second try reopens it. A card that fails
+ * both or takes longer than CONFIG_JOURNAL_SD_STALL_MS is taken offline, a slow append
+ * still holds the record and returns ESP_ERR_TIMEOUT.
+ */
+static esp_err_t append_record(const char *line)
+{
+    int64_t start = hal_time_us();
+    char rec[JOURNAL_RECORD_SIZE];
+    uint32_t seq = last_seq + 1;
+    size_t len = format_record(rec, seq, line);
+
+    // Opening the journal again takes the record in when the first append got it to the card
+    bool ok = false;
+    for (int attempt = 0; attempt < 2 && !ok; attempt++)
+    {
+        ok = open_journal() == ESP_OK && (last_seq == seq || sd_writer_append(&journal, rec, len) == ESP_OK);
+    }
+    int64_t elapsed = hal_time_us() - start;
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to append to %s", JOURNAL_FILE);
+        metrics_inc(METRIC_SD_WRITE_ERRORS);
+        go_offline("Card failed");
+        return ESP_FAIL;
+    }
+    pending += last_seq != seq;
+    last_seq = seq;
+    metrics_observe(METRIC_SD_JOURNAL_APPEND, elapsed);
+    if (elapsed > CONFIG_JOURNAL_SD_STALL_MS * 1000LL)
+    {
+        metrics_inc(METRIC_SD_STALLS);
+        go_offline("Card stalled");
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+/* Back to the card
+ *
+ * The lines kept in internal flash go to the journal oldest first, each leaving the
+ * ring once its record is on the card. They are already on the in-RAM leaderboard.
+ * Records keep going to the ring until it is empty, so they stay in order.
+ * Before a line is appended, its ring index and the sequence number its record gets
+ * are saved in NVS. A reset between the append and the pop then finds the record
+ * in the journal, and the line leaves the ring without being appended again.
+ */
+static void migrate_ring(void)
+{
+    char line[FLASH_RING_LINE_SIZE];
+    uint32_t moved = 0;
+    uint32_t index;
+    esp_err_t ret;
+    while ((ret = flash_ring_peek(line, sizeof(line), &index)) != ESP_ERR_NOT_FOUND)
+    {
+        esp_err_t appended = ESP_OK;
+        if (ret == ESP_OK && !ring_line_migrated(index))
+        {
+            if (save_pair(NVS_KEY_MIG_INDEX, index, NVS_KEY_MIG_SEQ, last_seq + 1) != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Could not save the ring position, results stay in internal flash");
+                return;
+            }
+            appended = append_record(line);
+        }
+        if (appended == ESP_FAIL)
+        {
+            return;
+        }
+        // A line that cannot be read is dropped rather than holding up the rest. One that does not leave
+        // the ring is tried again later, the saved index keeps it from being appended twice
+        if (flash_ring_pop() != ESP_OK)
+        {
+            return;
+        }
+        moved += ret == ESP_OK;
+        if (appended == ESP_ERR_TIMEOUT)
+        {
+            return;
+        }
+    }
+    if (moved > 0)
+    {
+        ESP_LOGI(TAG, "Moved %" PRIu32 " results from internal flash to the card", moved);
+    }
+    sd_ok = true;
+}
+
+esp_err_t journal_init(const char *scores_file)
+{
+    scores_path = scores_file;
+    sd_writer_close(&journal);
+    sd_ok = sd_loaded = false;
+    if (open_journal() != ESP_OK)
+    {
+        // No card yet: the leaderboard starts from internal flash, journal_poll() retries
+        ESP_LOGE(TAG, "Failed to open %s, results go to internal flash", JOURNAL_FILE);
+        ring_apply_t apply = { 0 };
+        clear_highscores();
+        flash_ring_foreach(apply_ring_line, &apply);
+        go_offline("No card");
+        return ESP_FAIL;
+    }
+    journal_replay(scores_file);
+    sd_loaded = true;
+    migrate_ring();
+    return journal_checkpoint();
+}
+
+// Add a named player's result to the index before it goes to the log, at the position it is going to take.
+// A failure leaves the index to be rebuilt, it never holds the log up
+static void index_line(const char *line)
+{
+    history_record_t record;
+    history_cursor_t at;
+    if (!history_parse_line(line, &record) || record.user[0] == '\0')
+    {
+        return;
+    }
+    esp_err_t ret = history_log_cursor(LOG_FILE, &at);
+    ret = ret == ESP_OK ? user_index_add(record.user, &at) : ret;
+    // A name with no file left would not get one from the rebuild either
+    if (ret != ESP_OK && ret != ESP_ERR_NOT_FOUND)
+    {
+        user_index_invalidate();
+    }
+}
+
+// Move the log into a segment, the mark then stands at its start
+static esp_err_t seal_log(void)
+{
+    esp_err_t ret = history_seal(LOG_FILE);
+    if (ret == ESP_OK && save_mark(log_seq, 0) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not save the log mark after sealing");
+    }
+    return ret;
+}
+
+esp_err_t journal_checkpoint(void)
+{
+    if (!sd_ok)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (pending == 0 && !scores_dirty && scores_seq == last_seq)
+    {
+        return ESP_OK;
+    }
+    int64_t start = hal_time_us();
+    bool ok = open_journal() == ESP_OK;
+
+    // The log first: the highscore file never gets ahead of it. Opening the log pads over what
+    // a reset or a failed append left of a line. A whole line a failed append left is the record
+    // it was writing, that one is not written twice
+    char rec[JOURNAL_RECORD_SIZE], tail[JOURNAL_RECORD_SIZE];
+    if (ok && log_torn)
+    {
+        FILE *f = open_log(LOG_FILE) == ESP_OK ? hal_fopen(LOG_FILE, "r") : NULL;
+        ok = f != NULL && read_last_line(f, sd_writer_data_end(f), tail, sizeof(tail)) &&
+             fseek(journal.f, log_offset, SEEK_SET) == 0;
+        if (f != NULL)
+        {
+            fclose(f);
+        }
+        uint32_t seq;
+        char *line = ok && log_offset < journal.end && fgets(rec, sizeof(rec), journal.f) != NULL ?
+                     parse_record(rec, &seq) : NULL;
+        if (line != NULL && strcmp(tail, line) == 0)
+        {
+            ESP_LOGW(TAG, "Record %" PRIu32 " made it to the log before its append failed", seq);
+            log_offset = ftell(journal.f);
+            log_seq = seq;
+        }
+        log_torn = !ok;
+    }
+    // A seal that failed once the journal was emptied goes first, lines added to the log before would
+    // be sealed twice
+    if (ok && log_offset == 0)
+    {
+        ok = open_log(LOG_FILE) == ESP_OK && (log_data_end(LOG_FILE) < HISTORY_SEGMENT_BYTES || seal_log() == ESP_OK);
+    }
+    ok = ok && fseek(journal.f, log_offset, SEEK_SET) == 0;
+    while (ok && log_offset < journal.end)
+    {
+        if (fgets(rec, sizeof(rec), journal.f) == NULL)
+        {
+            // A read error leaves the stream in a state the next append should not inherit
+            sd_writer_close(&journal);
+            ok = false;
+            break;
+        }
+        long next = ftell(journal.f);
+        uint32_t seq;
+        char *line = parse_record(rec, &seq);
+        if (line != NULL)
+        {
+            index_line(line);
+        }
+        ok = line == NULL || save_log(LOG_FILE, line) == ESP_OK;
+        log_torn = log_torn || !ok; // Some or all of the line can be on the card all the same
+        log_offset = ok ? next : log_offset;
+        log_seq = ok && line != NULL ? seq : log_seq;
+    }
+    // The journal is only rewound under a mark that covers it
+    long end = ok ? log_data_end(LOG_FILE) : -1;
+    if (ok && (log_seq != mark_seq || end != mark_end))
+    {
+        ok = end >= 0 && save_mark(log_seq, end) == ESP_OK;
+    }
+    if (ok)
+    {
+        pending = 0;
+        ok = save_highscores(scores_path, last_seq) == ESP_OK;
+    }
+    if (ok)
+    {
+        scores_seq = last_seq;
+        scores_dirty = false;
+        // Everything is in the log, a reset during the rewind loses nothing. A log due to be
+        // sealed empties the journal first, so no record is left pointing into the log
+        bool seal = history_seal_due(LOG_FILE);
+        if ((journal.end >= JOURNAL_REWIND_BYTES || seal) && sd_writer_rewind(&journal) == ESP_OK)
+        {
+            log_offset = 0;
+            if (seal)
+            {
+                seal_log();
+            }
+        }
+    }
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Checkpoint failed, retrying later");
+        last_append_us = hal_time_us(); // Back off for another idle period
+        return ESP_FAIL;
+    }
+    metrics_observe(METRIC_SD_CHECKPOINT, hal_time_us() - start);
+    ESP_LOGI(TAG, "Checkpoint at %" PRIu32 " in %lld us", last_seq, (long long)(hal_time_us() - start));
+    return ESP_OK;
+}
+
+esp_err_t journal_append(const char *line)
+{
+    apply_line(line);
+    last_append_us = hal_time_us();
+    bool tried = sd_ok;
+    uint32_t seq = last_seq + 1;
+    if (!sd_ok || append_record(line) == ESP_FAIL)
+    {
+        // The card is out or failing, the result waits in internal flash. The append that failed can
+        // have got its record to the card all the same, the line is then taken as moved, see migrate_ring()
+        esp_err_t ret = flash_ring_push(line);
+        char first[FLASH_RING_LINE_SIZE];
+        uint32_t index;
+        if (tried && ret == ESP_OK && flash_ring_count() == 1 &&
+            flash_ring_peek(first, sizeof(first), &index) == ESP_OK &&
+            save_pair(NVS_KEY_MIG_INDEX, index, NVS_KEY_MIG_SEQ, seq) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Could not save the ring position of %" PRIu32, seq);
+        }
+        return ret;
+    }
+    if (sd_ok && pending >= JOURNAL_MAX_PENDING)
+    {
+        return journal_checkpoint();
+    }
+    return ESP_OK;
+}
+
+void journal_poll(void)
+{
+    int64_t now = hal_time_us();
+    if (!sd_ok)
+    {
+        if (now < sd_retry_us)
+        {
+            return;
+        }
+        sd_retry_us = now + JOURNAL_RETRY_S * 1000000LL;
+        if (open_journal() != ESP_OK)
+        {
+            return;
+        }
+        if (!sd_loaded)
+        {
+            // The card came in after boot: its table, then the lines in flash on top
+            journal_replay(scores_path);
+            sd_loaded = true;
+        }
+        migrate_ring();
+        if (sd_ok)
+        {
+            ESP_LOGI(TAG, "Card back, results go to the card again");
+            journal_checkpoint();
+        }
+        return;
+    }
+    if (now - last_append_us < CONFIG_JOURNAL_CHECKPOINT_IDLE_S * 1000000LL)
+    {
+        return;
+    }
+    if (pending > 0 || scores_dirty || scores_seq != last_seq)
+    {
+        journal_checkpoint();
+    }
+    else if (user_index_stale() && now >= index_retry_us && user_index_rebuild() != ESP_OK)
+    {
+        index_retry_us = now + JOURNAL_INDEX_RETRY_S * 1000000LL;
+    }
+}
@@ -0,0 +1,101 @@
+#include <string.h>
+#include <stdbool.h>
+#include "../includes/lzss.h"
+
+size_t lzss_encode(const uint8_t *in, size_t len, uint8_t *out, size_t out_size)
+{
+    size_t o = 0, flag_at = 0;
+    int bit = 8;
+    for (size_t i = 0; i < len; bit++) {
+        if (bit == 8) {
+            if (o >= out_size) {
+                return 0;
+            }
+            flag_at = o;
+            out[o++] = 0;
+            bit = 0;
+        }
+
+        // Longest match in the window, it may run on into the bytes it produces
+        size_t best_len = 0, best_dist = 0;
+        size_t max_len = len - i < LZSS_MAX_MATCH ? len - i : LZSS_MAX_MATCH;
+        for (size_t dist = 1; dist <= LZSS_WINDOW && dist <= i && best_len < max_len; dist++) {
+            size_t n = 0;
+            while (n < max_len && in[i + n - dist] == in[i + n]) {
+                n++;
+            }
+            if (n > best_len) {
+                best_len = n;
+                best_dist = dist;
+            }
+        }
+
+        if (best_len >= LZSS_MIN_MATCH) {
+            if (o + 2 > out_size) {
+                return 0;
+            }
+            out[o++] = (uint8_t)(best_dist - 1);
+            out[o++] = (uint8_t)(best_len - LZSS_MIN_MATCH);
+            i += best_len;
+        } else {
+            if (o + 1 > out_size) {
+                return 0;
+            }
+            out[flag_at] |= 1 << bit;
+            out[o++] = in[i++];
+        }
+    }
+    return o;
+}
+
+void lzss_decoder_init(lzss_decoder_t *d, FILE *in, uint32_t len)
+{
+    memset(d, 0, sizeof(*d));
+    d->in = in;
+    d->in_left = len;
+}
+
+static int next_in(lzss_decoder_t *d)
+{
+    if (d->in_left == 0) {
+        return -1;
+    }
+    d->in_left--;
+    int c = fgetc(d->in);
+    return c == EOF ? -1 : c;
+}
+
+int lzss_decoder_getc(lzss_decoder_t *d)
+{
+    if (d->match_left == 0) {
+        if (d->flag_bits == 0) {
+            int flags = next_in(d);
+            if (flags < 0) {
+                return -1;
+            }
+            d->flags = (uint8_t)flags;
+            d->flag_bits = 8;
+        }
+        bool literal = d->flags & 1;
+        d->flags >>= 1;
+        d->flag_bits--;
+        if (literal) {
+            int c = next_in(d);
+            if (c >= 0) {
+                d->window[d->pos++] = (uint8_t)c;
+            }
+            return c;
+        }
+        int dist = next_in(d);
+        int len = next_in(d);
+        if (dist < 0 || len < 0) {
+            return -1;
+        }
+        d->match_dist = dist + 1;
+        d->match_left = len + LZSS_MIN_MATCH;
+    }
+    uint8_t c = d->window[(uint8_t)(d->pos - d->match_dist)];
+    d->window[d->pos++] = c;
+    d->match_left--;
+    return c;
+}
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <math.h>
+#include <inttypes.h>
+#include "../includes/measurement.h"
+#include "../includes/MQ303A.h"
+#include "../includes/sd_card.h"
+#include "../includes/journal.h"
+#include "../includes/session.h"
+#include "../includes/user.h"
+#include "../includes/result.h"
+#include "../includes/metrics.h"
+#include "../includes/trace.h"
+#include "../includes/dlog.h"
+#include "../includes/hal.h"
+#include "esp_log.h"
+
+static const char *TAG = "measurement";
+
+// Log how far the capture timestamps drifted from the nominal sampling period
+static void log_capture_jitter(const int64_t *timestamps, int count)
+{
+    if (count < 2) {
+        return;
+    }
+    const int64_t period_us = CAPTURE_PERIOD_MS * 1000;
+    int64_t max_dev = 0;
+    double sum_sq = 0;
+    for (int i = 1; i < count; i++) {
+        int64_t dev = (timestamps[i] - timestamps[i - 1]) - period_us;
+        if (llabs(dev) > max_dev) {
+            max_dev = llabs(dev);
+        }
+        sum_sq += (double)dev * dev;
+    }
+    double mean_period = (double)(timestamps[count - 1] - timestamps[0]) / (count - 1);
+    ESP_LOGI(TAG, "Capture jitter: mean period %.1f us, max deviation %lld us, rms %.1f us",
+             mean_period, (long long)max_dev, sqrt(sum_sq / (count - 1)));
+}
+
+void measurement_baseline(measurement_t *m)
+{
+    // A replay only runs the math, the phase metrics and trace stay about the live sensor
+    bool live = m->source == NULL;
+    int64_t start = hal_time_us();
+    if (live) {
+        TRACE_BEGIN("baseline");
+        adc_trace_mark(ADC_TRACE_BASELINE);
+    }
+    m->rs_air = mq303a_get_rs_air(live ? &mq303a_adc_source : m->source, BASELINE_SAMPLES); // Get RS_air value
+    ESP_LOGI(TAG, "RS_air: %.3f", m->rs_air);
+    if (live) {
+        TRACE_END("baseline");
+        metrics_observe(METRIC_PHASE_BASELINE, hal_time_us() - start);
+    }
+}
+
+void measurement_capture(measurement_t *m, int led_gpio)
+{
+    bool live = m->source == NULL;
+    const mq303a_source_t *source = live ? &mq303a_adc_source : m->source;
+    int64_t start = hal_time_us();
+    if (live) {
+        TRACE_BEGIN("capture");
+        adc_trace_mark(ADC_TRACE_CAPTURE);
+    }
+
+    m->ppm = 0;
+    m->count = 0;
+    hal_period_t period;
+    hal_period_start(&period);
+    while (m->count < CAPTURE_SAMPLES)
+    {
+        if (live) {
+            hal_gpio_set(led_gpio, 1);                // Turn on the LED
+        }
+        m->sample_times[m->count] = hal_time_us();    // Acquisition timestamp
+        float RS_gas = mq303a_get_rs_gas(source);     // Get RS_gas value
+
+        float ratio = RS_gas / m->rs_air;             // Calculate the ratio of RS values
+        m->ratios[m->count] = ratio;
+        float ppm = mq303a_ppm_from_ratio(ratio);
+        DLOGI(DLOG_MAIN, "RS_gas: %.3f, Ratio: %.3f", RS_gas, ratio);
+        DLOGI(DLOG_MAIN, "PPM: %.2f", ppm);
+        DLOGI(DLOG_MAIN, "BAC: %.2f", mq303a_bac_from_ppm(ppm));
+        if (ppm > m->ppm) // Check if the current PPM is greater than the previous one
+        {
+            m->ppm = ppm; // Update PPM value
+        }
+        if (live) {
+            hal_period_wait(&period, CAPTURE_PERIOD_MS); // Keep a fixed 0.1 second cadence
+        }
+        m->count++;
+    }
+    m->bac = mq303a_bac_from_ppm(m->ppm); // Convert PPM to BAC
+
+    if (live) {
+        TRACE_END("capture");
+        metrics_observe(METRIC_PHASE_CAPTURE, hal_time_us() - start);
+        log_capture_jitter(m->sample_times, m->count);
+    }
+}
+
+esp_err_t measurement_replay(adc_trace_t *trace, measurement_t *m)
+{
+    if (adc_trace_seek(trace, ADC_TRACE_BASELINE) < BASELINE_SAMPLES ||
+        adc_trace_seek(trace, ADC_TRACE_CAPTURE) < CAPTURE_SAMPLES) {
+        ESP_LOGW(TAG, "Trace is too short to replay");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    mq303a_source_t source = adc_trace_source(trace);
+    m->source = &source;
+    adc_trace_seek(trace, ADC_TRACE_BASELINE);
+    measurement_baseline(m);
+    adc_trace_seek(trace, ADC_TRACE_CAPTURE);
+    measurement_capture(m, -1);
+    m->source = NULL;
+    return ESP_OK;
+}
+
+void measurement_store(const measurement_t *m)
+{
+    int64_t start = hal_time_us();
+    TRACE_BEGIN("store");
+    char user[USER_NAME_SIZE], line[MAX_CHAR_SIZE];
+    user_take_player(user); // Named from the web UI before the test, or nobody
+    result_t result;
+    result_make(&result, hal_clock_now(), m->ppm, m->bac, ""); // The name goes into the line, not a reference
+    if (result.flags & RESULT_CLOCK_UNSET) {
+        // Numbered within 1970, so the session of every such test has an id of its own
+        result.time = (uint32_t)session_unset_id();
+        ESP_LOGW(TAG, "Clock not synchronised, the result is dated 1970 + %" PRIu32 " s", result.time);
+    }
+    if (result.flags & RESULT_CLIPPED) {
+        ESP_LOGW(TAG, "PPM %.2f does not fit a result, stored saturated", m->ppm);
+    }
+    result_format_line(&result, user, line, sizeof(line));
+    journal_append(line); // One record, the log and highscore files follow at the next checkpoint
+    session_record(m, result.time); // Saved to the card by session_poll between tests
+    display_highscores(); // Display the highscore table
+    adc_trace_save(m->rs_air, m->ppm, m->bac); // Keep the raw samples when recording
+    TRACE_END("store");
+    metrics_observe(METRIC_PHASE_STORE, hal_time_us() - start);
+}
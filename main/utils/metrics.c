@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include "../includes/metrics.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#define METRICS_MAX_TASKS 8
+#define BUCKET_COUNT (sizeof(bucket_bounds_us) / sizeof(bucket_bounds_us[0]))
+
+// Upper bounds of the histogram buckets in microseconds, +Inf is implicit
+static const int64_t bucket_bounds_us[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+};
+
+typedef struct {
+    atomic_uint_fast32_t buckets[BUCKET_COUNT + 1]; // Not cumulative, the last one is +Inf
+    atomic_uint_fast64_t sum_us;
+} histogram_t;
+
+// Histograms sharing a name must be next to each other so HELP/TYPE is written once
+static const struct {
+    const char *name;
+    const char *help;
+    const char *labels;
+} histogram_info[METRIC_HISTOGRAM_COUNT] = {
+    [METRIC_ADC_READ] = { "breathalyzer_adc_read_seconds", "ADC oneshot read and calibration time", "" },
+    [METRIC_PHASE_WARMUP] = { "breathalyzer_phase_seconds", "Duration of each phase of a test", "phase=\"warmup\"" },
+    [METRIC_PHASE_BASELINE] = { "breathalyzer_phase_seconds", NULL, "phase=\"baseline\"" },
+    [METRIC_PHASE_CAPTURE] = { "breathalyzer_phase_seconds", NULL, "phase=\"capture\"" },
+    [METRIC_PHASE_STORE] = { "breathalyzer_phase_seconds", NULL, "phase=\"store\"" },
+    [METRIC_SD_SAVE_LOG] = { "breathalyzer_sd_write_seconds", "SD card write latency", "op=\"save_log\"" },
+    [METRIC_SD_SAVE_HIGHSCORES] = { "breathalyzer_sd_write_seconds", NULL, "op=\"save_highscores\"" },
+    [METRIC_SD_JOURNAL_APPEND] = { "breathalyzer_sd_write_seconds", NULL, "op=\"journal_append\"" },
+    [METRIC_SD_CHECKPOINT] = { "breathalyzer_sd_write_seconds", NULL, "op=\"checkpoint\"" },
+    [METRIC_HTTP_INDEX] = { "breathalyzer_http_handler_seconds", "HTTP handler latency", "handler=\"index\"" },
+    [METRIC_HTTP_STATUS] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"status\"" },
+    [METRIC_HTTP_HIGHSCORES] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"highscores\"" },
+    [METRIC_HTTP_EXPORT] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"export\"" },
+    [METRIC_HTTP_METRICS] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"metrics\"" },
+    [METRIC_HTTP_TRACE] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"trace\"" },
+    [METRIC_HTTP_LOG] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"log\"" },
+    [METRIC_HTTP_REPLAY] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"replay\"" },
+    [METRIC_HTTP_STATIC] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"static\"" },
+    [METRIC_HTTP_DIAG] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"diag\"" },
+    [METRIC_HTTP_SESSIONS] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"sessions\"" },
+    [METRIC_HTTP_USERS] = { "breathalyzer_http_handler_seconds", NULL, "handler=\"users\"" },
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_info[METRIC_COUNTER_COUNT] = {
+    [METRIC_TESTS_COMPLETED] = { "breathalyzer_tests_completed_total", "Breath tests run to completion" },
+    [METRIC_SD_WRITE_ERRORS] = { "breathalyzer_sd_write_errors_total", "SD card writes that failed" },
+    [METRIC_SD_PREALLOCATIONS] = { "breathalyzer_sd_preallocations_total", "Log file extensions by one chunk" },
+    [METRIC_SD_STALLS] = { "breathalyzer_sd_stalls_total", "Journal appends slow enough to take the card offline" },
+    [METRIC_FLASH_RING_WRITES] = { "breathalyzer_flash_ring_writes_total", "Results written to internal flash instead of the card" },
+    [METRIC_FLASH_RING_DROPPED] = { "breathalyzer_flash_ring_dropped_total", "Results dropped from the full internal flash ring" },
+    [METRIC_HTTP_REJECTED] = { "breathalyzer_http_rejected_total", "HTTP requests answered 503" },
+};
+
+static histogram_t histograms[METRIC_HISTOGRAM_COUNT];
+static atomic_uint_fast32_t counters[METRIC_COUNTER_COUNT];
+
+static portMUX_TYPE tasks_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t tasks[METRICS_MAX_TASKS];
+static int task_count = 0;
+
+void metrics_observe(metric_histogram_t histogram, int64_t duration_us)
+{
+    size_t bucket = 0;
+    while (bucket < BUCKET_COUNT && duration_us > bucket_bounds_us[bucket]) {
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&histograms[histogram].buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histograms[histogram].sum_us, (uint_fast64_t)duration_us, memory_order_relaxed);
+}
+
+void metrics_inc(metric_counter_t counter)
+{
+    atomic_fetch_add_explicit(&counters[counter], 1, memory_order_relaxed);
+}
+
+void metrics_register_task(TaskHandle_t task)
+{
+    portENTER_CRITICAL(&tasks_lock);
+    if (task != NULL && task_count < METRICS_MAX_TASKS) {
+        tasks[task_count++] = task;
+    }
+    portEXIT_CRITICAL(&tasks_lock);
+}
+
+static esp_err_t emitf(metrics_emit_t emit, void *ctx, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+static esp_err_t emitf(metrics_emit_t emit, void *ctx, const char *fmt, ...)
+{
+    char line[160];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+    }
+    return emit(ctx, line, len);
+}
+
+static esp_err_t render_histogram(metric_histogram_t id, metrics_emit_t emit, void *ctx)
+{
+    const char *name = histogram_info[id].name;
+    const char *labels = histogram_info[id].labels;
+    const char *sep = labels[0] != '\0' ? "," : "";
+    histogram_t *h = &histograms[id];
+
+    if (histogram_info[id].help != NULL) {
+        if (emitf(emit, ctx, "# HELP %s %s\n# TYPE %s histogram\n", name, histogram_info[id].help, name) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i <= BUCKET_COUNT; i++) {
+        cumulative += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        esp_err_t ret;
+        if (i < BUCKET_COUNT) {
+            ret = emitf(emit, ctx, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, sep,
+                        bucket_bounds_us[i] / 1e6, (unsigned long)cumulative);
+        } else {
+            ret = emitf(emit, ctx, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep,
+                        (unsigned long)cumulative);
+        }
+        if (ret != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    uint64_t sum_us = atomic_load_explicit(&h->sum_us, memory_order_relaxed);
+    const char *open = labels[0] != '\0' ? "{" : "";
+    const char *close = labels[0] != '\0' ? "}" : "";
+    if (emitf(emit, ctx, "%s_sum%s%s%s %.6f\n", name, open, labels, close, sum_us / 1e6) != ESP_OK ||
+        emitf(emit, ctx, "%s_count%s%s%s %lu\n", name, open, labels, close, (unsigned long)cumulative) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t metrics_render(metrics_emit_t emit, void *ctx)
+{
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        if (render_histogram(i, emit, ctx) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        if (emitf(emit, ctx, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", counter_info[i].name,
+                  counter_info[i].help, counter_info[i].name, counter_info[i].name,
+                  (unsigned long)atomic_load_explicit(&counters[i], memory_order_relaxed)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+
+    if (emitf(emit, ctx,
+              "# HELP breathalyzer_uptime_seconds Time since boot\n"
+              "# TYPE breathalyzer_uptime_seconds gauge\n"
+              "breathalyzer_uptime_seconds %.3f\n"
+              "# HELP breathalyzer_heap_free_bytes Free heap right now\n"
+              "# TYPE breathalyzer_heap_free_bytes gauge\n"
+              "breathalyzer_heap_free_bytes %lu\n",
+              esp_timer_get_time() / 1e6, (unsigned long)esp_get_free_heap_size()) != ESP_OK ||
+        emitf(emit, ctx,
+              "# HELP breathalyzer_heap_min_free_bytes Lowest free heap since boot\n"
+              "# TYPE breathalyzer_heap_min_free_bytes gauge\n"
+              "breathalyzer_heap_min_free_bytes %lu\n",
+              (unsigned long)esp_get_minimum_free_heap_size()) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    TaskHandle_t snapshot[METRICS_MAX_TASKS];
+    portENTER_CRITICAL(&tasks_lock);
+    int count = task_count;
+    for (int i = 0; i < count; i++) {
+        snapshot[i] = tasks[i];
+    }
+    portEXIT_CRITICAL(&tasks_lock);
+
+    if (emitf(emit, ctx,
+              "# HELP breathalyzer_task_stack_free_bytes Stack high-water mark, lowest free stack seen\n"
+              "# TYPE breathalyzer_task_stack_free_bytes gauge\n") != ESP_OK) {
+        return ESP_FAIL;
+    }
+    for (int i = 0; i < count; i++) {
+        // ESP-IDF reports the high-water mark in bytes
+        if (emitf(emit, ctx, "breathalyzer_task_stack_free_bytes{task=\"%s\"} %u\n",
+                  pcTaskGetName(snapshot[i]), (unsigned)uxTaskGetStackHighWaterMark(snapshot[i])) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
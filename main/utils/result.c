@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../includes/result.h"
+#include "../includes/history.h"
+
+// Round to the scale, negatives and NaN give 0 and values past max are saturated
+static uint32_t to_fixed(float value, int scale, uint32_t max, uint8_t *flags)
+{
+    float q = value * scale + 0.5f;
+    if (!(q >= 1.0f)) {
+        return 0;
+    }
+    if (q >= (float)max) {
+        *flags |= RESULT_CLIPPED;
+        return max;
+    }
+    return (uint32_t)q;
+}
+
+esp_err_t result_make(result_t *result, time_t time, float ppm, float bac, const char *user)
+{
+    result->flags = 0;
+    if (time < 0) {
+        result->flags |= RESULT_CLOCK_UNSET;
+        time = 0;
+    }
+    result->time = (uint32_t)time;
+    result->ppm = to_fixed(ppm, RESULT_PPM_SCALE, UINT32_MAX, &result->flags);
+    result->bac = to_fixed(bac, RESULT_BAC_SCALE, UINT16_MAX, &result->flags);
+    return user_ref(user, &result->user);
+}
+
+esp_err_t result_parse_line(const char *line, result_t *result)
+{
+    history_record_t record;
+    if (!history_parse_line(line, &record)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return result_make(result, record.timestamp, record.ppm, record.bac, record.user);
+}
+
+void result_release(result_t *result)
+{
+    user_unref(result->user);
+    result->user = USER_NONE;
+}
+
+void result_date(const result_t *result, struct tm *date)
+{
+    time_t time = result->time;
+    if (localtime_r(&time, date) == NULL) {
+        memset(date, 0, sizeof(*date));
+        date->tm_year = 70;
+        date->tm_mday = 1;
+    }
+}
+
+size_t result_format_line(const result_t *result, const char *user, char *line, size_t len)
+{
+    struct tm date;
+    result_date(result, &date);
+    return snprintf(line, len, "%02d/%02d/%04d %02d:%02d:%02d - PPM: %" PRIu32 ".%02" PRIu32 ", BAC: %u.%03u%s%s\n",
+                    date.tm_mday, date.tm_mon + 1, date.tm_year + 1900, date.tm_hour, date.tm_min, date.tm_sec,
+                    result->ppm / RESULT_PPM_SCALE, result->ppm % RESULT_PPM_SCALE,
+                    result->bac / RESULT_BAC_SCALE, result->bac % RESULT_BAC_SCALE,
+                    user[0] != '\0' ? " - USER: " : "", user);
+}
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../includes/sd_bench.h"
+#include "../includes/sd_card.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+static const char *TAG = "sd_bench";
+
+#define SCRATCH_FILE MOUNT_POINT "/sdbench.tmp"
+
+static const uint32_t op_sizes[] = { 64, 512, 4096, 16384 };
+#define OP_SIZE_COUNT (sizeof(op_sizes) / sizeof(op_sizes[0]))
+#define MAX_OP_BYTES 16384
+
+static const char *pattern_names[SD_BENCH_PATTERN_COUNT] = { "seq_write", "seq_read", "rand_write", "rand_read" };
+static const char *pattern_modes[SD_BENCH_PATTERN_COUNT] = { "w", "r", "r+", "r" };
+static const char *vbuf_names[SD_BENCH_VBUF_COUNT] = { "default", "none", "full" };
+
+// One run at a time, the latencies and the scratch file are shared
+static portMUX_TYPE bench_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool bench_running = false;
+static uint32_t latencies[SD_BENCH_MAX_OPS];
+
+const char *sd_bench_pattern_name(sd_bench_pattern_t pattern)
+{
+    return pattern_names[pattern];
+}
+
+const char *sd_bench_vbuf_name(sd_bench_vbuf_t vbuf)
+{
+    return vbuf_names[vbuf];
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* One pass over the scratch file
+ *
+ * Random passes touch ops offsets of the file the sequential write of the same size
+ * left behind, so they never extend it.
+ */
+static esp_err_t run_pass(sd_bench_pattern_t pattern, sd_bench_vbuf_t vbuf, uint32_t op_bytes, uint32_t ops,
+                          char *data, char *vbuf_mem, sd_bench_result_t *result)
+{
+    bool writing = pattern == SD_BENCH_SEQ_WRITE || pattern == SD_BENCH_RAND_WRITE;
+    bool random = pattern == SD_BENCH_RAND_WRITE || pattern == SD_BENCH_RAND_READ;
+    uint32_t state = 0x9e3779b9u ^ op_bytes;
+
+    int64_t start = hal_time_us();
+    FILE *f = hal_fopen(SCRATCH_FILE, pattern_modes[pattern]);
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", SCRATCH_FILE);
+        return ESP_FAIL;
+    }
+    if (vbuf == SD_BENCH_VBUF_NONE) {
+        setvbuf(f, NULL, _IONBF, 0);
+    } else if (vbuf == SD_BENCH_VBUF_FULL) {
+        setvbuf(f, vbuf_mem, _IOFBF, SD_BENCH_FULL_VBUF_SIZE);
+    }
+
+    bool ok = true;
+    for (uint32_t i = 0; i < ops && ok; i++) {
+        int64_t op_start = hal_time_us();
+        if (random) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            ok = fseek(f, (long)(state % ops) * op_bytes, SEEK_SET) == 0;
+        }
+        if (ok && writing) {
+            ok = fwrite(data, 1, op_bytes, f) == op_bytes;
+        } else if (ok) {
+            ok = fread(data, 1, op_bytes, f) == op_bytes;
+        }
+        latencies[i] = (uint32_t)(hal_time_us() - op_start);
+    }
+    ok = fclose(f) == 0 && ok;
+    int64_t elapsed = hal_time_us() - start;
+    if (!ok) {
+        ESP_LOGE(TAG, "%s of %" PRIu32 " byte ops failed", pattern_names[pattern], op_bytes);
+        return ESP_FAIL;
+    }
+
+    qsort(latencies, ops, sizeof(latencies[0]), compare_u32);
+    result->pattern = pattern;
+    result->vbuf = vbuf;
+    result->op_bytes = op_bytes;
+    result->ops = ops;
+    result->mb_per_s = elapsed > 0 ? (double)ops * op_bytes / elapsed : 0; // Bytes per us are MB/s
+    result->p50_us = latencies[ops / 2];
+    result->p99_us = latencies[(ops * 99) / 100];
+    result->max_us = latencies[ops - 1];
+    return ESP_OK;
+}
+
+int sd_bench_run(uint32_t pass_bytes, sd_bench_result_t *results, int max_results)
+{
+    portENTER_CRITICAL(&bench_lock);
+    bool busy = bench_running;
+    bench_running = true;
+    portEXIT_CRITICAL(&bench_lock);
+    if (busy) {
+        ESP_LOGW(TAG, "Benchmark already running");
+        return -1;
+    }
+
+    char *data = malloc(MAX_OP_BYTES);
+    char *vbuf_mem = malloc(SD_BENCH_FULL_VBUF_SIZE);
+    int count = 0;
+    esp_err_t ret = data != NULL && vbuf_mem != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+    if (ret == ESP_OK) {
+        for (uint32_t i = 0; i < MAX_OP_BYTES; i++) {
+            data[i] = 'a' + i % 26;
+        }
+    }
+
+    for (int s = 0; s < OP_SIZE_COUNT && ret == ESP_OK; s++) {
+        uint32_t ops = pass_bytes / op_sizes[s];
+        ops = ops < 1 ? 1 : ops > SD_BENCH_MAX_OPS ? SD_BENCH_MAX_OPS : ops;
+        for (int v = 0; v < SD_BENCH_VBUF_COUNT && ret == ESP_OK; v++) {
+            for (int p = 0; p < SD_BENCH_PATTERN_COUNT && ret == ESP_OK && count < max_results; p++) {
+                ret = run_pass(p, v, op_sizes[s], ops, data, vbuf_mem, &results[count]);
+                count += ret == ESP_OK;
+            }
+        }
+    }
+
+    hal_remove(SCRATCH_FILE);
+    free(data);
+    free(vbuf_mem);
+    portENTER_CRITICAL(&bench_lock);
+    bench_running = false;
+    portEXIT_CRITICAL(&bench_lock);
+    return ret == ESP_OK ? count : -1;
+}
+
+// The sequential write setting the logs should use, -1 if there is none
+static int fastest_seq_write(const sd_bench_result_t *results, int count)
+{
+    int best = -1;
+    for (int i = 0; i < count; i++) {
+        if (results[i].pattern == SD_BENCH_SEQ_WRITE && (best < 0 || results[i].mb_per_s > results[best].mb_per_s)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void sd_bench_print(FILE *out, const hal_storage_info_t *info, const sd_bench_result_t *results, int count)
+{
+    fprintf(out, "SD card: %.1f MB, %.1f MB free, %" PRIu32 " byte clusters\n", info->total_bytes / 1e6,
+            info->free_bytes / 1e6, info->cluster_bytes);
+    fprintf(out, "%-10s %8s %-8s %5s %9s %9s %9s %9s\n", "pattern", "op bytes", "vbuf", "ops", "MB/s", "p50 us",
+            "p99 us", "max us");
+    for (int i = 0; i < count; i++) {
+        const sd_bench_result_t *r = &results[i];
+        fprintf(out, "%-10s %8" PRIu32 " %-8s %5" PRIu32 " %9.3f %9" PRIu32 " %9" PRIu32 " %9" PRIu32 "\n",
+                pattern_names[r->pattern], r->op_bytes, vbuf_names[r->vbuf], r->ops, r->mb_per_s, r->p50_us,
+                r->p99_us, r->max_us);
+    }
+    int best = fastest_seq_write(results, count);
+    if (best >= 0) {
+        fprintf(out, "Fastest sequential write: %" PRIu32 " byte ops, %s buffering, %.3f MB/s\n",
+                results[best].op_bytes, vbuf_names[results[best].vbuf], results[best].mb_per_s);
+    }
+}
+
+esp_err_t sd_bench_render(const hal_storage_info_t *info, const sd_bench_result_t *results, int count,
+                          sd_bench_emit_t emit, void *ctx)
+{
+    char text[224];
+    int best = fastest_seq_write(results, count);
+    size_t len = snprintf(text, sizeof(text),
+                          "{\"total_bytes\":%" PRIu64 ",\"free_bytes\":%" PRIu64 ",\"cluster_bytes\":%" PRIu32 ","
+                          "\"full_vbuf_bytes\":%d,\"fastest_seq_write\":%d,\"results\":[",
+                          info->total_bytes, info->free_bytes, info->cluster_bytes, SD_BENCH_FULL_VBUF_SIZE, best);
+    esp_err_t ret = emit(ctx, text, len);
+    for (int i = 0; i < count && ret == ESP_OK; i++) {
+        const sd_bench_result_t *r = &results[i];
+        len = snprintf(text, sizeof(text),
+                       "%s{\"pattern\":\"%s\",\"op_bytes\":%" PRIu32 ",\"vbuf\":\"%s\",\"ops\":%" PRIu32 ","
+                       "\"mb_per_s\":%.4f,\"p50_us\":%" PRIu32 ",\"p99_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+                       i ? "," : "", pattern_names[r->pattern], r->op_bytes, vbuf_names[r->vbuf], r->ops,
+                       r->mb_per_s, r->p50_us, r->p99_us, r->max_us);
+        ret = emit(ctx, text, len);
+    }
+    if (ret == ESP_OK) {
+        ret = emit(ctx, "]}", 2);
+    }
+    return ret;
+}
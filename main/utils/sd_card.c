@@ -1,23 +1,43 @@
 
+#include <errno.h>
+#include <inttypes.h>
 #include "../includes/sd_card.h"
+#include "../includes/metrics.h"
+#include "../includes/trace.h"
+#include "../includes/hal.h"
+#include "../includes/sd_writer.h"
+#include "../includes/cbor.h"
+#include "esp_log.h"
 
 // Global variable definitions
-char logs[MAX_LOG_SIZE][MAX_CHAR_SIZE]; // Buffer for storing logs
-int log_size = 0;                       // Current size of the log buffer
 const char *TAGSD = "sd_card";
-highscore_t highscores[MAX_HIGHSCORES];
+result_t highscores[MAX_HIGHSCORES];
+
+// The table and one result being built hold references at once
+_Static_assert(USER_REFS - 1 > MAX_HIGHSCORES, "USER_REFS too small for the leaderboard");
+
+// Guards highscores[] and its version against readers on the web server tasks
+static portMUX_TYPE highscores_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t highscores_version = 0;
 
 esp_err_t s_write_file(const char *path, char *data)
 {
     ESP_LOGI(TAGSD, "Opening file %s", path);
-    FILE *f = fopen(path, "w");
+    TRACE_BEGIN("fopen");
+    FILE *f = hal_fopen(path, "w");
+    TRACE_END("fopen");
     if (f == NULL)
     {
         ESP_LOGE(TAGSD, "Failed to open file for writing");
         return ESP_FAIL;
     }
-    fprintf(f, data);
-    fclose(f);
+    int written = fprintf(f, data);
+    // Buffered data only reaches the card in fclose, so its result counts too
+    if (fclose(f) != 0 || written < 0)
+    {
+        ESP_LOGE(TAGSD, "Failed to write file: %s", strerror(errno));
+        return ESP_FAIL;
+    }
     ESP_LOGI(TAGSD, "File written");
 
     return ESP_OK;
@@ -26,7 +46,9 @@ esp_err_t s_write_file(const char *path, char *data)
 esp_err_t s_read_file(const char *path)
 {
     ESP_LOGI(TAGSD, "Reading file %s", path);
-    FILE *f = fopen(path, "r");
+    TRACE_BEGIN("fopen");
+    FILE *f = hal_fopen(path, "r");
+    TRACE_END("fopen");
     if (f == NULL)
     {
         ESP_LOGE(TAGSD, "Failed to open file for reading");
@@ -47,86 +69,193 @@ esp_err_t s_read_file(const char *path)
     return ESP_OK;
 }
 
+/* Leaderboard file
+ *
+ * One "dd/mm/yyyy score ppm" line per entry, followed by the player name if any, then a "#seq crc" trailer: the
+ * journal sequence number of the last result in the table and a CRC of the lines above it. The PPM always has
+ * a decimal point, which no name has, so lines from older firmware without it still read, with a PPM of 0.
+ * The file is rewritten in place, so a torn rewrite leaves new lines followed by old
+ * ones and an old trailer whose CRC no longer matches, or no trailer at all.
+ */
+#define HIGHSCORES_TRAILER_SIZE 24
+#define HIGHSCORES_LINE_SIZE (30 + USER_NAME_SIZE) // Date, BAC up to 65.535 and PPM up to 42949672.95
+_Static_assert(MAX_HIGHSCORES * HIGHSCORES_LINE_SIZE + HIGHSCORES_TRAILER_SIZE <= SD_SECTOR_SIZE,
+               "Highscore file does not fit a sector");
+
 // Function to load highscores from the file
-esp_err_t load_highscores(const char *file)
+esp_err_t load_highscores(const char *file, uint32_t *seq)
 {
-    for (int i = 0; i < MAX_HIGHSCORES; i++)
+    highscore_t table[MAX_HIGHSCORES];
+    memset(table, 0, sizeof(table));
+    if (seq != NULL)
     {
-        highscores[i].score = -1.0f;
-        memset(&highscores[i].date, 0, sizeof(struct tm));
+        *seq = 0;
     }
 
-    FILE *f = fopen(file, "r");
+    esp_err_t ret = ESP_OK;
+    TRACE_BEGIN("fopen");
+    FILE *f = hal_fopen(file, "r");
+    TRACE_END("fopen");
     if (f == NULL)
     {
         ESP_LOGW(TAGSD, "Highscore file not found, initializing empty table.");
-        memset(highscores, 0, sizeof(highscores));
-        return ESP_OK;
     }
-
-    for (int i = 0; i < MAX_HIGHSCORES; i++)
+    else
     {
-        int day, month, year;
-        if (fscanf(f, "%d/%d/%d %f", &day, &month, &year, &highscores[i].score) != 4)
+        // The whole file fits in the sector it is padded to, the padding ends the string
+        char text[SD_SECTOR_SIZE + 1];
+        size_t len = fread(text, 1, SD_SECTOR_SIZE, f);
+        text[len] = '\0';
+        fclose(f);
+
+        char *line = text;
+        for (int i = 0; i < MAX_HIGHSCORES; i++)
+        {
+            struct tm date = {0};
+            float score, ppm = 0;
+            int end = 0, next = 0;
+            if (sscanf(line, "%d/%d/%d %f%n", &date.tm_mday, &date.tm_mon, &date.tm_year, &score, &end) != 4)
+            {
+                break;
+            }
+            if (line[end] == ' ' && memchr(line + end + 1, '.', strcspn(line + end + 1, " \n")) != NULL &&
+                sscanf(line + end, " %f%n", &ppm, &next) == 1)
+            {
+                end += next;
+            }
+            if (line[end] == ' ')
+            {
+                sscanf(line + end + 1, "%12[-_A-Z0-9]", table[i].user);
+            }
+            // The file keeps the day, the entry gets its midnight
+            date.tm_mon -= 1;     // tm_mon is 0-based
+            date.tm_year -= 1900; // tm_year is years since 1900
+            date.tm_isdst = -1;
+            result_make(&table[i].result, mktime(&date), ppm, score, "");
+            line = strchr(line, '\n');
+            if (line == NULL)
+            {
+                break;
+            }
+            line++;
+        }
+
+        // Without a trailer the rewrite was torn before reaching it, or the file predates the journal
+        char *trailer = text[0] == '#' ? text : strstr(text, "\n#");
+        trailer = trailer != NULL && trailer != text ? trailer + 1 : trailer;
+        uint32_t file_seq, crc;
+        if (len > 0 && (trailer == NULL || sscanf(trailer, "#%" SCNu32 " %" SCNx32, &file_seq, &crc) != 2 ||
+                        crc != hal_crc32(0, text, trailer - text)))
+        {
+            ESP_LOGW(TAGSD, "Highscore file is damaged.");
+            ret = ESP_ERR_INVALID_CRC;
+        }
+        else if (seq != NULL && trailer != NULL)
+        {
+            *seq = file_seq;
+        }
+        if (ret == ESP_OK)
         {
-            break;
+            ESP_LOGI(TAGSD, "Highscores loaded successfully.");
         }
-        // Set the date fields
-        highscores[i].date.tm_mday = day;
-        highscores[i].date.tm_mon = month - 1;    // tm_mon is 0-based
-        highscores[i].date.tm_year = year - 1900; // tm_year is years since 1900
-        highscores[i].date.tm_hour = 0;
-        highscores[i].date.tm_min = 0;
-        highscores[i].date.tm_sec = 0;
     }
 
-    fclose(f);
-    ESP_LOGI(TAGSD, "Highscores loaded successfully.");
-    return ESP_OK;
+    // Swapped under the lock, copy_highscores() never sees an entry whose name slot was let go of. The old names
+    // are all released first, so the two tables never hold more than MAX_HIGHSCORES of them between them
+    int unnamed = 0;
+    portENTER_CRITICAL(&highscores_lock);
+    for (int i = 0; i < MAX_HIGHSCORES; i++)
+    {
+        user_unref(highscores[i].user);
+    }
+    for (int i = 0; i < MAX_HIGHSCORES; i++)
+    {
+        highscores[i] = table[i].result;
+        unnamed += user_ref(table[i].user, &highscores[i].user) != ESP_OK;
+    }
+    highscores_version++;
+    portEXIT_CRITICAL(&highscores_lock);
+    if (unnamed > 0)
+    {
+        ESP_LOGE(TAGSD, "Every name reference is taken, %d highscores loaded without their player", unnamed);
+    }
+    return ret;
 }
 
 // Function to save highscores to the file
-esp_err_t save_highscores(const char *file)
+esp_err_t save_highscores(const char *file, uint32_t seq)
 {
-    FILE *f = fopen(file, "w");
-    if (f == NULL)
-    {
-        ESP_LOGE(TAGSD, "Failed to open highscore file for adding.");
-        return ESP_FAIL;
-    }
-
+    int64_t start = hal_time_us();
+    char text[MAX_HIGHSCORES * HIGHSCORES_LINE_SIZE + HIGHSCORES_TRAILER_SIZE];
+    size_t len = 0;
     for (int i = 0; i < MAX_HIGHSCORES; i++)
     {
-        if (highscores[i].score > 0)
+        if (highscores[i].bac > 0)
         {
-            fprintf(f, "%02d/%02d/%04d %.2f\n",
-                    highscores[i].date.tm_mday,
-                    highscores[i].date.tm_mon + 1,
-                    highscores[i].date.tm_year + 1900,
-                    highscores[i].score);
+            struct tm date;
+            char user[USER_NAME_SIZE];
+            result_date(&highscores[i], &date);
+            user_ref_name(highscores[i].user, user);
+            len += snprintf(text + len, sizeof(text) - HIGHSCORES_TRAILER_SIZE - len, "%02d/%02d/%04d %u.%03u %" PRIu32 ".%02" PRIu32 "%s%s\n",
+                            date.tm_mday,
+                            date.tm_mon + 1,
+                            date.tm_year + 1900,
+                            highscores[i].bac / RESULT_BAC_SCALE,
+                            highscores[i].bac % RESULT_BAC_SCALE,
+                            highscores[i].ppm / RESULT_PPM_SCALE,
+                            highscores[i].ppm % RESULT_PPM_SCALE,
+                            user[0] != '\0' ? " " : "",
+                            user);
+            len = len < sizeof(text) - HIGHSCORES_TRAILER_SIZE ? len : sizeof(text) - HIGHSCORES_TRAILER_SIZE - 1;
         }
     }
+    len += snprintf(text + len, sizeof(text) - len, "#%" PRIu32 " %08" PRIx32 "\n", seq, hal_crc32(0, text, len));
 
-    fclose(f);
+    // Rewritten in place: the file keeps its cluster and is never truncated
+    if (sd_writer_replace(file, text, len) != ESP_OK)
+    {
+        ESP_LOGE(TAGSD, "Failed to write highscore file: %s", strerror(errno));
+        metrics_inc(METRIC_SD_WRITE_ERRORS);
+        return ESP_FAIL;
+    }
+    metrics_observe(METRIC_SD_SAVE_HIGHSCORES, hal_time_us() - start);
     ESP_LOGI(TAGSD, "Highscores saved successfully.");
     return ESP_OK;
 }
 
+void clear_highscores(void)
+{
+    portENTER_CRITICAL(&highscores_lock);
+    for (int i = 0; i < MAX_HIGHSCORES; i++)
+    {
+        user_unref(highscores[i].user);
+    }
+    memset(highscores, 0, sizeof(highscores));
+    highscores_version++;
+    portEXIT_CRITICAL(&highscores_lock);
+}
+
 // Function to add a new highscore
-void add_highscore(const char *file, struct tm date, float score)
+void add_highscore(const result_t *result)
 {
     for (int i = 0; i < MAX_HIGHSCORES; i++)
     {
-        if (score > highscores[i].score)
+        if (result->bac > highscores[i].bac)
         {
+            portENTER_CRITICAL(&highscores_lock);
+            user_unref(highscores[MAX_HIGHSCORES - 1].user); // Pushed off the table
             for (int j = MAX_HIGHSCORES - 1; j > i; j--)
             {
                 highscores[j] = highscores[j - 1];
             }
-            highscores[i].date = date;
-            highscores[i].score = score;
+            highscores[i] = *result;
+            user_ref_hold(result->user);
+            highscores_version++;
+            portEXIT_CRITICAL(&highscores_lock);
+            struct tm date;
+            result_date(result, &date);
             ESP_LOGI(TAGSD, "New highscore added: %02d/%02d/%04d - %.2f",
-                     date.tm_mday, date.tm_mon + 1, date.tm_year + 1900, score);
+                     date.tm_mday, date.tm_mon + 1, date.tm_year + 1900, result_bac(result));
             return;
         }
     }
@@ -138,72 +267,163 @@ void display_highscores(void)
     ESP_LOGI(TAGSD, "Highscore Table:");
     for (int i = 0; i < MAX_HIGHSCORES; i++)
     {
-        if (highscores[i].score > 0)
+        if (highscores[i].bac > 0)
         {
+            struct tm date;
+            result_date(&highscores[i], &date);
             ESP_LOGI(TAGSD, "%d. %02d/%02d/%04d - %.2f", i + 1,
-                     highscores[i].date.tm_mday,
-                     highscores[i].date.tm_mon + 1,
-                     highscores[i].date.tm_year + 1900,
-                     highscores[i].score);
+                     date.tm_mday,
+                     date.tm_mon + 1,
+                     date.tm_year + 1900,
+                     result_bac(&highscores[i]));
         }
     }
 }
 
-void add_log(float ppm, float bac)
+uint32_t get_highscores_version(void)
 {
-    struct tm tm_info = get_date();
-    if (log_size >= MAX_LOG_SIZE)
+    portENTER_CRITICAL(&highscores_lock);
+    uint32_t version = highscores_version;
+    portEXIT_CRITICAL(&highscores_lock);
+    return version;
+}
+
+uint32_t copy_highscores(highscore_t out[MAX_HIGHSCORES])
+{
+    // The names are looked up under the lock, a reference let go of after it could name someone else
+    portENTER_CRITICAL(&highscores_lock);
+    for (int i = 0; i < MAX_HIGHSCORES; i++)
     {
-        ESP_LOGW(TAGSD, "Log buffer is full, saving log.");
-        // TODO: Implement saving all logs to file
+        out[i].result = highscores[i];
+        user_ref_name(highscores[i].user, out[i].user);
     }
-    sprintf(logs[log_size], "%02d/%02d/%04d %02d:%02d:%02d - PPM: %.2f, BAC: %.3f\n",
-            tm_info.tm_mday, tm_info.tm_mon + 1, tm_info.tm_year + 1900,
-            tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec, ppm, bac);
-    log_size++;
+    uint32_t version = highscores_version;
+    portEXIT_CRITICAL(&highscores_lock);
+    return version;
 }
 
-esp_err_t save_log(const char *file, char *msg)
+size_t highscores_to_json(const highscore_t table[MAX_HIGHSCORES], int first, int limit, char *buf, size_t len)
 {
-    FILE *f = fopen(file, "a");
-    if (f == NULL)
+    size_t pos = snprintf(buf, len, "[");
+    for (int i = first; i < MAX_HIGHSCORES && i - first < limit; i++)
+    {
+        if (table[i].result.bac > 0)
+        {
+            struct tm date;
+            result_date(&table[i].result, &date);
+            pos += snprintf(buf + (pos < len ? pos : len), pos < len ? len - pos : 0,
+                            "%s{\"date\":\"%02d-%02d-%04d\",\"score\":%u.%03u%s%s%s}",
+                            pos > 1 ? "," : "",
+                            date.tm_mday, date.tm_mon + 1, date.tm_year + 1900,
+                            table[i].result.bac / RESULT_BAC_SCALE, table[i].result.bac % RESULT_BAC_SCALE,
+                            table[i].user[0] != '\0' ? ",\"user\":\"" : "", table[i].user,
+                            table[i].user[0] != '\0' ? "\"" : "");
+        }
+    }
+    pos += snprintf(buf + (pos < len ? pos : len), pos < len ? len - pos : 0, "]");
+    return pos;
+}
+
+size_t highscores_to_cbor(const highscore_t table[MAX_HIGHSCORES], int first, int limit, uint8_t *buf, size_t len)
+{
+    cbor_writer_t w;
+    int count = 0;
+    for (int i = first; i < MAX_HIGHSCORES && i - first < limit; i++)
+    {
+        count += table[i].result.bac > 0;
+    }
+    cbor_init(&w, buf, len);
+    cbor_array(&w, count);
+    for (int i = first; i < MAX_HIGHSCORES && i - first < limit; i++)
+    {
+        if (table[i].result.bac > 0)
+        {
+            struct tm tm_info;
+            char date[36];
+            result_date(&table[i].result, &tm_info);
+            snprintf(date, sizeof(date), "%02d-%02d-%04d", tm_info.tm_mday, tm_info.tm_mon + 1,
+                     tm_info.tm_year + 1900);
+            cbor_map(&w, table[i].user[0] != '\0' ? 3 : 2);
+            cbor_text(&w, "date");
+            cbor_text(&w, date);
+            cbor_text(&w, "score");
+            cbor_uint(&w, table[i].result.bac);
+            if (table[i].user[0] != '\0')
+            {
+                cbor_text(&w, "user");
+                cbor_text(&w, table[i].user);
+            }
+        }
+    }
+    return w.pos;
+}
+
+// The log stays open between tests, see sd_writer.h
+static sd_writer_t log_writer;
+
+esp_err_t open_log(const char *file)
+{
+    if (log_writer.f != NULL && strcmp(log_writer.path, file) != 0)
+    {
+        sd_writer_close(&log_writer);
+    }
+    if (log_writer.f == NULL && sd_writer_open(&log_writer, file) != ESP_OK)
     {
         ESP_LOGE(TAGSD, "Failed to open log file for adding.");
+        metrics_inc(METRIC_SD_WRITE_ERRORS);
         return ESP_FAIL;
     }
+    return ESP_OK;
+}
 
-    fprintf(f, "%s", msg);
+esp_err_t save_log(const char *file, char *msg)
+{
+    int64_t start = hal_time_us();
+    if (open_log(file) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
 
-    fclose(f);
+    // A failed append closes the writer, the next save opens the file again
+    if (sd_writer_append(&log_writer, msg, strlen(msg)) != ESP_OK)
+    {
+        ESP_LOGE(TAGSD, "Failed to write log file: %s", strerror(errno));
+        metrics_inc(METRIC_SD_WRITE_ERRORS);
+        return ESP_FAIL;
+    }
+    metrics_observe(METRIC_SD_SAVE_LOG, hal_time_us() - start);
     ESP_LOGI(TAGSD, "Log saved successfully.");
 
-    log_size = 0; // Reset log size after saving
-    msg= '\0'; // Clear the log buffer
-
     return ESP_OK;
 }
 
-void sync_clock()
+long log_data_end(const char *file)
 {
-    esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
-    esp_netif_sntp_init(&config);
-    if (esp_netif_sntp_sync_wait(pdMS_TO_TICKS(10000)) != ESP_OK) {
-        ESP_LOGW(TAGSD, "Failed to update system time within 10s, timestamps will be wrong!");
+    if (log_writer.f != NULL && strcmp(log_writer.path, file) == 0)
+    {
+        return log_writer.end;
+    }
+    FILE *f = hal_fopen(file, "r");
+    if (f == NULL)
+    {
+        return -1;
     }
-    ESP_LOGI(TAGSD, "Current timestamp: %lld", time(NULL));
+    long end = sd_writer_data_end(f);
+    fclose(f);
+    return end;
 }
 
-struct tm get_date(void)
+esp_err_t clear_log(const char *file)
 {
-    time_t now = time(NULL);
-    struct tm tm_info;
-    if (now == (time_t)-1 || localtime_r(&now, &tm_info) == NULL)
-    {
-        // handle error, set to a default date
-        memset(&tm_info, 0, sizeof(tm_info));
-        tm_info.tm_year = 70;  // 1970
-        tm_info.tm_mon = 0;    // January
-        tm_info.tm_mday = 1;   // 1st day
-    }
-    return tm_info;
-}
\ No newline at end of file
+    if (log_writer.f != NULL && strcmp(log_writer.path, file) != 0)
+    {
+        sd_writer_close(&log_writer);
+    }
+    if ((log_writer.f == NULL && sd_writer_open(&log_writer, file) != ESP_OK) || sd_writer_rewind(&log_writer) != ESP_OK)
+    {
+        ESP_LOGE(TAGSD, "Failed to clear the log file.");
+        metrics_inc(METRIC_SD_WRITE_ERRORS);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
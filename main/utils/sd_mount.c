@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string.h>
+#include "../includes/sd_mount.h"
+#include "../includes/sd_card.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_vfs_fat.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "driver/sdspi_host.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "sd_mount";
+
+#define NVS_NAMESPACE "sd"
+#define NVS_KEY_FREQ "freq_khz"
+#define NVS_KEY_SERIAL "serial"
+
+#define PROBE_TRANSFER_SECTORS (SD_MAX_TRANSFER_SIZE / SD_SECTOR_SIZE)
+#define PROBE_TRANSFERS 2 // Spans more than one multi-block read
+
+// Clocks tried from the top, SDMMC_FREQ_DEFAULT is where the card used to be mounted
+static const int clock_steps_khz[] = { 40000, 26000, SDMMC_FREQ_DEFAULT, 10000, 5000, 1000, SDMMC_FREQ_PROBING };
+#define CLOCK_STEP_COUNT (sizeof(clock_steps_khz) / sizeof(clock_steps_khz[0]))
+
+static bool background_format; // format_if_mount_failed of the sd_mount_background() caller
+
+static void load_saved_clock(uint32_t *freq_khz, uint32_t *serial)
+{
+    nvs_handle_t nvs;
+    *freq_khz = 0;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_u32(nvs, NVS_KEY_SERIAL, serial) != ESP_OK || nvs_get_u32(nvs, NVS_KEY_FREQ, freq_khz) != ESP_OK) {
+        *freq_khz = 0;
+    }
+    nvs_close(nvs);
+}
+
+static void save_clock(uint32_t freq_khz, uint32_t serial)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not open NVS, the clock is probed again next boot");
+        return;
+    }
+    if (nvs_set_u32(nvs, NVS_KEY_SERIAL, serial) != ESP_OK || nvs_set_u32(nvs, NVS_KEY_FREQ, freq_khz) != ESP_OK ||
+        nvs_commit(nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not save the SD clock to NVS");
+    }
+    nvs_close(nvs);
+}
+
+/* Raw read check
+ *
+ * Reads the first sectors of the card twice in SD_MAX_TRANSFER_SIZE transfers and
+ * compares the passes. They hold the partition table and the space reserved before
+ * the first partition, so nothing is written and the check runs before the filesystem
+ * is mounted. Every block also carries the SPI data CRC, so a clock the card cannot
+ * keep up with fails on a CRC error or on a mismatch between the passes.
+ */
+static esp_err_t read_check(sdmmc_card_t *card)
+{
+    uint8_t *buffer = heap_caps_malloc(SD_MAX_TRANSFER_SIZE, MALLOC_CAP_DMA);
+    if (buffer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    uint32_t crc[PROBE_TRANSFERS];
+    esp_err_t ret = ESP_OK;
+    for (int pass = 0; pass < 2 && ret == ESP_OK; pass++) {
+        for (int t = 0; t < PROBE_TRANSFERS && ret == ESP_OK; t++) {
+            ret = sdmmc_read_sectors(card, buffer, t * PROBE_TRANSFER_SECTORS, PROBE_TRANSFER_SECTORS);
+            uint32_t sum = esp_rom_crc32_le(0, buffer, SD_MAX_TRANSFER_SIZE);
+            if (ret == ESP_OK && pass == 0) {
+                crc[t] = sum;
+            } else if (ret == ESP_OK && crc[t] != sum) {
+                ret = ESP_ERR_INVALID_RESPONSE;
+            }
+        }
+    }
+    heap_caps_free(buffer);
+    return ret;
+}
+
+// Initialise the card at one clock without mounting it, then run the read check when asked to
+static esp_err_t check_clock(int freq_khz, bool verify, uint32_t *serial)
+{
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    host.max_freq_khz = freq_khz;
+    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
+    slot_config.gpio_cs = PIN_NUM_CS;
+    slot_config.host_id = host.slot;
+
+    esp_err_t ret = sdspi_host_init();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    sdspi_dev_handle_t handle;
+    ret = sdspi_host_init_device(&slot_config, &handle);
+    if (ret == ESP_OK) {
+        sdmmc_card_t card;
+        host.slot = handle;
+        ret = sdmmc_card_init(&host, &card);
+        if (ret == ESP_OK) {
+            *serial = (uint32_t)card.cid.serial;
+            if (verify) {
+                ret = read_check(&card);
+            }
+        }
+        sdspi_host_remove_device(handle);
+    }
+    sdspi_host_deinit();
+    return ret;
+}
+
+static esp_err_t mount_at(int freq_khz, bool format_if_mount_failed, sdmmc_card_t **card)
+{
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+        .format_if_mount_failed = format_if_mount_failed,
+        .max_files = 7, // Two are held by the log and journal writers
+        .allocation_unit_size = SD_ALLOCATION_UNIT
+    };
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    host.max_freq_khz = freq_khz;
+
+    // This initializes the slot without card detect (CD) and write protect (WP) signals.
+    // Modify slot_config.gpio_cd and slot_config.gpio_wp if your board has these signals.
+    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
+    slot_config.gpio_cs = PIN_NUM_CS;
+    slot_config.host_id = host.slot;
+
+    return esp_vfs_fat_sdspi_mount(MOUNT_POINT, &host, &slot_config, &mount_config, card);
+}
+
+esp_err_t sd_mount(sdmmc_card_t **card, bool format_if_mount_failed)
+{
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    spi_bus_config_t bus_cfg = {
+        .mosi_io_num = PIN_NUM_MOSI,
+        .miso_io_num = PIN_NUM_MISO,
+        .sclk_io_num = PIN_NUM_CLK,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = SD_MAX_TRANSFER_SIZE,
+    };
+    esp_err_t ret = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to initialize bus (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    uint32_t saved_khz, saved_serial = 0;
+    load_saved_clock(&saved_khz, &saved_serial);
+
+    int top = 0;
+    while (top < CLOCK_STEP_COUNT - 1 && clock_steps_khz[top] > CONFIG_SD_SPI_MAX_FREQ_KHZ) {
+        top++;
+    }
+    int step = top;
+    while (saved_khz != 0 && step < CLOCK_STEP_COUNT - 1 && clock_steps_khz[step] > saved_khz) {
+        step++;
+    }
+
+    // The saved clock is trusted without the read check as long as the card it was found for is inserted
+    bool verify = saved_khz == 0;
+    bool fallback = false; // A clock failed, the card is only mounted from here on, never formatted
+    uint32_t serial = 0;
+    while (true) {
+        ESP_LOGI(TAG, "Checking the card at %d kHz", clock_steps_khz[step]);
+        ret = check_clock(clock_steps_khz[step], verify, &serial);
+        if (ret == ESP_OK && saved_khz != 0 && serial != saved_serial) {
+            // The saved clock belongs to another card, check this one from the top
+            ESP_LOGI(TAG, "Different card, probing its clock");
+            saved_khz = 0;
+            verify = true;
+            step = top;
+            continue;
+        }
+        if (ret == ESP_OK || ret == ESP_ERR_NO_MEM || step == CLOCK_STEP_COUNT - 1) {
+            break;
+        }
+        ESP_LOGW(TAG, "Card check at %d kHz failed (%s)", clock_steps_khz[step], esp_err_to_name(ret));
+        verify = true;
+        fallback = true;
+        step++;
+    }
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Mounting at %d kHz", clock_steps_khz[step]);
+        ret = mount_at(clock_steps_khz[step], format_if_mount_failed && !fallback, card);
+        if (ret != ESP_OK && format_if_mount_failed && fallback) {
+            ESP_LOGE(TAG, "Not formatting a card that failed a clock check, format it on a PC if it has no FAT");
+        }
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mount the card (%s). "
+                 "Make sure SD card lines have pull-up resistors in place.", esp_err_to_name(ret));
+        spi_bus_free(host.slot);
+        return ret;
+    }
+
+    if (saved_khz != (uint32_t)clock_steps_khz[step] || serial != saved_serial) {
+        save_clock(clock_steps_khz[step], serial);
+    }
+    ESP_LOGI(TAG, "Card mounted at %d kHz (asked for %d kHz), %d byte transfers",
+             (*card)->real_freq_khz, clock_steps_khz[step], SD_MAX_TRANSFER_SIZE);
+    return ESP_OK;
+}
+
+static void mount_task(void *arg)
+{
+    sdmmc_card_t **card = arg;
+    while (sd_mount(card, background_format) != ESP_OK) {
+        vTaskDelay(pdMS_TO_TICKS(SD_MOUNT_RETRY_MS));
+    }
+    ESP_LOGI(TAG, "Card inserted and mounted");
+    sdmmc_card_print_info(stdout, *card);
+    vTaskDelete(NULL);
+}
+
+void sd_mount_background(sdmmc_card_t **card, bool format_if_mount_failed)
+{
+    background_format = format_if_mount_failed;
+    if (xTaskCreate(mount_task, "sd_mount", 4096, card, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the mount task, insert a card and reset");
+    }
+}
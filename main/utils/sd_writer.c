@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../includes/sd_writer.h"
+#include "../includes/sd_card.h"
+#include "../includes/metrics.h"
+#include "../includes/trace.h"
+#include "../includes/hal.h"
+#include "esp_log.h"
+
+static const char *TAG = "sd_writer";
+
+static const char zero_sector[SD_SECTOR_SIZE];
+
+/* Finding the data
+ *
+ * The padding is only ever at the tail, so walk back one sector at a time until a
+ * sector holds something other than NULs.
+ */
+long sd_writer_data_end(FILE *f)
+{
+    char sector[SD_SECTOR_SIZE];
+    if (fseek(f, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    long end = ftell(f);
+    while (end > 0) {
+        long start = (end - 1) / SD_SECTOR_SIZE * SD_SECTOR_SIZE;
+        size_t len = end - start;
+        if (fseek(f, start, SEEK_SET) != 0 || fread(sector, 1, len, f) != len) {
+            return -1;
+        }
+        while (len > 0 && sector[len - 1] == '\0') {
+            len--;
+        }
+        if (len > 0) {
+            return start + len;
+        }
+        end = start;
+    }
+    return end;
+}
+
+// Grow the file with whole chunks of padding until it holds need bytes
+static esp_err_t extend(sd_writer_t *w, long need)
+{
+    long size = (need + SD_WRITER_CHUNK_SIZE - 1) / SD_WRITER_CHUNK_SIZE * SD_WRITER_CHUNK_SIZE;
+    int64_t start = hal_time_us();
+    if (fseek(w->f, w->size, SEEK_SET) != 0) {
+        return ESP_FAIL;
+    }
+    // The first piece brings an unaligned size written by older firmware back to a sector boundary
+    for (long pos = w->size; pos < size; ) {
+        size_t len = SD_SECTOR_SIZE - pos % SD_SECTOR_SIZE;
+        if (fwrite(zero_sector, 1, len, w->f) != len) {
+            return ESP_FAIL;
+        }
+        pos += len;
+    }
+    if (hal_fsync(w->f) != 0) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Extended %s to %ld bytes in %lld us", w->path, size, (long long)(hal_time_us() - start));
+    w->size = size;
+    metrics_inc(METRIC_SD_PREALLOCATIONS);
+    return ESP_OK;
+}
+
+// Write the padding back over the data in [from, to) and push it to the card. The last byte goes first: a
+// record that loses its newline and then only part of the rest is still found torn and padded over on open
+static bool pad(sd_writer_t *w, long from, long to)
+{
+    clearerr(w->f);
+    bool ok = to <= from || (fseek(w->f, to - 1, SEEK_SET) == 0 && fputc('\0', w->f) == 0 && hal_fsync(w->f) == 0);
+    ok = ok && fseek(w->f, from, SEEK_SET) == 0;
+    for (long pos = from; pos < to - 1 && ok; ) {
+        size_t len = to - 1 - pos < SD_SECTOR_SIZE ? to - 1 - pos : SD_SECTOR_SIZE;
+        ok = fwrite(zero_sector, 1, len, w->f) == len;
+        pos += len;
+    }
+    return ok && hal_fsync(w->f) == 0;
+}
+
+esp_err_t sd_writer_open(sd_writer_t *w, const char *path)
+{
+    memset(w, 0, sizeof(*w));
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    TRACE_BEGIN("fopen");
+    w->f = hal_fopen(path, "r+");
+    if (w->f == NULL && errno == ENOENT) {
+        w->f = hal_fopen(path, "w+");
+    }
+    TRACE_END("fopen");
+    w->buf = hal_dma_alloc(SD_WRITER_BUF_SIZE);
+    if (w->f == NULL || w->buf == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        sd_writer_close(w);
+        return ESP_FAIL;
+    }
+    setvbuf(w->f, w->buf, _IOFBF, SD_WRITER_BUF_SIZE);
+
+    w->end = sd_writer_data_end(w->f);
+    if (w->end < 0 || fseek(w->f, 0, SEEK_END) != 0) {
+        ESP_LOGE(TAG, "Failed to read %s", path);
+        sd_writer_close(w);
+        return ESP_FAIL;
+    }
+    w->size = ftell(w->f);
+
+    // A record torn by a reset or a failed append ends without a newline, what is left of it is padded over
+    long keep = w->end;
+    bool ok = true;
+    for (int c = 0; ok && keep > 0 && c != '\n'; ) {
+        ok = fseek(w->f, keep - 1, SEEK_SET) == 0 && (c = fgetc(w->f)) != EOF;
+        keep -= ok && c != '\n';
+    }
+    if (!ok || (keep < w->end && !pad(w, keep, w->end))) {
+        ESP_LOGE(TAG, "Failed to pad over the torn record in %s", path);
+        sd_writer_close(w);
+        return ESP_FAIL;
+    }
+    if (keep < w->end) {
+        ESP_LOGW(TAG, "Padded over %ld bytes of a torn record in %s", w->end - keep, path);
+        w->end = keep;
+    }
+    ESP_LOGI(TAG, "Opened %s, %ld of %ld bytes used", path, w->end, w->size);
+    return ESP_OK;
+}
+
+esp_err_t sd_writer_append(sd_writer_t *w, const char *data, size_t len)
+{
+    // Keep at least one NUL after the data so the end can be found
+    bool ok = w->end + (long)len < w->size || extend(w, w->end + len + 1) == ESP_OK;
+    ok = ok && fseek(w->f, w->end, SEEK_SET) == 0;
+    bool attempted = ok;
+    ok = ok && fwrite(data, 1, len, w->f) == len;
+    ok = ok && hal_fsync(w->f) == 0;
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to append to %s: %s", w->path, strerror(errno));
+        // Some or all of the data can be on the card all the same
+        if (attempted && !pad(w, w->end, w->end + (long)len)) {
+            ESP_LOGW(TAG, "Could not take back the failed append to %s", w->path);
+        }
+        sd_writer_close(w);
+        return ESP_FAIL;
+    }
+    w->end += len;
+    return ESP_OK;
+}
+
+/* Starting over
+ *
+ * The data is overwritten with NULs front to back, a reset half way leaves the newest
+ * data in place and the file reads as if it had only lost its oldest lines.
+ */
+esp_err_t sd_writer_rewind(sd_writer_t *w)
+{
+    bool ok = fseek(w->f, 0, SEEK_SET) == 0;
+    for (long pos = 0; pos < w->end && ok; ) {
+        size_t len = w->end - pos < SD_SECTOR_SIZE ? w->end - pos : SD_SECTOR_SIZE;
+        ok = fwrite(zero_sector, 1, len, w->f) == len;
+        pos += len;
+    }
+    ok = ok && hal_fsync(w->f) == 0;
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to rewind %s: %s", w->path, strerror(errno));
+        sd_writer_close(w);
+        return ESP_FAIL;
+    }
+    w->end = 0;
+    return ESP_OK;
+}
+
+void sd_writer_close(sd_writer_t *w)
+{
+    if (w->f != NULL) {
+        fclose(w->f);
+        w->f = NULL;
+    }
+    free(w->buf);
+    w->buf = NULL;
+}
+
+esp_err_t sd_writer_replace(const char *path, const char *data, size_t len)
+{
+    TRACE_BEGIN("fopen");
+    FILE *f = hal_fopen(path, "r+");
+    if (f == NULL && errno == ENOENT) {
+        f = hal_fopen(path, "w");
+    }
+    TRACE_END("fopen");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+
+    // Unbuffered: data and padding go to the filesystem as one write per piece, no stdio copy
+    setvbuf(f, NULL, _IONBF, 0);
+    // An empty file still gets a sector of NULs to cover whatever was there before
+    size_t padding = len % SD_SECTOR_SIZE != 0 || len == 0 ? SD_SECTOR_SIZE - len % SD_SECTOR_SIZE : 0;
+    bool ok = fwrite(data, 1, len, f) == len;
+    ok = ok && (padding == 0 || fwrite(zero_sector, 1, padding, f) == padding);
+    ok = ok && hal_fsync(f) == 0;
+    ok = fclose(f) == 0 && ok;
+    return ok ? ESP_OK : ESP_FAIL;
+}
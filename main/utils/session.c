@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../includes/session.h"
+#include "../includes/sd_writer.h"
+#include "../includes/journal.h"
+#include "../includes/hal.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+static const char *TAG = "session";
+
+#define SESSION_FILE_BYTES (CONFIG_SESSION_FILE_KB * 1024)
+
+#define NVS_NAMESPACE "session"
+#define NVS_KEY_UNSET "unset" // Last id given with the clock unset
+
+// The main task records and saves, HTTP handlers look sessions up
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+static session_t ring[SESSION_RING_SIZE];
+static uint32_t recorded;    // Sessions recorded since boot, the newest is ring[(recorded - 1) % size]
+static uint32_t saved;       // Sessions written to the card, only the main task touches it
+static int64_t retry_us;     // A failed write waits until then
+static sd_writer_t samples;
+static uint32_t unset_id;    // Last id given with the clock unset, only the main task touches it
+
+time_t session_unset_id(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret == ESP_OK) {
+        uint32_t stored;
+        unset_id = nvs_get_u32(nvs, NVS_KEY_UNSET, &stored) == ESP_OK && stored > unset_id ? stored : unset_id;
+        ret = nvs_set_u32(nvs, NVS_KEY_UNSET, unset_id + 1);
+        ret = ret == ESP_OK ? nvs_commit(nvs) : ret;
+        nvs_close(nvs);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Could not save the session id (%s), ids may repeat after a reset", esp_err_to_name(ret));
+    }
+    return ++unset_id;
+}
+
+void session_record(const measurement_t *m, time_t id)
+{
+    session_t s = {
+        .id = id,
+        .rs_air = m->rs_air,
+        .ppm = m->ppm,
+        .bac = m->bac,
+        .interval_ms = CAPTURE_PERIOD_MS,
+        .count = m->count,
+    };
+    for (int i = 0; i < m->count; i++) {
+        float q = m->ratios[i] * SESSION_RATIO_SCALE + 0.5f;
+        s.ratio[i] = q <= 0 ? 0 : q >= UINT16_MAX ? UINT16_MAX : (uint16_t)q;
+    }
+
+    portENTER_CRITICAL(&ring_lock);
+    ring[recorded % SESSION_RING_SIZE] = s;
+    recorded++;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+// "crc id rs_air ppm bac interval count ratios", the ratios as four hex digits each
+static size_t format_line(const session_t *s, char line[SESSION_LINE_SIZE])
+{
+    char body[SESSION_LINE_SIZE];
+    int len = snprintf(body, sizeof(body), "%lld %.3f %.2f %.3f %u %u ", (long long)s->id, s->rs_air, s->ppm,
+                       s->bac, s->interval_ms, s->count);
+    for (int i = 0; i < s->count && len + 6 < (int)sizeof(body); i++) {
+        len += snprintf(body + len, sizeof(body) - len, "%04x", s->ratio[i]);
+    }
+    len += snprintf(body + len, sizeof(body) - len, "\n");
+    return snprintf(line, SESSION_LINE_SIZE, "%08" PRIx32 " %s", hal_crc32(0, body, len), body);
+}
+
+static bool parse_line(const char *line, session_t *s)
+{
+    uint32_t crc;
+    int body = 0, ratios = 0;
+    long long id;
+    unsigned interval, count;
+    if (sscanf(line, "%8" SCNx32 " %n", &crc, &body) != 1 || body == 0 ||
+        hal_crc32(0, line + body, strlen(line + body)) != crc ||
+        sscanf(line + body, "%lld %f %f %f %u %u %n", &id, &s->rs_air, &s->ppm, &s->bac, &interval, &count,
+               &ratios) != 6 || ratios == 0 || count > CAPTURE_SAMPLES) {
+        return false;
+    }
+    s->id = (time_t)id;
+    s->interval_ms = interval;
+    s->count = count;
+    const char *hex = line + body + ratios;
+    for (unsigned i = 0; i < count; i++) {
+        unsigned value;
+        if (sscanf(hex + i * 4, "%4x", &value) != 1) {
+            return false;
+        }
+        s->ratio[i] = value;
+    }
+    return true;
+}
+
+// A full file becomes the old one, whatever the old one held is dropped
+static esp_err_t rotate(void)
+{
+    sd_writer_close(&samples);
+    hal_remove(SESSION_FILE_OLD);
+    if (hal_rename(SESSION_FILE, SESSION_FILE_OLD) != 0) {
+        ESP_LOGE(TAG, "Failed to rotate %s", SESSION_FILE);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t save(const session_t *s)
+{
+    char line[SESSION_LINE_SIZE];
+    size_t len = format_line(s, line);
+    if (samples.f == NULL && sd_writer_open(&samples, SESSION_FILE) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (samples.end + (long)len > SESSION_FILE_BYTES &&
+        (rotate() != ESP_OK || sd_writer_open(&samples, SESSION_FILE) != ESP_OK)) {
+        return ESP_FAIL;
+    }
+    return sd_writer_append(&samples, line, len);
+}
+
+void session_poll(void)
+{
+    if (saved == recorded || hal_time_us() < retry_us) {
+        return;
+    }
+    // Sessions pushed out of the ring before they could be saved are gone
+    uint32_t newest = recorded;
+    if (newest - saved > SESSION_RING_SIZE) {
+        ESP_LOGW(TAG, "%" PRIu32 " sessions were never saved", newest - saved - SESSION_RING_SIZE);
+        saved = newest - SESSION_RING_SIZE;
+    }
+    while (saved != newest) {
+        session_t s;
+        portENTER_CRITICAL(&ring_lock);
+        s = ring[saved % SESSION_RING_SIZE];
+        portEXIT_CRITICAL(&ring_lock);
+        if (save(&s) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to save session %lld, retrying later", (long long)s.id);
+            retry_us = hal_time_us() + JOURNAL_RETRY_S * 1000000LL;
+            return;
+        }
+        saved++;
+    }
+}
+
+static bool find_in_file(const char *path, time_t id, session_t *out)
+{
+    FILE *f = hal_fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    // The file is padded past its data, see sd_writer.h
+    long end = sd_writer_data_end(f);
+    bool found = false;
+    char line[SESSION_LINE_SIZE];
+    if (end > 0 && fseek(f, 0, SEEK_SET) == 0) {
+        while (!found && ftell(f) < end && fgets(line, sizeof(line), f) != NULL) {
+            found = parse_line(line, out) && out->id == id;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+esp_err_t session_find(time_t id, session_t *out)
+{
+    bool found = false;
+    portENTER_CRITICAL(&ring_lock);
+    uint32_t kept = recorded < SESSION_RING_SIZE ? recorded : SESSION_RING_SIZE;
+    for (uint32_t i = 0; i < kept && !found; i++) {
+        const session_t *s = &ring[(recorded - 1 - i) % SESSION_RING_SIZE];
+        if (s->id == id) {
+            *out = *s;
+            found = true;
+        }
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (found || find_in_file(SESSION_FILE, id, out) || find_in_file(SESSION_FILE_OLD, id, out)) {
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE // fopencookie, in both glibc and newlib
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "../includes/storage_fault.h"
+#include "../includes/hal.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#ifdef CONFIG_STORAGE_FAULT_INJECT
+
+static const char *TAG = "storage_fault";
+
+// The cookie callback types differ between newlib and glibc
+#if defined(ESP_PLATFORM)
+typedef _READ_WRITE_RETURN_TYPE cookie_ssize_t;
+#ifdef __LARGE64_FILES
+typedef _off64_t cookie_off_t;
+#else
+typedef off_t cookie_off_t;
+#endif
+#else
+typedef ssize_t cookie_ssize_t;
+typedef off64_t cookie_off_t;
+#endif
+
+static portMUX_TYPE fault_lock = portMUX_INITIALIZER_UNLOCKED;
+static storage_fault_config_t fault_config;
+static storage_fault_stats_t fault_stats;
+static bool fault_enabled = false;
+static bool fault_suspended = false;
+static bool fault_ejected = false;
+static uint32_t fault_random = 1;
+static uint32_t fault_written = 0; // Bytes written since the last configure, for enospc_after
+
+// xorshift32, only called with fault_lock held
+static bool roll(uint32_t pct)
+{
+    if (pct == 0 || fault_suspended) {
+        return false;
+    }
+    fault_random ^= fault_random << 13;
+    fault_random ^= fault_random >> 17;
+    fault_random ^= fault_random << 5;
+    return fault_random % 100 < pct;
+}
+
+void storage_fault_configure(const storage_fault_config_t *config)
+{
+    static const storage_fault_config_t off = { 0 };
+    portENTER_CRITICAL(&fault_lock);
+    fault_config = *config;
+    fault_enabled = memcmp(config, &off, sizeof(off)) != 0;
+    fault_random = config->seed != 0 ? config->seed : 1;
+    fault_written = 0;
+    memset(&fault_stats, 0, sizeof(fault_stats));
+    portEXIT_CRITICAL(&fault_lock);
+    ESP_LOGW(TAG, "Storage faults %s: latency %" PRIu32 " ms, stall %" PRIu32 "%% x %" PRIu32 " ms, "
+             "ENOSPC after %" PRIu32 " B, EIO %" PRIu32 "%%, torn %" PRIu32 "%%",
+             fault_enabled ? "on" : "off", config->latency_ms, config->stall_pct, config->stall_ms,
+             config->enospc_after, config->eio_pct, config->torn_pct);
+}
+
+void storage_fault_suspend(bool suspend)
+{
+    portENTER_CRITICAL(&fault_lock);
+    fault_suspended = suspend;
+    portEXIT_CRITICAL(&fault_lock);
+}
+
+void storage_fault_eject(bool ejected)
+{
+    portENTER_CRITICAL(&fault_lock);
+    fault_ejected = ejected;
+    portEXIT_CRITICAL(&fault_lock);
+    ESP_LOGW(TAG, "Card %s", ejected ? "ejected" : "inserted");
+}
+
+void storage_fault_get(storage_fault_config_t *config, storage_fault_stats_t *stats)
+{
+    portENTER_CRITICAL(&fault_lock);
+    *config = fault_config;
+    *stats = fault_stats;
+    portEXIT_CRITICAL(&fault_lock);
+}
+
+esp_err_t storage_fault_parse(const char *spec, storage_fault_config_t *config)
+{
+    static const struct {
+        const char *key;
+        size_t offset;
+        bool percent;
+    } keys[] = {
+        { "latency_ms", offsetof(storage_fault_config_t, latency_ms), false },
+        { "stall_pct", offsetof(storage_fault_config_t, stall_pct), true },
+        { "stall_ms", offsetof(storage_fault_config_t, stall_ms), false },
+        { "enospc_after", offsetof(storage_fault_config_t, enospc_after), false },
+        { "eio_pct", offsetof(storage_fault_config_t, eio_pct), true },
+        { "torn_pct", offsetof(storage_fault_config_t, torn_pct), true },
+        { "seed", offsetof(storage_fault_config_t, seed), false },
+    };
+
+    while (*spec != '\0') {
+        size_t len = strcspn(spec, ",&");
+        const char *eq = memchr(spec, '=', len);
+        if (eq == NULL) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        size_t key_len = eq - spec;
+        char *end;
+        unsigned long value = strtoul(eq + 1, &end, 10);
+        if (end != spec + len || end == eq + 1) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        size_t i = 0;
+        while (i < sizeof(keys) / sizeof(keys[0]) &&
+               (strlen(keys[i].key) != key_len || strncmp(keys[i].key, spec, key_len) != 0)) {
+            i++;
+        }
+        if (i == sizeof(keys) / sizeof(keys[0]) || (keys[i].percent && value > 100) || value > UINT32_MAX) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        *(uint32_t *)((char *)config + keys[i].offset) = value;
+        spec += len;
+        if (*spec != '\0') {
+            spec++;
+        }
+    }
+    return ESP_OK;
+}
+
+/* The faulty file
+ *
+ * The wrapped file is unbuffered, the cookie's own stdio buffer decides when writes happen.
+ * Open cookies are listed so storage_fault_sync() can find the file behind one, stdio
+ * gives no fd and no way back to the cookie.
+ */
+typedef struct fault_file {
+    FILE *file;   // Wrapped
+    FILE *faulty; // Handed out
+    struct fault_file *next;
+} fault_file_t;
+
+static fault_file_t *fault_files = NULL;
+
+static cookie_ssize_t fault_read(void *cookie, char *buf, size_t size)
+{
+    FILE *file = ((fault_file_t *)cookie)->file;
+    portENTER_CRITICAL(&fault_lock);
+    bool eio = roll(fault_config.eio_pct);
+    fault_stats.eio += eio;
+    eio = eio || (fault_ejected && !fault_suspended);
+    portEXIT_CRITICAL(&fault_lock);
+    if (eio) {
+        errno = EIO;
+        return -1;
+    }
+    size_t n = fread(buf, 1, size, file);
+    if (n == 0 && ferror(file)) {
+        return -1;
+    }
+    return n;
+}
+
+static cookie_ssize_t fault_write(void *cookie, const char *buf, size_t size)
+{
+    FILE *file = ((fault_file_t *)cookie)->file;
+    size_t allowed = size;
+    int error = 0;
+
+    portENTER_CRITICAL(&fault_lock);
+    fault_stats.writes++;
+    uint32_t delay_ms = fault_suspended ? 0 : fault_config.latency_ms;
+    if (roll(fault_config.stall_pct)) {
+        delay_ms += fault_config.stall_ms;
+        fault_stats.stalls++;
+    }
+    if (fault_config.enospc_after > 0 && !fault_suspended && fault_written + size > fault_config.enospc_after) {
+        // Fill the card up to the limit, the rest of the data fails on the next write
+        allowed = fault_config.enospc_after - fault_written;
+        if (allowed == 0) {
+            error = ENOSPC;
+            fault_stats.enospc++;
+        }
+    }
+    if (fault_ejected && !fault_suspended) {
+        error = EIO;
+        allowed = 0;
+    } else if (error == 0 && roll(fault_config.eio_pct)) {
+        error = EIO;
+        allowed = 0;
+        fault_stats.eio++;
+    } else if (error == 0 && roll(fault_config.torn_pct)) {
+        error = EIO;
+        allowed = size > 1 ? fault_random % size : 0;
+        fault_stats.torn++;
+    }
+    fault_written += allowed;
+    portEXIT_CRITICAL(&fault_lock);
+
+    if (delay_ms > 0) {
+        hal_delay_ms(delay_ms);
+    }
+    size_t n = allowed > 0 ? fwrite(buf, 1, allowed, file) : 0;
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return n > 0 ? (cookie_ssize_t)n : -1;
+}
+
+static int fault_seek(void *cookie, cookie_off_t *offset, int whence)
+{
+    FILE *file = ((fault_file_t *)cookie)->file;
+    if (fseek(file, (long)*offset, whence) != 0) {
+        return -1;
+    }
+    *offset = ftell(file);
+    return 0;
+}
+
+static int fault_close(void *cookie)
+{
+    fault_file_t *ff = cookie;
+    portENTER_CRITICAL(&fault_lock);
+    for (fault_file_t **p = &fault_files; *p != NULL; p = &(*p)->next) {
+        if (*p == ff) {
+            *p = ff->next;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&fault_lock);
+    int ret = fclose(ff->file);
+    free(ff);
+    return ret;
+}
+
+int storage_fault_sync(FILE *faulty)
+{
+    portENTER_CRITICAL(&fault_lock);
+    fault_file_t *ff = fault_files;
+    while (ff != NULL && ff->faulty != faulty) {
+        ff = ff->next;
+    }
+    bool eio = ff != NULL && roll(fault_config.eio_pct);
+    fault_stats.eio += eio;
+    eio = eio || (ff != NULL && fault_ejected && !fault_suspended);
+    portEXIT_CRITICAL(&fault_lock);
+    if (ff == NULL) {
+        return 0; // Not ours, nothing to sync through
+    }
+    if (eio) {
+        errno = EIO;
+        return -1;
+    }
+    if (fflush(ff->file) != 0) {
+        return -1;
+    }
+    int fd = fileno(ff->file);
+    return fd < 0 ? 0 : fsync(fd);
+}
+
+FILE *storage_fault_wrap(FILE *file, const char *path)
+{
+    if (file == NULL || !fault_enabled) {
+        return file;
+    }
+
+    portENTER_CRITICAL(&fault_lock);
+    bool eio = roll(fault_config.eio_pct);
+    fault_stats.eio += eio;
+    bool ejected = fault_ejected && !fault_suspended;
+    portEXIT_CRITICAL(&fault_lock);
+    if (eio || ejected) {
+        ESP_LOGD(TAG, "Failing open of %s", path);
+        fclose(file);
+        errno = ejected ? ENODEV : EIO;
+        return NULL;
+    }
+
+    fault_file_t *ff = malloc(sizeof(fault_file_t));
+    if (ff == NULL) {
+        return file;
+    }
+    ff->file = file;
+    setvbuf(file, NULL, _IONBF, 0);
+    static const cookie_io_functions_t functions = {
+        .read = fault_read,
+        .write = fault_write,
+        .seek = fault_seek,
+        .close = fault_close,
+    };
+    // The mode is not needed, the cookie passes on whatever the wrapped file allows
+    FILE *faulty = fopencookie(ff, "r+", functions);
+    if (faulty == NULL) {
+        free(ff);
+        return file;
+    }
+    ff->faulty = faulty;
+    portENTER_CRITICAL(&fault_lock);
+    ff->next = fault_files;
+    fault_files = ff;
+    portEXIT_CRITICAL(&fault_lock);
+    return faulty;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include "../includes/trace.h"
+
+#ifdef CONFIG_TRACE_ENABLE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TRACE_MAX_TASKS 16
+
+typedef struct {
+    atomic_uint seq; // Index + 1 once the event is fully written, 0 while it is being written
+    char phase;      // Chrome trace phase: 'B'egin, 'E'nd or 'i'nstant
+    const char *name;
+    TaskHandle_t task;
+    int64_t time_us;
+    uint32_t cycles;
+} trace_event_t;
+
+static trace_event_t events[CONFIG_TRACE_BUFFER_EVENTS];
+static atomic_uint next_index = 0;
+
+void trace_record(const char *name, char phase)
+{
+    // Claiming a slot is the only shared step, writers never wait on each other
+    unsigned index = atomic_fetch_add_explicit(&next_index, 1, memory_order_relaxed);
+    trace_event_t *event = &events[index % CONFIG_TRACE_BUFFER_EVENTS];
+
+    atomic_store_explicit(&event->seq, 0, memory_order_relaxed);
+    event->phase = phase;
+    event->name = name;
+    event->task = xTaskGetCurrentTaskHandle();
+    event->time_us = esp_timer_get_time();
+    event->cycles = esp_cpu_get_cycle_count();
+    atomic_store_explicit(&event->seq, index + 1, memory_order_release);
+}
+
+// Copy an event out of the ring, fails if it was overwritten or is still being written
+static bool read_event(unsigned index, trace_event_t *out)
+{
+    trace_event_t *event = &events[index % CONFIG_TRACE_BUFFER_EVENTS];
+    if (atomic_load_explicit(&event->seq, memory_order_acquire) != index + 1) {
+        return false;
+    }
+    out->phase = event->phase;
+    out->name = event->name;
+    out->task = event->task;
+    out->time_us = event->time_us;
+    out->cycles = event->cycles;
+    return atomic_load_explicit(&event->seq, memory_order_acquire) == index + 1;
+}
+
+esp_err_t trace_render(trace_emit_t emit, void *ctx)
+{
+    char line[192];
+    int len;
+    unsigned end = atomic_load_explicit(&next_index, memory_order_acquire);
+    unsigned start = end > CONFIG_TRACE_BUFFER_EVENTS ? end - CONFIG_TRACE_BUFFER_EVENTS : 0;
+
+    static const char head[] = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    if (emit(ctx, head, sizeof(head) - 1) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    // Tasks are never deleted in this firmware, so their names are still valid here
+    TaskHandle_t named[TRACE_MAX_TASKS];
+    int named_count = 0;
+    bool first = true;
+
+    for (unsigned i = start; i < end; i++) {
+        trace_event_t event;
+        if (!read_event(i, &event)) {
+            continue;
+        }
+
+        bool known = false;
+        for (int t = 0; t < named_count; t++) {
+            known |= named[t] == event.task;
+        }
+        if (!known && named_count < TRACE_MAX_TASKS) {
+            named[named_count++] = event.task;
+            len = snprintf(line, sizeof(line),
+                           "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+                           first ? "" : ",", (unsigned long)(uintptr_t)event.task, pcTaskGetName(event.task));
+            if (emit(ctx, line, len) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            first = false;
+        }
+
+        len = snprintf(line, sizeof(line),
+                       "%s{\"ph\":\"%c\",\"name\":\"%s\",\"pid\":1,\"tid\":%lu,\"ts\":%lld%s\"args\":{\"cycles\":%lu}}",
+                       first ? "" : ",", event.phase, event.name, (unsigned long)(uintptr_t)event.task,
+                       (long long)event.time_us, event.phase == 'i' ? ",\"s\":\"t\"," : ",",
+                       (unsigned long)event.cycles);
+        if (emit(ctx, line, len) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        first = false;
+    }
+
+    static const char tail[] = "]}";
+    return emit(ctx, tail, sizeof(tail) - 1);
+}
+
+#endif
@@ -0,0 +1,455 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../includes/user.h"
+#include "../includes/history.h"
+#include "../includes/sd_card.h"
+#include "../includes/hal.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+static const char *TAG = "user";
+
+#define USER_PATH_SIZE 32
+#define USER_LINE_SIZE 48
+
+// HTTP handlers name the player, the main task takes it when a test is stored
+static portMUX_TYPE player_lock = portMUX_INITIALIZER_UNLOCKED;
+static char player[USER_NAME_SIZE];
+
+bool user_normalize(const char *name, char out[USER_NAME_SIZE])
+{
+    size_t len = strlen(name);
+    if (len == 0 || len > USER_NAME_MAX) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '_') {
+            return false;
+        }
+        out[i] = toupper((unsigned char)name[i]);
+    }
+    out[len] = '\0';
+    return true;
+}
+
+void user_set_player(const char name[USER_NAME_SIZE])
+{
+    portENTER_CRITICAL(&player_lock);
+    snprintf(player, sizeof(player), "%s", name);
+    portEXIT_CRITICAL(&player_lock);
+}
+
+void user_get_player(char out[USER_NAME_SIZE])
+{
+    portENTER_CRITICAL(&player_lock);
+    memcpy(out, player, sizeof(player));
+    portEXIT_CRITICAL(&player_lock);
+}
+
+void user_take_player(char out[USER_NAME_SIZE])
+{
+    portENTER_CRITICAL(&player_lock);
+    memcpy(out, player, sizeof(player));
+    player[0] = '\0';
+    portEXIT_CRITICAL(&player_lock);
+}
+
+// Taken inside the highscores lock, never the other way around
+static portMUX_TYPE ref_lock = portMUX_INITIALIZER_UNLOCKED;
+static char ref_names[USER_REFS][USER_NAME_SIZE]; // A released slot keeps its name until reused
+static uint8_t ref_counts[USER_REFS];
+
+esp_err_t user_ref(const char *name, uint8_t *ref)
+{
+    uint8_t found = USER_NONE, unused = USER_NONE;
+    *ref = USER_NONE;
+    if (name[0] == '\0') {
+        return ESP_OK;
+    }
+    portENTER_CRITICAL(&ref_lock);
+    for (uint8_t i = 1; i < USER_REFS && found == USER_NONE; i++) {
+        if (strcmp(ref_names[i], name) == 0) {
+            found = i;
+        } else if (unused == USER_NONE && ref_counts[i] == 0) {
+            unused = i;
+        }
+    }
+    found = found != USER_NONE ? found : unused;
+    if (found != USER_NONE) {
+        snprintf(ref_names[found], sizeof(ref_names[found]), "%s", name);
+        ref_counts[found]++;
+    }
+    portEXIT_CRITICAL(&ref_lock);
+    *ref = found;
+    return found != USER_NONE ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void user_ref_hold(uint8_t ref)
+{
+    if (ref != USER_NONE && ref < USER_REFS) {
+        portENTER_CRITICAL(&ref_lock);
+        ref_counts[ref]++;
+        portEXIT_CRITICAL(&ref_lock);
+    }
+}
+
+void user_unref(uint8_t ref)
+{
+    if (ref != USER_NONE && ref < USER_REFS) {
+        portENTER_CRITICAL(&ref_lock);
+        ref_counts[ref] -= ref_counts[ref] > 0;
+        portEXIT_CRITICAL(&ref_lock);
+    }
+}
+
+void user_ref_name(uint8_t ref, char out[USER_NAME_SIZE])
+{
+    out[0] = '\0';
+    if (ref != USER_NONE && ref < USER_REFS) {
+        portENTER_CRITICAL(&ref_lock);
+        memcpy(out, ref_names[ref], USER_NAME_SIZE);
+        portEXIT_CRITICAL(&ref_lock);
+    }
+}
+
+/* Finding a player's file
+ *
+ * FNV-1a of the name picks the first file to try, a file holding another name sends
+ * the search to the next one. Files are never removed, so the first missing file ends
+ * the search: the name has no file yet and that is where it goes.
+ */
+static esp_err_t find_file(const char *name, char path[USER_PATH_SIZE], bool *exists)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    size_t len = strlen(name);
+    for (int probe = 0; probe < USER_PROBES; probe++) {
+        snprintf(path, USER_PATH_SIZE, USER_FILE_FMT, hash + probe);
+        FILE *f = hal_fopen(path, "r");
+        if (f == NULL) {
+            *exists = false;
+            return ESP_OK;
+        }
+        char line[USER_LINE_SIZE];
+        bool match = fgets(line, sizeof(line), f) != NULL && strncmp(line, name, len) == 0 && line[len] == '\n';
+        fclose(f);
+        if (match) {
+            *exists = true;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+static bool parse_line(const char *line, history_cursor_t *at)
+{
+    if (strchr(line, '\n') == NULL || sscanf(line, "%d %" SCNu32 " %ld", &at->file, &at->index, &at->offset) != 3) {
+        return false;
+    }
+    return at->file > 0;
+}
+
+static int format_line(const history_cursor_t *at, char line[USER_LINE_SIZE])
+{
+    return snprintf(line, USER_LINE_SIZE, "%d %" PRIu32 " %ld\n", at->file, at->index, at->offset);
+}
+
+// The last complete line of a file, torn is set when a reset cut the line after it short
+static void last_line(const char *path, char out[USER_LINE_SIZE], bool *torn)
+{
+    out[0] = '\0';
+    *torn = false;
+    FILE *f = hal_fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+    char buf[2 * USER_LINE_SIZE + 1];
+    long size = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+    long start = size > (long)sizeof(buf) - 1 ? size - (long)sizeof(buf) + 1 : 0;
+    size_t len = size > 0 && fseek(f, start, SEEK_SET) == 0 ? fread(buf, 1, size - start, f) : 0;
+    fclose(f);
+    buf[len] = '\0';
+    *torn = len > 0 && buf[len - 1] != '\n';
+
+    // The read most likely starts inside a line
+    char *line = start > 0 ? strchr(buf, '\n') : buf;
+    line = line != NULL && start > 0 ? line + 1 : line;
+    for (char *nl; line != NULL && (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+        size_t n = nl + 1 - line;
+        if (n < USER_LINE_SIZE) {
+            memcpy(out, line, n);
+            out[n] = '\0';
+        }
+    }
+}
+
+esp_err_t user_index_add(const char *name, const history_cursor_t *at)
+{
+    char path[USER_PATH_SIZE];
+    bool exists, torn = false;
+    if (find_file(name, path, &exists) != ESP_OK) {
+        ESP_LOGW(TAG, "No file left for %s, its tests stay out of the index", name);
+        return ESP_ERR_NOT_FOUND;
+    }
+    char line[USER_LINE_SIZE], last[USER_LINE_SIZE];
+    format_line(at, line);
+    if (exists) {
+        // A checkpoint cut short after the line was written goes through the same record again
+        history_cursor_t before;
+        last_line(path, last, &torn);
+        if (parse_line(last, &before) &&
+            (before.file > at->file || (before.file == at->file && before.index >= at->index))) {
+            return ESP_OK;
+        }
+    } else if (hal_mkdir(USER_DIR) != 0) {
+        ESP_LOGE(TAG, "Failed to create %s", USER_DIR);
+        return ESP_FAIL;
+    }
+
+    FILE *f = hal_fopen(path, "a");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+    bool ok = (exists || fprintf(f, "%s\n", name) > 0) && fprintf(f, "%s%s", torn ? "\n" : "", line) > 0;
+    ok = hal_fsync(f) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* Index state
+ *
+ * The mark is read once per boot, the task that writes the log is the only one to
+ * invalidate and rebuild the index.
+ */
+static enum { INDEX_UNKNOWN, INDEX_OK, INDEX_STALE } index_state;
+
+void user_index_invalidate(void)
+{
+    if (index_state != INDEX_STALE) {
+        ESP_LOGW(TAG, "Player index out of date, it is rebuilt from the history");
+    }
+    index_state = INDEX_STALE;
+    hal_remove(USER_INDEX_MARK);
+}
+
+bool user_index_stale(void)
+{
+    if (index_state == INDEX_UNKNOWN) {
+        FILE *f = hal_fopen(USER_INDEX_MARK, "r");
+        int version = 0;
+        if (f != NULL) {
+            version = fscanf(f, "%d", &version) == 1 ? version : 0;
+            fclose(f);
+        }
+        index_state = version == USER_INDEX_VERSION ? INDEX_OK : INDEX_STALE;
+    }
+    return index_state == INDEX_STALE;
+}
+
+// Open a player's file for the rebuild, emptied to the name line the first time the rebuild meets them
+static FILE *rebuild_open(const char *name, char (**seen)[USER_NAME_SIZE], size_t *count, size_t *size)
+{
+    bool first = true;
+    for (size_t i = 0; i < *count && first; i++) {
+        first = strcmp((*seen)[i], name) != 0;
+    }
+    char path[USER_PATH_SIZE];
+    bool exists;
+    if (find_file(name, path, &exists) != ESP_OK) {
+        return NULL;
+    }
+    if (first) {
+        if (*count == *size) {
+            size_t grown = *size > 0 ? *size * 2 : 16;
+            char (*names)[USER_NAME_SIZE] = realloc(*seen, grown * USER_NAME_SIZE);
+            if (names == NULL) {
+                return NULL;
+            }
+            *seen = names;
+            *size = grown;
+        }
+        snprintf((*seen)[(*count)++], USER_NAME_SIZE, "%s", name);
+    }
+    FILE *f = hal_fopen(path, first ? "w" : "a");
+    if (f != NULL && first && fprintf(f, "%s\n", name) <= 0) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+static bool rebuild_close(FILE *f)
+{
+    bool ok = hal_fsync(f) == 0;
+    return fclose(f) == 0 && ok;
+}
+
+/* Rebuild
+ *
+ * One walk over the history, the position of every named test goes to its player's
+ * file, each file starting over the first time its player comes up. The file of the
+ * last player stays open, one player often takes several tests in a row. A name with
+ * no file left is skipped like user_index_add() does.
+ */
+esp_err_t user_index_rebuild(void)
+{
+    int64_t start = hal_time_us();
+    hal_remove(USER_INDEX_MARK);
+    if (hal_mkdir(USER_DIR) != 0) {
+        ESP_LOGE(TAG, "Failed to create %s", USER_DIR);
+        return ESP_FAIL;
+    }
+    history_reader_t *history = malloc(sizeof(history_reader_t));
+    if (history == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    char (*seen)[USER_NAME_SIZE] = NULL;
+    size_t count = 0, size = 0;
+    uint32_t tests = 0;
+    bool ok = true;
+    if (history_open(history, LOG_FILE) == ESP_OK) {
+        FILE *f = NULL;
+        char name[USER_NAME_SIZE] = "";
+        history_cursor_t before, after;
+        history_record_t record;
+        history_tell(history, &before);
+        while (ok && history_next(history, &record)) {
+            history_tell(history, &after);
+            // A record that was the first of the next file is at its start
+            history_cursor_t at = after.file == before.file ? before : (history_cursor_t){ after.file, 0, 0 };
+            before = after;
+            if (record.user[0] == '\0') {
+                continue;
+            }
+            if (f == NULL || strcmp(name, record.user) != 0) {
+                ok = f == NULL || rebuild_close(f);
+                f = rebuild_open(record.user, &seen, &count, &size);
+                snprintf(name, sizeof(name), "%s", record.user);
+                if (f == NULL) {
+                    continue;
+                }
+            }
+            char line[USER_LINE_SIZE];
+            int len = format_line(&at, line);
+            ok = ok && fwrite(line, 1, len, f) == (size_t)len;
+            tests++;
+        }
+        ok = (f == NULL || rebuild_close(f)) && ok;
+        history_close(history);
+    }
+    free(history);
+    free(seen);
+
+    FILE *mark = ok ? hal_fopen(USER_INDEX_MARK, "w") : NULL;
+    ok = mark != NULL && fprintf(mark, "%d\n", USER_INDEX_VERSION) > 0;
+    ok = mark != NULL && rebuild_close(mark) && ok;
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to rebuild the player index");
+        index_state = INDEX_STALE;
+        return ESP_FAIL;
+    }
+    index_state = INDEX_OK;
+    ESP_LOGI(TAG, "Rebuilt the player index, %" PRIu32 " tests of %u players in %lld us", tests, (unsigned)count,
+             (long long)(hal_time_us() - start));
+    return ESP_OK;
+}
+
+esp_err_t user_open(user_reader_t *reader, const char *name)
+{
+    char path[USER_PATH_SIZE];
+    bool exists;
+    reader->f = NULL;
+    reader->history = NULL;
+    snprintf(reader->name, sizeof(reader->name), "%s", name);
+    if (find_file(name, path, &exists) != ESP_OK || !exists) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    reader->f = hal_fopen(path, "r");
+    reader->history = malloc(sizeof(history_reader_t));
+    char line[USER_LINE_SIZE];
+    if (reader->f == NULL || reader->history == NULL || fgets(line, sizeof(line), reader->f) == NULL ||
+        history_open(reader->history, LOG_FILE) != ESP_OK) {
+        free(reader->history);
+        reader->history = NULL;
+        user_close(reader);
+        return ESP_FAIL;
+    }
+    reader->start = ftell(reader->f);
+    return ESP_OK;
+}
+
+/* Following a position
+ *
+ * A player's tests are in history order, so the next one is often further into the
+ * segment being read: the reader reads on up to it instead of seeking, which would
+ * decode the segment from its start again.
+ */
+bool user_next(user_reader_t *reader, time_t *timestamp, float *ppm, float *bac)
+{
+    char line[USER_LINE_SIZE];
+    while (reader->f != NULL && fgets(line, sizeof(line), reader->f) != NULL) {
+        history_cursor_t at, now;
+        if (!parse_line(line, &at)) {
+            continue;
+        }
+        history_tell(reader->history, &now);
+        bool ahead = now.file == at.file && now.index <= at.index && at.file <= reader->history->segments;
+        if (!ahead && history_seek(reader->history, &at) != ESP_OK) {
+            continue;
+        }
+        history_record_t record;
+        bool found = true;
+        for (uint32_t skip = ahead ? at.index - now.index : 0; skip > 0 && found; skip--) {
+            found = history_next(reader->history, &record);
+        }
+        if (found && history_next(reader->history, &record) && strcmp(record.user, reader->name) == 0) {
+            *timestamp = record.timestamp;
+            *ppm = record.ppm;
+            *bac = record.bac;
+            return true;
+        }
+    }
+    return false;
+}
+
+long user_tell(user_reader_t *reader)
+{
+    return reader->f != NULL ? ftell(reader->f) : -1;
+}
+
+esp_err_t user_seek(user_reader_t *reader, long offset)
+{
+    // A rebuild writes the file again, an offset taken before it may now be past the end or inside a line,
+    // so it has to be the first test or follow a newline
+    long at = user_tell(reader);
+    long size = fseek(reader->f, 0, SEEK_END) == 0 ? ftell(reader->f) : -1;
+    bool line_start = offset == reader->start ||
+                      (offset > reader->start && offset <= size && fseek(reader->f, offset - 1, SEEK_SET) == 0 &&
+                       fgetc(reader->f) == '\n');
+    if (!line_start) {
+        fseek(reader->f, at, SEEK_SET);
+        return ESP_ERR_INVALID_ARG;
+    }
+    return fseek(reader->f, offset, SEEK_SET) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+void user_close(user_reader_t *reader)
+{
+    if (reader->f != NULL) {
+        fclose(reader->f);
+        reader->f = NULL;
+    }
+    if (reader->history != NULL) {
+        history_close(reader->history);
+        free(reader->history);
+        reader->history = NULL;
+    }
+}
@@ -0,0 +1,1935 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "../includes/web_server.h"
+#include "../includes/sd_card.h"
+#include "../includes/history.h"
+#include "../includes/metrics.h"
+#include "../includes/trace.h"
+#include "../includes/dlog.h"
+#include "../includes/measurement.h"
+#include "../includes/adc_trace.h"
+#include "../includes/hal.h"
+#include "../includes/storage_fault.h"
+#include "../includes/sd_bench.h"
+#include "../includes/session.h"
+#include "../includes/user.h"
+#include "../includes/cbor.h"
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_random.h"
+
+static const char *TAG = "web_server";
+
+/* Async request workers
+ *
+ * esp_http_server runs every handler on its own task, so a handler that blocks on
+ * the SD card holds up every other connection. Handlers that touch the card hand
+ * their request over to a small pool of worker tasks and return right away.
+ */
+#define ASYNC_WORKER_STACK_SIZE 4096
+#define ASYNC_WORKER_PRIORITY 5
+#define ASYNC_QUEUE_SIZE CONFIG_WEB_MAX_OPEN_SOCKETS
+
+typedef esp_err_t (*httpd_req_handler_t)(httpd_req_t *req);
+
+typedef struct {
+    httpd_req_t *req;
+    httpd_req_handler_t handler;
+    int64_t submitted_us;
+} httpd_async_req_t;
+
+// Registered as user_ctx of every URI: the real handler, its trace name and latency histogram
+typedef struct {
+    httpd_req_handler_t handler;
+    const char *name;
+    metric_histogram_t metric;
+} uri_handler_t;
+
+static QueueHandle_t async_req_queue = NULL;
+static TaskHandle_t worker_handles[CONFIG_WEB_ASYNC_WORKERS];
+static bool request_handed_off = false; // Only used on the httpd task, see timed_handler
+
+static bool is_on_async_worker_thread(void)
+{
+    TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < CONFIG_WEB_ASYNC_WORKERS; i++) {
+        if (worker_handles[i] == handle) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Queue a request for the workers, the caller answers 503 if this fails
+static esp_err_t submit_async_req(httpd_req_t *req, httpd_req_handler_t handler)
+{
+    httpd_req_t *copy = NULL;
+    esp_err_t err = httpd_req_async_handler_begin(req, &copy);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    httpd_async_req_t async_req = {
+        .req = copy,
+        .handler = handler,
+        .submitted_us = esp_timer_get_time(),
+    };
+    if (xQueueSend(async_req_queue, &async_req, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Async request queue full");
+        httpd_req_async_handler_complete(copy);
+        return ESP_FAIL;
+    }
+    request_handed_off = true;
+    return ESP_OK;
+}
+
+static void async_req_worker_task(void *arg)
+{
+    while (1) {
+        httpd_async_req_t async_req;
+        if (xQueueReceive(async_req_queue, &async_req, portMAX_DELAY) == pdTRUE) {
+            ESP_LOGD(TAG, "Worker handling %s", async_req.req->uri);
+            const uri_handler_t *entry = async_req.req->user_ctx;
+            TRACE_BEGIN(entry->name);
+            esp_err_t ret = async_req.handler(async_req.req);
+            TRACE_END(entry->name);
+            // Latency as seen by the client, including the time spent in the queue
+            metrics_observe(entry->metric, esp_timer_get_time() - async_req.submitted_us);
+            httpd_handle_t server = async_req.req->handle;
+            int sockfd = httpd_req_to_sockfd(async_req.req);
+            if (httpd_req_async_handler_complete(async_req.req) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to complete async request");
+            }
+            // The httpd task closes the socket when a handler fails, but not for async ones.
+            // A response cut short by a read error would leave the client waiting for the rest
+            if (ret != ESP_OK) {
+                httpd_sess_trigger_close(server, sockfd);
+            }
+        }
+    }
+}
+
+static void start_async_req_workers(void)
+{
+    async_req_queue = xQueueCreate(ASYNC_QUEUE_SIZE, sizeof(httpd_async_req_t));
+    for (int i = 0; i < CONFIG_WEB_ASYNC_WORKERS; i++) {
+        if (xTaskCreate(async_req_worker_task, "async_req_worker", ASYNC_WORKER_STACK_SIZE,
+                        NULL, ASYNC_WORKER_PRIORITY, &worker_handles[i]) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start async worker %d", i);
+        }
+    }
+}
+
+// Hand the request over to the workers, or answer 503 when their queue is full
+static esp_err_t run_on_async_worker(httpd_req_t *req, httpd_req_handler_t handler)
+{
+    if (submit_async_req(req, handler) == ESP_OK) {
+        return ESP_OK;
+    }
+    metrics_inc(METRIC_HTTP_REJECTED);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+// Every URI is registered through this wrapper to time its handler
+static esp_err_t timed_handler(httpd_req_t *req)
+{
+    const uri_handler_t *entry = req->user_ctx;
+    request_handed_off = false;
+    int64_t start = esp_timer_get_time();
+    TRACE_BEGIN(entry->name);
+    esp_err_t ret = entry->handler(req);
+    TRACE_END(entry->name);
+    // Requests handed to the workers are timed there
+    if (!request_handed_off) {
+        metrics_observe(entry->metric, esp_timer_get_time() - start);
+    }
+    return ret;
+}
+
+/* Pagination
+ *
+ * List endpoints take ?limit= and ?cursor=. A page that stops short of the end of
+ * the list gives the cursor of the next one in X-Next-Cursor, the body has the same
+ * format as without paging. Cursors are opaque to clients and point straight at a
+ * position in the list, so a deep page costs what the first one does.
+ */
+#define PAGE_DEFAULT_LIMIT 100
+#define PAGE_MAX_LIMIT 1000
+#define PAGE_CURSOR_SIZE 32
+
+// Read limit and cursor from a query string, what it leaves out is left as it was. false for a bad limit
+static bool get_page_params(const char *query, uint32_t *limit, char cursor[PAGE_CURSOR_SIZE])
+{
+    char param[12];
+    if (httpd_query_key_value(query, "limit", param, sizeof(param)) == ESP_OK) {
+        char *end;
+        unsigned long value = strtoul(param, &end, 10);
+        if (end == param || *end != '\0' || value == 0 || value > PAGE_MAX_LIMIT) {
+            return false;
+        }
+        *limit = value;
+    }
+    if (httpd_query_key_value(query, "cursor", cursor, PAGE_CURSOR_SIZE) != ESP_OK) {
+        cursor[0] = '\0';
+    }
+    return true;
+}
+
+/* Content negotiation
+ *
+ * Data endpoints answer in CBOR (RFC 8949) instead of JSON when the Accept header asks
+ * for application/cbor at least as much as for application/json. CBOR carries PPM in
+ * 1/100, BAC in 1/1000 and sample ratios in 1/10000 as integers, the units they are
+ * kept in, so no float is formatted on the way out. Tests are [timestamp, ppm, bac]
+ * arrays, with the player name as a fourth item when there is one.
+ */
+#define ACCEPT_SIZE 128
+
+// Quality the Accept header gives a media type, 0 when it is not listed
+static float accept_quality(const char *accept, const char *type)
+{
+    size_t len = strlen(type);
+    for (const char *p = accept; (p = strstr(p, type)) != NULL; p += len) {
+        if ((p != accept && p[-1] != ' ' && p[-1] != ',') || strchr(",; ", p[len]) == NULL) {
+            continue; // Part of a longer type
+        }
+        const char *next = strchr(p, ',');
+        const char *q = strstr(p, "q=");
+        return q != NULL && (next == NULL || q < next) ? strtof(q + 2, NULL) : 1.0f;
+    }
+    return 0.0f;
+}
+
+static bool wants_cbor(httpd_req_t *req)
+{
+    char accept[ACCEPT_SIZE] = "";
+    httpd_req_get_hdr_value_str(req, "Accept", accept, sizeof(accept));
+    float cbor = accept_quality(accept, "application/cbor");
+    return cbor > 0.0f && cbor >= accept_quality(accept, "application/json");
+}
+
+// One test as a CBOR array, returns its length
+static size_t test_to_cbor(time_t timestamp, float ppm, float bac, const char *user, uint8_t *buf, size_t len)
+{
+    cbor_writer_t c;
+    cbor_init(&c, buf, len);
+    cbor_array(&c, user != NULL && user[0] != '\0' ? 4 : 3);
+    cbor_int(&c, timestamp);
+    cbor_int(&c, lroundf(ppm * 100));
+    cbor_int(&c, lroundf(bac * 1000));
+    if (user != NULL && user[0] != '\0') {
+        cbor_text(&c, user);
+    }
+    return c.pos;
+}
+
+/* Long-poll clients parked on /api/v1/highscores?wait= */
+#define HIGHSCORES_MAX_WAIT_S 30
+#define MAX_LONGPOLL_CLIENTS 4
+#define LONGPOLL_TASK_PRIORITY 5
+
+typedef struct {
+    httpd_req_t *req;    // Async copy of the request, NULL if the slot is free
+    uint32_t version;    // Highscore table version the client already has
+    int64_t deadline_us; // When to give up and answer 304
+} longpoll_client_t;
+
+static longpoll_client_t longpoll_clients[MAX_LONGPOLL_CLIENTS];
+static SemaphoreHandle_t longpoll_mutex = NULL;
+static TaskHandle_t longpoll_task_handle = NULL;
+static uint32_t etag_salt = 0; // Changes every boot so stale ETags never match
+
+// The leaderboard ranks a request asks for, the whole table unless it pages
+static bool get_highscores_page(httpd_req_t *req, int *first, int *limit)
+{
+    char query[64];
+    char cursor[PAGE_CURSOR_SIZE] = "";
+    uint32_t page_limit = MAX_HIGHSCORES;
+    *first = 0;
+    *limit = MAX_HIGHSCORES;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        return true;
+    }
+    if (!get_page_params(query, &page_limit, cursor)) {
+        return false;
+    }
+    char *end = cursor;
+    unsigned long rank = strtoul(cursor, &end, 16);
+    if (*end != '\0' || rank >= MAX_HIGHSCORES) {
+        return false;
+    }
+    *first = rank;
+    *limit = page_limit;
+    return true;
+}
+
+// CBOR and JSON are two representations of the table, each with its own tags
+static void highscores_etag(uint32_t version, int first, int limit, bool cbor, char *etag, size_t len)
+{
+    if (first == 0 && limit >= MAX_HIGHSCORES) {
+        snprintf(etag, len, "\"%08" PRIx32 "-%" PRIu32 "%s\"", etag_salt, version, cbor ? "-c" : "");
+    } else {
+        snprintf(etag, len, "\"%08" PRIx32 "-%" PRIu32 "-%x-%x%s\"", etag_salt, version, first, limit,
+                 cbor ? "-c" : "");
+    }
+}
+
+static esp_err_t send_highscores(httpd_req_t *req)
+{
+    highscore_t table[MAX_HIGHSCORES];
+    uint32_t version = copy_highscores(table);
+    int first, limit;
+    get_highscores_page(req, &first, &limit);
+    bool cbor = wants_cbor(req);
+
+    // Sized for a full table, the serializers cannot run out of room
+    char json[HIGHSCORES_JSON_SIZE];
+    size_t len = cbor ? highscores_to_cbor(table, first, limit, (uint8_t *)json, sizeof(json)) :
+                 highscores_to_json(table, first, limit, json, sizeof(json));
+
+    char etag[48];
+    char next[PAGE_CURSOR_SIZE];
+    highscores_etag(version, first, limit, cbor, etag, sizeof(etag));
+    httpd_resp_set_type(req, cbor ? "application/cbor" : "application/json");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "Vary", "Accept");
+    if (first + limit < MAX_HIGHSCORES && table[first + limit].result.bac > 0) {
+        snprintf(next, sizeof(next), "%x", first + limit);
+        httpd_resp_set_hdr(req, "X-Next-Cursor", next);
+    }
+
+    return httpd_resp_send(req, json, len);
+}
+
+static esp_err_t send_not_modified(httpd_req_t *req, uint32_t version)
+{
+    char etag[48];
+    int first, limit;
+    get_highscores_page(req, &first, &limit);
+    highscores_etag(version, first, limit, wants_cbor(req), etag, sizeof(etag));
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "Vary", "Accept");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+// Answers parked long-poll requests once the table changes or their wait expires
+static void longpoll_task(void *arg)
+{
+    while (1)
+    {
+        TickType_t wait = pdMS_TO_TICKS(HIGHSCORES_MAX_WAIT_S * 1000);
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(longpoll_mutex, portMAX_DELAY);
+        for (int i = 0; i < MAX_LONGPOLL_CLIENTS; i++) {
+            if (longpoll_clients[i].req != NULL) {
+                int64_t remaining = longpoll_clients[i].deadline_us - now;
+                TickType_t ticks = remaining > 0 ? pdMS_TO_TICKS(remaining / 1000) + 1 : 0;
+                if (ticks < wait) {
+                    wait = ticks;
+                }
+            }
+        }
+        xSemaphoreGive(longpoll_mutex);
+
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        // Collect the finished clients first so no response is sent with the mutex held
+        longpoll_client_t done[MAX_LONGPOLL_CLIENTS];
+        int done_count = 0;
+        uint32_t version = get_highscores_version();
+        now = esp_timer_get_time();
+
+        xSemaphoreTake(longpoll_mutex, portMAX_DELAY);
+        for (int i = 0; i < MAX_LONGPOLL_CLIENTS; i++) {
+            if (longpoll_clients[i].req != NULL &&
+                (longpoll_clients[i].version != version || longpoll_clients[i].deadline_us <= now)) {
+                done[done_count++] = longpoll_clients[i];
+                longpoll_clients[i].req = NULL;
+            }
+        }
+        xSemaphoreGive(longpoll_mutex);
+
+        for (int i = 0; i < done_count; i++) {
+            if (done[i].version != version) {
+                send_highscores(done[i].req);
+            } else {
+                send_not_modified(done[i].req, version);
+            }
+            httpd_req_async_handler_complete(done[i].req);
+        }
+    }
+}
+
+// Wake up the long-poll clients after the highscore table changed
+void notify_highscore_waiters(void)
+{
+    if (longpoll_task_handle != NULL) {
+        xTaskNotifyGive(longpoll_task_handle);
+    }
+}
+
+static void longpoll_init(void)
+{
+    etag_salt = esp_random();
+    longpoll_mutex = xSemaphoreCreateMutex();
+    xTaskCreate(longpoll_task, "longpoll", 4096, NULL, LONGPOLL_TASK_PRIORITY, &longpoll_task_handle);
+}
+
+/* Measurement-priority admission control
+ *
+ * The HTTP tasks share the single core with the measurement loop in app_main. While a
+ * capture runs they drop below the main task, and requests that would read from the
+ * SD card are turned away with 503 so the sampling cadence stays intact.
+ */
+#define CAPTURE_HTTP_PRIORITY tskIDLE_PRIORITY
+#define CAPTURE_RETRY_AFTER_S "6" // Baseline plus capture take about 5 seconds
+
+static volatile bool capture_active = false;
+static TaskHandle_t httpd_task_handle = NULL;
+static UBaseType_t httpd_task_priority = 0;
+
+static void set_http_priority(bool lowered)
+{
+    if (httpd_task_handle != NULL) {
+        vTaskPrioritySet(httpd_task_handle, lowered ? CAPTURE_HTTP_PRIORITY : httpd_task_priority);
+    }
+    for (int i = 0; i < CONFIG_WEB_ASYNC_WORKERS; i++) {
+        if (worker_handles[i] != NULL) {
+            vTaskPrioritySet(worker_handles[i], lowered ? CAPTURE_HTTP_PRIORITY : ASYNC_WORKER_PRIORITY);
+        }
+    }
+    if (longpoll_task_handle != NULL) {
+        vTaskPrioritySet(longpoll_task_handle, lowered ? CAPTURE_HTTP_PRIORITY : LONGPOLL_TASK_PRIORITY);
+    }
+}
+
+void set_capture_active(bool active)
+{
+    capture_active = active;
+    set_http_priority(active);
+    ESP_LOGD(TAG, "Capture %s, HTTP tasks at %s priority", active ? "started" : "finished",
+             active ? "lowered" : "normal");
+}
+
+// Answer 503 to requests that are not needed while a capture is running
+static bool reject_during_capture(httpd_req_t *req)
+{
+    if (!capture_active) {
+        return false;
+    }
+    metrics_inc(METRIC_HTTP_REJECTED);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", CAPTURE_RETRY_AFTER_S);
+    httpd_resp_send(req, NULL, 0);
+    return true;
+}
+
+typedef enum {
+    RANGE_NONE,          // No usable Range header, send the whole resource
+    RANGE_OK,            // Send bytes start..end (inclusive)
+    RANGE_UNSATISFIABLE, // Answer 416
+} byte_range_t;
+
+// Parse a single "bytes=" range against a resource of total bytes
+static byte_range_t parse_byte_range(const char *value, size_t total, size_t *start, size_t *end)
+{
+    // Multiple ranges are allowed to be ignored, the client then gets the full resource
+    if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL) {
+        return RANGE_NONE;
+    }
+    const char *spec = value + 6;
+    char *next;
+
+    if (*spec == '-') {
+        // Suffix range: the last n bytes
+        unsigned long long n = strtoull(spec + 1, &next, 10);
+        if (next == spec + 1 || *next != '\0') {
+            return RANGE_NONE;
+        }
+        if (n == 0 || total == 0) {
+            return RANGE_UNSATISFIABLE;
+        }
+        *start = n >= total ? 0 : total - n;
+        *end = total - 1;
+        return RANGE_OK;
+    }
+
+    unsigned long long first = strtoull(spec, &next, 10);
+    if (next == spec || *next != '-') {
+        return RANGE_NONE;
+    }
+    spec = next + 1;
+    unsigned long long last = total - 1;
+    if (*spec != '\0') {
+        last = strtoull(spec, &next, 10);
+        if (next == spec || *next != '\0' || last < first) {
+            return RANGE_NONE;
+        }
+        if (last >= total) {
+            last = total - 1;
+        }
+    }
+    if (first >= total) {
+        return RANGE_UNSATISFIABLE;
+    }
+    *start = first;
+    *end = last;
+    return RANGE_OK;
+}
+
+static esp_err_t send_range_not_satisfiable(httpd_req_t *req, size_t total)
+{
+    char content_range[32];
+    snprintf(content_range, sizeof(content_range), "bytes */%u", (unsigned)total);
+    httpd_resp_set_status(req, "416 Range Not Satisfiable");
+    httpd_resp_set_hdr(req, "Content-Range", content_range);
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/* Static files
+ *
+ * Files are sent with a Content-Length, and Range requests are answered with 206 by
+ * seeking into the file, so interrupted downloads resume instead of starting over.
+ * httpd_resp_send_chunk can only stream with chunked encoding, so the response
+ * headers are written with httpd_send.
+ */
+#define FILE_CHUNK_SIZE 1024
+
+static const struct {
+    const char *ext;
+    const char *type;
+} mime_types[] = {
+    { ".html", "text/html" },
+    { ".htm", "text/html" },
+    { ".css", "text/css" },
+    { ".js", "application/javascript" },
+    { ".mjs", "application/javascript" },
+    { ".json", "application/json" },
+    { ".map", "application/json" },
+    { ".webmanifest", "application/manifest+json" },
+    { ".txt", "text/plain" },
+    { ".csv", "text/csv" },
+    { ".ndjson", "application/x-ndjson" },
+    { ".xml", "application/xml" },
+    { ".svg", "image/svg+xml" },
+    { ".png", "image/png" },
+    { ".jpg", "image/jpeg" },
+    { ".jpeg", "image/jpeg" },
+    { ".gif", "image/gif" },
+    { ".webp", "image/webp" },
+    { ".avif", "image/avif" },
+    { ".bmp", "image/bmp" },
+    { ".ico", "image/x-icon" },
+    { ".woff", "font/woff" },
+    { ".woff2", "font/woff2" },
+    { ".ttf", "font/ttf" },
+    { ".otf", "font/otf" },
+    { ".eot", "application/vnd.ms-fontobject" },
+    { ".wasm", "application/wasm" },
+    { ".pdf", "application/pdf" },
+    { ".zip", "application/zip" },
+    { ".gz", "application/gzip" },
+    { ".mp3", "audio/mpeg" },
+    { ".wav", "audio/wav" },
+    { ".ogg", "audio/ogg" },
+    { ".mp4", "video/mp4" },
+    { ".webm", "video/webm" },
+};
+
+static const char *mime_type_for(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (ext != NULL) {
+        for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++) {
+            if (strcasecmp(ext, mime_types[i].ext) == 0) {
+                return mime_types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+static esp_err_t send_raw(httpd_req_t *req, const char *buf, size_t len)
+{
+    while (len > 0) {
+        int sent = httpd_send(req, buf, len);
+        if (sent <= 0) {
+            return ESP_FAIL;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return ESP_OK;
+}
+
+// Send a file from the SD card. Returns ESP_ERR_NOT_FOUND without answering if it does not exist
+static esp_err_t send_file(httpd_req_t *req, const char *filepath)
+{
+    struct stat st;
+    if (hal_stat(filepath, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    TRACE_BEGIN("fopen");
+    FILE *file = hal_fopen(filepath, "r");
+    TRACE_END("fopen");
+    if (file == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    size_t total = st.st_size;
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%lx-%llx\"", (unsigned long)total, (unsigned long long)st.st_mtime);
+
+    char header[64];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", header, sizeof(header)) == ESP_OK &&
+        strstr(header, etag) != NULL) {
+        fclose(file);
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_set_hdr(req, "ETag", etag);
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    const char *status = "200 OK";
+    char content_range[64] = "";
+    size_t first = 0;
+    size_t len = total;
+    if (httpd_req_get_hdr_value_str(req, "Range", header, sizeof(header)) == ESP_OK) {
+        char if_range[32] = "";
+        httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range));
+        size_t last;
+        if (if_range[0] == '\0' || strcmp(if_range, etag) == 0) {
+            switch (parse_byte_range(header, total, &first, &last)) {
+            case RANGE_OK:
+                status = "206 Partial Content";
+                snprintf(content_range, sizeof(content_range), "Content-Range: bytes %u-%u/%u\r\n",
+                         (unsigned)first, (unsigned)last, (unsigned)total);
+                len = last - first + 1;
+                break;
+            case RANGE_UNSATISFIABLE:
+                fclose(file);
+                return send_range_not_satisfiable(req, total);
+            case RANGE_NONE:
+                break;
+            }
+        }
+    }
+
+    if (first > 0 && fseek(file, first, SEEK_SET) != 0) {
+        fclose(file);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    char head[256];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 %s\r\n"
+                            "Content-Type: %s\r\n"
+                            "Content-Length: %u\r\n"
+                            "%s"
+                            "Accept-Ranges: bytes\r\n"
+                            "ETag: %s\r\n"
+                            "\r\n",
+                            status, mime_type_for(filepath), (unsigned)len, content_range, etag);
+    esp_err_t ret = send_raw(req, head, head_len);
+
+    char chunk[FILE_CHUNK_SIZE];
+    while (ret == ESP_OK && len > 0) {
+        size_t n = fread(chunk, 1, len < sizeof(chunk) ? len : sizeof(chunk), file);
+        if (n == 0) {
+            // The file shrank under us, the connection has to be dropped to honour Content-Length
+            ret = ESP_FAIL;
+            break;
+        }
+        ret = send_raw(req, chunk, n);
+        len -= n;
+    }
+
+    fclose(file);
+    return ret;
+}
+
+// HTTP handlers
+static esp_err_t index_handler(httpd_req_t *req)
+{
+    if (!is_on_async_worker_thread()) {
+        if (reject_during_capture(req)) {
+            return ESP_OK;
+        }
+        return run_on_async_worker(req, index_handler);
+    }
+
+    ESP_LOGI(TAG, "Index handler called for URI: %s", req->uri);
+    
+    esp_err_t ret = send_file(req, "/sdcard/index.html");
+    if (ret == ESP_ERR_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to open /sdcard/index.html - serving fallback content");
+        ESP_LOGE(TAG, "Error opening file: %s", strerror(errno));
+        
+        // Serve fallback HTML content
+        const char* fallback_html = 
+            "<!DOCTYPE html>"
+            "<html><head><title>ESP32 Breathalyzer</title></head>"
+            "<body style='font-family: Arial, sans-serif; text-align: center; padding: 50px;'>"
+            "<h1>ESP32 Breathalyzer Server</h1>"
+            "<p>SD card file not found. Please check:</p>"
+            "<ul style='text-align: left; max-width: 400px; margin: 0 auto;'>"
+            "<li>SD card is properly inserted</li>"
+            "<li>index.html file exists in the root directory</li>"
+            "<li>SD card is formatted as FAT32</li>"
+            "</ul>"
+            "<p><a href='/api/status'>Check API Status</a></p>"
+            "</body></html>";
+        
+        httpd_resp_set_type(req, "text/html");
+        httpd_resp_send(req, fallback_html, strlen(fallback_html));
+        return ESP_OK;
+    }
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Index page served successfully");
+    }
+    return ret;
+}
+
+static esp_err_t status_handler(httpd_req_t *req)
+{
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    esp_netif_ip_info_t ip_info;
+    esp_netif_get_ip_info(netif, &ip_info);
+    wifi_config_t wifi_config;
+    esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+    
+    char response[256];
+    snprintf(response, sizeof(response), 
+        "{"
+        "\"ip\":\"%d.%d.%d.%d\","
+        "\"status\":\"connected\","
+        "\"ssid\":\"%s\""
+        "}", 
+        IP2STR(&ip_info.ip), (const char *)wifi_config.sta.ssid);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response, strlen(response));
+    return ESP_OK;
+}
+
+/* Handler for getting alcohol highscores
+ *
+ * Supports If-None-Match against the table version, and ?wait=<seconds> to hold
+ * the request until the table changes instead of answering 304 right away.
+ */
+static esp_err_t highscores_handler(httpd_req_t *req)
+{
+    uint32_t version = get_highscores_version();
+    int first, limit;
+    if (!get_highscores_page(req, &first, &limit)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid limit or cursor");
+        return ESP_FAIL;
+    }
+    char etag[48];
+    highscores_etag(version, first, limit, wants_cbor(req), etag, sizeof(etag));
+
+    char if_none_match[64] = "";
+    httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match));
+    if (strstr(if_none_match, etag) == NULL) {
+        return send_highscores(req);
+    }
+
+    int wait_s = 0;
+    char query[64];
+    char param[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "wait", param, sizeof(param)) == ESP_OK) {
+        wait_s = atoi(param);
+    }
+    if (wait_s <= 0) {
+        return send_not_modified(req, version);
+    }
+    if (wait_s > HIGHSCORES_MAX_WAIT_S) {
+        wait_s = HIGHSCORES_MAX_WAIT_S;
+    }
+
+    // Park the request, the long-poll task answers it from now on
+    xSemaphoreTake(longpoll_mutex, portMAX_DELAY);
+    int slot = -1;
+    for (int i = 0; i < MAX_LONGPOLL_CLIENTS; i++) {
+        if (longpoll_clients[i].req == NULL) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0 || httpd_req_async_handler_begin(req, &longpoll_clients[slot].req) != ESP_OK) {
+        xSemaphoreGive(longpoll_mutex);
+        ESP_LOGW(TAG, "No free long-poll slot, asking the client to come back later");
+        metrics_inc(METRIC_HTTP_REJECTED);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "60");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    longpoll_clients[slot].version = version;
+    longpoll_clients[slot].deadline_us = esp_timer_get_time() + (int64_t)wait_s * 1000000;
+    xSemaphoreGive(longpoll_mutex);
+
+    xTaskNotifyGive(longpoll_task_handle);
+    return ESP_OK;
+}
+
+// Whether a path has a ".." segment, which would lead out of the card's root
+static bool has_parent_segment(const char *path, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (path[i] == '.' && path[i + 1] == '.' && (i == 0 || path[i - 1] == '/') &&
+            (i + 2 == len || path[i + 2] == '/')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static esp_err_t static_handler(httpd_req_t *req)
+{
+    if (!is_on_async_worker_thread()) {
+        if (reject_during_capture(req)) {
+            return ESP_OK;
+        }
+        return run_on_async_worker(req, static_handler);
+    }
+
+    // Drop the query string, it is not part of the file name
+    char filepath[520];
+    size_t path_len = strcspn(req->uri, "?#");
+    if (has_parent_segment(req->uri, path_len)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Path must stay on the card");
+        return ESP_FAIL;
+    }
+    snprintf(filepath, sizeof(filepath), "/sdcard%.*s", (int)path_len, req->uri);
+
+    esp_err_t ret = send_file(req, filepath);
+    if (ret == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    return ret;
+}
+
+/* Chunked response writer
+ *
+ * Collects small pieces of output into one buffer and sends it as an HTTP chunk when
+ * full. Bytes outside [start, end) are counted but not sent, which lets a generated
+ * response be measured first and then answer a byte range.
+ */
+#define WRITER_CHUNK_SIZE 1024
+
+typedef struct {
+    httpd_req_t *req; // NULL when only measuring the length of the output
+    size_t pos;       // Output bytes produced so far
+    size_t start;     // First byte to send
+    size_t end;       // One past the last byte to send
+    size_t used;
+    char chunk[WRITER_CHUNK_SIZE];
+} chunk_writer_t;
+
+static void chunk_writer_init(chunk_writer_t *w, httpd_req_t *req)
+{
+    w->req = req;
+    w->pos = 0;
+    w->start = 0;
+    w->end = SIZE_MAX;
+    w->used = 0;
+}
+
+static esp_err_t chunk_write(chunk_writer_t *w, const char *data, size_t len)
+{
+    size_t piece_start = w->pos;
+    size_t piece_end = w->pos + len;
+    w->pos = piece_end;
+    if (w->req == NULL || piece_end <= w->start || piece_start >= w->end) {
+        return ESP_OK;
+    }
+
+    // Clip the piece to the requested range
+    size_t skip = w->start > piece_start ? w->start - piece_start : 0;
+    size_t stop = (w->end < piece_end ? w->end : piece_end) - piece_start;
+    data += skip;
+    len = stop - skip;
+
+    while (len > 0) {
+        size_t n = sizeof(w->chunk) - w->used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(w->chunk + w->used, data, n);
+        w->used += n;
+        data += n;
+        len -= n;
+        if (w->used == sizeof(w->chunk)) {
+            if (httpd_resp_send_chunk(w->req, w->chunk, w->used) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            w->used = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+// Send what is left in the buffer and terminate the chunked response
+static esp_err_t chunk_writer_finish(chunk_writer_t *w)
+{
+    if (w->used > 0 && httpd_resp_send_chunk(w->req, w->chunk, w->used) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    w->used = 0;
+    return httpd_resp_send_chunk(w->req, NULL, 0);
+}
+
+/* Bulk export of the measurement history
+ *
+ * GET /api/v1/export?format=csv|ndjson|cbor&from=<epoch>&to=<epoch>
+ * Records are formatted one at a time into a fixed chunk buffer, so RAM use does not
+ * depend on the size of the export. For Range requests the export is formatted once
+ * to learn its length, then only the requested bytes are sent. With limit or cursor
+ * the export is one page, see Pagination, and Range does not apply. cbor is a CBOR
+ * sequence (RFC 8742) of tests, and without format Accept picks between it and CSV,
+ * see Content negotiation. The export reads the card, so the tests still waiting in
+ * the journal only show up, and the ETag only changes, at the next checkpoint (see
+ * journal.h).
+ */
+typedef enum {
+    EXPORT_CSV,
+    EXPORT_NDJSON,
+    EXPORT_CBOR,
+} export_format_t;
+
+static const struct {
+    const char *name;
+    const char *type;
+    const char *disposition;
+} export_formats[] = {
+    [EXPORT_CSV] = { "csv", "text/csv", "attachment; filename=\"history.csv\"" },
+    [EXPORT_NDJSON] = { "ndjson", "application/x-ndjson", "attachment; filename=\"history.ndjson\"" },
+    [EXPORT_CBOR] = { "cbor", "application/cbor-seq", "attachment; filename=\"history.cbor\"" },
+};
+
+typedef struct {
+    export_format_t format;
+    time_t from;
+    time_t to; // 0 means no upper bound
+} export_query_t;
+
+static int format_export_record(const export_query_t *query, const history_record_t *record,
+                                char *buf, size_t len)
+{
+    if (query->format == EXPORT_CBOR) {
+        return test_to_cbor(record->timestamp, record->ppm, record->bac, record->user, (uint8_t *)buf, len);
+    }
+    struct tm tm_info;
+    char date_str[24];
+    localtime_r(&record->timestamp, &tm_info);
+    strftime(date_str, sizeof(date_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+
+    if (query->format == EXPORT_CSV) {
+        return snprintf(buf, len, "%lld,%s,%.2f,%.3f\n",
+                        (long long)record->timestamp, date_str, record->ppm, record->bac);
+    }
+    return snprintf(buf, len, "{\"timestamp\":%lld,\"date\":\"%s\",\"ppm\":%.2f,\"bac\":%.3f%s%s%s}\n",
+                    (long long)record->timestamp, date_str, record->ppm, record->bac,
+                    record->user[0] != '\0' ? ",\"user\":\"" : "", record->user,
+                    record->user[0] != '\0' ? "\"" : "");
+}
+
+// Produce the export from where the reader is through the writer, stopping early once the range or limit is sent
+static esp_err_t export_run(const export_query_t *query, history_reader_t *reader, uint32_t limit, chunk_writer_t *w)
+{
+    static const char csv_header[] = "timestamp,date,ppm,bac\n";
+    if (query->format == EXPORT_CSV && chunk_write(w, csv_header, strlen(csv_header)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    history_record_t record;
+    char line[128];
+    for (uint32_t sent = 0; sent < limit && history_next(reader, &record); ) {
+        if (record.timestamp < query->from || (query->to != 0 && record.timestamp > query->to)) {
+            continue;
+        }
+        int len = format_export_record(query, &record, line, sizeof(line));
+        if (chunk_write(w, line, len) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        if (w->req != NULL && w->pos >= w->end) {
+            break;
+        }
+        sent++;
+    }
+    return ESP_OK;
+}
+
+// Walk a page without formatting it, next gets where the following page starts. false when this one is the last
+static bool export_page_end(const export_query_t *query, history_reader_t *reader, uint32_t limit,
+                            history_cursor_t *next)
+{
+    history_record_t record;
+    uint32_t count = 0;
+    while (history_next(reader, &record)) {
+        if (record.timestamp < query->from || (query->to != 0 && record.timestamp > query->to)) {
+            continue;
+        }
+        if (count == limit) {
+            return true;
+        }
+        count++;
+        history_tell(reader, next);
+    }
+    return false;
+}
+
+static esp_err_t export_handler(httpd_req_t *req)
+{
+    if (!is_on_async_worker_thread()) {
+        if (reject_during_capture(req)) {
+            return ESP_OK;
+        }
+        return run_on_async_worker(req, export_handler);
+    }
+
+    export_query_t query = {
+        .format = EXPORT_CSV,
+        .from = 0,
+        .to = 0,
+    };
+    char query_str[160];
+    char param[24];
+    char cursor_str[PAGE_CURSOR_SIZE] = "";
+    uint32_t limit = 0;
+    bool format_given = false;
+    if (httpd_req_get_url_query_str(req, query_str, sizeof(query_str)) == ESP_OK) {
+        if (httpd_query_key_value(query_str, "format", param, sizeof(param)) == ESP_OK) {
+            int format = 0;
+            while (format < sizeof(export_formats) / sizeof(export_formats[0]) &&
+                   strcmp(param, export_formats[format].name) != 0) {
+                format++;
+            }
+            if (format == sizeof(export_formats) / sizeof(export_formats[0])) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "format must be csv, ndjson or cbor");
+                return ESP_FAIL;
+            }
+            query.format = format;
+            format_given = true;
+        }
+        if (httpd_query_key_value(query_str, "from", param, sizeof(param)) == ESP_OK) {
+            query.from = (time_t)strtoll(param, NULL, 10);
+        }
+        if (httpd_query_key_value(query_str, "to", param, sizeof(param)) == ESP_OK) {
+            query.to = (time_t)strtoll(param, NULL, 10);
+        }
+        if (!get_page_params(query_str, &limit, cursor_str)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "limit must be between 1 and 1000");
+            return ESP_FAIL;
+        }
+    }
+    if (!format_given && wants_cbor(req)) {
+        query.format = EXPORT_CBOR;
+    }
+    // Without limit or cursor the export is the whole history, as a download
+    bool paged = limit != 0 || cursor_str[0] != '\0';
+    limit = limit != 0 ? limit : paged ? PAGE_DEFAULT_LIMIT : UINT32_MAX;
+
+    // A missing log file is just an empty history
+    history_reader_t reader;
+    history_open(&reader, LOG_FILE);
+    history_set_range(&reader, query.from, query.to);
+
+    history_cursor_t at = { 0 };
+    if (cursor_str[0] != '\0' &&
+        (!history_cursor_parse(cursor_str, &at) || history_seek(&reader, &at) != ESP_OK)) {
+        history_close(&reader);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid cursor");
+        return ESP_FAIL;
+    }
+
+    // The history only grows, the segment count and where the log ends identify the export for If-Range
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%x-%lx%s\"", (unsigned)reader.segments, reader.end,
+             query.format == EXPORT_CBOR ? "-c" : "");
+
+    chunk_writer_t *w = calloc(1, sizeof(chunk_writer_t));
+    if (w == NULL) {
+        history_close(&reader);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    chunk_writer_init(w, req);
+
+    char range[48] = "";
+    char if_range[32] = "";
+    httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range));
+    httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range));
+    bool use_range = !paged && range[0] != '\0' && (if_range[0] == '\0' || strcmp(if_range, etag) == 0);
+
+    esp_err_t ret = ESP_OK;
+    char next_str[HISTORY_CURSOR_SIZE];
+    if (paged) {
+        // The next cursor goes out in a header, so the page is walked once before it is sent
+        history_cursor_t next;
+        if (export_page_end(&query, &reader, limit, &next)) {
+            history_cursor_format(&next, next_str, sizeof(next_str));
+            httpd_resp_set_hdr(req, "X-Next-Cursor", next_str);
+        }
+        history_seek(&reader, &at);
+    }
+    if (use_range) {
+        // Sizing pass, nothing is sent
+        w->req = NULL;
+        export_run(&query, &reader, limit, w);
+        size_t total = w->pos;
+        w->req = req;
+        w->pos = 0;
+        history_rewind(&reader);
+
+        size_t first, last;
+        switch (parse_byte_range(range, total, &first, &last)) {
+        case RANGE_OK: {
+            char content_range[64];
+            snprintf(content_range, sizeof(content_range), "bytes %u-%u/%u",
+                     (unsigned)first, (unsigned)last, (unsigned)total);
+            httpd_resp_set_status(req, "206 Partial Content");
+            httpd_resp_set_hdr(req, "Content-Range", content_range);
+            w->start = first;
+            w->end = last + 1;
+            break;
+        }
+        case RANGE_UNSATISFIABLE:
+            ret = send_range_not_satisfiable(req, total);
+            free(w);
+            history_close(&reader);
+            return ret;
+        case RANGE_NONE:
+            break;
+        }
+    }
+
+    httpd_resp_set_type(req, export_formats[query.format].type);
+    httpd_resp_set_hdr(req, "Content-Disposition", export_formats[query.format].disposition);
+    httpd_resp_set_hdr(req, "Vary", "Accept");
+    if (!paged) {
+        httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    }
+    httpd_resp_set_hdr(req, "ETag", etag);
+
+    ret = export_run(&query, &reader, limit, w);
+    if (ret == ESP_OK) {
+        ret = chunk_writer_finish(w);
+    }
+    free(w);
+    history_close(&reader);
+    return ret;
+}
+
+// Output callback for metrics_render and trace_render
+static esp_err_t metrics_emit(void *ctx, const char *text, size_t len)
+{
+    return chunk_write(ctx, text, len);
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    chunk_writer_t *w = malloc(sizeof(chunk_writer_t));
+    if (w == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    chunk_writer_init(w, req);
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    esp_err_t ret = metrics_render(metrics_emit, w);
+    if (ret == ESP_OK) {
+        ret = chunk_writer_finish(w);
+    }
+    free(w);
+    return ret;
+}
+
+#ifdef CONFIG_TRACE_ENABLE
+static esp_err_t trace_handler(httpd_req_t *req)
+{
+    chunk_writer_t *w = malloc(sizeof(chunk_writer_t));
+    if (w == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    chunk_writer_init(w, req);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"trace.json\"");
+    esp_err_t ret = trace_render(metrics_emit, w);
+    if (ret == ESP_OK) {
+        ret = chunk_writer_finish(w);
+    }
+    free(w);
+    return ret;
+}
+#endif
+
+static const char *log_level_names[] = { "none", "error", "warn", "info", "debug", "verbose" };
+
+/* Handler for the deferred log levels
+ *
+ * POST ?module=<tag>&level=<name> changes one module, the current levels are returned either way. A GET
+ * never changes them and gets 405 with a query, like /api/v1/diag/faults.
+ */
+static esp_err_t log_level_handler(httpd_req_t *req)
+{
+    char query[64];
+    char module_name[24];
+    char level_name[16];
+    bool has_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+    if (has_query && req->method != HTTP_POST) {
+        httpd_resp_set_hdr(req, "Allow", "GET, POST");
+        httpd_resp_send_err(req, HTTPD_405_METHOD_NOT_ALLOWED, "Change the log levels with POST");
+        return ESP_FAIL;
+    }
+    if (req->method == HTTP_POST) {
+        if (!has_query || httpd_query_key_value(query, "module", module_name, sizeof(module_name)) != ESP_OK ||
+            httpd_query_key_value(query, "level", level_name, sizeof(level_name)) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected module and level");
+            return ESP_FAIL;
+        }
+        dlog_module_t module = dlog_find_module(module_name);
+        int level = -1;
+        for (int i = 0; i < sizeof(log_level_names) / sizeof(log_level_names[0]); i++) {
+            if (strcasecmp(level_name, log_level_names[i]) == 0) {
+                level = i;
+            }
+        }
+        if (module == DLOG_MODULE_COUNT || level < 0) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown module or level");
+            return ESP_FAIL;
+        }
+        dlog_set_level(module, level);
+        ESP_LOGI(TAG, "Log level of %s set to %s", dlog_module_tag(module), log_level_names[level]);
+    }
+
+    char response[256];
+    size_t len = snprintf(response, sizeof(response), "{");
+    for (int i = 0; i < DLOG_MODULE_COUNT; i++) {
+        len += snprintf(response + len, sizeof(response) - len, "%s\"%s\":\"%s\"", i ? "," : "",
+                        dlog_module_tag(i), log_level_names[dlog_levels[i]]);
+    }
+    snprintf(response + len, sizeof(response) - len, "}");
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+// Binary dump of the deferred log ring, decode it with tools/dlog_decode.py
+static esp_err_t log_dump_handler(httpd_req_t *req)
+{
+    chunk_writer_t *w = malloc(sizeof(chunk_writer_t));
+    if (w == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    chunk_writer_init(w, req);
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"dlog.bin\"");
+    esp_err_t ret = dlog_dump(metrics_emit, w);
+    if (ret == ESP_OK) {
+        ret = chunk_writer_finish(w);
+    }
+    free(w);
+    return ret;
+}
+
+/* Handler replaying a recorded ADC trace
+ *
+ * ?file=trace_<time>.adc runs the trace through the measurement pipeline and returns
+ * the result next to the one recorded on the device, with whether they are bit-identical.
+ */
+static esp_err_t replay_handler(httpd_req_t *req)
+{
+    if (!is_on_async_worker_thread()) {
+        if (reject_during_capture(req)) {
+            return ESP_OK;
+        }
+        return run_on_async_worker(req, replay_handler);
+    }
+
+    char query[96];
+    char name[64];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "file", name, sizeof(name)) != ESP_OK ||
+        strchr(name, '/') != NULL || strstr(name, "..") != NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "file must name a trace on the card");
+        return ESP_FAIL;
+    }
+
+    char path[80];
+    snprintf(path, sizeof(path), MOUNT_POINT "/%s", name);
+    adc_trace_t trace;
+    esp_err_t ret = adc_trace_load(path, &trace);
+    if (ret == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Trace not found");
+        return ESP_FAIL;
+    } else if (ret != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not a valid ADC trace");
+        return ESP_FAIL;
+    }
+
+    measurement_t m = { .source = NULL };
+    int64_t start = esp_timer_get_time();
+    ret = measurement_replay(&trace, &m);
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (ret != ESP_OK) {
+        adc_trace_free(&trace);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Trace is too short to replay");
+        return ESP_FAIL;
+    }
+
+    char recorded[96] = "null";
+    bool identical = false;
+    if (trace.has_result) {
+        snprintf(recorded, sizeof(recorded), "{\"rs_air\":%.9g,\"ppm\":%.9g,\"bac\":%.9g}",
+                 trace.rs_air, trace.ppm, trace.bac);
+        identical = memcmp(&m.rs_air, &trace.rs_air, sizeof(float)) == 0 &&
+                    memcmp(&m.ppm, &trace.ppm, sizeof(float)) == 0 &&
+                    memcmp(&m.bac, &trace.bac, sizeof(float)) == 0;
+    }
+    adc_trace_free(&trace);
+
+    char response[320];
+    snprintf(response, sizeof(response),
+             "{\"file\":\"%s\",\"rs_air\":%.9g,\"ppm\":%.9g,\"bac\":%.9g,"
+             "\"recorded\":%s,\"identical\":%s,\"elapsed_us\":%lld}",
+             name, m.rs_air, m.ppm, m.bac, recorded, identical ? "true" : "false", (long long)elapsed);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+}
+
+#ifdef CONFIG_STORAGE_FAULT_INJECT
+/* Storage fault injection
+ *
+ * GET /api/v1/diag/faults returns the fault configuration and what was injected so
+ * far. POST replaces the configuration with its query string and returns the same,
+ * keys left out are turned off. A GET never changes it, so a prefetch or a crawler
+ * following a link cannot arm faults on the storage path.
+ */
+static esp_err_t faults_handler(httpd_req_t *req)
+{
+    char query[160];
+    bool has_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+    if (has_query && req->method != HTTP_POST) {
+        httpd_resp_set_hdr(req, "Allow", "GET, POST");
+        httpd_resp_send_err(req, HTTPD_405_METHOD_NOT_ALLOWED, "Change the faults with POST");
+        return ESP_FAIL;
+    }
+    if (req->method == HTTP_POST) {
+        // A POST without a query turns every fault off
+        storage_fault_config_t config = { 0 };
+        if (has_query && storage_fault_parse(query, &config) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                "Expected latency_ms, stall_pct, stall_ms, enospc_after, eio_pct, torn_pct, seed");
+            return ESP_FAIL;
+        }
+        storage_fault_configure(&config);
+    }
+
+    storage_fault_config_t config;
+    storage_fault_stats_t stats;
+    storage_fault_get(&config, &stats);
+    char response[320];
+    snprintf(response, sizeof(response),
+             "{\"latency_ms\":%" PRIu32 ",\"stall_pct\":%" PRIu32 ",\"stall_ms\":%" PRIu32 ","
+             "\"enospc_after\":%" PRIu32 ",\"eio_pct\":%" PRIu32 ",\"torn_pct\":%" PRIu32 ",\"seed\":%" PRIu32 ","
+             "\"injected\":{\"writes\":%" PRIu32 ",\"stalls\":%" PRIu32 ",\"enospc\":%" PRIu32 ","
+             "\"eio\":%" PRIu32 ",\"torn\":%" PRIu32 "}}",
+             config.latency_ms, config.stall_pct, config.stall_ms, config.enospc_after, config.eio_pct,
+             config.torn_pct, config.seed, stats.writes, stats.stalls, stats.enospc, stats.eio, stats.torn);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+}
+#endif
+
+/* SD card benchmark
+ *
+ * GET /api/v1/diag/sd runs sd_bench over a scratch file, ?kb= sets the bytes per pass.
+ * It takes tens of seconds on a slow card and holds an async worker all along.
+ */
+#define SD_BENCH_MAX_PASS_KB 4096
+
+static esp_err_t sd_bench_handler(httpd_req_t *req)
+{
+    if (!is_on_async_worker_thread()) {
+        if (reject_during_capture(req)) {
+            return ESP_OK;
+        }
+        return run_on_async_worker(req, sd_bench_handler);
+    }
+
+    char query[32];
+    char value[12];
+    uint32_t pass_kb = CONFIG_SD_BENCH_PASS_KB;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "kb", value, sizeof(value)) == ESP_OK) {
+        pass_kb = strtoul(value, NULL, 10);
+        if (pass_kb == 0 || pass_kb > SD_BENCH_MAX_PASS_KB) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "kb must be between 1 and 4096");
+            return ESP_FAIL;
+        }
+    }
+
+    hal_storage_info_t info = { 0 };
+    sd_bench_result_t *results = malloc(SD_BENCH_MAX_RESULTS * sizeof(sd_bench_result_t));
+    chunk_writer_t *w = malloc(sizeof(chunk_writer_t));
+    if (results == NULL || w == NULL) {
+        free(results);
+        free(w);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    hal_storage_info(&info);
+    int count = sd_bench_run(pass_kb * 1024, results, SD_BENCH_MAX_RESULTS);
+    if (count < 0) {
+        free(results);
+        free(w);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Benchmark failed or already running");
+        return ESP_FAIL;
+    }
+
+    chunk_writer_init(w, req);
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t ret = sd_bench_render(&info, results, count, metrics_emit, w);
+    if (ret == ESP_OK) {
+        ret = chunk_writer_finish(w);
+    }
+    free(results);
+    free(w);
+    return ret;
+}
+
+/* Samples of one test
+ *
+ * GET /api/v1/sessions/{id}/samples, id being the timestamp of the test in the
+ * history. The ratio and PPM series come as two arrays, one value per
+ * interval_ms from the start of the capture.
+ */
+#define SESSIONS_PREFIX "/api/v1/sessions/"
+
+// The same map in CBOR, the ratios are sent as kept, without any float formatting
+static esp_err_t send_session_cbor(httpd_req_t *req, const session_t *session, uint8_t *buf, size_t len)
+{
+    cbor_writer_t c;
+    cbor_init(&c, buf, len);
+    cbor_map(&c, 7);
+    cbor_text(&c, "id");
+    cbor_int(&c, session->id);
+    cbor_text(&c, "rs_air");
+    cbor_float(&c, session->rs_air);
+    cbor_text(&c, "ppm");
+    cbor_int(&c, lroundf(session->ppm * 100));
+    cbor_text(&c, "bac");
+    cbor_int(&c, lroundf(session->bac * 1000));
+    cbor_text(&c, "interval_ms");
+    cbor_uint(&c, session->interval_ms);
+    cbor_text(&c, "ratio");
+    cbor_array(&c, session->count);
+    for (int i = 0; i < session->count; i++) {
+        cbor_uint(&c, session->ratio[i]);
+    }
+    cbor_text(&c, "samples_ppm");
+    cbor_array(&c, session->count);
+    for (int i = 0; i < session->count; i++) {
+        cbor_int(&c, lroundf(mq303a_ppm_from_ratio(session->ratio[i] / (float)SESSION_RATIO_SCALE) * 100));
+    }
+    if (c.pos > len) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/cbor");
+    httpd_resp_set_hdr(req, "Vary", "Accept");
+    return httpd_resp_send(req, (const char *)buf, c.pos);
+}
+
+static esp_err_t sessions_handler(httpd_req_t *req)
+{
+    if (!is_on_async_worker_thread()) {
+        if (reject_during_capture(req)) {
+            return ESP_OK;
+        }
+        return run_on_async_worker(req, sessions_handler);
+    }
+
+    const char *start = req->uri + strlen(SESSIONS_PREFIX);
+    char *end;
+    long long id = strtoll(start, &end, 10);
+    if (end == start || strncmp(end, "/samples", 8) != 0 || (end[8] != '\0' && end[8] != '?')) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    session_t *session = malloc(sizeof(session_t));
+    chunk_writer_t *w = malloc(sizeof(chunk_writer_t));
+    esp_err_t ret = session != NULL && w != NULL ? session_find((time_t)id, session) : ESP_ERR_NO_MEM;
+    if (ret != ESP_OK) {
+        free(session);
+        free(w);
+        if (ret == ESP_ERR_NOT_FOUND) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Session not found");
+        } else {
+            httpd_resp_send_500(req);
+        }
+        return ESP_FAIL;
+    }
+    if (wants_cbor(req)) {
+        // Well under a chunk, the writer's buffer holds all of it
+        ret = send_session_cbor(req, session, (uint8_t *)w->chunk, sizeof(w->chunk));
+        free(session);
+        free(w);
+        return ret;
+    }
+
+    chunk_writer_init(w, req);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Vary", "Accept");
+    char buf[112];
+    int len = snprintf(buf, sizeof(buf),
+                       "{\"id\":%lld,\"rs_air\":%.3f,\"ppm\":%.2f,\"bac\":%.3f,\"interval_ms\":%u,\"ratio\":[",
+                       (long long)session->id, session->rs_air, session->ppm, session->bac, session->interval_ms);
+    ret = chunk_write(w, buf, len);
+    for (int i = 0; i < session->count && ret == ESP_OK; i++) {
+        len = snprintf(buf, sizeof(buf), "%s%.4f", i > 0 ? "," : "", session->ratio[i] / (float)SESSION_RATIO_SCALE);
+        ret = chunk_write(w, buf, len);
+    }
+    static const char ppm_key[] = "],\"samples_ppm\":[";
+    ret = ret == ESP_OK ? chunk_write(w, ppm_key, strlen(ppm_key)) : ret;
+    for (int i = 0; i < session->count && ret == ESP_OK; i++) {
+        float ppm = mq303a_ppm_from_ratio(session->ratio[i] / (float)SESSION_RATIO_SCALE);
+        len = snprintf(buf, sizeof(buf), "%s%.2f", i > 0 ? "," : "", ppm);
+        ret = chunk_write(w, buf, len);
+    }
+    ret = ret == ESP_OK ? chunk_write(w, "]}", 2) : ret;
+    if (ret == ESP_OK) {
+        ret = chunk_writer_finish(w);
+    }
+    free(session);
+    free(w);
+    return ret;
+}
+
+/* Player of the next test
+ *
+ * POST /api/v1/player?name=<name> names the player the next result is tagged with, an
+ * empty name clears it. The current player is returned either way. A GET never changes
+ * it and gets 405 with a query, like /api/v1/diag/faults.
+ */
+static esp_err_t player_handler(httpd_req_t *req)
+{
+    char query[48];
+    char param[24];
+    bool has_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+    if (has_query && req->method != HTTP_POST) {
+        httpd_resp_set_hdr(req, "Allow", "GET, POST");
+        httpd_resp_send_err(req, HTTPD_405_METHOD_NOT_ALLOWED, "Name the player with POST");
+        return ESP_FAIL;
+    }
+    if (req->method == HTTP_POST) {
+        if (!has_query || httpd_query_key_value(query, "name", param, sizeof(param)) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected name");
+            return ESP_FAIL;
+        }
+        char name[USER_NAME_SIZE] = "";
+        if (param[0] != '\0' && !user_normalize(param, name)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "name takes up to 12 letters, digits, - or _");
+            return ESP_FAIL;
+        }
+        user_set_player(name);
+    }
+
+    char name[USER_NAME_SIZE];
+    char response[48];
+    user_get_player(name);
+    snprintf(response, sizeof(response), "{\"player\":\"%s\"}", name);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+}
+
+/* History of one player
+ *
+ * GET /api/v1/users/{name}/history reads the player's own file, so it costs the same
+ * however many tests others took. The tests come oldest first, one page at a time,
+ * see Pagination. GET /api/v1/users/{name}/best gives the number of tests and the best
+ * one by BAC. Like the export, both lag the highscores until the next checkpoint.
+ */
+#define USERS_PREFIX "/api/v1/users/"
+
+typedef enum {
+    USERS_HISTORY,
+    USERS_BEST,
+} users_view_t;
+
+// The name and view a users URI asks for, false when it is not one
+static bool parse_users_uri(const char *uri, char name[USER_NAME_SIZE], users_view_t *view)
+{
+    static const char *views[] = { [USERS_HISTORY] = "history", [USERS_BEST] = "best" };
+    const char *start = uri + strlen(USERS_PREFIX);
+    const char *slash = strchr(start, '/');
+    size_t len = slash != NULL ? slash - start : 0;
+    if (len == 0 || len > USER_NAME_MAX) {
+        return false;
+    }
+    char param[USER_NAME_SIZE];
+    memcpy(param, start, len);
+    param[len] = '\0';
+    size_t view_len = strcspn(slash + 1, "?");
+    for (int i = 0; i < sizeof(views) / sizeof(views[0]); i++) {
+        if (strlen(views[i]) == view_len && strncmp(slash + 1, views[i], view_len) == 0) {
+            *view = i;
+            return user_normalize(param, name);
+        }
+    }
+    return false;
+}
+
+static esp_err_t send_user_history(httpd_req_t *req, user_reader_t *reader, chunk_writer_t *w)
+{
+    char query[64];
+    char cursor[PAGE_CURSOR_SIZE] = "";
+    uint32_t limit = PAGE_DEFAULT_LIMIT;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK && !get_page_params(query, &limit, cursor)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "limit must be between 1 and 1000");
+        return ESP_FAIL;
+    }
+    char *end = cursor;
+    long at = cursor[0] != '\0' ? strtol(cursor, &end, 16) : user_tell(reader);
+    if (*end != '\0' || user_seek(reader, at) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid cursor");
+        return ESP_FAIL;
+    }
+
+    // The next cursor goes out in a header, so the page is walked once before it is sent
+    time_t ts;
+    float ppm, bac;
+    uint32_t count = 0;
+    long next = at;
+    while (count < limit && user_next(reader, &ts, &ppm, &bac)) {
+        count++;
+        next = user_tell(reader);
+    }
+    char next_str[PAGE_CURSOR_SIZE];
+    if (count == limit && user_next(reader, &ts, &ppm, &bac)) {
+        snprintf(next_str, sizeof(next_str), "%lx", next);
+        httpd_resp_set_hdr(req, "X-Next-Cursor", next_str);
+    }
+    user_seek(reader, at);
+
+    chunk_writer_init(w, req);
+    bool cbor = wants_cbor(req);
+    httpd_resp_set_type(req, cbor ? "application/cbor" : "application/json");
+    httpd_resp_set_hdr(req, "Vary", "Accept");
+    char buf[96];
+    int n;
+    if (cbor) {
+        cbor_writer_t c;
+        cbor_init(&c, (uint8_t *)buf, sizeof(buf));
+        cbor_map(&c, 2);
+        cbor_text(&c, "user");
+        cbor_text(&c, reader->name);
+        cbor_text(&c, "history");
+        cbor_array(&c, count);
+        n = c.pos;
+    } else {
+        n = snprintf(buf, sizeof(buf), "{\"user\":\"%s\",\"history\":[", reader->name);
+    }
+    esp_err_t ret = chunk_write(w, buf, n);
+    for (uint32_t i = 0; i < count && ret == ESP_OK && user_next(reader, &ts, &ppm, &bac); i++) {
+        if (cbor) {
+            n = test_to_cbor(ts, ppm, bac, NULL, (uint8_t *)buf, sizeof(buf));
+        } else {
+            n = snprintf(buf, sizeof(buf), "%s{\"timestamp\":%lld,\"ppm\":%.2f,\"bac\":%.3f}", i > 0 ? "," : "",
+                         (long long)ts, ppm, bac);
+        }
+        ret = chunk_write(w, buf, n);
+    }
+    ret = ret == ESP_OK && !cbor ? chunk_write(w, "]}", 2) : ret;
+    return ret == ESP_OK ? chunk_writer_finish(w) : ret;
+}
+
+static esp_err_t send_user_best(httpd_req_t *req, user_reader_t *reader)
+{
+    uint32_t tests = 0;
+    time_t ts, best_ts = 0;
+    float ppm, bac, best_ppm = 0, best_bac = -1;
+    while (user_next(reader, &ts, &ppm, &bac)) {
+        if (bac > best_bac) {
+            best_ts = ts;
+            best_ppm = ppm;
+            best_bac = bac;
+        }
+        tests++;
+    }
+
+    char response[160];
+    int n;
+    httpd_resp_set_hdr(req, "Vary", "Accept");
+    if (wants_cbor(req)) {
+        cbor_writer_t c;
+        cbor_init(&c, (uint8_t *)response, sizeof(response));
+        cbor_map(&c, 3);
+        cbor_text(&c, "user");
+        cbor_text(&c, reader->name);
+        cbor_text(&c, "tests");
+        cbor_uint(&c, tests);
+        cbor_text(&c, "best");
+        if (tests > 0) {
+            c.pos += test_to_cbor(best_ts, best_ppm, best_bac, NULL, c.buf + c.pos, c.len - c.pos);
+        } else {
+            cbor_null(&c);
+        }
+        httpd_resp_set_type(req, "application/cbor");
+        return httpd_resp_send(req, response, c.pos);
+    }
+    n = snprintf(response, sizeof(response), "{\"user\":\"%s\",\"tests\":%" PRIu32 ",\"best\":",
+                 reader->name, tests);
+    if (tests > 0) {
+        snprintf(response + n, sizeof(response) - n, "{\"timestamp\":%lld,\"ppm\":%.2f,\"bac\":%.3f}}",
+                 (long long)best_ts, best_ppm, best_bac);
+    } else {
+        snprintf(response + n, sizeof(response) - n, "null}");
+    }
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t users_handler(httpd_req_t *req)
+{
+    if (!is_on_async_worker_thread()) {
+        if (reject_during_capture(req)) {
+            return ESP_OK;
+        }
+        return run_on_async_worker(req, users_handler);
+    }
+
+    char name[USER_NAME_SIZE];
+    users_view_t view;
+    if (!parse_users_uri(req->uri, name, &view)) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    user_reader_t reader;
+    chunk_writer_t *w = malloc(sizeof(chunk_writer_t));
+    esp_err_t ret = w != NULL ? user_open(&reader, name) : ESP_ERR_NO_MEM;
+    if (ret != ESP_OK) {
+        free(w);
+        if (ret == ESP_ERR_NOT_FOUND) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "User not found");
+        } else {
+            httpd_resp_send_500(req);
+        }
+        return ESP_FAIL;
+    }
+
+    ret = view == USERS_HISTORY ? send_user_history(req, &reader, w) : send_user_best(req, &reader);
+    user_close(&reader);
+    free(w);
+    return ret;
+}
+
+static uri_handler_t index_entry = { index_handler, "http_index", METRIC_HTTP_INDEX };
+static uri_handler_t status_entry = { status_handler, "http_status", METRIC_HTTP_STATUS };
+static uri_handler_t highscores_entry = { highscores_handler, "http_highscores", METRIC_HTTP_HIGHSCORES };
+static uri_handler_t export_entry = { export_handler, "http_export", METRIC_HTTP_EXPORT };
+static uri_handler_t metrics_entry = { metrics_handler, "http_metrics", METRIC_HTTP_METRICS };
+static uri_handler_t static_entry = { static_handler, "http_static", METRIC_HTTP_STATIC };
+static uri_handler_t log_level_entry = { log_level_handler, "http_log_level", METRIC_HTTP_LOG };
+static uri_handler_t log_dump_entry = { log_dump_handler, "http_log_dump", METRIC_HTTP_LOG };
+static uri_handler_t replay_entry = { replay_handler, "http_replay", METRIC_HTTP_REPLAY };
+static uri_handler_t sd_bench_entry = { sd_bench_handler, "http_sd_bench", METRIC_HTTP_DIAG };
+static uri_handler_t sessions_entry = { sessions_handler, "http_sessions", METRIC_HTTP_SESSIONS };
+static uri_handler_t player_entry = { player_handler, "http_player", METRIC_HTTP_USERS };
+static uri_handler_t users_entry = { users_handler, "http_users", METRIC_HTTP_USERS };
+#ifdef CONFIG_TRACE_ENABLE
+static uri_handler_t trace_entry = { trace_handler, "http_trace", METRIC_HTTP_TRACE };
+#endif
+#ifdef CONFIG_STORAGE_FAULT_INJECT
+static uri_handler_t faults_entry = { faults_handler, "http_faults", METRIC_HTTP_DIAG };
+#endif
+
+httpd_handle_t start_webserver(void)
+{
+    httpd_handle_t server = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_open_sockets = CONFIG_WEB_MAX_OPEN_SOCKETS;
+    config.max_uri_handlers = 20; // The default of 8 is not enough for the API
+    config.uri_match_fn = httpd_uri_match_wildcard; // Exact matching would never reach the "/*" handler
+#ifdef CONFIG_WEB_LRU_PURGE_ENABLE
+    config.lru_purge_enable = true; // Close the least recently used socket instead of refusing new clients
+#endif
+
+    if (httpd_start(&server, &config) == ESP_OK) {
+        httpd_task_handle = xTaskGetHandle("httpd");
+        httpd_task_priority = config.task_priority;
+        start_async_req_workers();
+        longpoll_init();
+
+        metrics_register_task(httpd_task_handle);
+        for (int i = 0; i < CONFIG_WEB_ASYNC_WORKERS; i++) {
+            metrics_register_task(worker_handles[i]);
+        }
+        metrics_register_task(longpoll_task_handle);
+
+        // Register specific handlers first
+        httpd_uri_t status_uri = {
+            .uri       = "/api/status",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &status_entry
+        };
+        httpd_register_uri_handler(server, &status_uri);
+
+        httpd_uri_t highscores_uri = {
+            .uri       = "/api/v1/highscores",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &highscores_entry
+        };
+        httpd_register_uri_handler(server, &highscores_uri);
+
+        httpd_uri_t export_uri = {
+            .uri       = "/api/v1/export",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &export_entry
+        };
+        httpd_register_uri_handler(server, &export_uri);
+
+        httpd_uri_t sessions_uri = {
+            .uri       = SESSIONS_PREFIX "*",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &sessions_entry
+        };
+        httpd_register_uri_handler(server, &sessions_uri);
+
+        httpd_uri_t player_uri = {
+            .uri       = "/api/v1/player",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &player_entry
+        };
+        httpd_register_uri_handler(server, &player_uri);
+        player_uri.method = HTTP_POST;
+        httpd_register_uri_handler(server, &player_uri);
+
+        httpd_uri_t users_uri = {
+            .uri       = USERS_PREFIX "*",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &users_entry
+        };
+        httpd_register_uri_handler(server, &users_uri);
+
+        httpd_uri_t metrics_uri = {
+            .uri       = "/api/v1/metrics",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &metrics_entry
+        };
+        httpd_register_uri_handler(server, &metrics_uri);
+
+#ifdef CONFIG_TRACE_ENABLE
+        httpd_uri_t trace_uri = {
+            .uri       = "/api/v1/trace",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &trace_entry
+        };
+        httpd_register_uri_handler(server, &trace_uri);
+#endif
+
+        httpd_uri_t log_level_uri = {
+            .uri       = "/api/v1/log/level",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &log_level_entry
+        };
+        httpd_register_uri_handler(server, &log_level_uri);
+        log_level_uri.method = HTTP_POST;
+        httpd_register_uri_handler(server, &log_level_uri);
+
+        httpd_uri_t log_dump_uri = {
+            .uri       = "/api/v1/log/dump",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &log_dump_entry
+        };
+        httpd_register_uri_handler(server, &log_dump_uri);
+
+        httpd_uri_t replay_uri = {
+            .uri       = "/api/v1/replay",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &replay_entry
+        };
+        httpd_register_uri_handler(server, &replay_uri);
+
+#ifdef CONFIG_STORAGE_FAULT_INJECT
+        httpd_uri_t faults_uri = {
+            .uri       = "/api/v1/diag/faults",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &faults_entry
+        };
+        httpd_register_uri_handler(server, &faults_uri);
+        faults_uri.method = HTTP_POST;
+        httpd_register_uri_handler(server, &faults_uri);
+#endif
+
+        httpd_uri_t sd_bench_uri = {
+            .uri       = "/api/v1/diag/sd",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &sd_bench_entry
+        };
+        httpd_register_uri_handler(server, &sd_bench_uri);
+
+        httpd_uri_t index_uri = {
+            .uri       = "/",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &index_entry
+        };
+        httpd_register_uri_handler(server, &index_uri);
+
+        // Register wildcard handler last
+        httpd_uri_t static_uri = {
+            .uri       = "/*",
+            .method    = HTTP_GET,
+            .handler   = timed_handler,
+            .user_ctx  = &static_entry
+        };
+        httpd_register_uri_handler(server, &static_uri);
+
+        return server;
+    }
+
+    ESP_LOGI(TAG, "Error starting server!");
+    return NULL;
+}
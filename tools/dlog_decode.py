@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Decode a deferred log dump fetched from /api/v1/log/dump.
+
+Records hold the addresses of their format strings and %s arguments, so the
+ELF of the running firmware is needed to turn them back into text:
+
+    curl -o dlog.bin http://<device>/api/v1/log/dump
+    python tools/dlog_decode.py build/breathalyzer.elf dlog.bin
+"""
+import argparse
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+MAGIC = 0x474F4C44  # "DLOG"
+VERSION = 1
+TAG_SIZE = 16
+MAX_ARGS = 4
+ARG_INT, ARG_DOUBLE, ARG_STR = 0, 1, 2
+LEVELS = {1: 'E', 2: 'W', 3: 'I', 4: 'D', 5: 'V'}
+SPEC = re.compile(r'%([-+ #0-9.]*)(?:hh|h|ll|l|L|q|j|z|t)?([diouxXcspfFeEgGaA%])')
+
+
+class Image:
+    """Reads NUL terminated strings out of the loaded sections of an ELF."""
+
+    def __init__(self, path):
+        self.sections = []
+        with open(path, 'rb') as f:
+            for section in ELFFile(f).iter_sections():
+                if section['sh_addr'] and section['sh_type'] == 'SHT_PROGBITS':
+                    self.sections.append((section['sh_addr'], section.data()))
+
+    def string(self, addr):
+        for base, data in self.sections:
+            if base <= addr < base + len(data):
+                end = data.find(b'\0', addr - base)
+                return data[addr - base:end].decode('utf-8', 'replace')
+        return '<0x%08x>' % addr
+
+
+def format_record(image, fmt, nargs, types, raw):
+    args = iter(range(nargs))
+
+    def convert(match):
+        flags, conv = match.groups()
+        if conv == '%':
+            return '%'
+        i = next(args, None)
+        if i is None:
+            return '<?>'
+        kind = (types >> (2 * i)) & 0x3
+        value = raw[i]
+        if kind == ARG_DOUBLE:
+            value = struct.unpack('<d', struct.pack('<Q', value))[0]
+        elif kind == ARG_INT and value >= 1 << 63:
+            value -= 1 << 64
+        if conv == 's':
+            return ('%' + flags + 's') % (image.string(value) if kind == ARG_STR else '<?>')
+        if conv == 'p':
+            return '0x%08x' % value
+        if conv in 'diouxXc':
+            return ('%' + flags + conv) % int(value)
+        return ('%' + flags + conv) % float(value)
+
+    return SPEC.sub(convert, fmt)
+
+
+def decode(image, dump, out):
+    magic, version, record_size, count, module_count = struct.unpack_from('<IHHII', dump, 0)
+    if magic != MAGIC or version != VERSION:
+        sys.exit('not a deferred log dump (magic 0x%08x, version %d)' % (magic, version))
+    offset = 16
+    tags = []
+    for _ in range(module_count):
+        tags.append(dump[offset:offset + TAG_SIZE].split(b'\0')[0].decode())
+        offset += TAG_SIZE
+
+    for _ in range(count):
+        index, fmt_addr, timestamp, level, module, nargs, types = struct.unpack_from('<IIIBBBB', dump, offset)
+        raw = struct.unpack_from('<%dQ' % MAX_ARGS, dump, offset + 16)
+        offset += record_size
+        if fmt_addr == 0:
+            out.write('# record %d lost\n' % index)
+            continue
+        message = format_record(image, image.string(fmt_addr), nargs, types, raw)
+        tag = tags[module] if module < len(tags) else str(module)
+        out.write('%s (%d) %s: %s\n' % (LEVELS.get(level, '?'), timestamp, tag, message))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('elf', help='firmware ELF the dump was taken from')
+    parser.add_argument('dump', help='binary dump from /api/v1/log/dump')
+    args = parser.parse_args()
+
+    with open(args.dump, 'rb') as f:
+        dump = f.read()
+    decode(Image(args.elf), dump, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()